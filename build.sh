@@ -399,9 +399,11 @@ xtchain_build()
     case "${SYSTEM_NAME}" in
         Windows)
             CCOMPILER="${SYSTEM_HOST}-gcc"
+            CFLAGS=""
             ;;
         *)
             CCOMPILER="clang"
+            CFLAGS="-pthread"
     esac
 
     # Build XTchain tools
@@ -410,7 +412,7 @@ xtchain_build()
     mkdir -p ${BINDIR}/lib/xtchain
     for EXEC in bin2c diskimg exetool xtcspecc; do
         if [ ! -e ${BINDIR}/bin/${EXEC} ]; then
-            ${CCOMPILER} ${WRKDIR}/tools/${EXEC}.c -o ${BINDIR}/bin/${EXEC}
+            ${CCOMPILER} -O2 ${CFLAGS} ${WRKDIR}/tools/${EXEC}.c -o ${BINDIR}/bin/${EXEC}
         fi
     done
     cp ${WRKDIR}/scripts/xtclib* ${BINDIR}/lib/xtchain/
@@ -6,69 +6,3524 @@
  * DEVELOPERS:  Rafal Kupiec <belliash@codingworkshop.eu.org>
  */
 
+#include <ctype.h>
+#include <inttypes.h>
 #include "xtchain.h"
 
-int main(int argc, char *argv[])
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BIN2C_X86_KERNELS
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BIN2C_NEON_KERNEL
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#define BIN2C_PARALLEL
+#endif
+
+
+/* Size of the chunk read from the input file at once */
+#define BIN2C_INPUT_CHUNK       (64 * 1024)
+
+/* Size of the buffer holding formatted text before it is written out */
+#define BIN2C_OUTPUT_BUFFER     (1024 * 1024)
+
+/* Size of the input chunk formatted by a single worker thread and the smallest input converted in parallel */
+#define BIN2C_PARALLEL_CHUNK    (4 * 1024 * 1024)
+#define BIN2C_PARALLEL_MINIMUM  (16 * 1024 * 1024)
+
+/* Number of characters emitted for every input byte (",0xNN") */
+#define BIN2C_BYTE_TEXT         5
+
+/* Size of the block compressed at once and the compression hash table */
+#define BIN2C_COMPRESS_BLOCK    (4 * 1024 * 1024)
+#define BIN2C_HASH_BITS         16
+
+/* LZ4 block format limits, last match has to start 12 bytes before and the last 5 bytes are literals */
+#define BIN2C_LZ4_MFLIMIT       12
+#define BIN2C_LZ4_LASTLITERALS  5
+#define BIN2C_LZ4_MAX_OFFSET    65535
+
+/* Compressed block header flag marking a block stored without compression */
+#define BIN2C_BLOCK_STORED      0x80000000
+
+/* Size of the data set processed by every kernel in benchmark mode */
+#define BIN2C_BENCHMARK_SIZE    (64 * 1024 * 1024)
+
+/* C compiler building the emitted decompressor in benchmark mode unless CC is set, commands run by the Windows
+   shell are wrapped in another pair of quotes so that the quoted paths inside survive */
+#ifdef _WIN32
+#define BIN2C_COMPILER          "clang"
+#define BIN2C_COMMAND_QUOTE     "\""
+#define popen                   _popen
+#define pclose                  _pclose
+#else
+#define BIN2C_COMPILER          "cc"
+#define BIN2C_COMMAND_QUOTE     ""
+#endif
+
+/* Default alignment of the data section in object files and the largest alignment that can be requested */
+#define BIN2C_OBJECT_ALIGNMENT  16
+#define BIN2C_MAX_ALIGNMENT     4096
+
+/* Largest word emitted into C arrays */
+#define BIN2C_MAX_WORD          8
+
+/* COFF constants */
+#define IMAGE_FILE_MACHINE_I386         0x014C
+#define IMAGE_FILE_MACHINE_AMD64        0x8664
+#define IMAGE_FILE_MACHINE_ARMNT        0x01C4
+#define IMAGE_FILE_MACHINE_ARM64        0xAA64
+#define IMAGE_SCN_CNT_INITIALIZED_DATA  0x00000040
+#define IMAGE_SCN_ALIGN_1BYTES          0x00100000
+#define IMAGE_SCN_MEM_READ              0x40000000
+#define IMAGE_SYM_CLASS_EXTERNAL        2
+#define IMAGE_SYM_CLASS_STATIC          3
+
+/* ELF constants */
+#define EM_386                  3
+#define EM_ARM                  40
+#define EM_X86_64               62
+#define EM_AARCH64              183
+#define EF_ARM_EABI_VER5        0x05000000
+#define SHT_PROGBITS            1
+#define SHT_SYMTAB              2
+#define SHT_STRTAB              3
+#define SHF_ALLOC               2
+#define STB_GLOBAL              1
+#define STT_OBJECT              1
+
+enum _ARCH
 {
-    /* Check for proper number of arguments */
-    if(argc != 4)
+    ARCH_UNKNOWN = -1,
+    ARCH_X86,
+    ARCH_AMD64,
+    ARCH_ARM,
+    ARCH_ARM64
+};
+
+enum _BIN2C_FORMATS
+{
+    FORMAT_C,
+    FORMAT_ASM,
+    FORMAT_EMBED,
+    FORMAT_COFF,
+    FORMAT_ELF
+};
+
+typedef char *(*PBIN2C_ENCODER)(char *Output, const unsigned char *Input, size_t Length);
+
+typedef struct _BIN2C_FORMAT
+{
+    int Identifier;
+    const char *Name;
+    const char *Description;
+    int Binary;
+} BIN2C_FORMAT, *PBIN2C_FORMAT;
+
+typedef struct _BIN2C_INPUT
+{
+    char *FileName;
+    char *Name;
+    uint64_t Size;
+} BIN2C_INPUT, *PBIN2C_INPUT;
+
+typedef struct _BIN2C_INPUT_LIST
+{
+    PBIN2C_INPUT Items;
+    int Count;
+    int Capacity;
+} BIN2C_INPUT_LIST, *PBIN2C_INPUT_LIST;
+
+typedef struct _BIN2C_KERNEL
+{
+    const char *Name;
+    PBIN2C_ENCODER Encode;
+    int (*IsSupported)(void);
+} BIN2C_KERNEL, *PBIN2C_KERNEL;
+
+typedef struct _BIN2C_WRITER
+{
+    FILE *File;
+    char *Buffer;
+    size_t Length;
+    uint64_t DataSize;
+    uint64_t InputSize;
+    uint64_t Offset;
+    uint64_t Alignment;
+    const char *Section;
+    uint8_t Pending[BIN2C_MAX_WORD];
+    size_t PendingLength;
+    size_t WordSize;
+    int Compress;
+    int Const;
+    int Raw;
+    int Threads;
+    int Error;
+} BIN2C_WRITER, *PBIN2C_WRITER;
+
+typedef struct _BIN2C_PARALLEL_JOB
+{
+    const unsigned char *Data;
+    uint64_t Size;
+    uint64_t Offset;
+    uint64_t Chunks;
+    uint64_t NextChunk;
+    int Descriptor;
+    int Error;
+} BIN2C_PARALLEL_JOB, *PBIN2C_PARALLEL_JOB;
+
+/* Forward references */
+static int AddInput(PBIN2C_INPUT_LIST List, const char *Specification);
+static int BenchmarkKernels(void);
+static int BenchmarkCompression(void);
+static int CompareFiles(const char *FirstName, const char *SecondName);
+static int CompareInputs(const void *First, const void *Second);
+static size_t CompressBlock(const uint8_t *Input, size_t Length, uint8_t *Output, uint32_t *HashTable);
+static int CompressStream(FILE *InputFile, PBIN2C_WRITER Writer);
+static int ConvertStream(FILE *InputFile, PBIN2C_WRITER Writer);
+static char *EncodeScalar(char *Output, const unsigned char *Input, size_t Length);
+static void FlushWriter(PBIN2C_WRITER Writer);
+static int GetArchitecture(const char *Name);
+static int GetFormat(const char *Name);
+static char *GetFullPath(const char *FileName);
+static int GetInputSize(const char *FileName, uint64_t *Size);
+static int GetShift(uint64_t Value);
+static char *GetTempName(const char *FileName);
+static void InitializeHexTable(void);
+static int IsIdentifier(const char *Name);
+static int LoadResponseFile(PBIN2C_INPUT_LIST List, const char *FileName);
+static uint8_t *PutUint16(uint8_t *Buffer, uint16_t Value);
+static uint8_t *PutUint32(uint8_t *Buffer, uint32_t Value);
+static uint8_t *PutUint64(uint8_t *Buffer, uint64_t Value);
+static int ReplaceOutput(const char *TempName, const char *FileName);
+static int RunDecompressorTest(const char *VectorName, double *Times, int Count);
+static PBIN2C_KERNEL SelectKernel(void);
+static void Usage(const char *ExecName);
+static int WriteAsmAsset(PBIN2C_WRITER Writer, const char *InputName, const char *Name);
+static int WriteCAsset(PBIN2C_WRITER Writer, const char *InputName, const char *Name);
+static void WriteCDeclaration(PBIN2C_WRITER Writer, const char *Type, const char *Name);
+static int WriteCoffObject(PBIN2C_WRITER Writer, const char *InputName, const char *Name, int Architecture);
+static void WriteData(PBIN2C_WRITER Writer, const unsigned char *Data, size_t Length);
+static int WriteDecompressor(const char *FileName);
+static int WriteDepfile(const char *FileName, const char *OutputName, PBIN2C_INPUT_LIST List,
+                        char **Arguments, int Count);
+static int WriteElfObject(PBIN2C_WRITER Writer, const char *InputName, const char *Name, int Architecture);
+static int WriteEmbedAsset(PBIN2C_WRITER Writer, const char *InputName, const char *Name);
+static void WriteFormatted(PBIN2C_WRITER Writer, const char *Format, ...);
+static void WriteHeader(PBIN2C_WRITER Writer, const uint8_t *Header, size_t Length);
+static void WriteIndex(PBIN2C_WRITER Writer, int Format, PBIN2C_INPUT_LIST List, const char *IndexName);
+static void WritePadding(PBIN2C_WRITER Writer, uint64_t Alignment);
+static int WriteSource(PBIN2C_WRITER Writer, int Format, PBIN2C_INPUT_LIST List, const char *IndexName);
+static void WriteText(PBIN2C_WRITER Writer, const char *Text, size_t Length);
+static void WriteWords(PBIN2C_WRITER Writer, const unsigned char *Data, size_t Length, int Final);
+
+#ifdef BIN2C_X86_KERNELS
+static char *EncodeAvx2(char *Output, const unsigned char *Input, size_t Length);
+static char *EncodeSse2(char *Output, const unsigned char *Input, size_t Length);
+static int IsAvx2Supported(void);
+static int IsSse2Supported(void);
+#endif
+
+#ifdef BIN2C_NEON_KERNEL
+static char *EncodeNeon(char *Output, const unsigned char *Input, size_t Length);
+#endif
+
+#ifdef BIN2C_PARALLEL
+static int BenchmarkThreads(void);
+static void *ConvertChunks(void *Context);
+static int ConvertMapped(const char *InputName, PBIN2C_WRITER Writer);
+static int ConvertParallel(const unsigned char *Data, uint64_t Size, int Descriptor, uint64_t Offset, int Threads);
+static int GetProcessorCount(void);
+#endif
+
+/* Supported output formats */
+static BIN2C_FORMAT Formats[] = {
+    {FORMAT_C, "c", "C structure", 0},
+    {FORMAT_ASM, "asm", "assembly source", 0},
+    {FORMAT_EMBED, "embed", "C23 embed source", 0},
+    {FORMAT_COFF, "coff", "COFF object", 1},
+    {FORMAT_ELF, "elf", "ELF object", 1}
+};
+
+/* Freestanding decompressor for compressed payloads, written out on request */
+static const char DecompressorSource[] =
+    "/*\n"
+    " * Decompressor for data converted by bin2c --compress, generated by bin2c.\n"
+    " * Payload is a sequence of LZ4 blocks, each preceded by a 32-bit little-endian header\n"
+    " * holding the block length, with the top bit set for blocks stored as-is. Blocks expand\n"
+    " * to %u bytes, except the last one. Payload ends with a 64-bit little-endian original size.\n"
+    " * This code does not depend on any library and can be used in a boot loader or a kernel.\n"
+    " */\n"
+    "\n"
+    "#define BIN2C_BLOCK_SIZE %uULL\n"
+    "\n"
+    "static void Bin2cCopy(unsigned char *Destination, const unsigned char *Source, unsigned long long Length)\n"
+    "{\n"
+    "    while(Length >= 8)\n"
+    "    {\n"
+    "#if defined(__GNUC__)\n"
+    "        __builtin_memcpy(Destination, Source, 8);\n"
+    "#else\n"
+    "        Destination[0] = Source[0]; Destination[1] = Source[1]; Destination[2] = Source[2]; Destination[3] = Source[3];\n"
+    "        Destination[4] = Source[4]; Destination[5] = Source[5]; Destination[6] = Source[6]; Destination[7] = Source[7];\n"
+    "#endif\n"
+    "        Destination += 8;\n"
+    "        Source += 8;\n"
+    "        Length -= 8;\n"
+    "    }\n"
+    "    while(Length--)\n"
+    "    {\n"
+    "        *Destination++ = *Source++;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static int Bin2cDecodeBlock(const unsigned char *Input, const unsigned char *InputEnd,\n"
+    "                            unsigned char *Output, unsigned char *OutputEnd)\n"
+    "{\n"
+    "    unsigned char *OutputStart = Output;\n"
+    "    unsigned long long Length;\n"
+    "    unsigned long long Offset;\n"
+    "    unsigned int Token;\n"
+    "    unsigned int Byte;\n"
+    "\n"
+    "    while(Input < InputEnd)\n"
+    "    {\n"
+    "        Token = *Input++;\n"
+    "        Length = Token >> 4;\n"
+    "        if(Length == 15)\n"
+    "        {\n"
+    "            do\n"
+    "            {\n"
+    "                if(Input >= InputEnd)\n"
+    "                {\n"
+    "                    return -1;\n"
+    "                }\n"
+    "                Byte = *Input++;\n"
+    "                Length += Byte;\n"
+    "            }\n"
+    "            while(Byte == 255);\n"
+    "        }\n"
+    "        if(Length > (unsigned long long)(InputEnd - Input) || Length > (unsigned long long)(OutputEnd - Output))\n"
+    "        {\n"
+    "            return -1;\n"
+    "        }\n"
+    "        Bin2cCopy(Output, Input, Length);\n"
+    "        Input += Length;\n"
+    "        Output += Length;\n"
+    "        if(Input == InputEnd)\n"
+    "        {\n"
+    "            break;\n"
+    "        }\n"
+    "        if(InputEnd - Input < 2)\n"
+    "        {\n"
+    "            return -1;\n"
+    "        }\n"
+    "        Offset = Input[0] | ((unsigned int)Input[1] << 8);\n"
+    "        Input += 2;\n"
+    "        if(Offset == 0 || Offset > (unsigned long long)(Output - OutputStart))\n"
+    "        {\n"
+    "            return -1;\n"
+    "        }\n"
+    "        Length = Token & 15;\n"
+    "        if(Length == 15)\n"
+    "        {\n"
+    "            do\n"
+    "            {\n"
+    "                if(Input >= InputEnd)\n"
+    "                {\n"
+    "                    return -1;\n"
+    "                }\n"
+    "                Byte = *Input++;\n"
+    "                Length += Byte;\n"
+    "            }\n"
+    "            while(Byte == 255);\n"
+    "        }\n"
+    "        Length += 4;\n"
+    "        if(Length > (unsigned long long)(OutputEnd - Output))\n"
+    "        {\n"
+    "            return -1;\n"
+    "        }\n"
+    "        if(Offset >= 8)\n"
+    "        {\n"
+    "            Bin2cCopy(Output, Output - Offset, Length);\n"
+    "            Output += Length;\n"
+    "        }\n"
+    "        else\n"
+    "        {\n"
+    "            while(Length--)\n"
+    "            {\n"
+    "                *Output = *(Output - Offset);\n"
+    "                Output++;\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    return (Output == OutputEnd) ? 0 : -1;\n"
+    "}\n"
+    "\n"
+    "unsigned long long bin2c_uncompressed_size(const unsigned char *Source, unsigned long long SourceSize)\n"
+    "{\n"
+    "    unsigned long long Size = 0;\n"
+    "    int Index;\n"
+    "\n"
+    "    if(SourceSize < 8)\n"
+    "    {\n"
+    "        return 0;\n"
+    "    }\n"
+    "    for(Index = 7; Index >= 0; Index--)\n"
+    "    {\n"
+    "        Size = (Size << 8) | Source[SourceSize - 8 + Index];\n"
+    "    }\n"
+    "    return Size;\n"
+    "}\n"
+    "\n"
+    "int bin2c_decompress(const unsigned char *Source, unsigned long long SourceSize,\n"
+    "                     unsigned char *Destination, unsigned long long DestinationSize)\n"
+    "{\n"
+    "    const unsigned char *SourceEnd;\n"
+    "    unsigned long long BlockSize;\n"
+    "    unsigned long long Remaining;\n"
+    "    unsigned int Header;\n"
+    "    unsigned int Length;\n"
+    "\n"
+    "    Remaining = bin2c_uncompressed_size(Source, SourceSize);\n"
+    "    if(SourceSize < 8 || Remaining > DestinationSize)\n"
+    "    {\n"
+    "        return -1;\n"
+    "    }\n"
+    "    SourceEnd = Source + SourceSize - 8;\n"
+    "\n"
+    "    while(Remaining > 0)\n"
+    "    {\n"
+    "        if(SourceEnd - Source < 4)\n"
+    "        {\n"
+    "            return -1;\n"
+    "        }\n"
+    "        Header = Source[0] | ((unsigned int)Source[1] << 8) | ((unsigned int)Source[2] << 16) | ((unsigned int)Source[3] << 24);\n"
+    "        Source += 4;\n"
+    "        Length = Header & 0x7FFFFFFF;\n"
+    "        BlockSize = (Remaining < BIN2C_BLOCK_SIZE) ? Remaining : BIN2C_BLOCK_SIZE;\n"
+    "        if(Length > (unsigned long long)(SourceEnd - Source))\n"
+    "        {\n"
+    "            return -1;\n"
+    "        }\n"
+    "        if(Header & 0x80000000)\n"
+    "        {\n"
+    "            if(Length != BlockSize)\n"
+    "            {\n"
+    "                return -1;\n"
+    "            }\n"
+    "            Bin2cCopy(Destination, Source, Length);\n"
+    "        }\n"
+    "        else if(Bin2cDecodeBlock(Source, Source + Length, Destination, Destination + BlockSize) != 0)\n"
+    "        {\n"
+    "            return -1;\n"
+    "        }\n"
+    "        Source += Length;\n"
+    "        Destination += BlockSize;\n"
+    "        Remaining -= BlockSize;\n"
+    "    }\n"
+    "\n"
+    "    return (Source == SourceEnd) ? 0 : -1;\n"
+    "}\n";
+
+/* Test program appended to the decompressor in benchmark mode, it reads records holding a timing flag, original
+   and compressed sizes followed by both data, checks the round trip and prints decompression times */
+static const char DecompressorTestSource[] =
+    "\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "#include <time.h>\n"
+    "\n"
+    "static int Bin2cReadSize(FILE *File, unsigned long long *Value)\n"
+    "{\n"
+    "    unsigned char Buffer[8];\n"
+    "    int Index;\n"
+    "\n"
+    "    if(fread(Buffer, 1, 8, File) != 8)\n"
+    "    {\n"
+    "        return -1;\n"
+    "    }\n"
+    "    for(*Value = 0, Index = 7; Index >= 0; Index--)\n"
+    "    {\n"
+    "        *Value = (*Value << 8) | Buffer[Index];\n"
+    "    }\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "int main(int argc, char **argv)\n"
+    "{\n"
+    "    unsigned long long Timed;\n"
+    "    unsigned long long Size;\n"
+    "    unsigned long long Packed;\n"
+    "    unsigned char *Compressed;\n"
+    "    unsigned char *Input;\n"
+    "    unsigned char *Output;\n"
+    "    double Best;\n"
+    "    double Elapsed;\n"
+    "    clock_t Start;\n"
+    "    FILE *File;\n"
+    "    int Iteration;\n"
+    "    int Result = 0;\n"
+    "\n"
+    "    File = (argc > 1) ? fopen(argv[1], \"rb\") : NULL;\n"
+    "    if(File == NULL)\n"
+    "    {\n"
+    "        fprintf(stderr, \"Error: unable to open test data\\n\");\n"
+    "        return 1;\n"
+    "    }\n"
+    "    while(Result == 0 && Bin2cReadSize(File, &Timed) == 0)\n"
+    "    {\n"
+    "        Input = NULL;\n"
+    "        Compressed = NULL;\n"
+    "        Output = NULL;\n"
+    "        if(Bin2cReadSize(File, &Size) != 0 || Bin2cReadSize(File, &Packed) != 0 ||\n"
+    "           (Input = (unsigned char *)malloc(Size + 1)) == NULL ||\n"
+    "           (Compressed = (unsigned char *)malloc(Packed + 1)) == NULL ||\n"
+    "           (Output = (unsigned char *)malloc(Size + 1)) == NULL ||\n"
+    "           fread(Input, 1, Size, File) != Size || fread(Compressed, 1, Packed, File) != Packed)\n"
+    "        {\n"
+    "            fprintf(stderr, \"Error: unable to read test data\\n\");\n"
+    "            Result = 1;\n"
+    "        }\n"
+    "        Best = -1;\n"
+    "        for(Iteration = 0; Result == 0 && Iteration < (Timed ? 4 : 1); Iteration++)\n"
+    "        {\n"
+    "            memset(Output, 0, Size + 1);\n"
+    "            Start = clock();\n"
+    "            if(bin2c_decompress(Compressed, Packed, Output, Size) != 0 || memcmp(Input, Output, Size) != 0)\n"
+    "            {\n"
+    "                fprintf(stderr, \"Round trip FAILED (length %llu)\\n\", Size);\n"
+    "                Result = 1;\n"
+    "            }\n"
+    "            Elapsed = (double)(clock() - Start) / CLOCKS_PER_SEC;\n"
+    "            Best = (Best < 0 || Elapsed < Best) ? Elapsed : Best;\n"
+    "        }\n"
+    "        if(Result == 0 && Timed)\n"
+    "        {\n"
+    "            printf(\"%.9f\\n\", Best);\n"
+    "        }\n"
+    "        free(Input);\n"
+    "        free(Compressed);\n"
+    "        free(Output);\n"
+    "    }\n"
+    "    fclose(File);\n"
+    "    return Result;\n"
+    "}\n";
+
+/* Byte to text lookup table, every entry holds ",0xNN" */
+static char HexTable[256][BIN2C_BYTE_TEXT];
+
+/* Text produced for 16 input bytes with hex digits left out, used as a template by vector kernels */
+static uint8_t VectorPattern[5][16];
+
+/* Shuffle masks placing hex digits of 16 input bytes into five 16-byte output blocks */
+static uint8_t VectorShuffle[5][16];
+
+/* Available encoding kernels, ordered from the slowest to the fastest one */
+static BIN2C_KERNEL Kernels[] = {
+    {"scalar", EncodeScalar, NULL},
+#ifdef BIN2C_X86_KERNELS
+    {"sse2", EncodeSse2, IsSse2Supported},
+    {"avx2", EncodeAvx2, IsAvx2Supported},
+#endif
+#ifdef BIN2C_NEON_KERNEL
+    {"neon", EncodeNeon, NULL},
+#endif
+};
+
+/* Kernel used for the conversion */
+static PBIN2C_KERNEL Kernel = &Kernels[0];
+
+/* Adds an input file given as <file>[=<name>] to the list */
+static int AddInput(PBIN2C_INPUT_LIST List, const char *Specification)
+{
+    PBIN2C_INPUT Input;
+    PBIN2C_INPUT Items;
+    char *Separator;
+    char *Name;
+
+    /* Grow the list if needed */
+    if(List->Count == List->Capacity)
+    {
+        List->Capacity = List->Capacity ? List->Capacity * 2 : 64;
+        Items = (PBIN2C_INPUT)realloc(List->Items, List->Capacity * sizeof(BIN2C_INPUT));
+        if(Items == NULL)
+        {
+            /* Memory allocation failed */
+            printf("Error: unable to allocate memory for input list\n");
+            return -1;
+        }
+        List->Items = Items;
+    }
+
+    /* Copy the file name */
+    Input = &List->Items[List->Count];
+    Input->FileName = strdup(Specification);
+    Input->Size = 0;
+    if(Input->FileName == NULL)
+    {
+        /* Memory allocation failed */
+        printf("Error: unable to allocate memory for input list\n");
+        return -1;
+    }
+
+    /* Check if the symbol name has been provided explicitly */
+    Separator = strrchr(Input->FileName, '=');
+    if(Separator && IsIdentifier(Separator + 1))
+    {
+        /* Split the symbol name off the file name */
+        *Separator = '\0';
+        Input->Name = strdup(Separator + 1);
+    }
+    else
+    {
+        /* Derive the symbol name from the file name */
+        Separator = _tcsrchrs(Input->FileName, '/', '\\');
+        Input->Name = (char *)malloc(strlen(Input->FileName) + 2);
+        if(Input->Name)
+        {
+            /* Identifiers cannot start with a digit */
+            Name = Input->Name;
+            if(Separator == NULL)
+            {
+                Separator = Input->FileName;
+            }
+            else
+            {
+                Separator++;
+            }
+            if(*Separator >= '0' && *Separator <= '9')
+            {
+                *Name++ = '_';
+            }
+
+            /* Replace all characters not allowed in identifiers with underscores */
+            while(*Separator)
+            {
+                *Name++ = (isalnum((unsigned char)*Separator) || *Separator == '_') ? *Separator : '_';
+                Separator++;
+            }
+            *Name = '\0';
+        }
+    }
+
+    /* Make sure the symbol name is valid */
+    if(Input->Name == NULL || !IsIdentifier(Input->Name))
     {
-        printf("Usage: %s <input binary> <output file> <structure name>\n", argv[0]);
+        printf("Error: unable to derive symbol name for %s\n", Input->FileName);
+        free(Input->FileName);
+        free(Input->Name);
+        return -1;
+    }
+
+    /* Input added */
+    List->Count++;
+    return 0;
+}
+
+/* Verifies compression round trip with the emitted decompressor and measures compression and decompression speed */
+static int BenchmarkCompression(void)
+{
+    static const char *Words[] = {"kernel", "driver", "boot", "loader", "image", "section", "0000", "\xFF\xFF",
+                                  "XTOS", " ", "\n", "header", "\x01\x01\x01\x01", "table", "font", "splash"};
+    BIN2C_WRITER Writer = {0};
+    FILE *InputFile;
+    FILE *Vector;
+    const char *TempDir;
+    char VectorName[4096];
+    uint8_t Header[24];
+    uint8_t *Compressed;
+    uint8_t *Input;
+    double Elapsed[2];
+    double Ratio[2];
+    double Times[2];
+    double Start;
+    size_t Index;
+    size_t Length;
+    size_t Offset;
+    uint32_t Seed = 0x87654321;
+    int Pass;
+    int Result = 0;
+
+    /* Allocate memory for the benchmark data */
+    Input = (uint8_t *)malloc(BIN2C_BENCHMARK_SIZE);
+    Writer.Buffer = (char *)malloc(BIN2C_OUTPUT_BUFFER);
+    if(Input == NULL || Writer.Buffer == NULL)
+    {
+        /* Memory allocation failed */
+        printf("Error: unable to allocate memory for benchmark data\n");
+        free(Input);
+        free(Writer.Buffer);
         return 1;
     }
 
-    /* Open the input binary file in binary mode */
-    FILE *inputFile = fopen(argv[1], "rb");
-    if(inputFile == NULL)
+    /* Collect original and compressed data in a temporary file, which is read by the emitted decompressor */
+#ifdef _WIN32
+    TempDir = getenv("TEMP");
+#else
+    TempDir = getenv("TMPDIR");
+#endif
+    TempDir = (TempDir && *TempDir) ? TempDir : ".";
+    snprintf(VectorName, sizeof(VectorName), "%s%cbin2c-%ld.bin", TempDir, PATH_SEP, (long)getpid());
+    Vector = fopen(VectorName, "wb");
+    if(Vector == NULL)
     {
-        printf("Error: unable to open file %s\n", argv[1]);
+        printf("Error: unable to create file %s\n", VectorName);
+        free(Input);
+        free(Writer.Buffer);
         return 1;
     }
 
-    /* Open the destination source code file in text mode */
-    FILE *outputFile = fopen(argv[2], "w");
-    if(outputFile == NULL)
+    /* Test compressible data first, then incompressible data, then short inputs including an empty one */
+    Writer.Compress = 1;
+    Writer.Raw = 1;
+    for(Pass = 0; Pass < 2 + 300 && Result == 0; Pass++)
+    {
+        if(Pass < 2)
+        {
+            /* Fill input buffer with pseudo-random words or bytes */
+            for(Offset = 0; Offset < BIN2C_BENCHMARK_SIZE;)
+            {
+                Seed = Seed * 1103515245 + 12345;
+                if(Pass == 0)
+                {
+                    Length = strlen(Words[(Seed >> 16) & 15]);
+                    Length = (Offset + Length > BIN2C_BENCHMARK_SIZE) ? BIN2C_BENCHMARK_SIZE - Offset : Length;
+                    memcpy(Input + Offset, Words[(Seed >> 16) & 15], Length);
+                    Offset += Length;
+                }
+                else
+                {
+                    Input[Offset++] = (uint8_t)(Seed >> 16);
+                }
+            }
+            Length = BIN2C_BENCHMARK_SIZE;
+        }
+        else
+        {
+            /* Use repeated pattern so that short matches are exercised as well */
+            Length = Pass - 2;
+            for(Index = 0; Index < Length; Index++)
+            {
+                Input[Index] = (uint8_t)((Index % 7) * 31 + (Index / 50));
+            }
+        }
+
+        /* Compress the data into a temporary file */
+        InputFile = tmpfile();
+        Writer.File = tmpfile();
+        if(InputFile == NULL || Writer.File == NULL || fwrite(Input, 1, Length, InputFile) != Length)
+        {
+            printf("Error: unable to create temporary file\n");
+            Result = 1;
+            break;
+        }
+        rewind(InputFile);
+        Writer.DataSize = 0;
+        Start = get_timestamp();
+        ConvertStream(InputFile, &Writer);
+        FlushWriter(&Writer);
+        if(Pass < 2)
+        {
+            Elapsed[Pass] = get_timestamp() - Start;
+            Ratio[Pass] = 100.0 * Writer.DataSize / Length;
+        }
+        fclose(InputFile);
+
+        /* Read the compressed payload back and add the record, only large inputs are timed */
+        Compressed = (uint8_t *)malloc(Writer.DataSize);
+        rewind(Writer.File);
+        if(Compressed == NULL || fread(Compressed, 1, Writer.DataSize, Writer.File) != Writer.DataSize)
+        {
+            printf("Error: unable to read compressed data\n");
+            Result = 1;
+        }
+        else
+        {
+            PutUint64(PutUint64(PutUint64(Header, Pass < 2), Length), Writer.DataSize);
+            fwrite(Header, 1, sizeof(Header), Vector);
+            fwrite(Input, 1, Length, Vector);
+            fwrite(Compressed, 1, Writer.DataSize, Vector);
+        }
+        free(Compressed);
+        fclose(Writer.File);
+    }
+    if(fclose(Vector) != 0 && Result == 0)
+    {
+        printf("Error: unable to write file %s\n", VectorName);
+        Result = 1;
+    }
+
+    /* Decompress everything with the emitted decompressor */
+    if(Result == 0 && RunDecompressorTest(VectorName, Times, 2) != 0)
+    {
+        Result = 1;
+    }
+
+    /* Print results */
+    if(Result == 0)
+    {
+        printf("\nData           Ratio   Compression   Decompression\n");
+        for(Pass = 0; Pass < 2; Pass++)
+        {
+            printf("%-14s %5.1f%%  %7.1f MB/s  %9.1f MB/s\n", Pass ? "random" : "compressible", Ratio[Pass],
+                   BIN2C_BENCHMARK_SIZE / Elapsed[Pass] / (1024 * 1024),
+                   (Times[Pass] > 0) ? BIN2C_BENCHMARK_SIZE / Times[Pass] / (1024 * 1024) : 0.0);
+        }
+    }
+
+    /* Free allocated memory */
+    remove(VectorName);
+    free(Input);
+    free(Writer.Buffer);
+    return Result;
+}
+
+/* Measures throughput of every supported kernel and verifies it against the scalar one */
+static int BenchmarkKernels(void)
+{
+    unsigned char *Input;
+    char *Output;
+    char *Reference;
+    char *End;
+    double Best;
+    double Elapsed;
+    double Start;
+    size_t Index;
+    size_t Length;
+    size_t Offset;
+    size_t ReferenceLength;
+    uint32_t Seed = 0x12345678;
+    int Iteration;
+    int Result = 0;
+
+    /* Allocate memory for the benchmark data */
+    Input = (unsigned char *)malloc(BIN2C_BENCHMARK_SIZE);
+    Output = (char *)malloc((size_t)BIN2C_BENCHMARK_SIZE * BIN2C_BYTE_TEXT);
+    Reference = (char *)malloc((size_t)BIN2C_BENCHMARK_SIZE * BIN2C_BYTE_TEXT);
+    if(Input == NULL || Output == NULL || Reference == NULL)
     {
-        printf("Error: unable to open file %s\n", argv[2]);
-        fclose(inputFile);
+        /* Memory allocation failed */
+        printf("Error: unable to allocate memory for benchmark data\n");
+        free(Input);
+        free(Output);
+        free(Reference);
         return 1;
     }
 
-    /* Get the size of the binary file */
-    fseek(inputFile, 0, SEEK_END);
-    long binSize = ftell(inputFile);
-    rewind(inputFile);
+    /* Fill input buffer with pseudo-random data */
+    for(Index = 0; Index < BIN2C_BENCHMARK_SIZE; Index++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        Input[Index] = (unsigned char)(Seed >> 16);
+    }
+
+    /* Produce the reference output */
+    ReferenceLength = EncodeScalar(Reference, Input, BIN2C_BENCHMARK_SIZE) - Reference;
+
+    /* Benchmark all kernels */
+    printf("Kernel     Throughput\n");
+    for(Index = 0; Index < sizeof(Kernels) / sizeof(BIN2C_KERNEL); Index++)
+    {
+        /* Skip kernels not supported by the CPU */
+        if(Kernels[Index].IsSupported && !Kernels[Index].IsSupported())
+        {
+            printf("%-10s not supported\n", Kernels[Index].Name);
+            continue;
+        }
+
+        /* Verify kernel output for short, unaligned inputs */
+        for(Offset = 0; Offset < 4; Offset++)
+        {
+            for(Length = 0; Length < 300; Length++)
+            {
+                End = Kernels[Index].Encode(Output, Input + Offset, Length);
+                if((size_t)(End - Output) != Length * BIN2C_BYTE_TEXT ||
+                   memcmp(Output, Reference + Offset * BIN2C_BYTE_TEXT, Length * BIN2C_BYTE_TEXT) != 0)
+                {
+                    /* Kernel output differs from the scalar reference */
+                    printf("%-10s FAILED (length %zu, offset %zu)\n", Kernels[Index].Name, Length, Offset);
+                    Result = 1;
+                    break;
+                }
+            }
+        }
+
+        /* Run the kernel several times over cache-sized chunks, just like the conversion does */
+        Best = 0;
+        for(Iteration = 0; Iteration < 4; Iteration++)
+        {
+            Start = get_timestamp();
+            for(Offset = 0; Offset < BIN2C_BENCHMARK_SIZE; Offset += BIN2C_INPUT_CHUNK)
+            {
+                Kernels[Index].Encode(Output, Input + Offset, BIN2C_INPUT_CHUNK);
+            }
+            Elapsed = get_timestamp() - Start;
+            if(Best == 0 || Elapsed < Best)
+            {
+                Best = Elapsed;
+            }
+        }
+
+        /* Verify kernel output for the whole data set */
+        End = Kernels[Index].Encode(Output, Input, BIN2C_BENCHMARK_SIZE);
+        if((size_t)(End - Output) != ReferenceLength || memcmp(Output, Reference, ReferenceLength) != 0)
+        {
+            /* Kernel output differs from the scalar reference */
+            printf("%-10s FAILED\n", Kernels[Index].Name);
+            Result = 1;
+            continue;
+        }
+
+        /* Print kernel throughput */
+        printf("%-10s %.1f MB/s\n", Kernels[Index].Name, BIN2C_BENCHMARK_SIZE / Best / (1024 * 1024));
+    }
+
+    /* Free allocated memory */
+    free(Input);
+    free(Output);
+    free(Reference);
+    return Result;
+}
+
+#ifdef BIN2C_PARALLEL
+/* Measures scaling of the parallel conversion with the number of threads */
+static int BenchmarkThreads(void)
+{
+    unsigned char *Input;
+    char *Output;
+    char *Reference;
+    FILE *File;
+    double Base = 0;
+    double Best;
+    double Elapsed;
+    double Start;
+    size_t BytesRead;
+    size_t Index;
+    size_t Offset;
+    size_t ReferenceLength;
+    uint32_t Seed = 0x13572468;
+    int Iteration;
+    int Processors;
+    int Result = 0;
+    int Threads;
 
-    /* Allocate memory for the binary data */
-    unsigned char *binData = (unsigned char *)malloc(binSize);
-    if(binData == NULL)
+    /* Allocate memory for the benchmark data */
+    Input = (unsigned char *)malloc(BIN2C_BENCHMARK_SIZE);
+    Output = (char *)malloc(BIN2C_INPUT_CHUNK);
+    Reference = (char *)malloc((size_t)BIN2C_BENCHMARK_SIZE * BIN2C_BYTE_TEXT);
+    File = tmpfile();
+    if(Input == NULL || Output == NULL || Reference == NULL || File == NULL)
     {
-        printf("Error: unable to allocate memory for binary data\n");
-        fclose(inputFile);
-        fclose(outputFile);
+        /* Memory allocation failed */
+        printf("Error: unable to allocate memory for benchmark data\n");
+        free(Input);
+        free(Output);
+        free(Reference);
+        if(File)
+        {
+            fclose(File);
+        }
         return 1;
     }
 
-    /* Read the binary data into memory */
-    fread(binData, sizeof(unsigned char), binSize, inputFile);
+    /* Fill input buffer with pseudo-random data */
+    for(Index = 0; Index < BIN2C_BENCHMARK_SIZE; Index++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        Input[Index] = (unsigned char)(Seed >> 16);
+    }
+
+    /* Produce the reference output, the very first byte is not preceded by a separator */
+    ReferenceLength = EncodeScalar(Reference, Input, BIN2C_BENCHMARK_SIZE) - Reference - 1;
+    memmove(Reference, Reference + 1, ReferenceLength);
+
+    /* Benchmark doubling thread counts up to the number of processors, always verify a few threads */
+    Processors = GetProcessorCount();
+    Processors = (Processors < 4) ? 4 : Processors;
+    printf("\nThreads    Throughput     Speedup\n");
+    for(Threads = 1; Result == 0; Threads = (Threads * 2 > Processors && Threads < Processors) ? Processors : Threads * 2)
+    {
+        /* Convert the data several times and take the best result */
+        Best = 0;
+        for(Iteration = 0; Iteration < 3; Iteration++)
+        {
+            Start = get_timestamp();
+            if(ConvertParallel(Input, BIN2C_BENCHMARK_SIZE, fileno(File), 0, Threads) != 0)
+            {
+                printf("Error: unable to write temporary file\n");
+                Result = 1;
+                break;
+            }
+            Elapsed = get_timestamp() - Start;
+            if(Best == 0 || Elapsed < Best)
+            {
+                Best = Elapsed;
+            }
+        }
+
+        /* Verify the output against the reference */
+        rewind(File);
+        for(Offset = 0; Result == 0 && Offset < ReferenceLength; Offset += BytesRead)
+        {
+            BytesRead = fread(Output, 1, BIN2C_INPUT_CHUNK, File);
+            if(BytesRead == 0 || Offset + BytesRead > ReferenceLength ||
+               memcmp(Output, Reference + Offset, BytesRead) != 0)
+            {
+                printf("%-10d FAILED\n", Threads);
+                Result = 1;
+            }
+        }
+
+        /* Print throughput and speedup over a single thread */
+        if(Result == 0)
+        {
+            Base = (Threads == 1) ? Best : Base;
+            printf("%-10d %7.1f MB/s  %7.2fx\n", Threads, BIN2C_BENCHMARK_SIZE / Best / (1024 * 1024), Base / Best);
+        }
+
+        /* Stop after the number of processors has been reached */
+        if(Threads >= Processors)
+        {
+            break;
+        }
+    }
+
+    /* Free allocated memory */
+    fclose(File);
+    free(Input);
+    free(Output);
+    free(Reference);
+    return Result;
+}
+#endif
+
+/* Compares contents of both files, returns 0 only when both can be read and are identical */
+static int CompareFiles(const char *FirstName, const char *SecondName)
+{
+    unsigned char *Buffer;
+    FILE *First;
+    FILE *Second;
+    size_t FirstRead;
+    size_t SecondRead;
+    int Result;
+
+    /* Open both files */
+    First = fopen(FirstName, "rb");
+    if(First == NULL)
+    {
+        /* File does not exist */
+        return -1;
+    }
+    Second = fopen(SecondName, "rb");
+    if(Second == NULL)
+    {
+        /* File does not exist */
+        fclose(First);
+        return -1;
+    }
+
+    /* Allocate fixed size buffer for both files */
+    Buffer = (unsigned char *)malloc(BIN2C_INPUT_CHUNK * 2);
+    if(Buffer == NULL)
+    {
+        /* Memory allocation failed */
+        fclose(Second);
+        fclose(First);
+        return -1;
+    }
+
+    /* Compare the files chunk by chunk until they differ or both end */
+    do
+    {
+        FirstRead = fread(Buffer, 1, BIN2C_INPUT_CHUNK, First);
+        SecondRead = fread(Buffer + BIN2C_INPUT_CHUNK, 1, BIN2C_INPUT_CHUNK, Second);
+        Result = (FirstRead != SecondRead || memcmp(Buffer, Buffer + BIN2C_INPUT_CHUNK, FirstRead) != 0) ? -1 : 0;
+    }
+    while(Result == 0 && FirstRead > 0);
+
+    /* Check for read errors */
+    if(ferror(First) || ferror(Second))
+    {
+        Result = -1;
+    }
+    free(Buffer);
+    fclose(Second);
+    fclose(First);
+    return Result;
+}
+
+/* Orders input files by their symbol names */
+static int CompareInputs(const void *First, const void *Second)
+{
+    return strcmp(((const BIN2C_INPUT *)First)->Name, ((const BIN2C_INPUT *)Second)->Name);
+}
+
+/* Compresses a single block in LZ4 block format, returns compressed length */
+static size_t CompressBlock(const uint8_t *Input, size_t Length, uint8_t *Output, uint32_t *HashTable)
+{
+    const uint8_t *Anchor = Input;
+    const uint8_t *End = Input + Length;
+    const uint8_t *Limit = Input + Length - BIN2C_LZ4_MFLIMIT;
+    const uint8_t *MatchLimit = Input + Length - BIN2C_LZ4_LASTLITERALS;
+    const uint8_t *Position = Input;
+    const uint8_t *Reference;
+    uint8_t *Start = Output;
+    uint8_t *Token;
+    uint32_t Hash;
+    uint32_t Sequence;
+    size_t LiteralLength;
+    size_t MatchLength;
+    size_t Step;
+
+    /* Clear hash table, positions are stored incremented by one so that zero means empty */
+    memset(HashTable, 0, sizeof(uint32_t) << BIN2C_HASH_BITS);
+
+    /* Look for matches unless the block is too short to hold any */
+    while(Length > BIN2C_LZ4_MFLIMIT && Position < Limit)
+    {
+        /* Look up the last position holding the same 4 bytes */
+        memcpy(&Sequence, Position, sizeof(uint32_t));
+        Hash = (Sequence * 2654435761U) >> (32 - BIN2C_HASH_BITS);
+        Reference = HashTable[Hash] ? Input + HashTable[Hash] - 1 : NULL;
+        HashTable[Hash] = (uint32_t)(Position - Input) + 1;
+
+        /* Check if a match has been found */
+        if(Reference == NULL || Position - Reference > BIN2C_LZ4_MAX_OFFSET || memcmp(Reference, Position, 4) != 0)
+        {
+            /* Skip faster over data that does not compress */
+            Step = 1 + ((Position - Anchor) >> 6);
+            Position += Step;
+            continue;
+        }
+
+        /* Extend the match backwards and forwards */
+        while(Position > Anchor && Reference > Input && Position[-1] == Reference[-1])
+        {
+            Position--;
+            Reference--;
+        }
+        MatchLength = 4;
+        while(Position + MatchLength < MatchLimit && Position[MatchLength] == Reference[MatchLength])
+        {
+            MatchLength++;
+        }
+
+        /* Write the token and literal length */
+        LiteralLength = Position - Anchor;
+        Token = Output++;
+        *Token = (uint8_t)(((LiteralLength >= 15) ? 15 : LiteralLength) << 4);
+        if(LiteralLength >= 15)
+        {
+            for(Step = LiteralLength - 15; Step >= 255; Step -= 255)
+            {
+                *Output++ = 255;
+            }
+            *Output++ = (uint8_t)Step;
+        }
+
+        /* Copy literals and write match offset */
+        memcpy(Output, Anchor, LiteralLength);
+        Output += LiteralLength;
+        *Output++ = (uint8_t)(Position - Reference);
+        *Output++ = (uint8_t)((Position - Reference) >> 8);
+
+        /* Write match length */
+        *Token |= (uint8_t)((MatchLength - 4 >= 15) ? 15 : MatchLength - 4);
+        if(MatchLength - 4 >= 15)
+        {
+            for(Step = MatchLength - 4 - 15; Step >= 255; Step -= 255)
+            {
+                *Output++ = 255;
+            }
+            *Output++ = (uint8_t)Step;
+        }
+
+        /* Continue after the match */
+        Position += MatchLength;
+        Anchor = Position;
+    }
+
+    /* Write the last literals */
+    LiteralLength = End - Anchor;
+    *Output++ = (uint8_t)(((LiteralLength >= 15) ? 15 : LiteralLength) << 4);
+    if(LiteralLength >= 15)
+    {
+        for(Step = LiteralLength - 15; Step >= 255; Step -= 255)
+        {
+            *Output++ = 255;
+        }
+        *Output++ = (uint8_t)Step;
+    }
+    memcpy(Output, Anchor, LiteralLength);
+    Output += LiteralLength;
+
+    /* Return compressed length */
+    return Output - Start;
+}
+
+/* Compresses the input stream block by block into the output data */
+static int CompressStream(FILE *InputFile, PBIN2C_WRITER Writer)
+{
+    uint8_t *Compressed;
+    uint8_t *Input;
+    uint32_t *HashTable;
+    uint8_t Header[8];
+    size_t BytesRead;
+    size_t Length;
+    int Result = 0;
+
+    /* Allocate buffers, compressed block might be slightly larger than the input */
+    Input = (uint8_t *)malloc(BIN2C_COMPRESS_BLOCK);
+    Compressed = (uint8_t *)malloc(BIN2C_COMPRESS_BLOCK + BIN2C_COMPRESS_BLOCK / 255 + 16);
+    HashTable = (uint32_t *)malloc(sizeof(uint32_t) << BIN2C_HASH_BITS);
+    if(Input == NULL || Compressed == NULL || HashTable == NULL)
+    {
+        /* Memory allocation failed */
+        free(Input);
+        free(Compressed);
+        free(HashTable);
+        return -1;
+    }
+
+    /* Process the input file block by block */
+    Writer->InputSize = 0;
+    while(1)
+    {
+        /* Fill the whole block, so that every block but the last one has the same size */
+        BytesRead = 0;
+        while(BytesRead < BIN2C_COMPRESS_BLOCK &&
+              (Length = fread(Input + BytesRead, 1, BIN2C_COMPRESS_BLOCK - BytesRead, InputFile)) > 0)
+        {
+            BytesRead += Length;
+        }
+        if(BytesRead == 0)
+        {
+            break;
+        }
+
+        /* Compress the block, store it as-is if it does not shrink */
+        Length = CompressBlock(Input, BytesRead, Compressed, HashTable);
+        if(Length >= BytesRead)
+        {
+            PutUint32(Header, (uint32_t)BytesRead | BIN2C_BLOCK_STORED);
+            WriteData(Writer, Header, sizeof(uint32_t));
+            WriteData(Writer, Input, BytesRead);
+        }
+        else
+        {
+            PutUint32(Header, (uint32_t)Length);
+            WriteData(Writer, Header, sizeof(uint32_t));
+            WriteData(Writer, Compressed, Length);
+        }
+        Writer->InputSize += BytesRead;
+    }
+
+    /* Check for read errors */
+    if(ferror(InputFile))
+    {
+        /* Failed to read input file */
+        Result = -1;
+    }
+
+    /* Finish the payload with the original size */
+    PutUint64(Header, Writer->InputSize);
+    WriteData(Writer, Header, sizeof(uint64_t));
+
+    /* Free allocated memory */
+    free(Input);
+    free(Compressed);
+    free(HashTable);
+    return Result;
+}
+
+#ifdef BIN2C_PARALLEL
+/* Worker thread formatting chunks of the mapped input and writing them at their final offsets */
+static void *ConvertChunks(void *Context)
+{
+    PBIN2C_PARALLEL_JOB Job = (PBIN2C_PARALLEL_JOB)Context;
+    uint64_t Chunk;
+    uint64_t Position;
+    uint64_t Start;
+    size_t Length;
+    char *Buffer;
+    char *Text;
+    ssize_t Written;
+
+    /* Allocate buffer for a single formatted chunk */
+    Buffer = (char *)malloc((size_t)BIN2C_PARALLEL_CHUNK * BIN2C_BYTE_TEXT);
+    if(Buffer == NULL)
+    {
+        /* Memory allocation failed */
+        __atomic_store_n(&Job->Error, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
 
-    /* Write the C structure to the header file */
-    fprintf(outputFile, "unsigned char %s[] = {", argv[3]);
-    for(int i = 0; i < binSize; i++)
+    /* Take chunks until all of them are done */
+    while((Chunk = __atomic_fetch_add(&Job->NextChunk, 1, __ATOMIC_RELAXED)) < Job->Chunks &&
+          !__atomic_load_n(&Job->Error, __ATOMIC_RELAXED))
     {
-        fprintf(outputFile, "0x%02X", binData[i]);
-        if(i < binSize - 1)
+        /* Format the chunk */
+        Start = Chunk * BIN2C_PARALLEL_CHUNK;
+        Length = (Job->Size - Start > BIN2C_PARALLEL_CHUNK) ? BIN2C_PARALLEL_CHUNK : (size_t)(Job->Size - Start);
+        Length = Kernel->Encode(Buffer, Job->Data + Start, Length) - Buffer;
+
+        /* Every byte takes the same space, the very first one is not preceded by a separator */
+        Text = Buffer;
+        Position = Job->Offset + Start * BIN2C_BYTE_TEXT;
+        if(Chunk == 0)
+        {
+            Text++;
+            Length--;
+        }
+        else
+        {
+            Position--;
+        }
+
+        /* Write the formatted chunk at its offset */
+        while(Length > 0)
         {
-            fprintf(outputFile, ",");
+            Written = pwrite(Job->Descriptor, Text, Length, (off_t)Position);
+            if(Written <= 0)
+            {
+                /* Failed to write output file */
+                __atomic_store_n(&Job->Error, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            Text += Written;
+            Position += Written;
+            Length -= Written;
         }
     }
-    fprintf(outputFile, "};\nunsigned int %s_size = %ld;\n", argv[3], binSize);
-    free(binData);
 
-    /* Close all open files */
-    fclose(inputFile);
-    fclose(outputFile);
+    /* Free the buffer */
+    free(Buffer);
+    return NULL;
+}
+
+/* Converts the memory mapped input file using all worker threads */
+static int ConvertMapped(const char *InputName, PBIN2C_WRITER Writer)
+{
+    struct stat Stat;
+    void *Data;
+    int Descriptor;
+    int Result;
+    int Threads;
+
+    /* Map the input file */
+    Descriptor = open(InputName, O_RDONLY);
+    if(Descriptor < 0)
+    {
+        /* Failed to open input file */
+        return -1;
+    }
+    if(fstat(Descriptor, &Stat) != 0 || Stat.st_size == 0 ||
+       (Data = mmap(NULL, (size_t)Stat.st_size, PROT_READ, MAP_PRIVATE, Descriptor, 0)) == MAP_FAILED)
+    {
+        /* Failed to map input file */
+        close(Descriptor);
+        return -1;
+    }
+    close(Descriptor);
+
+    /* Write out all buffered text, chunks are written directly to the file */
+    FlushWriter(Writer);
+    fflush(Writer->File);
+
+    /* Convert the data and continue writing after it */
+    Threads = Writer->Threads ? Writer->Threads : GetProcessorCount();
+    Result = ConvertParallel((const unsigned char *)Data, (uint64_t)Stat.st_size, fileno(Writer->File),
+                             Writer->Offset, Threads);
+    munmap(Data, (size_t)Stat.st_size);
+    if(Result != 0 || fseek(Writer->File, 0, SEEK_END) != 0)
+    {
+        /* Conversion failed */
+        Writer->Error = 1;
+        return -1;
+    }
+
+    /* Update output offset and data size */
+    Writer->Offset += (uint64_t)Stat.st_size * BIN2C_BYTE_TEXT - 1;
+    Writer->DataSize = (uint64_t)Stat.st_size;
+    return 0;
+}
+
+/* Formats the data on a pool of worker threads, writing chunks at offsets following the given one */
+static int ConvertParallel(const unsigned char *Data, uint64_t Size, int Descriptor, uint64_t Offset, int Threads)
+{
+    BIN2C_PARALLEL_JOB Job;
+    pthread_t *Workers;
+    int Created;
+
+    /* Describe the job */
+    Job.Data = Data;
+    Job.Size = Size;
+    Job.Offset = Offset;
+    Job.Chunks = (Size + BIN2C_PARALLEL_CHUNK - 1) / BIN2C_PARALLEL_CHUNK;
+    Job.NextChunk = 0;
+    Job.Descriptor = Descriptor;
+    Job.Error = 0;
 
-    printf("Binary data converted to C structure successfully.\n");
+    /* Never start more threads than there are chunks */
+    if((uint64_t)Threads > Job.Chunks)
+    {
+        Threads = (int)Job.Chunks;
+    }
+
+    /* Start the workers, the calling thread works as well */
+    Workers = (pthread_t *)malloc(sizeof(pthread_t) * (Threads > 1 ? Threads : 1));
+    if(Workers == NULL)
+    {
+        /* Memory allocation failed */
+        return -1;
+    }
+    for(Created = 0; Created < Threads - 1; Created++)
+    {
+        if(pthread_create(&Workers[Created], NULL, ConvertChunks, &Job) != 0)
+        {
+            /* Continue with threads started so far */
+            break;
+        }
+    }
+    ConvertChunks(&Job);
+
+    /* Wait for all workers to finish */
+    while(Created > 0)
+    {
+        pthread_join(Workers[--Created], NULL);
+    }
+    free(Workers);
+
+    /* Return result */
+    return Job.Error ? -1 : 0;
+}
+#endif
+
+/* Converts the input stream chunk by chunk into the output data */
+static int ConvertStream(FILE *InputFile, PBIN2C_WRITER Writer)
+{
+    unsigned char *InputBuffer;
+    size_t BytesRead;
+
+    /* Check if data should be compressed */
+    if(Writer->Compress)
+    {
+        /* Compress the input stream */
+        return CompressStream(InputFile, Writer);
+    }
+
+    /* Allocate fixed size input buffer */
+    InputBuffer = (unsigned char *)malloc(BIN2C_INPUT_CHUNK);
+    if(InputBuffer == NULL)
+    {
+        /* Memory allocation failed */
+        return -1;
+    }
+
+    /* Process the input file in fixed size chunks */
+    while((BytesRead = fread(InputBuffer, 1, BIN2C_INPUT_CHUNK, InputFile)) > 0)
+    {
+        WriteData(Writer, InputBuffer, BytesRead);
+    }
+
+    /* Check for read errors */
+    if(ferror(InputFile))
+    {
+        /* Failed to read input file */
+        free(InputBuffer);
+        return -1;
+    }
+
+    /* Free input buffer */
+    free(InputBuffer);
+    return 0;
+}
+
+#ifdef BIN2C_X86_KERNELS
+/* Formats input bytes using AVX2 instructions, 32 bytes at a time */
+__attribute__((target("avx2")))
+static char *EncodeAvx2(char *Output, const unsigned char *Input, size_t Length)
+{
+    const __m256i Digits = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                            '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
+                                            '0', '1', '2', '3', '4', '5', '6', '7',
+                                            '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+    const __m256i NibbleMask = _mm256_set1_epi8(0x0F);
+    const __m256i Zero = _mm256_setzero_si256();
+    __m256i Data;
+    __m256i High;
+    __m256i Low;
+    __m256i Pairs[2];
+    __m256i Pattern[5];
+    __m256i Result;
+    __m256i Shuffle[5];
+    __m256i Window[5];
+    int Block;
+
+    /* Load templates and shuffle masks into both lanes */
+    for(Block = 0; Block < 5; Block++)
+    {
+        Pattern[Block] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)VectorPattern[Block]));
+        Shuffle[Block] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)VectorShuffle[Block]));
+    }
+
+    /* Process 32 bytes at a time, every lane takes care of 16 of them */
+    while(Length >= 32)
+    {
+        /* Translate nibbles into hex digits */
+        Data = _mm256_loadu_si256((const __m256i *)Input);
+        High = _mm256_shuffle_epi8(Digits, _mm256_and_si256(_mm256_srli_epi16(Data, 4), NibbleMask));
+        Low = _mm256_shuffle_epi8(Digits, _mm256_and_si256(Data, NibbleMask));
+
+        /* Interleave digits, every lane holds 32 digits describing its 16 input bytes */
+        Pairs[0] = _mm256_unpacklo_epi8(High, Low);
+        Pairs[1] = _mm256_unpackhi_epi8(High, Low);
+
+        /* Slide a window over the digits for every output block */
+        Window[0] = Pairs[0];
+        Window[1] = _mm256_alignr_epi8(Pairs[1], Pairs[0], 6);
+        Window[2] = _mm256_alignr_epi8(Pairs[1], Pairs[0], 12);
+        Window[3] = _mm256_alignr_epi8(Zero, Pairs[1], 2);
+        Window[4] = _mm256_alignr_epi8(Zero, Pairs[1], 8);
+
+        /* Place the digits into the template and store both lanes */
+        for(Block = 0; Block < 5; Block++)
+        {
+            Result = _mm256_or_si256(_mm256_shuffle_epi8(Window[Block], Shuffle[Block]), Pattern[Block]);
+            _mm_storeu_si128((__m128i *)(Output + Block * 16), _mm256_castsi256_si128(Result));
+            _mm_storeu_si128((__m128i *)(Output + 80 + Block * 16), _mm256_extracti128_si256(Result, 1));
+        }
+
+        /* Advance to the next block */
+        Input += 32;
+        Output += 32 * BIN2C_BYTE_TEXT;
+        Length -= 32;
+    }
+
+    /* Format the remaining bytes */
+    return EncodeSse2(Output, Input, Length);
+}
+#endif
+
+#ifdef BIN2C_NEON_KERNEL
+/* Formats input bytes using NEON instructions, 16 bytes at a time */
+static char *EncodeNeon(char *Output, const unsigned char *Input, size_t Length)
+{
+    const uint8x16_t Digits = vld1q_u8((const uint8_t *)"0123456789ABCDEF");
+    const uint8x16_t NibbleMask = vdupq_n_u8(0x0F);
+    const uint8x16_t Zero = vdupq_n_u8(0);
+    uint8x16_t Data;
+    uint8x16_t High;
+    uint8x16_t Low;
+    uint8x16_t Pairs[2];
+    uint8x16_t Pattern[5];
+    uint8x16_t Shuffle[5];
+    uint8x16_t Window[5];
+    int Block;
+
+    /* Load templates and shuffle masks */
+    for(Block = 0; Block < 5; Block++)
+    {
+        Pattern[Block] = vld1q_u8(VectorPattern[Block]);
+        Shuffle[Block] = vld1q_u8(VectorShuffle[Block]);
+    }
+
+    /* Process 16 bytes at a time */
+    while(Length >= 16)
+    {
+        /* Translate nibbles into hex digits */
+        Data = vld1q_u8(Input);
+        High = vqtbl1q_u8(Digits, vshrq_n_u8(Data, 4));
+        Low = vqtbl1q_u8(Digits, vandq_u8(Data, NibbleMask));
+
+        /* Interleave digits */
+        Pairs[0] = vzip1q_u8(High, Low);
+        Pairs[1] = vzip2q_u8(High, Low);
+
+        /* Slide a window over the digits for every output block */
+        Window[0] = Pairs[0];
+        Window[1] = vextq_u8(Pairs[0], Pairs[1], 6);
+        Window[2] = vextq_u8(Pairs[0], Pairs[1], 12);
+        Window[3] = vextq_u8(Pairs[1], Zero, 2);
+        Window[4] = vextq_u8(Pairs[1], Zero, 8);
+
+        /* Place the digits into the template, out of range indices yield zero */
+        for(Block = 0; Block < 5; Block++)
+        {
+            vst1q_u8((uint8_t *)Output + Block * 16,
+                     vorrq_u8(vqtbl1q_u8(Window[Block], Shuffle[Block]), Pattern[Block]));
+        }
+
+        /* Advance to the next block */
+        Input += 16;
+        Output += 16 * BIN2C_BYTE_TEXT;
+        Length -= 16;
+    }
+
+    /* Format the remaining bytes */
+    return EncodeScalar(Output, Input, Length);
+}
+#endif
+
+/* Formats input bytes using the lookup table, serves as a reference for other kernels */
+static char *EncodeScalar(char *Output, const unsigned char *Input, size_t Length)
+{
+    size_t Index;
+
+    /* Format every byte using the lookup table */
+    for(Index = 0; Index < Length; Index++)
+    {
+        memcpy(Output, HexTable[Input[Index]], BIN2C_BYTE_TEXT);
+        Output += BIN2C_BYTE_TEXT;
+    }
+
+    /* Return the end of formatted text */
+    return Output;
+}
+
+#ifdef BIN2C_X86_KERNELS
+/* Formats input bytes using SSE2 instructions, 16 bytes at a time */
+__attribute__((target("sse2")))
+static char *EncodeSse2(char *Output, const unsigned char *Input, size_t Length)
+{
+    const __m128i Letter = _mm_set1_epi8('A' - '0' - 10);
+    const __m128i NibbleMask = _mm_set1_epi8(0x0F);
+    const __m128i Nine = _mm_set1_epi8(9);
+    const __m128i Zero = _mm_set1_epi8('0');
+    __m128i Data;
+    __m128i High;
+    __m128i Low;
+    __m128i Pattern[5];
+    uint16_t Pairs[16];
+    int Block;
+    int Index;
+
+    /* Load output templates */
+    for(Block = 0; Block < 5; Block++)
+    {
+        Pattern[Block] = _mm_loadu_si128((const __m128i *)VectorPattern[Block]);
+    }
+
+    /* Process 16 bytes at a time */
+    while(Length >= 16)
+    {
+        /* Split bytes into nibbles */
+        Data = _mm_loadu_si128((const __m128i *)Input);
+        High = _mm_and_si128(_mm_srli_epi16(Data, 4), NibbleMask);
+        Low = _mm_and_si128(Data, NibbleMask);
+
+        /* Translate nibbles into hex digits */
+        High = _mm_add_epi8(_mm_add_epi8(High, Zero), _mm_and_si128(_mm_cmpgt_epi8(High, Nine), Letter));
+        Low = _mm_add_epi8(_mm_add_epi8(Low, Zero), _mm_and_si128(_mm_cmpgt_epi8(Low, Nine), Letter));
+
+        /* Interleave digits into pairs */
+        _mm_storeu_si128((__m128i *)&Pairs[0], _mm_unpacklo_epi8(High, Low));
+        _mm_storeu_si128((__m128i *)&Pairs[8], _mm_unpackhi_epi8(High, Low));
+
+        /* Store the template and fill in the digits */
+        for(Block = 0; Block < 5; Block++)
+        {
+            _mm_storeu_si128((__m128i *)(Output + Block * 16), Pattern[Block]);
+        }
+        for(Index = 0; Index < 16; Index++)
+        {
+            memcpy(Output + Index * BIN2C_BYTE_TEXT + 3, &Pairs[Index], sizeof(uint16_t));
+        }
+
+        /* Advance to the next block */
+        Input += 16;
+        Output += 16 * BIN2C_BYTE_TEXT;
+        Length -= 16;
+    }
+
+    /* Format the remaining bytes */
+    return EncodeScalar(Output, Input, Length);
+}
+#endif
+
+/* Writes out the contents of the output buffer */
+static void FlushWriter(PBIN2C_WRITER Writer)
+{
+    /* Write buffered text to the output file */
+    if(Writer->Length > 0 && fwrite(Writer->Buffer, 1, Writer->Length, Writer->File) != Writer->Length)
+    {
+        /* Failed to write output file */
+        Writer->Error = 1;
+    }
+
+    /* Reset the buffer */
+    Writer->Length = 0;
+}
+
+/* Translates architecture name into its identifier */
+static int GetArchitecture(const char *Name)
+{
+    if((strcasecmp(Name, "i386") == 0) || (strcasecmp(Name, "i686") == 0))
+    {
+        return ARCH_X86;
+    }
+    else if((strcasecmp(Name, "x86_64") == 0) || (strcasecmp(Name, "amd64") == 0))
+    {
+        return ARCH_AMD64;
+    }
+    else if((strcasecmp(Name, "arm") == 0) || (strcasecmp(Name, "armv7") == 0))
+    {
+        return ARCH_ARM;
+    }
+    else if((strcasecmp(Name, "aarch64") == 0) || (strcasecmp(Name, "arm64") == 0))
+    {
+        return ARCH_ARM64;
+    }
+
+    /* Unknown architecture */
+    return ARCH_UNKNOWN;
+}
+
+/* Looks up the output format by its name */
+static int GetFormat(const char *Name)
+{
+    int Index;
+
+    /* Find format */
+    for(Index = 0; Index < (int)(sizeof(Formats) / sizeof(BIN2C_FORMAT)); Index++)
+    {
+        if(strcasecmp(Formats[Index].Name, Name) == 0)
+        {
+            /* Format found, return its ID */
+            return Formats[Index].Identifier;
+        }
+    }
+
+    /* No valid format found */
+    return -1;
+}
+
+/* Resolves absolute path to the input file, using forward slashes as separators */
+static char *GetFullPath(const char *FileName)
+{
+    char *Path;
+    char *Separator;
+
+    /* Resolve absolute path */
+#ifdef _WIN32
+    Path = _fullpath(NULL, FileName, 0);
+#else
+    Path = realpath(FileName, NULL);
+#endif
+    if(Path == NULL)
+    {
+        /* Unable to resolve path */
+        return NULL;
+    }
+
+    /* Forward slashes are understood by both the assembler and the preprocessor */
+    for(Separator = Path; *Separator; Separator++)
+    {
+        if(*Separator == '\\')
+        {
+            *Separator = '/';
+        }
+    }
+
+    /* Return resolved path */
+    return Path;
+}
+
+/* Gets the size of the input file */
+static int GetInputSize(const char *FileName, uint64_t *Size)
+{
+#ifdef _WIN32
+    struct _stati64 Stat;
+
+    /* Stat the file */
+    if(_stati64(FileName, &Stat) != 0)
+#else
+    struct stat Stat;
+
+    /* Stat the file */
+    if(stat(FileName, &Stat) != 0)
+#endif
+    {
+        /* Failed to stat file */
+        return -1;
+    }
+
+    /* Return file size */
+    *Size = (uint64_t)Stat.st_size;
+    return 0;
+}
+
+#ifdef BIN2C_PARALLEL
+/* Gets the number of online processors */
+static int GetProcessorCount(void)
+{
+    long Count;
+
+    /* Query the system */
+    Count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (Count > 0) ? (int)Count : 1;
+}
+#endif
+
+/* Gets the base 2 logarithm of a power of two */
+static int GetShift(uint64_t Value)
+{
+    int Shift = 0;
+
+    /* Count trailing zero bits */
+    while(Value > 1)
+    {
+        Value >>= 1;
+        Shift++;
+    }
+
+    /* Return the shift */
+    return Shift;
+}
+
+/* Builds name of the temporary file written next to the given file */
+static char *GetTempName(const char *FileName)
+{
+    char *TempName;
+    size_t Length;
+
+    /* Allocate memory for the name */
+    Length = strlen(FileName) + 32;
+    TempName = (char *)malloc(Length);
+    if(TempName == NULL)
+    {
+        /* Memory allocation failed */
+        return NULL;
+    }
+
+    /* Keep the temporary file in the same directory, so that it can be renamed atomically */
+    snprintf(TempName, Length, "%s.%ld.tmp", FileName, (long)getpid());
+    return TempName;
+}
+
+/* Precomputes the textual representation of every byte value */
+static void InitializeHexTable(void)
+{
+    static const char Digits[] = "0123456789ABCDEF";
+    int Block;
+    int Index;
+    int Position;
+
+    /* Fill in the lookup table */
+    for(Index = 0; Index < 256; Index++)
+    {
+        HexTable[Index][0] = ',';
+        HexTable[Index][1] = '0';
+        HexTable[Index][2] = 'x';
+        HexTable[Index][3] = Digits[Index >> 4];
+        HexTable[Index][4] = Digits[Index & 0x0F];
+    }
+
+    /* Build templates and shuffle masks for vector kernels */
+    for(Block = 0; Block < 5; Block++)
+    {
+        for(Index = 0; Index < 16; Index++)
+        {
+            /* Get position within the text of a single byte */
+            Position = (Block * 16 + Index) % BIN2C_BYTE_TEXT;
+            if(Position < 3)
+            {
+                /* Constant character, shuffle index with the top bit set yields zero */
+                VectorPattern[Block][Index] = HexTable[0][Position];
+                VectorShuffle[Block][Index] = 0x80;
+            }
+            else
+            {
+                /* Hex digit, index it relative to the first byte touched by this block */
+                VectorPattern[Block][Index] = 0;
+                VectorShuffle[Block][Index] = 2 * ((Block * 16 + Index) / BIN2C_BYTE_TEXT - (Block * 16) / BIN2C_BYTE_TEXT) +
+                                              Position - 3;
+            }
+        }
+    }
+}
+
+#ifdef BIN2C_X86_KERNELS
+/* Checks whether the CPU supports AVX2 instructions */
+static int IsAvx2Supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/* Checks whether the CPU supports SSE2 instructions */
+static int IsSse2Supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+#endif
+
+/* Checks whether the name is a valid C identifier */
+static int IsIdentifier(const char *Name)
+{
+    /* Identifiers cannot be empty or start with a digit */
+    if(*Name == '\0' || (*Name >= '0' && *Name <= '9'))
+    {
+        return 0;
+    }
+
+    /* Check all characters */
+    while(*Name)
+    {
+        if(!isalnum((unsigned char)*Name) && *Name != '_')
+        {
+            /* Invalid character found */
+            return 0;
+        }
+        Name++;
+    }
+
+    /* Valid identifier */
+    return 1;
+}
+
+/* Adds all input files listed in the response file, one per line */
+static int LoadResponseFile(PBIN2C_INPUT_LIST List, const char *FileName)
+{
+    FILE *File;
+    char Line[4096];
+    size_t Length;
+
+    /* Open the response file */
+    File = fopen(FileName, "r");
+    if(File == NULL)
+    {
+        printf("Error: unable to open file %s\n", FileName);
+        return -1;
+    }
+
+    /* Read all lines */
+    while(fgets(Line, sizeof(Line), File))
+    {
+        /* Strip the line ending */
+        Length = strlen(Line);
+        while(Length > 0 && (Line[Length - 1] == '\n' || Line[Length - 1] == '\r'))
+        {
+            Line[--Length] = '\0';
+        }
+
+        /* Skip empty lines */
+        if(Length == 0)
+        {
+            continue;
+        }
+
+        /* Add input file */
+        if(AddInput(List, Line) != 0)
+        {
+            fclose(File);
+            return -1;
+        }
+    }
+
+    /* Close the response file */
+    fclose(File);
+    return 0;
+}
+
+/* Stores a 16-bit little-endian value and advances the buffer pointer */
+static uint8_t *PutUint16(uint8_t *Buffer, uint16_t Value)
+{
+    Buffer[0] = (uint8_t)Value;
+    Buffer[1] = (uint8_t)(Value >> 8);
+    return Buffer + 2;
+}
+
+/* Stores a 32-bit little-endian value and advances the buffer pointer */
+static uint8_t *PutUint32(uint8_t *Buffer, uint32_t Value)
+{
+    Buffer = PutUint16(Buffer, (uint16_t)Value);
+    return PutUint16(Buffer, (uint16_t)(Value >> 16));
+}
+
+/* Stores a 64-bit little-endian value and advances the buffer pointer */
+static uint8_t *PutUint64(uint8_t *Buffer, uint64_t Value)
+{
+    Buffer = PutUint32(Buffer, (uint32_t)Value);
+    return PutUint32(Buffer, (uint32_t)(Value >> 32));
+}
+
+/* Moves the temporary file over the given file unless their contents are identical */
+static int ReplaceOutput(const char *TempName, const char *FileName)
+{
+    /* Leave the existing file and its modification time intact when nothing has changed */
+    if(CompareFiles(TempName, FileName) == 0)
+    {
+        remove(TempName);
+        return 1;
+    }
+
+    /* Replace the file atomically */
+#ifdef _WIN32
+    if(!MoveFileExA(TempName, FileName, MOVEFILE_REPLACE_EXISTING))
+#else
+    if(rename(TempName, FileName) != 0)
+#endif
+    {
+        /* Unable to replace the file */
+        printf("Error: unable to write file %s\n", FileName);
+        remove(TempName);
+        return -1;
+    }
+
+    /* File has been replaced */
+    return 0;
+}
+
+/* Builds the emitted decompressor together with the test program and runs it over the records in the file */
+static int RunDecompressorTest(const char *VectorName, double *Times, int Count)
+{
+    const char *Compiler;
+    char Command[3 * (4096 + 8)];
+    char ProgramName[4096 + 8];
+    char SourceName[4096 + 8];
+    char Line[64];
+    FILE *File;
+    FILE *Pipe;
+    int Index;
+    int Result = 0;
+
+    /* Write the decompressor with the test program */
+    snprintf(SourceName, sizeof(SourceName), "%s.c", VectorName);
+    snprintf(ProgramName, sizeof(ProgramName), "%s.exe", VectorName);
+    File = fopen(SourceName, "w");
+    if(File == NULL)
+    {
+        printf("Error: unable to create file %s\n", SourceName);
+        return -1;
+    }
+    fprintf(File, DecompressorSource, BIN2C_COMPRESS_BLOCK, BIN2C_COMPRESS_BLOCK);
+    fputs(DecompressorTestSource, File);
+    if(fclose(File) != 0)
+    {
+        printf("Error: unable to write file %s\n", SourceName);
+        remove(SourceName);
+        return -1;
+    }
+
+    /* Build the test program */
+    Compiler = getenv("CC");
+    Compiler = (Compiler && *Compiler) ? Compiler : BIN2C_COMPILER;
+    snprintf(Command, sizeof(Command), BIN2C_COMMAND_QUOTE "%s -O2 -o \"%s\" \"%s\"" BIN2C_COMMAND_QUOTE,
+             Compiler, ProgramName, SourceName);
+    fflush(stdout);
+    if(system(Command) != 0)
+    {
+        printf("Error: unable to build the decompressor with %s, set CC to a working C compiler\n", Compiler);
+        remove(SourceName);
+        remove(ProgramName);
+        return -1;
+    }
+
+    /* Run it and collect decompression times of the timed records */
+    snprintf(Command, sizeof(Command), BIN2C_COMMAND_QUOTE "\"%s\" \"%s\"" BIN2C_COMMAND_QUOTE, ProgramName,
+             VectorName);
+    Pipe = popen(Command, "r");
+    for(Index = 0; Index < Count; Index++)
+    {
+        Times[Index] = (Pipe && fgets(Line, sizeof(Line), Pipe)) ? strtod(Line, NULL) : -1;
+        Result = (Times[Index] < 0) ? -1 : Result;
+    }
+    if(Pipe == NULL || pclose(Pipe) != 0 || Result != 0)
+    {
+        printf("Error: the emitted decompressor failed the round trip\n");
+        Result = -1;
+    }
+
+    /* Remove the test program */
+    remove(SourceName);
+    remove(ProgramName);
+    return Result;
+}
+
+/* Selects the fastest kernel supported by the CPU */
+static PBIN2C_KERNEL SelectKernel(void)
+{
+    int Index;
+
+    /* Walk the kernels list from the fastest one */
+    for(Index = sizeof(Kernels) / sizeof(BIN2C_KERNEL) - 1; Index > 0; Index--)
+    {
+        if(!Kernels[Index].IsSupported || Kernels[Index].IsSupported())
+        {
+            /* Kernel supported */
+            return &Kernels[Index];
+        }
+    }
+
+    /* Fall back to the scalar kernel */
+    return &Kernels[0];
+}
+
+/* Prints usage information */
+static void Usage(const char *ExecName)
+{
+    printf("Usage: %s [<options> ...] <input binary> <output file> <structure name>\n"
+           "       %s [<options> ...] --batch <output file> <index name> <input binary>[=<name>] ... @<list file> ...\n"
+           "       %s --decompressor=<file>\n"
+           "       %s --benchmark\n\n"
+           "Possible options:\n"
+           "  --align=<bytes>         align the data to a power of two, up to page size (4096)\n"
+           "  --arch=<arch>           set object file architecture to one of: aarch64, armv7, i686, x86_64\n"
+           "  --format=<format>       output format, one of:\n"
+           "                            c      C array (default)\n"
+           "                            asm    assembly source using .incbin, needs preprocessing (.S)\n"
+           "                            embed  C23 source using #embed\n"
+           "                            coff   COFF object file for the target architecture\n"
+           "                            elf    ELF object file, for the host unless specified otherwise\n"
+           "  --batch                 convert many files into a single source with a sorted index,\n"
+           "                          list files hold one <input binary>[=<name>] per line\n"
+           "  --compress              compress data in LZ4 block format, supported by c, coff and elf formats\n"
+           "  --const                 declare data read-only, object files are always read-only\n"
+           "  --decompressor=<file>   write freestanding C source of the decompressor for compressed data\n"
+           "  --depfile=<file>        write Makefile style dependency file listing all input files\n"
+           "  --section=<name>        place the data in the named section\n"
+           "  --threads=<count>       number of threads formatting large C arrays, defaults to processor count\n"
+           "  --word=<bits>           emit C array of 8, 16, 32 or 64-bit little-endian words,\n"
+           "                          <structure name>_size still holds the size in bytes\n"
+           "  --benchmark             verify and measure hex encoding kernels, parallel conversion and compression,\n"
+           "                          compressed data is checked with the emitted decompressor,\n"
+           "                          built by the C compiler given in CC\n",
+           ExecName, ExecName, ExecName, ExecName);
+}
+
+/* Writes assembly source pulling the input file with .incbin */
+static int WriteAsmAsset(PBIN2C_WRITER Writer, const char *InputName, const char *Name)
+{
+    char *Path;
+    uint64_t Size;
+
+    /* Get input file size and its absolute path */
+    Path = GetFullPath(InputName);
+    if(Path == NULL || GetInputSize(InputName, &Size) != 0)
+    {
+        printf("Error: unable to open file %s\n", InputName);
+        free(Path);
+        return -1;
+    }
+
+    /* Select the section, read-only and named sections are declared with flags of the object format */
+    if(Writer->Const || Writer->Section)
+    {
+        WriteFormatted(Writer,
+                       "#ifdef __ELF__\n"
+                       "    .section %s,\"a%s\",%%progbits\n"
+                       "#else\n"
+                       "    .section %s,\"d%s\"\n"
+                       "#endif\n",
+                       Writer->Section ? Writer->Section : ".rodata", Writer->Const ? "" : "w",
+                       Writer->Section ? Writer->Section : ".rdata", Writer->Const ? "r" : "w");
+    }
+    else
+    {
+        WriteFormatted(Writer, "    .data\n");
+    }
+
+    /* Align the data if requested */
+    if(Writer->Alignment)
+    {
+        WriteFormatted(Writer, "    .p2align %d\n", GetShift(Writer->Alignment));
+    }
+
+    /* Write the data */
+    WriteFormatted(Writer,
+                   "    .globl BIN2C_SYMBOL(%s)\n"
+                   "BIN2C_SYMBOL(%s):\n"
+                   "    .incbin \"%s\"\n"
+                   "1:\n\n",
+                   Name, Name, Path);
+
+    /* Write the size, use 64-bit size only when needed */
+    WriteFormatted(Writer,
+                   "    .globl BIN2C_SYMBOL(%s_size)\n"
+                   "    .p2align %d\n"
+                   "BIN2C_SYMBOL(%s_size):\n"
+                   "    %s 1b - BIN2C_SYMBOL(%s)\n\n",
+                   Name, Size > UINT32_MAX ? 3 : 2, Name, Size > UINT32_MAX ? ".quad" : ".long", Name);
+
+    /* Free resolved path */
+    free(Path);
+    Writer->DataSize = Size;
+    return 0;
+}
+
+/* Writes a COFF object file with the input file placed in a read-only section */
+static int WriteCoffObject(PBIN2C_WRITER Writer, const char *InputName, const char *Name, int Architecture)
+{
+    FILE *InputFile;
+    uint8_t Header[60] = {0};
+    uint8_t Symbol[18];
+    uint8_t *Cursor;
+    const char *Prefix;
+    const char *SectionName;
+    char LongName[9];
+    uint64_t Alignment;
+    uint32_t NumberOfSymbols;
+    uint32_t StringTableSize;
+    uint32_t SymbolTableOffset;
+    uint32_t SizeOffset;
+    uint16_t Machine;
+    size_t NameLength;
+    size_t SectionNameLength;
+
+    /* Get machine type and symbol decoration */
+    Prefix = "";
+    switch(Architecture)
+    {
+        case ARCH_X86:
+            Machine = IMAGE_FILE_MACHINE_I386;
+            Prefix = "_";
+            break;
+        case ARCH_AMD64:
+            Machine = IMAGE_FILE_MACHINE_AMD64;
+            break;
+        case ARCH_ARM:
+            Machine = IMAGE_FILE_MACHINE_ARMNT;
+            break;
+        default:
+            Machine = IMAGE_FILE_MACHINE_ARM64;
+            break;
+    }
+
+    /* Get section name and alignment, section names longer than 8 characters are kept in the string table */
+    NameLength = strlen(Prefix) + strlen(Name);
+    SectionName = Writer->Section ? Writer->Section : ".rdata";
+    SectionNameLength = strlen(SectionName);
+    StringTableSize = (uint32_t)(4 + (NameLength + 1) + (NameLength + sizeof("_size")));
+    if(SectionNameLength > 8)
+    {
+        snprintf(LongName, sizeof(LongName), "/%u", StringTableSize);
+    }
+    Alignment = Writer->Alignment ? Writer->Alignment : BIN2C_OBJECT_ALIGNMENT;
+
+    /* Open the input binary file in binary mode */
+    InputFile = fopen(InputName, "rb");
+    if(InputFile == NULL)
+    {
+        printf("Error: unable to open file %s\n", InputName);
+        return -1;
+    }
+
+    /* Reserve space for file and section headers, they are written once sizes are known */
+    WriteText(Writer, (const char *)Header, sizeof(Header));
+
+    /* Copy the binary data */
+    Writer->Raw = 1;
+    if(ConvertStream(InputFile, Writer) != 0)
+    {
+        printf("Error: unable to read file %s\n", InputName);
+        fclose(InputFile);
+        return -1;
+    }
+    fclose(InputFile);
+
+    /* COFF sections are limited to 4GB */
+    if(Writer->DataSize > UINT32_MAX - 8)
+    {
+        printf("Error: file %s is too large for a COFF object\n", InputName);
+        return -1;
+    }
+
+    /* Append the size right after the aligned data */
+    WritePadding(Writer, sizeof(uint32_t));
+    SizeOffset = (uint32_t)(Writer->Offset - sizeof(Header));
+    PutUint32(Symbol, (uint32_t)Writer->DataSize);
+    WriteText(Writer, (const char *)Symbol, sizeof(uint32_t));
+    SymbolTableOffset = sizeof(Header) + SizeOffset + sizeof(uint32_t);
+
+    /* Section symbol with its auxiliary section definition record */
+    memset(Symbol, 0, sizeof(Symbol));
+    if(SectionNameLength > 8)
+    {
+        PutUint32(Symbol + 4, StringTableSize);
+    }
+    else
+    {
+        memcpy(Symbol, SectionName, SectionNameLength);
+    }
+    Cursor = PutUint32(Symbol + 8, 0);
+    Cursor = PutUint16(Cursor, 1);
+    Cursor = PutUint16(Cursor, 0);
+    *Cursor++ = IMAGE_SYM_CLASS_STATIC;
+    *Cursor++ = 1;
+    WriteText(Writer, (const char *)Symbol, sizeof(Symbol));
+    memset(Symbol, 0, sizeof(Symbol));
+    PutUint32(Symbol, SizeOffset + sizeof(uint32_t));
+    WriteText(Writer, (const char *)Symbol, sizeof(Symbol));
+    NumberOfSymbols = 2;
+
+    /* Mark the object as SAFESEH compatible on i386 */
+    if(Architecture == ARCH_X86)
+    {
+        memset(Symbol, 0, sizeof(Symbol));
+        memcpy(Symbol, "@feat.00", 8);
+        Cursor = PutUint32(Symbol + 8, 1);
+        Cursor = PutUint16(Cursor, 0xFFFF);
+        Cursor = PutUint16(Cursor, 0);
+        *Cursor++ = IMAGE_SYM_CLASS_STATIC;
+        *Cursor++ = 0;
+        WriteText(Writer, (const char *)Symbol, sizeof(Symbol));
+        NumberOfSymbols++;
+    }
+
+    /* Public symbols, names are kept in the string table */
+    memset(Symbol, 0, sizeof(Symbol));
+    Cursor = PutUint32(Symbol + 4, 4);
+    Cursor = PutUint32(Cursor, 0);
+    Cursor = PutUint16(Cursor, 1);
+    Cursor = PutUint16(Cursor, 0);
+    *Cursor++ = IMAGE_SYM_CLASS_EXTERNAL;
+    WriteText(Writer, (const char *)Symbol, sizeof(Symbol));
+    Cursor = PutUint32(Symbol + 4, (uint32_t)(4 + NameLength + 1));
+    Cursor = PutUint32(Cursor, SizeOffset);
+    WriteText(Writer, (const char *)Symbol, sizeof(Symbol));
+    NumberOfSymbols += 2;
+
+    /* String table */
+    PutUint32(Symbol, StringTableSize + (uint32_t)((SectionNameLength > 8) ? SectionNameLength + 1 : 0));
+    WriteText(Writer, (const char *)Symbol, sizeof(uint32_t));
+    WriteText(Writer, Prefix, strlen(Prefix));
+    WriteText(Writer, Name, strlen(Name) + 1);
+    WriteText(Writer, Prefix, strlen(Prefix));
+    WriteText(Writer, Name, strlen(Name));
+    WriteText(Writer, "_size", sizeof("_size"));
+    if(SectionNameLength > 8)
+    {
+        WriteText(Writer, SectionName, SectionNameLength + 1);
+    }
+
+    /* File header */
+    Cursor = PutUint16(Header, Machine);
+    Cursor = PutUint16(Cursor, 1);
+    Cursor = PutUint32(Cursor, 0);
+    Cursor = PutUint32(Cursor, SymbolTableOffset);
+    Cursor = PutUint32(Cursor, NumberOfSymbols);
+    Cursor = PutUint16(Cursor, 0);
+    Cursor = PutUint16(Cursor, 0);
+
+    /* Section header */
+    if(SectionNameLength > 8)
+    {
+        memcpy(Cursor, LongName, strlen(LongName));
+    }
+    else
+    {
+        memcpy(Cursor, SectionName, SectionNameLength);
+    }
+    Cursor = PutUint32(Cursor + 8, 0);
+    Cursor = PutUint32(Cursor, 0);
+    Cursor = PutUint32(Cursor, SizeOffset + sizeof(uint32_t));
+    Cursor = PutUint32(Cursor, sizeof(Header));
+    Cursor = PutUint32(Cursor, 0);
+    Cursor = PutUint32(Cursor, 0);
+    Cursor = PutUint16(Cursor, 0);
+    Cursor = PutUint16(Cursor, 0);
+    PutUint32(Cursor, IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_ALIGN_1BYTES * (GetShift(Alignment) + 1) |
+                      IMAGE_SCN_MEM_READ);
+
+    /* Write the headers at the beginning of the file */
+    WriteHeader(Writer, Header, sizeof(Header));
+    return 0;
+}
+
+/* Writes C source with the input file converted into an array */
+static int WriteCAsset(PBIN2C_WRITER Writer, const char *InputName, const char *Name)
+{
+    FILE *InputFile;
+#ifdef BIN2C_PARALLEL
+    uint64_t Size;
+#endif
+
+    /* Open the input binary file in binary mode */
+    InputFile = fopen(InputName, "rb");
+    if(InputFile == NULL)
+    {
+        printf("Error: unable to open file %s\n", InputName);
+        return -1;
+    }
+
+    /* Write the C structure header, element type depends on the word size */
+    switch(Writer->WordSize)
+    {
+        case 2:
+            WriteCDeclaration(Writer, "unsigned short", Name);
+            break;
+        case 4:
+            WriteCDeclaration(Writer, "unsigned int", Name);
+            break;
+        case 8:
+            WriteCDeclaration(Writer, "unsigned long long", Name);
+            break;
+        default:
+            WriteCDeclaration(Writer, "unsigned char", Name);
+            break;
+    }
+    Writer->DataSize = 0;
+
+#ifdef BIN2C_PARALLEL
+    /* Convert large files in parallel, every byte takes the same space so chunks can be written independently */
+    if(!Writer->Compress && Writer->WordSize <= 1 && Writer->Threads != 1 &&
+       GetInputSize(InputName, &Size) == 0 && Size >= BIN2C_PARALLEL_MINIMUM)
+    {
+        if(ConvertMapped(InputName, Writer) != 0)
+        {
+            printf("Error: unable to convert file %s\n", InputName);
+            fclose(InputFile);
+            return -1;
+        }
+    }
+    else
+#endif
+    /* Convert the binary data chunk by chunk */
+    if(ConvertStream(InputFile, Writer) != 0)
+    {
+        printf("Error: unable to read file %s\n", InputName);
+        fclose(InputFile);
+        return -1;
+    }
+
+    /* Write out the last, partially filled word */
+    if(Writer->WordSize > 1)
+    {
+        WriteWords(Writer, NULL, 0, 1);
+    }
+
+    /* Write the C structure trailer, use 64-bit size only when needed */
+    if(Writer->DataSize > UINT32_MAX)
+    {
+        WriteFormatted(Writer, "};\n%sunsigned long long %s_size = %" PRIu64 "ULL;\n",
+                       Writer->Const ? "const " : "", Name, Writer->DataSize);
+    }
+    else
+    {
+        WriteFormatted(Writer, "};\n%sunsigned int %s_size = %" PRIu64 ";\n",
+                       Writer->Const ? "const " : "", Name, Writer->DataSize);
+    }
+
+    /* Compressed data comes with its original size as well */
+    if(Writer->Compress)
+    {
+        WriteFormatted(Writer, "%sunsigned long long %s_uncompressed_size = %" PRIu64 "ULL;\n",
+                       Writer->Const ? "const " : "", Name, Writer->InputSize);
+    }
+
+    /* Close the input file */
+    fclose(InputFile);
+    return 0;
+}
+
+/* Writes declaration of the C array along with the requested alignment and section */
+static void WriteCDeclaration(PBIN2C_WRITER Writer, const char *Type, const char *Name)
+{
+    /* Write the type and the name */
+    WriteFormatted(Writer, "%s%s %s[]", Writer->Const ? "const " : "", Type, Name);
+
+    /* Write the attributes */
+    if(Writer->Alignment && Writer->Section)
+    {
+        WriteFormatted(Writer, " __attribute__((aligned(%" PRIu64 "), section(\"%s\")))",
+                       Writer->Alignment, Writer->Section);
+    }
+    else if(Writer->Alignment)
+    {
+        WriteFormatted(Writer, " __attribute__((aligned(%" PRIu64 ")))", Writer->Alignment);
+    }
+    else if(Writer->Section)
+    {
+        WriteFormatted(Writer, " __attribute__((section(\"%s\")))", Writer->Section);
+    }
+
+    /* Open the initializer */
+    WriteText(Writer, " = {", 4);
+}
+
+/* Writes C23 source pulling the input file with #embed */
+static int WriteEmbedAsset(PBIN2C_WRITER Writer, const char *InputName, const char *Name)
+{
+    char *Path;
+    uint64_t Size;
+
+    /* Get input file size and its absolute path */
+    Path = GetFullPath(InputName);
+    if(Path == NULL || GetInputSize(InputName, &Size) != 0)
+    {
+        printf("Error: unable to open file %s\n", InputName);
+        free(Path);
+        return -1;
+    }
+
+    /* Write the C structure, use 64-bit size only when needed */
+    WriteCDeclaration(Writer, "unsigned char", Name);
+    WriteFormatted(Writer,
+                   "\n"
+                   "#embed \"%s\"\n"
+                   "};\n"
+                   "%sunsigned %s %s_size = sizeof(%s);\n",
+                   Path, Writer->Const ? "const " : "", Size > UINT32_MAX ? "long long" : "int", Name, Name);
+
+    /* Free resolved path */
+    free(Path);
+    Writer->DataSize = Size;
+    return 0;
+}
+
+/* Writes an ELF relocatable object file with the input file placed in a read-only section */
+static int WriteElfObject(PBIN2C_WRITER Writer, const char *InputName, const char *Name, int Architecture)
+{
+    static const char SectionNames[] = "\0.note.GNU-stack\0.symtab\0.strtab\0.shstrtab";
+    static const uint32_t SectionNameOffsets[6] = {0, 0, 1, 17, 25, 33};
+    static const uint32_t SectionTypes[6] = {0, SHT_PROGBITS, SHT_PROGBITS, SHT_SYMTAB, SHT_STRTAB, SHT_STRTAB};
+    FILE *InputFile;
+    uint8_t Header[64] = {0};
+    uint8_t Record[64];
+    uint8_t *Cursor;
+    const char *SectionName;
+    uint64_t Alignment;
+    uint64_t DataAlignment;
+    uint64_t SectionHeadersOffset;
+    uint64_t SectionOffset[6] = {0};
+    uint64_t SectionSize[6] = {0};
+    uint64_t SizeOffset;
+    uint32_t Flags = 0;
+    uint16_t Machine;
+    size_t AddressSize;
+    size_t HeaderSize;
+    size_t Index;
+    size_t NameLength;
+    size_t SectionHeaderSize;
+    size_t SectionNameLength;
+    size_t SymbolSize;
+    int Elf64;
+
+    /* Get machine type and ELF class */
+    switch(Architecture)
+    {
+        case ARCH_X86:
+            Machine = EM_386;
+            Elf64 = 0;
+            break;
+        case ARCH_AMD64:
+            Machine = EM_X86_64;
+            Elf64 = 1;
+            break;
+        case ARCH_ARM:
+            Machine = EM_ARM;
+            Flags = EF_ARM_EABI_VER5;
+            Elf64 = 0;
+            break;
+        default:
+            Machine = EM_AARCH64;
+            Elf64 = 1;
+            break;
+    }
+
+    /* Get sizes of ELF structures */
+    AddressSize = Elf64 ? 8 : 4;
+    HeaderSize = Elf64 ? 64 : 52;
+    SectionHeaderSize = Elf64 ? 64 : 40;
+    SymbolSize = Elf64 ? 24 : 16;
+
+    /* Get data section name and alignment */
+    SectionName = Writer->Section ? Writer->Section : ".rodata";
+    SectionNameLength = strlen(SectionName);
+    DataAlignment = Writer->Alignment ? Writer->Alignment : BIN2C_OBJECT_ALIGNMENT;
+
+    /* Open the input binary file in binary mode */
+    InputFile = fopen(InputName, "rb");
+    if(InputFile == NULL)
+    {
+        printf("Error: unable to open file %s\n", InputName);
+        return -1;
+    }
+
+    /* Reserve space for the file header, it is written once sizes are known */
+    WriteText(Writer, (const char *)Header, HeaderSize);
+    WritePadding(Writer, DataAlignment);
+    SectionOffset[1] = Writer->Offset;
+
+    /* Copy the binary data */
+    Writer->Raw = 1;
+    if(ConvertStream(InputFile, Writer) != 0)
+    {
+        printf("Error: unable to read file %s\n", InputName);
+        fclose(InputFile);
+        return -1;
+    }
+    fclose(InputFile);
+
+    /* ELF32 sections are limited to 4GB */
+    if(!Elf64 && Writer->DataSize > UINT32_MAX - 8)
+    {
+        printf("Error: file %s is too large for an ELF32 object\n", InputName);
+        return -1;
+    }
+
+    /* Append the size right after the aligned data, use 64-bit size only when needed */
+    NameLength = strlen(Name);
+    if(Writer->DataSize > UINT32_MAX)
+    {
+        WritePadding(Writer, sizeof(uint64_t));
+        SizeOffset = Writer->Offset - SectionOffset[1];
+        PutUint64(Record, Writer->DataSize);
+        WriteText(Writer, (const char *)Record, sizeof(uint64_t));
+    }
+    else
+    {
+        WritePadding(Writer, sizeof(uint32_t));
+        SizeOffset = Writer->Offset - SectionOffset[1];
+        PutUint32(Record, (uint32_t)Writer->DataSize);
+        WriteText(Writer, (const char *)Record, sizeof(uint32_t));
+    }
+    SectionSize[1] = Writer->Offset - SectionOffset[1];
+
+    /* Empty non-executable stack marker */
+    SectionOffset[2] = Writer->Offset;
+
+    /* Symbol table with null symbol followed by public symbols */
+    WritePadding(Writer, AddressSize);
+    SectionOffset[3] = Writer->Offset;
+    memset(Record, 0, SymbolSize);
+    WriteText(Writer, (const char *)Record, SymbolSize);
+    for(Index = 0; Index < 2; Index++)
+    {
+        Cursor = PutUint32(Record, (uint32_t)(Index ? NameLength + 2 : 1));
+        if(Elf64)
+        {
+            *Cursor++ = (STB_GLOBAL << 4) | STT_OBJECT;
+            *Cursor++ = 0;
+            Cursor = PutUint16(Cursor, 1);
+            Cursor = PutUint64(Cursor, Index ? SizeOffset : 0);
+            PutUint64(Cursor, Index ? SectionSize[1] - SizeOffset : Writer->DataSize);
+        }
+        else
+        {
+            Cursor = PutUint32(Cursor, (uint32_t)(Index ? SizeOffset : 0));
+            Cursor = PutUint32(Cursor, (uint32_t)(Index ? SectionSize[1] - SizeOffset : Writer->DataSize));
+            *Cursor++ = (STB_GLOBAL << 4) | STT_OBJECT;
+            *Cursor++ = 0;
+            PutUint16(Cursor, 1);
+        }
+        WriteText(Writer, (const char *)Record, SymbolSize);
+    }
+    SectionSize[3] = Writer->Offset - SectionOffset[3];
+
+    /* Symbol names */
+    SectionOffset[4] = Writer->Offset;
+    WriteText(Writer, "", 1);
+    WriteText(Writer, Name, NameLength + 1);
+    WriteText(Writer, Name, NameLength);
+    WriteText(Writer, "_size", sizeof("_size"));
+    SectionSize[4] = Writer->Offset - SectionOffset[4];
+
+    /* Section names, starting with the data section name */
+    SectionOffset[5] = Writer->Offset;
+    WriteText(Writer, "", 1);
+    WriteText(Writer, SectionName, SectionNameLength);
+    WriteText(Writer, SectionNames, sizeof(SectionNames));
+    SectionSize[5] = Writer->Offset - SectionOffset[5];
+
+    /* Section headers, starting with the null one */
+    WritePadding(Writer, AddressSize);
+    SectionHeadersOffset = Writer->Offset;
+    memset(Record, 0, SectionHeaderSize);
+    WriteText(Writer, (const char *)Record, SectionHeaderSize);
+    for(Index = 1; Index < 6; Index++)
+    {
+        /* Describe the section */
+        Alignment = (Index == 1) ? DataAlignment : (Index == 3) ? AddressSize : 1;
+        Cursor = PutUint32(Record, (Index == 1) ? 1 : (uint32_t)(1 + SectionNameLength + SectionNameOffsets[Index]));
+        Cursor = PutUint32(Cursor, SectionTypes[Index]);
+        if(Elf64)
+        {
+            Cursor = PutUint64(Cursor, (Index == 1) ? SHF_ALLOC : 0);
+            Cursor = PutUint64(Cursor, 0);
+            Cursor = PutUint64(Cursor, SectionOffset[Index]);
+            Cursor = PutUint64(Cursor, SectionSize[Index]);
+        }
+        else
+        {
+            Cursor = PutUint32(Cursor, (Index == 1) ? SHF_ALLOC : 0);
+            Cursor = PutUint32(Cursor, 0);
+            Cursor = PutUint32(Cursor, (uint32_t)SectionOffset[Index]);
+            Cursor = PutUint32(Cursor, (uint32_t)SectionSize[Index]);
+        }
+        Cursor = PutUint32(Cursor, (Index == 3) ? 4 : 0);
+        Cursor = PutUint32(Cursor, (Index == 3) ? 1 : 0);
+        if(Elf64)
+        {
+            Cursor = PutUint64(Cursor, Alignment);
+            PutUint64(Cursor, (Index == 3) ? SymbolSize : 0);
+        }
+        else
+        {
+            Cursor = PutUint32(Cursor, (uint32_t)Alignment);
+            PutUint32(Cursor, (uint32_t)((Index == 3) ? SymbolSize : 0));
+        }
+        WriteText(Writer, (const char *)Record, SectionHeaderSize);
+    }
+
+    /* File header */
+    memcpy(Header, "\177ELF", 4);
+    Header[4] = Elf64 ? 2 : 1;
+    Header[5] = 1;
+    Header[6] = 1;
+    Cursor = PutUint16(Header + 16, 1);
+    Cursor = PutUint16(Cursor, Machine);
+    Cursor = PutUint32(Cursor, 1);
+    if(Elf64)
+    {
+        Cursor = PutUint64(Cursor, 0);
+        Cursor = PutUint64(Cursor, 0);
+        Cursor = PutUint64(Cursor, SectionHeadersOffset);
+    }
+    else
+    {
+        Cursor = PutUint32(Cursor, 0);
+        Cursor = PutUint32(Cursor, 0);
+        Cursor = PutUint32(Cursor, (uint32_t)SectionHeadersOffset);
+    }
+    Cursor = PutUint32(Cursor, Flags);
+    Cursor = PutUint16(Cursor, (uint16_t)HeaderSize);
+    Cursor = PutUint16(Cursor, 0);
+    Cursor = PutUint16(Cursor, 0);
+    Cursor = PutUint16(Cursor, (uint16_t)SectionHeaderSize);
+    Cursor = PutUint16(Cursor, 6);
+    PutUint16(Cursor, 5);
+
+    /* Write the header at the beginning of the file */
+    WriteHeader(Writer, Header, HeaderSize);
+    return 0;
+}
+
+/* Appends data bytes to the output, either as-is or as hex text */
+static void WriteData(PBIN2C_WRITER Writer, const unsigned char *Data, size_t Length)
+{
+    size_t Count;
+    char *Output;
+
+    /* Check if data is written as-is */
+    if(Writer->Raw)
+    {
+        /* Append data to the buffer */
+        WriteText(Writer, (const char *)Data, Length);
+        Writer->DataSize += Length;
+        return;
+    }
+
+    /* Check if data is written as words */
+    if(Writer->WordSize > 1)
+    {
+        /* Format whole words */
+        WriteWords(Writer, Data, Length, 0);
+        return;
+    }
+
+    /* Format data in pieces not exceeding the input chunk size */
+    while(Length > 0)
+    {
+        /* Get the size of the next piece */
+        Count = (Length > BIN2C_INPUT_CHUNK) ? BIN2C_INPUT_CHUNK : Length;
+
+        /* Make sure the whole formatted piece fits into the output buffer */
+        if(Writer->Length + Count * BIN2C_BYTE_TEXT > BIN2C_OUTPUT_BUFFER)
+        {
+            FlushWriter(Writer);
+        }
+
+        /* Format the piece using the selected kernel */
+        Output = Kernel->Encode(Writer->Buffer + Writer->Length, Data, Count);
+
+        /* The very first byte is not preceded by a separator */
+        if(Writer->DataSize == 0)
+        {
+            memmove(Writer->Buffer + Writer->Length, Writer->Buffer + Writer->Length + 1,
+                    Count * BIN2C_BYTE_TEXT - 1);
+            Output--;
+        }
+
+        /* Update buffer length and advance to the next piece */
+        Writer->Offset += (Output - Writer->Buffer) - Writer->Length;
+        Writer->Length = Output - Writer->Buffer;
+        Writer->DataSize += Count;
+        Data += Count;
+        Length -= Count;
+    }
+}
+
+/* Writes freestanding C source of the decompressor */
+static int WriteDecompressor(const char *FileName)
+{
+    FILE *File;
+    char *TempName;
+
+    /* Open the temporary file */
+    TempName = GetTempName(FileName);
+    File = TempName ? fopen(TempName, "w") : NULL;
+    if(File == NULL)
+    {
+        printf("Error: unable to create file %s\n", FileName);
+        free(TempName);
+        return -1;
+    }
+
+    /* Write the decompressor source with the block size filled in */
+    fprintf(File, DecompressorSource, BIN2C_COMPRESS_BLOCK, BIN2C_COMPRESS_BLOCK);
+    if(fclose(File) != 0)
+    {
+        printf("Error: unable to write file %s\n", FileName);
+        remove(TempName);
+        free(TempName);
+        return -1;
+    }
+
+    /* Replace the decompressor source if it has changed */
+    if(ReplaceOutput(TempName, FileName) < 0)
+    {
+        free(TempName);
+        return -1;
+    }
+    free(TempName);
+    return 0;
+}
+
+/* Writes a Makefile style dependency file listing all input files of the output */
+static int WriteDepfile(const char *FileName, const char *OutputName, PBIN2C_INPUT_LIST List,
+                        char **Arguments, int Count)
+{
+    const char *Path;
+    FILE *File;
+    int Index;
+
+    /* Open the dependency file */
+    File = fopen(FileName, "w");
+    if(File == NULL)
+    {
+        printf("Error: unable to create file %s\n", FileName);
+        return -1;
+    }
+
+    /* Write the output file followed by input files and response files */
+    for(Index = -1; Index < List->Count + Count; Index++)
+    {
+        /* Get the next path, only response files are taken from the arguments */
+        if(Index < 0)
+        {
+            Path = OutputName;
+        }
+        else if(Index < List->Count)
+        {
+            Path = List->Items[Index].FileName;
+        }
+        else if(Arguments[Index - List->Count][0] == '@')
+        {
+            Path = Arguments[Index - List->Count] + 1;
+        }
+        else
+        {
+            continue;
+        }
+
+        /* Escape characters with special meaning */
+        if(Index >= 0)
+        {
+            fputs(" \\\n  ", File);
+        }
+        while(*Path)
+        {
+            if(*Path == ' ' || *Path == '#')
+            {
+                fputc('\\', File);
+            }
+            else if(*Path == '$')
+            {
+                fputc('$', File);
+            }
+            fputc(*Path++, File);
+        }
+        if(Index < 0)
+        {
+            fputc(':', File);
+        }
+    }
+    fputc('\n', File);
+
+    /* Close the dependency file */
+    if(fclose(File) != 0)
+    {
+        printf("Error: unable to write file %s\n", FileName);
+        return -1;
+    }
+    return 0;
+}
+
+/* Appends formatted text to the output buffer */
+static void WriteFormatted(PBIN2C_WRITER Writer, const char *Format, ...)
+{
+    char Text[4096];
+    va_list Arguments;
+    int Length;
+
+    /* Format the text */
+    va_start(Arguments, Format);
+    Length = vsnprintf(Text, sizeof(Text), Format, Arguments);
+    va_end(Arguments);
+
+    /* Check if the text has been truncated */
+    if(Length < 0 || (size_t)Length >= sizeof(Text))
+    {
+        /* Text too long */
+        Writer->Error = 1;
+        return;
+    }
+
+    /* Append text to the buffer */
+    WriteText(Writer, Text, Length);
+}
+
+/* Overwrites the beginning of the output file with the given header */
+static void WriteHeader(PBIN2C_WRITER Writer, const uint8_t *Header, size_t Length)
+{
+    /* Write out all buffered data first */
+    FlushWriter(Writer);
+
+    /* Rewind the output file and write the header */
+    if(fseek(Writer->File, 0, SEEK_SET) != 0 || fwrite(Header, 1, Length, Writer->File) != Length)
+    {
+        /* Failed to write output file */
+        Writer->Error = 1;
+    }
+}
+
+/* Writes an index of all assets, sorted by name for binary search */
+static void WriteIndex(PBIN2C_WRITER Writer, int Format, PBIN2C_INPUT_LIST List, const char *IndexName)
+{
+    int Index;
+
+    /* Check output format */
+    if(Format == FORMAT_ASM)
+    {
+        /* Write the index table, pointer size depends on the target */
+        WriteFormatted(Writer,
+                       "#if __SIZEOF_POINTER__ == 8\n"
+                       "#define BIN2C_POINTER .quad\n"
+                       "#else\n"
+                       "#define BIN2C_POINTER .long\n"
+                       "#endif\n\n"
+                       "    .globl BIN2C_SYMBOL(%s)\n"
+                       "    .p2align 3\n"
+                       "BIN2C_SYMBOL(%s):\n",
+                       IndexName, IndexName);
+        for(Index = 0; Index < List->Count; Index++)
+        {
+            WriteFormatted(Writer,
+                           "    BIN2C_POINTER .Lbin2c_name_%d, BIN2C_SYMBOL(%s)\n"
+                           "    .quad %" PRIu64 "\n",
+                           Index, List->Items[Index].Name, List->Items[Index].Size);
+        }
+
+        /* Write the number of entries */
+        WriteFormatted(Writer,
+                       "\n    .globl BIN2C_SYMBOL(%s_count)\n"
+                       "    .p2align 2\n"
+                       "BIN2C_SYMBOL(%s_count):\n"
+                       "    .long %d\n\n",
+                       IndexName, IndexName, List->Count);
+
+        /* Write the names */
+        for(Index = 0; Index < List->Count; Index++)
+        {
+            WriteFormatted(Writer,
+                           ".Lbin2c_name_%d:\n"
+                           "    .asciz \"%s\"\n",
+                           Index, List->Items[Index].Name);
+        }
+        WriteText(Writer, "\n", 1);
+        return;
+    }
+
+    /* Write the index table */
+    WriteFormatted(Writer, "\nconst BIN2C_ASSET %s[] = {\n", IndexName);
+    for(Index = 0; Index < List->Count; Index++)
+    {
+        WriteFormatted(Writer, "    {\"%s\", (const unsigned char *)%s, %" PRIu64 "ULL},\n",
+                       List->Items[Index].Name, List->Items[Index].Name, List->Items[Index].Size);
+    }
+
+    /* Write the number of entries and freestanding lookup routine */
+    WriteFormatted(Writer,
+                   "};\n"
+                   "const unsigned int %s_count = %d;\n"
+                   "\n"
+                   "const BIN2C_ASSET *%s_find(const char *Name)\n"
+                   "{\n"
+                   "    unsigned int Low = 0;\n"
+                   "    unsigned int High = %d;\n"
+                   "    unsigned int Middle;\n"
+                   "    const char *Key;\n"
+                   "    const char *Entry;\n"
+                   "\n"
+                   "    while(Low < High)\n"
+                   "    {\n"
+                   "        Middle = Low + (High - Low) / 2;\n"
+                   "        Key = Name;\n"
+                   "        Entry = %s[Middle].Name;\n"
+                   "        while(*Key && *Key == *Entry)\n"
+                   "        {\n"
+                   "            Key++;\n"
+                   "            Entry++;\n"
+                   "        }\n"
+                   "        if(*Key == *Entry)\n"
+                   "        {\n"
+                   "            return &%s[Middle];\n"
+                   "        }\n"
+                   "        else if((unsigned char)*Key < (unsigned char)*Entry)\n"
+                   "        {\n"
+                   "            High = Middle;\n"
+                   "        }\n"
+                   "        else\n"
+                   "        {\n"
+                   "            Low = Middle + 1;\n"
+                   "        }\n"
+                   "    }\n"
+                   "\n"
+                   "    return 0;\n"
+                   "}\n",
+                   IndexName, List->Count, IndexName, List->Count, IndexName, IndexName);
+}
+
+/* Pads the output with zeros to the given alignment */
+static void WritePadding(PBIN2C_WRITER Writer, uint64_t Alignment)
+{
+    static const char Zero[BIN2C_MAX_ALIGNMENT] = {0};
+
+    /* Write zeros up to the next aligned offset */
+    WriteText(Writer, Zero, (size_t)((Alignment - Writer->Offset % Alignment) % Alignment));
+}
+
+/* Writes source file with all input files and an optional index */
+static int WriteSource(PBIN2C_WRITER Writer, int Format, PBIN2C_INPUT_LIST List, const char *IndexName)
+{
+    int Index;
+    int Result = 0;
+
+    /* Write the prologue */
+    if(Format == FORMAT_ASM)
+    {
+        /* Symbol decoration helpers, C symbols are prefixed with an underscore on some targets */
+        WriteFormatted(Writer,
+                       "#define BIN2C_CONCAT(Prefix, Name) Prefix ## Name\n"
+                       "#define BIN2C_EXPAND(Prefix, Name) BIN2C_CONCAT(Prefix, Name)\n"
+                       "#define BIN2C_SYMBOL(Name) BIN2C_EXPAND(__USER_LABEL_PREFIX__, Name)\n\n");
+    }
+    else if(IndexName)
+    {
+        /* Index entry type */
+        WriteFormatted(Writer,
+                       "#ifndef BIN2C_ASSET_DEFINED\n"
+                       "#define BIN2C_ASSET_DEFINED\n"
+                       "typedef struct _BIN2C_ASSET\n"
+                       "{\n"
+                       "    const char *Name;\n"
+                       "    const unsigned char *Data;\n"
+                       "    unsigned long long Size;\n"
+                       "} BIN2C_ASSET;\n"
+                       "#endif\n\n");
+    }
+
+    /* Write all assets */
+    for(Index = 0; Index < List->Count && Result == 0; Index++)
+    {
+        switch(Format)
+        {
+            case FORMAT_ASM:
+                Result = WriteAsmAsset(Writer, List->Items[Index].FileName, List->Items[Index].Name);
+                break;
+            case FORMAT_EMBED:
+                Result = WriteEmbedAsset(Writer, List->Items[Index].FileName, List->Items[Index].Name);
+                break;
+            default:
+                Result = WriteCAsset(Writer, List->Items[Index].FileName, List->Items[Index].Name);
+                break;
+        }
+        List->Items[Index].Size = Writer->DataSize;
+    }
+
+    /* Write the index */
+    if(Result == 0 && IndexName)
+    {
+        WriteIndex(Writer, Format, List, IndexName);
+    }
+
+    /* Mark the stack as non-executable on ELF targets */
+    if(Format == FORMAT_ASM)
+    {
+        WriteFormatted(Writer,
+                       "#ifdef __ELF__\n"
+                       "    .section .note.GNU-stack,\"\",%%progbits\n"
+                       "#endif\n");
+    }
+
+    /* Return result */
+    return Result;
+}
+
+/* Appends text to the output buffer */
+static void WriteText(PBIN2C_WRITER Writer, const char *Text, size_t Length)
+{
+    /* Flush the buffer if the text does not fit */
+    if(Writer->Length + Length > BIN2C_OUTPUT_BUFFER)
+    {
+        FlushWriter(Writer);
+    }
+
+    /* Keep track of the output file offset */
+    Writer->Offset += Length;
+
+    /* Check if the text is larger than the whole buffer */
+    if(Length > BIN2C_OUTPUT_BUFFER)
+    {
+        /* Write the text directly */
+        if(fwrite(Text, 1, Length, Writer->File) != Length)
+        {
+            /* Failed to write output file */
+            Writer->Error = 1;
+        }
+        return;
+    }
+
+    /* Append text to the buffer */
+    memcpy(Writer->Buffer + Writer->Length, Text, Length);
+    Writer->Length += Length;
+}
+
+/* Appends data bytes to the output as little-endian words, padding the last word with zeros when requested */
+static void WriteWords(PBIN2C_WRITER Writer, const unsigned char *Data, size_t Length, int Final)
+{
+    const unsigned char *Word;
+    size_t Bytes;
+    size_t Count;
+    size_t Index;
+    size_t Position;
+    size_t Words;
+    char *Output;
+
+    /* Format words until all data is consumed */
+    while(Length > 0 || (Final && Writer->PendingLength > 0))
+    {
+        /* Check if the next word is split between calls */
+        if(Writer->PendingLength > 0 || Length < Writer->WordSize)
+        {
+            /* Gather bytes of the word */
+            Count = Writer->WordSize - Writer->PendingLength;
+            Count = (Count > Length) ? Length : Count;
+            if(Count > 0)
+            {
+                memcpy(Writer->Pending + Writer->PendingLength, Data, Count);
+                Writer->PendingLength += Count;
+                Data += Count;
+                Length -= Count;
+            }
+
+            /* Wait for more data unless this is the last word */
+            if(Writer->PendingLength < Writer->WordSize)
+            {
+                if(!Final)
+                {
+                    return;
+                }
+                memset(Writer->Pending + Writer->PendingLength, 0, Writer->WordSize - Writer->PendingLength);
+            }
+
+            /* Format the gathered word */
+            Word = Writer->Pending;
+            Bytes = Writer->PendingLength;
+            Words = 1;
+            Writer->PendingLength = 0;
+        }
+        else
+        {
+            /* Format whole words in pieces not exceeding the input chunk size */
+            Word = Data;
+            Words = Length / Writer->WordSize;
+            Words = (Words > BIN2C_INPUT_CHUNK / Writer->WordSize) ? BIN2C_INPUT_CHUNK / Writer->WordSize : Words;
+            Bytes = Words * Writer->WordSize;
+            Data += Bytes;
+            Length -= Bytes;
+        }
+
+        /* Make sure all formatted words fit into the output buffer */
+        if(Writer->Length + Words * (3 + 2 * Writer->WordSize) > BIN2C_OUTPUT_BUFFER)
+        {
+            FlushWriter(Writer);
+        }
+
+        /* Format words, most significant byte first */
+        Output = Writer->Buffer + Writer->Length;
+        for(Index = 0; Index < Words; Index++)
+        {
+            /* The very first word is not preceded by a separator */
+            if(Writer->DataSize > 0 || Index > 0)
+            {
+                *Output++ = ',';
+            }
+            *Output++ = '0';
+            *Output++ = 'x';
+            for(Position = Writer->WordSize; Position > 0; Position--)
+            {
+                memcpy(Output, HexTable[Word[Position - 1]] + 3, 2);
+                Output += 2;
+            }
+            Word += Writer->WordSize;
+        }
+
+        /* Update buffer length */
+        Writer->Offset += (Output - Writer->Buffer) - Writer->Length;
+        Writer->Length = Output - Writer->Buffer;
+        Writer->DataSize += Bytes;
+    }
+}
+
+/* Main function */
+int main(int argc, char *argv[])
+{
+    BIN2C_INPUT_LIST Inputs = {0};
+    BIN2C_WRITER Writer = {0};
+    char *ArchString;
+    const char *DecompressorName = NULL;
+    const char *DepfileName = NULL;
+    const char *IndexName = NULL;
+    const char *OutputName;
+    char *TempName;
+    int Architecture = ARCH_UNKNOWN;
+    int Batch = 0;
+    int FirstInput;
+    int Format = FORMAT_C;
+    int Index;
+    int Result;
+
+    /* Read architecture from executable name */
+    split_argv(argv[0], NULL, NULL, &ArchString, NULL);
+    if(ArchString)
+    {
+        Architecture = GetArchitecture(strtok(ArchString, "-"));
+    }
+
+    /* Initialize byte to text lookup tables and pick the encoding kernel */
+    InitializeHexTable();
+    Kernel = SelectKernel();
+
+    /* Parse options */
+    for(Index = 1; Index < argc && strncmp(argv[Index], "--", 2) == 0; Index++)
+    {
+        if(strcmp(argv[Index], "--benchmark") == 0)
+        {
+            /* Benchmark all encoding kernels and the compression */
+#ifdef BIN2C_PARALLEL
+            return BenchmarkKernels() || BenchmarkCompression() || BenchmarkThreads();
+#else
+            return BenchmarkKernels() || BenchmarkCompression();
+#endif
+        }
+        else if(strncmp(argv[Index], "--arch=", 7) == 0)
+        {
+            /* Target architecture */
+            Architecture = GetArchitecture(argv[Index] + 7);
+            if(Architecture == ARCH_UNKNOWN)
+            {
+                printf("Error: %s is not a valid architecture\n", argv[Index] + 7);
+                return 1;
+            }
+        }
+        else if(strncmp(argv[Index], "--align=", 8) == 0)
+        {
+            /* Data alignment, must be a power of two not exceeding the page size */
+            Writer.Alignment = strtoull(argv[Index] + 8, NULL, 0);
+            if(Writer.Alignment == 0 || Writer.Alignment > BIN2C_MAX_ALIGNMENT ||
+               (Writer.Alignment & (Writer.Alignment - 1)) != 0)
+            {
+                printf("Error: %s is not a valid alignment\n", argv[Index] + 8);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[Index], "--batch") == 0)
+        {
+            /* Batch mode */
+            Batch = 1;
+        }
+        else if(strcmp(argv[Index], "--compress") == 0)
+        {
+            /* Compress data */
+            Writer.Compress = 1;
+        }
+        else if(strcmp(argv[Index], "--const") == 0)
+        {
+            /* Read-only data */
+            Writer.Const = 1;
+        }
+        else if(strncmp(argv[Index], "--decompressor=", 15) == 0)
+        {
+            /* Decompressor source file */
+            DecompressorName = argv[Index] + 15;
+        }
+        else if(strncmp(argv[Index], "--depfile=", 10) == 0)
+        {
+            /* Dependency file */
+            DepfileName = argv[Index] + 10;
+        }
+        else if(strncmp(argv[Index], "--format=", 9) == 0)
+        {
+            /* Output format */
+            Format = GetFormat(argv[Index] + 9);
+            if(Format < 0)
+            {
+                printf("Error: %s is not a valid output format\n", argv[Index] + 9);
+                return 1;
+            }
+        }
+        else if(strncmp(argv[Index], "--section=", 10) == 0)
+        {
+            /* Section name */
+            Writer.Section = argv[Index] + 10;
+            if(*Writer.Section == '\0' || strpbrk(Writer.Section, " \t\",\\") != NULL)
+            {
+                printf("Error: %s is not a valid section name\n", Writer.Section);
+                return 1;
+            }
+        }
+        else if(strncmp(argv[Index], "--threads=", 10) == 0)
+        {
+            /* Number of worker threads, zero picks the number of processors */
+            Writer.Threads = atoi(argv[Index] + 10);
+            if(argv[Index][10] == '\0' || strspn(argv[Index] + 10, "0123456789") != strlen(argv[Index] + 10))
+            {
+                printf("Error: %s is not a valid number of threads\n", argv[Index] + 10);
+                return 1;
+            }
+        }
+        else if(strncmp(argv[Index], "--word=", 7) == 0)
+        {
+            /* Array element size in bits */
+            if(strcmp(argv[Index] + 7, "8") != 0 && strcmp(argv[Index] + 7, "16") != 0 &&
+               strcmp(argv[Index] + 7, "32") != 0 && strcmp(argv[Index] + 7, "64") != 0)
+            {
+                printf("Error: %s is not a valid word size\n", argv[Index] + 7);
+                return 1;
+            }
+            Writer.WordSize = strtoul(argv[Index] + 7, NULL, 10) / 8;
+        }
+        else
+        {
+            /* Unknown option */
+            printf("Error: unknown option %s\n", argv[Index]);
+            return 1;
+        }
+    }
+
+    /* Write the decompressor source, it might be the only thing requested */
+    if(DecompressorName != NULL)
+    {
+        if(WriteDecompressor(DecompressorName) != 0)
+        {
+            return 1;
+        }
+        if(Index == argc && !Batch)
+        {
+            printf("Decompressor written to %s successfully.\n", DecompressorName);
+            return 0;
+        }
+    }
+
+    /* Compression needs the data to be converted by bin2c itself */
+    if(Writer.Compress && (Format == FORMAT_ASM || Format == FORMAT_EMBED))
+    {
+        printf("Error: compression is not supported with %s output format\n", Formats[Format].Name);
+        return 1;
+    }
+
+    /* Only C arrays are made of words */
+    if(Writer.WordSize > 1 && Format != FORMAT_C)
+    {
+        printf("Error: word size cannot be changed with %s output format\n", Formats[Format].Name);
+        return 1;
+    }
+
+    /* Check for proper number of arguments */
+    if((!Batch && argc - Index != 3) || (Batch && argc - Index < 3))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    /* Collect input files */
+    if(Batch)
+    {
+        /* Batch mode can only produce source files */
+        if(Formats[Format].Binary)
+        {
+            printf("Error: batch mode is not supported with %s output format\n", Formats[Format].Name);
+            return 1;
+        }
+
+        /* Output file and index name come first, followed by input files and response files */
+        OutputName = argv[Index];
+        IndexName = argv[Index + 1];
+        if(!IsIdentifier(IndexName))
+        {
+            printf("Error: %s is not a valid index name\n", IndexName);
+            return 1;
+        }
+        FirstInput = Index + 2;
+        for(Index = FirstInput; Index < argc; Index++)
+        {
+            if((argv[Index][0] == '@') ? LoadResponseFile(&Inputs, argv[Index] + 1) : AddInput(&Inputs, argv[Index]))
+            {
+                /* Failed to add input file */
+                return 1;
+            }
+        }
+
+        /* Sort input files by their names and make sure they are unique */
+        if(Inputs.Count == 0)
+        {
+            printf("Error: no input files specified\n");
+            return 1;
+        }
+        qsort(Inputs.Items, Inputs.Count, sizeof(BIN2C_INPUT), CompareInputs);
+        for(Index = 1; Index < Inputs.Count; Index++)
+        {
+            if(strcmp(Inputs.Items[Index - 1].Name, Inputs.Items[Index].Name) == 0)
+            {
+                printf("Error: symbol %s is used by both %s and %s\n",
+                       Inputs.Items[Index].Name, Inputs.Items[Index - 1].FileName, Inputs.Items[Index].FileName);
+                return 1;
+            }
+        }
+    }
+    else
+    {
+        /* Single input file, converted into a structure with the given name */
+        OutputName = argv[Index + 1];
+        Inputs.Items = (PBIN2C_INPUT)malloc(sizeof(BIN2C_INPUT));
+        if(Inputs.Items == NULL)
+        {
+            printf("Error: unable to allocate memory for input list\n");
+            return 1;
+        }
+        Inputs.Items[0].FileName = argv[Index];
+        Inputs.Items[0].Name = argv[Index + 2];
+        Inputs.Count = 1;
+        FirstInput = argc;
+    }
+
+    /* Check if target architecture is known when writing an object file */
+    if(Architecture == ARCH_UNKNOWN && Formats[Format].Binary)
+    {
+        if(Format == FORMAT_COFF)
+        {
+            /* COFF objects are only produced for the target */
+            printf("Error: no architecture specified\n");
+            return 1;
+        }
+
+        /* ELF objects default to the host architecture */
+#if defined(__x86_64__)
+        Architecture = ARCH_AMD64;
+#elif defined(__i386__)
+        Architecture = ARCH_X86;
+#elif defined(__aarch64__)
+        Architecture = ARCH_ARM64;
+#elif defined(__arm__)
+        Architecture = ARCH_ARM;
+#else
+        printf("Error: no architecture specified\n");
+        return 1;
+#endif
+    }
+
+    /* Open the temporary destination file, in text mode unless writing an object file */
+    TempName = GetTempName(OutputName);
+    Writer.File = TempName ? fopen(TempName, Formats[Format].Binary ? "wb" : "w") : NULL;
+    if(Writer.File == NULL)
+    {
+        printf("Error: unable to open file %s\n", OutputName);
+        return 1;
+    }
+
+    /* Allocate memory for the output buffer */
+    Writer.Buffer = (char *)malloc(BIN2C_OUTPUT_BUFFER);
+    if(Writer.Buffer == NULL)
+    {
+        printf("Error: unable to allocate memory for output buffer\n");
+        fclose(Writer.File);
+        remove(TempName);
+        return 1;
+    }
+
+    /* Write the output in requested format */
+    switch(Format)
+    {
+        case FORMAT_COFF:
+            Result = WriteCoffObject(&Writer, Inputs.Items[0].FileName, Inputs.Items[0].Name, Architecture);
+            break;
+        case FORMAT_ELF:
+            Result = WriteElfObject(&Writer, Inputs.Items[0].FileName, Inputs.Items[0].Name, Architecture);
+            break;
+        default:
+            Result = WriteSource(&Writer, Format, &Inputs, IndexName);
+            break;
+    }
+
+    /* Flush the output buffer and free it */
+    FlushWriter(&Writer);
+    free(Writer.Buffer);
+
+    /* Close the output file */
+    if(fclose(Writer.File) != 0 || Writer.Error)
+    {
+        printf("Error: unable to write file %s\n", OutputName);
+        remove(TempName);
+        return 1;
+    }
+
+    /* Check if conversion succeeded */
+    if(Result != 0)
+    {
+        /* Conversion failed */
+        remove(TempName);
+        return 1;
+    }
+
+    /* Replace the output file only if its contents have changed */
+    Result = ReplaceOutput(TempName, OutputName);
+    free(TempName);
+    if(Result < 0 || (DepfileName && WriteDepfile(DepfileName, OutputName, &Inputs, argv + FirstInput,
+                                                  argc - FirstInput) != 0))
+    {
+        return 1;
+    }
+
+    printf("Binary data converted to %s successfully.\n", Formats[Format].Description);
+    if(Result > 0)
+    {
+        printf("Output file %s is up to date, left unchanged.\n", OutputName);
+    }
+    if(Batch)
+    {
+        printf("%d files written with index %s.\n", Inputs.Count, IndexName);
+    }
     return 0;
 }
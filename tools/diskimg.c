@@ -9,50 +9,1185 @@
 
 #include "xtchain.h"
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#endif
+
+#define ZERO_CHUNK_SIZE (1024 * 1024)
+
+#define FAT_ATTRIBUTE_DIRECTORY     0x10
+#define FAT_ATTRIBUTE_ARCHIVE       0x20
+#define FAT_ATTRIBUTE_LONG_NAME     0x0F
+#define FAT_COPY_CLUSTERS           64
+#define FAT_DIRECTORY_ENTRY_SIZE    32
+#define FAT_MAX_NAME                255
+
+#define CLUSTER_TO_SECTOR(Volume, Cluster)  ((Volume)->FirstDataSector + ((Cluster) - 2) * (Volume)->SectorsPerCluster)
+#define FAT_END_OF_CHAIN(Volume)            (((Volume)->FatType == 32) ? 0x0FFFFFFF : 0xFFFF)
+
 
 static RESERVED_SECTOR_INFO Fat32ReservedMap[] =
 {
-    {0, "Main VBR"},
-    {1, "FSInfo Sector"},
-    {6, "Backup VBR"},
-    {7, "Backup FSInfo Sector"},
-    {-1, NULL}
-};
+    {0, "Main VBR"},
+    {1, "FSInfo Sector"},
+    {6, "Backup VBR"},
+    {7, "Backup FSInfo Sector"},
+    {-1, NULL}
+};
+
+/* Forward references */
+static int AddDirectoryEntry(PFAT_VOLUME Volume, PFAT_DIRECTORY Directory, const char *Name, uint8_t Attributes,
+                             uint32_t Cluster, uint32_t Size, time_t Time);
+static int AllocateClusters(PFAT_VOLUME Volume, uint32_t Count, uint32_t *First);
+static int AllocateImage(FILE *File, long long Size, int Preallocate);
+static void CollectNodes(PFAT_NODE Directory, uint8_t Attributes, PFAT_NODE *Order, uint32_t *Count);
+static int CompareNodes(const void *First, const void *Second);
+static int CopyData(PFAT_VOLUME Volume, const char *SourceDir, const char *TraceFile);
+static int CopyImageFile(PFAT_VOLUME Volume, PFAT_NODE Node, uint8_t *Buffer);
+static int DecodeName(const char *Name, uint16_t *LongName, uint32_t *Length);
+static long DetermineExtraSector(long sectors_to_write);
+static PFAT_NODE FindNode(PFAT_NODE Directory, const char *Path);
+static int FindShortName(PFAT_DIRECTORY Directory, const uint8_t *ShortName);
+static int FlushVolume(PFAT_VOLUME Volume);
+static int FormatVolume(PFAT_VOLUME Volume);
+static void FreeTree(PFAT_NODE Node);
+long GetSectorFileSize(const char *FileName);
+int LoadSectors(const char *FileName, uint8_t *Buffer, int SectorCount);
+static int LoadTrace(PFAT_NODE Root, const char *TraceFile, PFAT_NODE *Order, uint32_t *Count);
+static int MakeShortName(PFAT_DIRECTORY Directory, const char *Name, uint8_t *ShortName, uint8_t *CaseFlags);
+static int MatchName(const char *Name, const char *Component, size_t Length);
+static int PlanDirectory(PFAT_VOLUME Volume, PFAT_NODE Directory);
+static int PlanLayout(PFAT_VOLUME Volume, PFAT_NODE *Order, uint32_t Count);
+static void PrintExtents(PFAT_VOLUME Volume, PFAT_NODE Root, PFAT_NODE *Order, uint32_t Count);
+static int ScanDirectory(PFAT_NODE Directory, uint32_t *Count);
+static void SetEntryCluster(PFAT_VOLUME Volume, uint8_t *Entry, uint32_t Cluster);
+static void SetShortEntry(PFAT_VOLUME Volume, uint8_t *Entry, const uint8_t *ShortName, uint8_t Attributes,
+                          uint8_t CaseFlags, uint32_t Cluster, uint32_t Size, time_t Time);
+static int WriteDirectory(PFAT_VOLUME Volume, PFAT_NODE Directory);
+static int WriteLayout(PFAT_VOLUME Volume, PFAT_NODE *Order, uint32_t Count);
+static void WriteUint16(uint8_t *Buffer, uint16_t Value);
+static void WriteUint32(uint8_t *Buffer, uint32_t Value);
+static int WriteSectors(PFAT_VOLUME Volume, uint32_t Sector, const uint8_t *Buffer, uint32_t Count);
+
+/* Adds an entry to the directory, preceded by long file name entries if the name does not fit 8.3 */
+static int AddDirectoryEntry(PFAT_VOLUME Volume, PFAT_DIRECTORY Directory, const char *Name, uint8_t Attributes,
+                             uint32_t Cluster, uint32_t Size, time_t Time)
+{
+    static const uint8_t LongNameOffsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    uint16_t LongName[FAT_MAX_NAME + 1];
+    uint8_t ShortName[11];
+    uint8_t *Entries;
+    uint8_t *Entry;
+    uint8_t CaseFlags;
+    uint8_t Checksum = 0;
+    uint32_t Capacity;
+    uint32_t Position;
+    uint32_t Sequence;
+    uint32_t Length;
+    uint32_t Slots;
+    uint32_t Index;
+    int LongNeeded;
+
+    /* Convert the name to UTF-16 and generate a unique short name */
+    if(DecodeName(Name, LongName, &Length) != 0)
+    {
+        fprintf(stderr, "Error: file name '%s' is too long\n", Name);
+        return -1;
+    }
+    LongNeeded = MakeShortName(Directory, Name, ShortName, &CaseFlags);
+    if(LongNeeded < 0)
+    {
+        fprintf(stderr, "Error: unable to generate a unique short name for '%s'\n", Name);
+        return -1;
+    }
+    Slots = LongNeeded ? (Length + 12) / 13 : 0;
+
+    /* Grow the directory until the name fits, FAT16 root directory has a fixed size */
+    if(Directory->Count + Slots + 1 > Directory->Capacity)
+    {
+        if(Directory->Limit)
+        {
+            fprintf(stderr, "Error: root directory is full, unable to add '%s'\n", Name);
+            return -1;
+        }
+        for(Capacity = Directory->Capacity * 2; Directory->Count + Slots + 1 > Capacity; Capacity *= 2);
+        Entries = realloc(Directory->Entries, (size_t)Capacity * FAT_DIRECTORY_ENTRY_SIZE);
+        if(!Entries)
+        {
+            /* Memory allocation failed */
+            perror("Failed to allocate memory for directory");
+            return -1;
+        }
+        memset(Entries + Directory->Capacity * FAT_DIRECTORY_ENTRY_SIZE, 0,
+               (size_t)(Capacity - Directory->Capacity) * FAT_DIRECTORY_ENTRY_SIZE);
+        Directory->Entries = Entries;
+        Directory->Capacity = Capacity;
+    }
+
+    /* Long name entries are stored in reverse order and carry the checksum of the short name */
+    for(Index = 0; Index < 11; Index++)
+    {
+        Checksum = (uint8_t)(((Checksum & 1) << 7) + (Checksum >> 1) + ShortName[Index]);
+    }
+    for(Sequence = Slots; Sequence > 0; Sequence--)
+    {
+        Entry = Directory->Entries + Directory->Count++ * FAT_DIRECTORY_ENTRY_SIZE;
+        Entry[0] = (uint8_t)(Sequence | ((Sequence == Slots) ? 0x40 : 0));
+        Entry[11] = FAT_ATTRIBUTE_LONG_NAME;
+        Entry[13] = Checksum;
+        for(Index = 0; Index < 13; Index++)
+        {
+            /* Name is terminated with a null character and padded with 0xFFFF */
+            Position = (Sequence - 1) * 13 + Index;
+            WriteUint16(Entry + LongNameOffsets[Index],
+                        (Position < Length) ? LongName[Position] : (Position == Length) ? 0 : 0xFFFF);
+        }
+    }
+
+    /* Add the short name entry */
+    Entry = Directory->Entries + Directory->Count++ * FAT_DIRECTORY_ENTRY_SIZE;
+    SetShortEntry(Volume, Entry, ShortName, Attributes, CaseFlags, Cluster, Size, Time);
+    return 0;
+}
+
+/* Allocates a chain of clusters, returning the first one */
+static int AllocateClusters(PFAT_VOLUME Volume, uint32_t Count, uint32_t *First)
+{
+    uint32_t Previous = 0;
+    uint32_t Index;
+
+    /* Make sure there is enough free space */
+    if(Count > Volume->FreeClusters)
+    {
+        fprintf(stderr, "Error: not enough free space in the image\n");
+        return -1;
+    }
+
+    /* Take the next free clusters and link them together */
+    *First = 0;
+    for(Index = 0; Index < Count; Index++)
+    {
+        while(Volume->Fat[Volume->NextFree] != 0)
+        {
+            Volume->NextFree = (Volume->NextFree + 1 < Volume->ClusterCount + 2) ? Volume->NextFree + 1 : 2;
+        }
+        Volume->Fat[Volume->NextFree] = FAT_END_OF_CHAIN(Volume);
+        if(Previous)
+        {
+            Volume->Fat[Previous] = Volume->NextFree;
+        }
+        else
+        {
+            *First = Volume->NextFree;
+        }
+        Previous = Volume->NextFree;
+    }
+    Volume->FreeClusters -= Count;
+    return 0;
+}
+
+/* Sets the image size, unwritten regions stay sparse unless the image is preallocated */
+static int AllocateImage(FILE *File, long long Size, int Preallocate)
+{
+    uint8_t *Zero;
+    long long Offset;
+    size_t Length;
+
+    /* Extend the file without writing any data, holes read back as zeros */
+#ifdef _WIN32
+    if(_chsize_s(_fileno(File), Size) != 0)
+#else
+    if(ftruncate(fileno(File), (off_t)Size) != 0)
+#endif
+    {
+        /* Failed to set the image size */
+        return -1;
+    }
+
+    /* Check if the image has to be fully allocated */
+    if(!Preallocate)
+    {
+        return 0;
+    }
+
+#ifdef __linux__
+    /* Reserve all blocks at once, if supported by the file system */
+    if(posix_fallocate(fileno(File), 0, (off_t)Size) == 0)
+    {
+        return 0;
+    }
+#endif
+
+    /* Fall back to writing zeros in large chunks */
+    Zero = calloc(1, ZERO_CHUNK_SIZE);
+    if(!Zero)
+    {
+        /* Memory allocation failed */
+        return -1;
+    }
+    fseek(File, 0, SEEK_SET);
+    for(Offset = 0; Offset < Size; Offset += Length)
+    {
+        Length = (Size - Offset < ZERO_CHUNK_SIZE) ? (size_t)(Size - Offset) : ZERO_CHUNK_SIZE;
+        if(fwrite(Zero, 1, Length, File) != Length)
+        {
+            /* Failed to write zeros */
+            free(Zero);
+            return -1;
+        }
+    }
+
+    /* Free the buffer */
+    free(Zero);
+    return 0;
+}
+
+/* Appends nodes with the given attributes to the layout order, parents before their children, skipping boot files */
+static void CollectNodes(PFAT_NODE Directory, uint8_t Attributes, PFAT_NODE *Order, uint32_t *Count)
+{
+    PFAT_NODE Node;
+
+    /* Walk the tree in name order */
+    for(Node = Directory->Child; Node; Node = Node->Next)
+    {
+        if(Node->Attributes == Attributes && !Node->BootOrder)
+        {
+            Order[(*Count)++] = Node;
+        }
+        if(Node->Attributes & FAT_ATTRIBUTE_DIRECTORY)
+        {
+            CollectNodes(Node, Attributes, Order, Count);
+        }
+    }
+}
+
+/* Compares nodes by name */
+static int CompareNodes(const void *First, const void *Second)
+{
+    return strcmp((*(const PFAT_NODE *)First)->Name, (*(const PFAT_NODE *)Second)->Name);
+}
+
+/* Copies a directory recursively to the image, the whole layout is planned before anything is written */
+static int CopyData(PFAT_VOLUME Volume, const char *SourceDir, const char *TraceFile)
+{
+    PFAT_NODE *Order = NULL;
+    PFAT_NODE Root;
+    uint32_t BootFiles = 0;
+    uint32_t Directories = 0;
+    uint32_t Count = 0;
+    uint32_t Nodes = 0;
+    double Start;
+    int Result;
+
+    /* Scan the source tree, its root node stands for the root directory of the volume */
+    Start = get_timestamp();
+    Root = calloc(1, sizeof(FAT_NODE));
+    if(!Root || !(Root->Path = malloc(strlen(SourceDir) + 1)))
+    {
+        /* Memory allocation failed */
+        perror("Failed to allocate memory for file list");
+        free(Root);
+        return -1;
+    }
+    strcpy(Root->Path, SourceDir);
+    Root->Attributes = FAT_ATTRIBUTE_DIRECTORY;
+    Root->Time = time(NULL);
+    Result = ScanDirectory(Root, &Nodes);
+
+    /* Build all directories, so that their sizes are known */
+    if(Result == 0)
+    {
+        Result = PlanDirectory(Volume, Root);
+    }
+
+    /* Lay out the root directory first, followed by boot files in access order, then other directories and files */
+    if(Result == 0)
+    {
+        Order = malloc((size_t)(Nodes + 1) * sizeof(PFAT_NODE));
+        if(!Order)
+        {
+            /* Memory allocation failed */
+            perror("Failed to allocate memory for file list");
+            Result = -1;
+        }
+    }
+    if(Result == 0)
+    {
+        Order[Count++] = Root;
+        if(TraceFile)
+        {
+            Result = LoadTrace(Root, TraceFile, Order, &Count);
+            BootFiles = Count - 1;
+        }
+    }
+    if(Result == 0)
+    {
+        CollectNodes(Root, FAT_ATTRIBUTE_DIRECTORY, Order, &Count);
+        Directories = Count - BootFiles - 1;
+        CollectNodes(Root, FAT_ATTRIBUTE_ARCHIVE, Order, &Count);
+        Result = PlanLayout(Volume, Order, Count);
+    }
+
+    /* Write FATs, directories and data in one pass */
+    if(Result == 0)
+    {
+        Result = WriteLayout(Volume, Order, Count);
+    }
+    if(Result == 0)
+    {
+        printf("Copied %u files and %u directories to %u clusters, each in one contiguous run, in %.3f seconds.\n",
+               Count - Directories - 1, Directories, Volume->ClusterCount - Volume->FreeClusters,
+               get_timestamp() - Start);
+        if(TraceFile)
+        {
+            PrintExtents(Volume, Root, Order + 1, BootFiles);
+        }
+    }
+
+    /* Free the source tree */
+    free(Order);
+    FreeTree(Root);
+    return Result;
+}
+
+/* Copies a file to its run in the image, data is written in chunks of consecutive clusters */
+static int CopyImageFile(PFAT_VOLUME Volume, PFAT_NODE Node, uint8_t *Buffer)
+{
+    FILE *Source;
+    uint32_t ClusterSize = Volume->SectorsPerCluster * SECTOR_SIZE;
+    uint32_t Cluster;
+    uint32_t Run;
+    uint64_t Position;
+    size_t Length;
+
+    /* Empty files take no clusters */
+    if(Node->Clusters == 0)
+    {
+        return 0;
+    }
+
+    /* Open the source file */
+    Source = fopen(Node->Path, "rb");
+    if(!Source)
+    {
+        /* Failed to open file */
+        perror("Failed to open source file");
+        return -1;
+    }
+
+    /* Copy the data, only the planned size is read in case the file has grown since it was scanned */
+    for(Cluster = 0; Cluster < Node->Clusters; Cluster += Run)
+    {
+        Run = (Node->Clusters - Cluster < FAT_COPY_CLUSTERS) ? Node->Clusters - Cluster : FAT_COPY_CLUSTERS;
+        Position = (uint64_t)Cluster * ClusterSize;
+        Length = (Node->Size - Position < (uint64_t)Run * ClusterSize) ? (size_t)(Node->Size - Position) :
+                                                                         (size_t)Run * ClusterSize;
+        Length = fread(Buffer, 1, Length, Source);
+        memset(Buffer + Length, 0, (size_t)Run * ClusterSize - Length);
+        if(WriteSectors(Volume, CLUSTER_TO_SECTOR(Volume, Node->Cluster + Cluster), Buffer,
+                        Run * Volume->SectorsPerCluster) != 0)
+        {
+            /* Failed to write file data */
+            perror("Failed to write file data to disk image");
+            fclose(Source);
+            return -1;
+        }
+    }
+
+    /* Close the file */
+    fclose(Source);
+    return 0;
+}
+
+/* Converts the UTF-8 file name to UTF-16, bytes that are not valid UTF-8 are taken as Latin-1 */
+static int DecodeName(const char *Name, uint16_t *LongName, uint32_t *Length)
+{
+    const uint8_t *Input = (const uint8_t *)Name;
+    uint32_t Character;
+    uint32_t Extra;
+    uint32_t Index;
+
+    /* Decode all characters */
+    *Length = 0;
+    while(*Input)
+    {
+        /* Get the sequence length */
+        Character = *Input;
+        Extra = ((Character & 0xE0) == 0xC0) ? 1 : ((Character & 0xF0) == 0xE0) ? 2 : ((Character & 0xF8) == 0xF0) ? 3 : 0;
+        for(Index = 1; Index <= Extra && (Input[Index] & 0xC0) == 0x80; Index++);
+        if(Extra && Index > Extra)
+        {
+            /* Valid multi-byte sequence */
+            Character &= 0x3F >> Extra;
+            for(Index = 1; Index <= Extra; Index++)
+            {
+                Character = (Character << 6) | (Input[Index] & 0x3F);
+            }
+            Input += Extra + 1;
+        }
+        else
+        {
+            /* Single byte */
+            Input++;
+        }
+
+        /* Store the character, using a surrogate pair outside of the basic plane */
+        if(*Length + ((Character >= 0x10000) ? 2 : 1) > FAT_MAX_NAME)
+        {
+            return -1;
+        }
+        if(Character >= 0x10000)
+        {
+            LongName[(*Length)++] = (uint16_t)(0xD800 + ((Character - 0x10000) >> 10));
+            LongName[(*Length)++] = (uint16_t)(0xDC00 + ((Character - 0x10000) & 0x3FF));
+        }
+        else
+        {
+            LongName[(*Length)++] = (uint16_t)Character;
+        }
+    }
+    return 0;
+}
+
+/* Determines a safe sector to write extra VBR data to */
+static long DetermineExtraSector(long sectors_to_write)
+{
+    long Candidate;
+    long Conflict;
+    long Index;
+    long LastSector;
+
+    /* Start search from sector 1 (sector 0 is the main VBR) */
+    for(Candidate = 1; Candidate < 32; Candidate++)
+    {
+        /* Calculate the last sector to write */
+        LastSector = Candidate + sectors_to_write - 1;
+        Conflict = 0;
+
+        /* Check if it fits within the reserved region (32 sectors) */
+        if(LastSector >= 32)
+        {
+            /* The remaining space is not large enough */
+            break;
+        }
+
+        /* Check for conflicts with critical sectors */
+        for(Index = 0; Fat32ReservedMap[Index].SectorNumber != -1; Index++)
+        {
+            if(Candidate <= Fat32ReservedMap[Index].SectorNumber && LastSector >= Fat32ReservedMap[Index].SectorNumber)
+            {
+                /* Found a conflict */
+                Conflict = 1;
+                break;
+            }
+        }
+
+        /* Make sure there are no conflicts */
+        if(!Conflict)
+        {
+            /* Found a suitable slot */
+            return Candidate;
+        }
+    }
+
+    /* No suitable slot found */
+    return -1;
+}
+
+/* Looks up a path in the source tree, components may be separated by either slash and are matched ignoring case */
+static PFAT_NODE FindNode(PFAT_NODE Directory, const char *Path)
+{
+    PFAT_NODE Node;
+    const char *End;
+
+    /* Descend one component at a time */
+    while(Directory)
+    {
+        while(*Path == '/' || *Path == '\\')
+        {
+            Path++;
+        }
+        if(*Path == '\0')
+        {
+            return Directory;
+        }
+        for(End = Path; *End && *End != '/' && *End != '\\'; End++);
+        if(End - Path == 1 && *Path == '.')
+        {
+            Path = End;
+            continue;
+        }
+        for(Node = Directory->Child; Node && !MatchName(Node->Name, Path, End - Path); Node = Node->Next);
+        Directory = Node;
+        Path = End;
+    }
+
+    /* Path not found */
+    return NULL;
+}
+
+/* Checks if the short name is already used in the directory */
+static int FindShortName(PFAT_DIRECTORY Directory, const uint8_t *ShortName)
+{
+    uint8_t *Entry;
+    uint32_t Index;
+
+    /* Compare with all short name entries */
+    for(Index = 0; Index < Directory->Count; Index++)
+    {
+        Entry = Directory->Entries + Index * FAT_DIRECTORY_ENTRY_SIZE;
+        if(Entry[11] != FAT_ATTRIBUTE_LONG_NAME && memcmp(Entry, ShortName, 11) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Writes all FAT copies and FSInfo, only the used part of the FAT is written as the rest is zeroed */
+static int FlushVolume(PFAT_VOLUME Volume)
+{
+    uint8_t FsInfo[SECTOR_SIZE] = {0};
+    uint8_t *Buffer;
+    uint32_t EntrySize = Volume->FatType / 8;
+    uint32_t Sectors;
+    uint32_t NextFree;
+    uint32_t Cluster;
+    uint32_t Index;
+    uint32_t Last;
+
+    /* Find the last used entry */
+    for(Last = Volume->ClusterCount + 1; Last > 0 && Volume->Fat[Last] == 0; Last--);
+    Sectors = ((Last + 1) * EntrySize + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+    /* Pack the entries */
+    Buffer = calloc(Sectors, SECTOR_SIZE);
+    if(!Buffer)
+    {
+        /* Memory allocation failed */
+        perror("Failed to allocate memory for FAT");
+        return -1;
+    }
+    for(Index = 0; Index <= Last; Index++)
+    {
+        if(Volume->FatType == 32)
+        {
+            WriteUint32(Buffer + Index * 4, Volume->Fat[Index]);
+        }
+        else
+        {
+            WriteUint16(Buffer + Index * 2, (uint16_t)Volume->Fat[Index]);
+        }
+    }
+
+    /* Write every FAT copy */
+    for(Index = 0; Index < Volume->NumberOfFats; Index++)
+    {
+        if(WriteSectors(Volume, Volume->ReservedSectors + Index * Volume->SectorsPerFat, Buffer, Sectors) != 0)
+        {
+            /* Failed to write FAT */
+            perror("Failed to write FAT to disk image");
+            free(Buffer);
+            return -1;
+        }
+    }
+    free(Buffer);
+
+    /* FAT32 keeps the free cluster count in FSInfo, which has a backup copy */
+    if(Volume->FatType == 32)
+    {
+        /* The next free hint is the first free cluster after the last allocated one, all ones when full */
+        NextFree = 0xFFFFFFFF;
+        for(Index = 0; Volume->FreeClusters && Index < Volume->ClusterCount; Index++)
+        {
+            Cluster = 2 + (Volume->NextFree - 1 + Index) % Volume->ClusterCount;
+            if(Volume->Fat[Cluster] == 0)
+            {
+                NextFree = Cluster;
+                break;
+            }
+        }
+        WriteUint32(&FsInfo[0], 0x41615252);
+        WriteUint32(&FsInfo[484], 0x61417272);
+        WriteUint32(&FsInfo[488], Volume->FreeClusters);
+        WriteUint32(&FsInfo[492], NextFree);
+        WriteUint32(&FsInfo[508], 0xAA550000);
+        if(WriteSectors(Volume, 1, FsInfo, 1) != 0 || WriteSectors(Volume, 7, FsInfo, 1) != 0)
+        {
+            /* Failed to write FSInfo */
+            perror("Failed to write FSInfo sector to disk image");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Formats the partition as FAT16 or FAT32, the image has to be zeroed already */
+static int FormatVolume(PFAT_VOLUME Volume)
+{
+    uint8_t BootSector[SECTOR_SIZE] = {0};
+    uint8_t *Extended;
+    uint32_t DataSectors;
+    uint32_t Divisor;
+
+    /* Pick the cluster size by the partition size, as recommended by Microsoft */
+    if(Volume->FatType == 32)
+    {
+        Volume->SectorsPerCluster = (Volume->TotalSectors <= 532480) ? 1 : (Volume->TotalSectors <= 16777216) ? 8 :
+                                    (Volume->TotalSectors <= 33554432) ? 16 : (Volume->TotalSectors <= 67108864) ? 32 : 64;
+        Volume->ReservedSectors = 32;
+        Volume->RootEntries = 0;
+        Volume->RootCluster = 2;
+    }
+    else
+    {
+        Volume->SectorsPerCluster = (Volume->TotalSectors <= 32680) ? 2 : (Volume->TotalSectors <= 262144) ? 4 :
+                                    (Volume->TotalSectors <= 524288) ? 8 : (Volume->TotalSectors <= 1048576) ? 16 :
+                                    (Volume->TotalSectors <= 2097152) ? 32 : 64;
+        Volume->ReservedSectors = 1;
+        Volume->RootEntries = 512;
+        Volume->RootCluster = 0;
+    }
+    Volume->NumberOfFats = 2;
+
+    /* Size the FAT so that it covers all clusters */
+    Volume->RootSectors = (Volume->RootEntries * 32 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    DataSectors = Volume->TotalSectors - Volume->ReservedSectors - Volume->RootSectors;
+    Divisor = 256 * Volume->SectorsPerCluster + Volume->NumberOfFats;
+    if(Volume->FatType == 32)
+    {
+        Divisor /= 2;
+    }
+    Volume->SectorsPerFat = (DataSectors + Divisor - 1) / Divisor;
+    Volume->FirstDataSector = Volume->ReservedSectors + Volume->NumberOfFats * Volume->SectorsPerFat + Volume->RootSectors;
+    Volume->ClusterCount = (Volume->TotalSectors - Volume->FirstDataSector) / Volume->SectorsPerCluster;
+
+    /* FAT type is determined by the number of clusters, make sure it matches the requested one */
+    if((Volume->FatType == 16 && (Volume->ClusterCount < 4085 || Volume->ClusterCount > 65524)) ||
+       (Volume->FatType == 32 && Volume->ClusterCount < 65525))
+    {
+        fprintf(stderr, "Error: partition of %u sectors cannot be formatted as FAT%d.\n",
+                Volume->TotalSectors, Volume->FatType);
+        return -1;
+    }
+
+    /* Build the boot sector, with a jump over the BPB to code halting the CPU */
+    BootSector[0] = 0xEB;
+    BootSector[1] = (Volume->FatType == 32) ? 0x58 : 0x3C;
+    BootSector[2] = 0x90;
+    memcpy(&BootSector[BootSector[1] + 2], "\xFA\xF4\xEB\xFD", 4);
+    memcpy(&BootSector[0x03], "MSWIN4.1", 8);
+    WriteUint16(&BootSector[0x0B], SECTOR_SIZE);
+    BootSector[0x0D] = Volume->SectorsPerCluster;
+    WriteUint16(&BootSector[0x0E], Volume->ReservedSectors);
+    BootSector[0x10] = Volume->NumberOfFats;
+    WriteUint16(&BootSector[0x11], Volume->RootEntries);
+    BootSector[0x15] = 0xF8;
+    WriteUint16(&BootSector[0x18], 63);
+    WriteUint16(&BootSector[0x1A], 255);
+    WriteUint32(&BootSector[0x1C], Volume->HiddenSectors);
+
+    /* Partitions smaller than 65536 sectors use the 16-bit TotalSectors16 field on FAT16 */
+    if(Volume->FatType == 16 && Volume->TotalSectors < 65536)
+    {
+        WriteUint16(&BootSector[0x13], (uint16_t)Volume->TotalSectors);
+    }
+    else
+    {
+        WriteUint32(&BootSector[0x20], Volume->TotalSectors);
+    }
+
+    /* Fill in the FAT-specific part of the BPB */
+    if(Volume->FatType == 32)
+    {
+        WriteUint32(&BootSector[0x24], Volume->SectorsPerFat);
+        WriteUint32(&BootSector[0x2C], Volume->RootCluster);
+        WriteUint16(&BootSector[0x30], 1);
+        WriteUint16(&BootSector[0x32], 6);
+        Extended = &BootSector[0x40];
+    }
+    else
+    {
+        WriteUint16(&BootSector[0x16], (uint16_t)Volume->SectorsPerFat);
+        Extended = &BootSector[0x24];
+    }
+
+    /* Set DriveNumber to emulate hard disk, followed by the volume serial number, label and file system type */
+    Extended[0] = 0x80;
+    Extended[2] = 0x29;
+    WriteUint32(&Extended[3], (uint32_t)time(NULL));
+    memcpy(&Extended[7], "NO NAME    ", 11);
+    memcpy(&Extended[18], (Volume->FatType == 32) ? "FAT32   " : "FAT16   ", 8);
+    BootSector[510] = 0x55;
+    BootSector[511] = 0xAA;
+
+    /* Write the boot sector */
+    if(WriteSectors(Volume, 0, BootSector, 1) != 0)
+    {
+        /* Failed to write boot sector */
+        perror("Failed to write boot sector to disk image");
+        return -1;
+    }
+
+    /* FAT32 keeps a backup of the boot sector */
+    if(Volume->FatType == 32 && WriteSectors(Volume, 6, BootSector, 1) != 0)
+    {
+        /* Failed to write backup boot sector */
+        perror("Failed to write backup boot sector to disk image");
+        return -1;
+    }
+
+    /* Set up the in-memory FAT with the media descriptor, FAT32 root directory takes the first cluster */
+    Volume->Fat = calloc(Volume->ClusterCount + 2, sizeof(uint32_t));
+    if(!Volume->Fat)
+    {
+        /* Memory allocation failed */
+        perror("Failed to allocate memory for FAT");
+        return -1;
+    }
+    Volume->Fat[0] = (Volume->FatType == 32) ? 0x0FFFFFF8 : 0xFFF8;
+    Volume->Fat[1] = FAT_END_OF_CHAIN(Volume);
+    Volume->NextFree = 2;
+    Volume->FreeClusters = Volume->ClusterCount;
+    if(Volume->FatType == 32)
+    {
+        Volume->Fat[Volume->RootCluster] = FAT_END_OF_CHAIN(Volume);
+        Volume->NextFree = Volume->RootCluster + 1;
+        Volume->FreeClusters--;
+    }
+
+    /* Partition formatted successfully, FATs are written once all clusters are allocated */
+    return 0;
+}
+
+/* Frees the node and all its children */
+static void FreeTree(PFAT_NODE Node)
+{
+    PFAT_NODE Child;
+    PFAT_NODE Next;
+
+    /* Free children first */
+    for(Child = Node->Child; Child; Child = Next)
+    {
+        Next = Child->Next;
+        FreeTree(Child);
+    }
+    free(Node->Directory.Entries);
+    free(Node->Path);
+    free(Node);
+}
+
+/* Gets the size of a file */
+long GetSectorFileSize(const char *FileName)
+{
+    FILE *File;
+    long Size;
+
+    /* Open the file in binary mode */
+    File = fopen(FileName, "rb");
+    if(!File)
+    {
+        /* Failed to open file */
+        perror("Failed to open file for size check");
+        return -1;
+    }
+
+    /* Get the file size */
+    fseek(File, 0, SEEK_END);
+    Size = ftell(File);
+
+    /* Close the file and return the size */
+    fclose(File);
+    return Size;
+}
+
+/* Loads one or more sectors from a file */
+int LoadSectors(const char *FileName, uint8_t *Buffer, int SectorCount)
+{
+    FILE *File;
+    long FileSize;
+    long BytesToRead = SectorCount * SECTOR_SIZE;
+
+    /* Get and validate file size */
+    FileSize = GetSectorFileSize(FileName);
+    if(FileSize < 0)
+    {
+        /* Failed to get file size */
+        perror("Failed to get file size");
+        return -1;
+    }
+    if(FileSize != BytesToRead)
+    {
+        fprintf(stderr, "Error: file '%s' must be exactly %ld bytes, but is %ld bytes.\n", FileName, BytesToRead, FileSize);
+        return -1;
+    }
+
+    /* Open the file in binary mode for reading */
+    File = fopen(FileName, "rb");
+    if(!File) {
+        /* Failed to open file */
+        perror("Failed to open sector file for reading");
+        return -1;
+    }
+
+    /* Read sectors to buffer */
+    if(fread(Buffer, 1, BytesToRead, File) != BytesToRead)
+    {
+        /* Failed to read sectors */
+        perror("Failed to read sectors from file");
+        fclose(File);
+        return -1;
+    }
+
+    /* Close the file */
+    fclose(File);
+    return 0;
+}
+
+/* Loads the boot trace and appends the listed files to the layout order, in the order they are first accessed */
+static int LoadTrace(PFAT_NODE Root, const char *TraceFile, PFAT_NODE *Order, uint32_t *Count)
+{
+    FILE *Trace;
+    PFAT_NODE Node;
+    char Line[4096];
+    char *Path;
+    char *End;
+    size_t Length;
+    uint32_t Missing = 0;
+
+    /* Open the trace file */
+    Trace = fopen(TraceFile, "r");
+    if(!Trace)
+    {
+        /* Failed to open file */
+        perror("Failed to open boot trace file");
+        return -1;
+    }
+
+    /* Each line holds a path, or a quoted path as in strace output, lines starting with # are comments */
+    Length = strlen(Root->Path);
+    while(fgets(Line, sizeof(Line), Trace))
+    {
+        /* Trim the line */
+        for(Path = Line; *Path == ' ' || *Path == '\t'; Path++);
+        for(End = Path + strlen(Path); End > Path && (End[-1] == '\n' || End[-1] == '\r' || End[-1] == ' ' ||
+                                                     End[-1] == '\t'); End--);
+        *End = '\0';
+        if(*Path == '\0' || *Path == '#')
+        {
+            continue;
+        }
+
+        /* Take the first quoted string, if there is one */
+        if((End = strchr(Path, '"')) && strchr(End + 1, '"'))
+        {
+            Path = End + 1;
+            *strchr(Path, '"') = '\0';
+        }
+
+        /* Paths may be given on the host, including the source directory */
+        if(strncmp(Path, Root->Path, Length) == 0 &&
+           (Path[Length] == '/' || Path[Length] == '\\' || Path[Length] == '\0'))
+        {
+            Path += Length;
+        }
+
+        /* Add files not listed yet, anything else the trace refers to is not part of the image */
+        Node = FindNode(Root, Path);
+        if(!Node || (Node->Attributes & FAT_ATTRIBUTE_DIRECTORY))
+        {
+            Missing += !Node;
+            continue;
+        }
+        if(!Node->BootOrder)
+        {
+            Order[(*Count)++] = Node;
+            Node->BootOrder = *Count - 1;
+        }
+    }
+
+    /* Close the file */
+    fclose(Trace);
+    if(Missing)
+    {
+        printf("Skipped %u boot trace entries not found in '%s'.\n", Missing, Root->Path);
+    }
+    return 0;
+}
+
+/* Generates a unique 8.3 name, returns 1 if a long name entry is needed as well */
+static int MakeShortName(PFAT_DIRECTORY Directory, const char *Name, uint8_t *ShortName, uint8_t *CaseFlags)
+{
+    const char *Extension;
+    uint8_t Candidate[11];
+    char Tail[8];
+    int Lossy = 0;
+    int Case[2][2] = {{0}};
+    int Count[2] = {0};
+    int Length;
+    int Keep;
+    int Part;
+    int Number;
+    unsigned char Character;
+
+    /* Extension starts at the last dot, unless the name starts with it */
+    Extension = strrchr(Name, '.');
+    if(Extension == Name)
+    {
+        Extension = NULL;
+    }
+
+    /* Convert both parts, characters not allowed in short names are replaced */
+    memset(ShortName, ' ', 11);
+    for(; *Name; Name++)
+    {
+        Part = (Extension && Name >= Extension) ? 1 : 0;
+        Character = (unsigned char)*Name;
+        if(Name == Extension || Character == ' ' || Character == '.' || (Character & 0xC0) == 0x80)
+        {
+            /* Dots and spaces are dropped, as are UTF-8 continuation bytes */
+            Lossy |= (Name != Extension);
+            continue;
+        }
+        if(Character >= 0x80 || strchr("+,;=[]\"*/:<>?\\|", Character) || Character < 0x20)
+        {
+            /* Character cannot be stored in a short name */
+            Character = '_';
+            Lossy = 1;
+        }
+        Case[Part][0] |= (Character >= 'A' && Character <= 'Z');
+        Case[Part][1] |= (Character >= 'a' && Character <= 'z');
+        if(Count[Part] < (Part ? 3 : 8))
+        {
+            ShortName[Part * 8 + Count[Part]] = (Character >= 'a' && Character <= 'z') ? Character - 'a' + 'A' :
+                                                                                         Character;
+        }
+        else
+        {
+            Lossy = 1;
+        }
+        Count[Part]++;
+    }
+    Lossy |= (Count[0] == 0);
+    if(Count[0] == 0)
+    {
+        ShortName[0] = '_';
+        Count[0] = 1;
+    }
+
+    /* Names fitting 8.3 need no long name, unless they mix upper and lower case within a part */
+    if(!Lossy && !(Case[0][0] && Case[0][1]) && !(Case[1][0] && Case[1][1]) && !FindShortName(Directory, ShortName))
+    {
+        *CaseFlags = (Case[0][1] ? 0x08 : 0) | (Case[1][1] ? 0x10 : 0);
+        return 0;
+    }
+
+    /* Add a numeric tail to make the short name unique */
+    *CaseFlags = 0;
+    for(Number = 1; Number < 1000000; Number++)
+    {
+        Length = snprintf(Tail, sizeof(Tail), "~%d", Number);
+        Keep = (Count[0] < 8 - Length) ? Count[0] : 8 - Length;
+        memcpy(Candidate, ShortName, 11);
+        memset(Candidate, ' ', 8);
+        memcpy(Candidate, ShortName, Keep);
+        memcpy(Candidate + Keep, Tail, Length);
+        if(!FindShortName(Directory, Candidate))
+        {
+            memcpy(ShortName, Candidate, 11);
+            return 1;
+        }
+    }
+
+    /* No unique name found */
+    return -1;
+}
+
+/* Checks if the path component matches the name, ignoring ASCII case as FAT does */
+static int MatchName(const char *Name, const char *Component, size_t Length)
+{
+    size_t Index;
+    char First;
+    char Second;
+
+    /* Compare character by character */
+    for(Index = 0; Index < Length; Index++)
+    {
+        First = (Name[Index] >= 'a' && Name[Index] <= 'z') ? Name[Index] - 'a' + 'A' : Name[Index];
+        Second = (Component[Index] >= 'a' && Component[Index] <= 'z') ? Component[Index] - 'a' + 'A' : Component[Index];
+        if(First == '\0' || First != Second)
+        {
+            return 0;
+        }
+    }
+    return Name[Length] == '\0';
+}
+
+/* Builds the entries of the directory and its subdirectories, clusters are filled in once the layout is planned */
+static int PlanDirectory(PFAT_VOLUME Volume, PFAT_NODE Directory)
+{
+    PFAT_DIRECTORY Entries = &Directory->Directory;
+    uint32_t ClusterSize = Volume->SectorsPerCluster * SECTOR_SIZE;
+    PFAT_NODE Node;
+
+    /* FAT16 root directory has a fixed size, other directories grow as needed */
+    if(!Directory->Parent && Volume->FatType == 16)
+    {
+        Entries->Capacity = Volume->RootEntries;
+        Entries->Limit = Volume->RootEntries;
+    }
+    else
+    {
+        Entries->Capacity = ClusterSize / FAT_DIRECTORY_ENTRY_SIZE;
+    }
+    Entries->Entries = calloc(Entries->Capacity, FAT_DIRECTORY_ENTRY_SIZE);
+    if(!Entries->Entries)
+    {
+        /* Memory allocation failed */
+        perror("Failed to allocate memory for directory");
+        return -1;
+    }
+
+    /* Add . and .. entries to subdirectories */
+    if(Directory->Parent)
+    {
+        SetShortEntry(Volume, Entries->Entries, (const uint8_t *)".          ", FAT_ATTRIBUTE_DIRECTORY, 0, 0, 0,
+                      Directory->Time);
+        SetShortEntry(Volume, Entries->Entries + FAT_DIRECTORY_ENTRY_SIZE, (const uint8_t *)"..         ",
+                      FAT_ATTRIBUTE_DIRECTORY, 0, 0, 0, Directory->Time);
+        Entries->Count = 2;
+    }
+
+    /* Add all children, building subdirectories along the way */
+    for(Node = Directory->Child; Node; Node = Node->Next)
+    {
+        if(AddDirectoryEntry(Volume, Entries, Node->Name, Node->Attributes, 0, Node->Size, Node->Time) != 0)
+        {
+            return -1;
+        }
+        Node->EntryIndex = Entries->Count - 1;
+        Node->Clusters = (uint32_t)(((uint64_t)Node->Size + ClusterSize - 1) / ClusterSize);
+        if((Node->Attributes & FAT_ATTRIBUTE_DIRECTORY) && PlanDirectory(Volume, Node) != 0)
+        {
+            return -1;
+        }
+    }
+
+    /* Directory takes as many clusters as its entries need, but at least one */
+    if(!Entries->Limit)
+    {
+        Directory->Clusters = (Entries->Count * FAT_DIRECTORY_ENTRY_SIZE + ClusterSize - 1) / ClusterSize;
+        if(Directory->Clusters == 0)
+        {
+            Directory->Clusters = 1;
+        }
+    }
+    return 0;
+}
+
+/* Assigns every node one contiguous run of clusters in the given order and points the entries at it */
+static int PlanLayout(PFAT_VOLUME Volume, PFAT_NODE *Order, uint32_t Count)
+{
+    PFAT_NODE Node;
+    uint32_t First;
+    uint32_t Index;
 
-/* Forward references */
-static void CopyData(const char *Image, long Offset, const char *SourceDir, const char *Relative);
-static void CopyImageFile(const char *Image, long Offset, const char *SourceFile, const char *Relative);
-static long DetermineExtraSector(long sectors_to_write);
-long GetSectorFileSize(const char *FileName);
-int LoadSectors(const char *FileName, uint8_t *Buffer, int SectorCount);
-static void MakeDirectory(const char *Image, long Offset, const char *Relative);
+    /* Allocate the runs, nothing has been freed on the new volume so next-fit allocation yields consecutive clusters */
+    for(Index = 0; Index < Count; Index++)
+    {
+        Node = Order[Index];
+        if(!Node->Parent && Volume->FatType == 32)
+        {
+            /* FAT32 root directory already holds its first cluster */
+            Node->Cluster = Volume->RootCluster;
+            if(Node->Clusters > 1)
+            {
+                if(AllocateClusters(Volume, Node->Clusters - 1, &First) != 0)
+                {
+                    return -1;
+                }
+                Volume->Fat[Node->Cluster] = First;
+            }
+        }
+        else if(Node->Clusters > 0 && AllocateClusters(Volume, Node->Clusters, &Node->Cluster) != 0)
+        {
+            return -1;
+        }
+    }
+
+    /* Fill in the clusters of all entries, root directory is referenced as cluster 0 */
+    for(Index = 0; Index < Count; Index++)
+    {
+        Node = Order[Index];
+        if(!Node->Parent)
+        {
+            continue;
+        }
+        SetEntryCluster(Volume, Node->Parent->Directory.Entries + Node->EntryIndex * FAT_DIRECTORY_ENTRY_SIZE,
+                        Node->Cluster);
+        if(Node->Attributes & FAT_ATTRIBUTE_DIRECTORY)
+        {
+            SetEntryCluster(Volume, Node->Directory.Entries, Node->Cluster);
+            SetEntryCluster(Volume, Node->Directory.Entries + FAT_DIRECTORY_ENTRY_SIZE,
+                            Node->Parent->Parent ? Node->Parent->Cluster : 0);
+        }
+    }
+    return 0;
+}
 
-/* Copies a directory recursively to the image */
-static void CopyData(const char *Image, long Offset, const char *SourceDir, const char *Relative)
+/* Prints the on-disk extents of the boot files as disk LBAs and clusters */
+static void PrintExtents(PFAT_VOLUME Volume, PFAT_NODE Root, PFAT_NODE *Order, uint32_t Count)
 {
-    char Path[2048];
-    struct dirent *Entry;
-    DIR *Directory;
-    struct stat Stat;
-    char new_rel[2048];
+    uint32_t Sector;
+    uint32_t Index;
 
-    /* Create the directory in the image */
-    if(Relative[0] != '\0')
+    /* Print one line per file, in access order */
+    printf("Placed %u boot files right after the root directory:\n", Count);
+    for(Index = 0; Index < Count; Index++)
     {
-        MakeDirectory(Image, Offset, Relative);
+        if(Order[Index]->Clusters == 0)
+        {
+            printf("  %4u  %-23s %-15s %10u  %s\n", Index + 1, "-", "-", Order[Index]->Size,
+                   Order[Index]->Path + strlen(Root->Path));
+            continue;
+        }
+        Sector = Volume->HiddenSectors + CLUSTER_TO_SECTOR(Volume, Order[Index]->Cluster);
+        printf("  %4u  LBA %9u-%-9u cl %5u-%-6u %10u  %s\n", Index + 1, Sector,
+               Sector + Order[Index]->Clusters * Volume->SectorsPerCluster - 1, Order[Index]->Cluster,
+               Order[Index]->Cluster + Order[Index]->Clusters - 1, Order[Index]->Size,
+               Order[Index]->Path + strlen(Root->Path));
     }
+}
+
+/* Reads the source directory recursively, children are sorted by name so that the layout is reproducible */
+static int ScanDirectory(PFAT_NODE Directory, uint32_t *Count)
+{
+    PFAT_NODE *Children = NULL;
+    PFAT_NODE *Grown;
+    PFAT_NODE Node;
+    struct dirent *Entry;
+    struct stat Stat;
+    DIR *Source;
+    char *Path;
+    size_t Length;
+    uint32_t Capacity = 0;
+    uint32_t Number = 0;
+    uint32_t Index;
+    int Result = 0;
 
     /* Open the source directory */
-    Directory = opendir(SourceDir);
-    if(!Directory)
+    Source = opendir(Directory->Path);
+    if(!Source)
     {
         /* Failed to open directory */
         perror("Failed to open source directory");
-        return;
+        return 0;
     }
 
     /* Read all entries in the directory */
-    while((Entry = readdir(Directory)))
+    while(Result == 0 && (Entry = readdir(Source)))
     {
         /* Skip . and .. entries */
         if(strcmp(Entry->d_name, ".") == 0 || strcmp(Entry->d_name, "..") == 0)
@@ -61,177 +1196,227 @@ static void CopyData(const char *Image, long Offset, const char *SourceDir, cons
         }
 
         /* Build the full path to the entry */
-        snprintf(Path, sizeof(Path), "%s%c%s", SourceDir, PATH_SEP, Entry->d_name);
+        Length = strlen(Directory->Path) + strlen(Entry->d_name) + 2;
+        Path = malloc(Length);
+        if(!Path)
+        {
+            /* Memory allocation failed */
+            perror("Failed to allocate memory for file list");
+            Result = -1;
+            break;
+        }
+        snprintf(Path, Length, "%s%c%s", Directory->Path, PATH_SEP, Entry->d_name);
 
-        /* Stat the entry */
+        /* Stat the entry, only files and directories are copied */
         if(stat(Path, &Stat) == -1)
         {
             /* Failed to stat entry */
             perror("Failed to stat file or directory");
+            free(Path);
             continue;
         }
-
-        /* Build the relative path to the entry */
-        if(Relative[0] != '\0')
+        if(!S_ISDIR(Stat.st_mode) && !S_ISREG(Stat.st_mode))
         {
-            snprintf(new_rel, sizeof(new_rel), "%s/%s", Relative, Entry->d_name);
+            free(Path);
+            continue;
         }
-        else
+
+        /* Files are limited to 4GB on FAT */
+        if(S_ISREG(Stat.st_mode) && (unsigned long long)Stat.st_size > 0xFFFFFFFFULL)
         {
-            snprintf(new_rel, sizeof(new_rel), "%s", Entry->d_name);
+            fprintf(stderr, "Error: file '%s' is too large for FAT\n", Path);
+            free(Path);
+            Result = -1;
+            break;
         }
 
-        /* Copy the entry to the image */
-        if(S_ISDIR(Stat.st_mode))
+        /* Add the entry to the list of children */
+        if(Number == Capacity)
         {
-            /* Entry is a directory, copy it recursively */
-            CopyData(Image, Offset, Path, new_rel);
+            Capacity = Capacity ? Capacity * 2 : 16;
+            Grown = realloc(Children, Capacity * sizeof(PFAT_NODE));
+            if(!Grown)
+            {
+                /* Memory allocation failed */
+                perror("Failed to allocate memory for file list");
+                free(Path);
+                Result = -1;
+                break;
+            }
+            Children = Grown;
         }
-        else if(S_ISREG(Stat.st_mode))
+        Node = calloc(1, sizeof(FAT_NODE));
+        if(!Node)
         {
-            /* Entry is a file, copy it */
-            CopyImageFile(Image, Offset, Path, new_rel);
+            /* Memory allocation failed */
+            perror("Failed to allocate memory for file list");
+            free(Path);
+            Result = -1;
+            break;
         }
+        Node->Path = Path;
+        Node->Name = Path + Length - strlen(Entry->d_name) - 1;
+        Node->Attributes = S_ISDIR(Stat.st_mode) ? FAT_ATTRIBUTE_DIRECTORY : FAT_ATTRIBUTE_ARCHIVE;
+        Node->Size = S_ISDIR(Stat.st_mode) ? 0 : (uint32_t)Stat.st_size;
+        Node->Time = Stat.st_mtime;
+        Node->Parent = Directory;
+        Children[Number++] = Node;
     }
 
     /* Close the directory */
-    closedir(Directory);
-}
+    closedir(Source);
 
-/* Copies a file to the image */
-static void CopyImageFile(const char *Image, long Offset, const char *SourceFile, const char *Relative)
-{
-    char Command[4096];
-
-    /* Copy the file to the image */
-    snprintf(Command, sizeof(Command), "mcopy -i \"%s@@%ld\" \"%s\" \"::/%s\"", Image, Offset, SourceFile, Relative);
-    if(system(Command) != 0)
+    /* Link the children in name order */
+    if(Number > 0)
     {
-        /* Failed to copy file */
-        fprintf(stderr, "Faile to copy file '%s' to image\n", SourceFile);
+        qsort(Children, Number, sizeof(PFAT_NODE), CompareNodes);
     }
-}
-
-/* Determines a safe sector to write extra VBR data to */
-static long DetermineExtraSector(long sectors_to_write)
-{
-    long Candidate;
-    long Conflict;
-    long Index;
-    long LastSector;
-
-    /* Start search from sector 1 (sector 0 is the main VBR) */
-    for(Candidate = 1; Candidate < 32; Candidate++)
+    for(Index = Number; Index > 0; Index--)
     {
-        /* Calculate the last sector to write */
-        LastSector = Candidate + sectors_to_write - 1;
-        Conflict = 0;
-
-        /* Check if it fits within the reserved region (32 sectors) */
-        if(LastSector >= 32)
-        {
-            /* The remaining space is not large enough */
-            break;
-        }
-
-        /* Check for conflicts with critical sectors */
-        for(Index = 0; Fat32ReservedMap[Index].SectorNumber != -1; Index++)
-        {
-            if(Candidate <= Fat32ReservedMap[Index].SectorNumber && LastSector >= Fat32ReservedMap[Index].SectorNumber)
-            {
-                /* Found a conflict */
-                Conflict = 1;
-                break;
-            }
-        }
+        Children[Index - 1]->Next = Directory->Child;
+        Directory->Child = Children[Index - 1];
+    }
+    free(Children);
+    *Count += Number;
 
-        /* Make sure there are no conflicts */
-        if(!Conflict)
+    /* Scan subdirectories */
+    for(Node = Directory->Child; Result == 0 && Node; Node = Node->Next)
+    {
+        if(Node->Attributes & FAT_ATTRIBUTE_DIRECTORY)
         {
-            /* Found a suitable slot */
-            return Candidate;
+            Result = ScanDirectory(Node, Count);
         }
     }
+    return Result;
+}
 
-    /* No suitable slot found */
-    return -1;
+/* Sets the first cluster of a short name entry, high word is only used on FAT32 */
+static void SetEntryCluster(PFAT_VOLUME Volume, uint8_t *Entry, uint32_t Cluster)
+{
+    WriteUint16(Entry + 20, (Volume->FatType == 32) ? (uint16_t)(Cluster >> 16) : 0);
+    WriteUint16(Entry + 26, (uint16_t)Cluster);
 }
 
-/* Gets the size of a file */
-long GetSectorFileSize(const char *FileName)
+/* Fills in the short name directory entry */
+static void SetShortEntry(PFAT_VOLUME Volume, uint8_t *Entry, const uint8_t *ShortName, uint8_t Attributes,
+                          uint8_t CaseFlags, uint32_t Cluster, uint32_t Size, time_t Time)
 {
-    FILE *File;
-    long Size;
+    struct tm *Local;
+    uint16_t Date = (1 << 5) | 1;
+    uint16_t Clock = 0;
 
-    /* Open the file in binary mode */
-    File = fopen(FileName, "rb");
-    if(!File)
+    /* Convert the modification time to DOS format, dates before 1980 are not representable */
+    Local = localtime(&Time);
+    if(Local && Local->tm_year >= 80)
     {
-        /* Failed to open file */
-        perror("Failed to open file for size check");
-        return -1;
+        Date = (uint16_t)(((Local->tm_year - 80) << 9) | ((Local->tm_mon + 1) << 5) | Local->tm_mday);
+        Clock = (uint16_t)((Local->tm_hour << 11) | (Local->tm_min << 5) | (Local->tm_sec / 2));
     }
 
-    /* Get the file size */
-    fseek(File, 0, SEEK_END);
-    Size = ftell(File);
-
-    /* Close the file and return the size */
-    fclose(File);
-    return Size;
+    /* Fill in the entry */
+    memset(Entry, 0, FAT_DIRECTORY_ENTRY_SIZE);
+    memcpy(Entry, ShortName, 11);
+    Entry[11] = Attributes;
+    Entry[12] = CaseFlags;
+    WriteUint16(Entry + 14, Clock);
+    WriteUint16(Entry + 16, Date);
+    WriteUint16(Entry + 18, Date);
+    WriteUint16(Entry + 22, Clock);
+    WriteUint16(Entry + 24, Date);
+    WriteUint32(Entry + 28, Size);
+    SetEntryCluster(Volume, Entry, Cluster);
 }
 
-/* Loads one or more sectors from a file */
-int LoadSectors(const char *FileName, uint8_t *Buffer, int SectorCount)
+/* Writes the directory to its run, or to the fixed area of the FAT16 root directory */
+static int WriteDirectory(PFAT_VOLUME Volume, PFAT_NODE Directory)
 {
-    FILE *File;
-    long FileSize;
-    long BytesToRead = SectorCount * SECTOR_SIZE;
+    uint32_t Sector;
+    uint32_t Count;
 
-    /* Get and validate file size */
-    FileSize = GetSectorFileSize(FileName);
-    if(FileSize < 0)
+    /* Only the FAT16 root directory has no clusters */
+    if(Directory->Clusters)
     {
-        /* Failed to get file size */
-        perror("Failed to get file size");
-        return -1;
+        Sector = CLUSTER_TO_SECTOR(Volume, Directory->Cluster);
+        Count = Directory->Clusters * Volume->SectorsPerCluster;
     }
-    if(FileSize != BytesToRead)
+    else
     {
-        fprintf(stderr, "Error: file '%s' must be exactly %ld bytes, but is %ld bytes.\n", FileName, BytesToRead, FileSize);
-        return -1;
+        Sector = Volume->ReservedSectors + Volume->NumberOfFats * Volume->SectorsPerFat;
+        Count = Volume->RootSectors;
     }
 
-    /* Open the file in binary mode for reading */
-    File = fopen(FileName, "rb");
-    if(!File) {
-        /* Failed to open file */
-        perror("Failed to open sector file for reading");
+    /* Write all entries */
+    if(WriteSectors(Volume, Sector, Directory->Directory.Entries, Count) != 0)
+    {
+        /* Failed to write directory */
+        perror("Failed to write directory to disk image");
         return -1;
     }
+    return 0;
+}
 
-    /* Read sectors to buffer */
-    if(fread(Buffer, 1, BytesToRead, File) != BytesToRead)
+/* Writes FATs, directories and file data in a single pass, runs are written in the order they were allocated */
+static int WriteLayout(PFAT_VOLUME Volume, PFAT_NODE *Order, uint32_t Count)
+{
+    uint8_t *Buffer;
+    uint32_t Index;
+    int Result;
+
+    /* Allocate the copy buffer */
+    Buffer = malloc((size_t)Volume->SectorsPerCluster * SECTOR_SIZE * FAT_COPY_CLUSTERS);
+    if(!Buffer)
     {
-        /* Failed to read sectors */
-        perror("Failed to read sectors from file");
-        fclose(File);
+        /* Memory allocation failed */
+        perror("Failed to allocate memory for file data");
         return -1;
     }
 
-    /* Close the file */
-    fclose(File);
-    return 0;
+    /* FATs precede the data area, followed by all runs in ascending order */
+    Result = FlushVolume(Volume);
+    for(Index = 0; Result == 0 && Index < Count; Index++)
+    {
+        if(Order[Index]->Attributes & FAT_ATTRIBUTE_DIRECTORY)
+        {
+            Result = WriteDirectory(Volume, Order[Index]);
+        }
+        else
+        {
+            Result = CopyImageFile(Volume, Order[Index], Buffer);
+        }
+    }
+
+    /* Free the buffer */
+    free(Buffer);
+    return Result;
+}
+
+/* Writes a 16-bit little-endian value */
+static void WriteUint16(uint8_t *Buffer, uint16_t Value)
+{
+    Buffer[0] = (uint8_t)Value;
+    Buffer[1] = (uint8_t)(Value >> 8);
 }
 
-/* Creates a directory in the image */
-static void MakeDirectory(const char *Image, long Offset, const char *Relative)
+/* Writes a 32-bit little-endian value */
+static void WriteUint32(uint8_t *Buffer, uint32_t Value)
 {
-    char Command[4096];
+    Buffer[0] = (uint8_t)Value;
+    Buffer[1] = (uint8_t)(Value >> 8);
+    Buffer[2] = (uint8_t)(Value >> 16);
+    Buffer[3] = (uint8_t)(Value >> 24);
+}
 
-    /* Create the directory in the image */
-    snprintf(Command, sizeof(Command), "mmd -i \"%s@@%ld\" \"::/%s\"", Image, Offset, Relative);
-    system(Command);
+/* Writes sectors to the partition */
+static int WriteSectors(PFAT_VOLUME Volume, uint32_t Sector, const uint8_t *Buffer, uint32_t Count)
+{
+    /* Seek to the sector and write the data */
+    if(fseek(Volume->File, Volume->Offset + (long)Sector * SECTOR_SIZE, SEEK_SET) != 0 ||
+       fwrite(Buffer, SECTOR_SIZE, Count, Volume->File) != Count)
+    {
+        /* Failed to write sectors */
+        return -1;
+    }
+    return 0;
 }
 
 /* Main function */
@@ -240,7 +1425,6 @@ int main(int argc, char **argv)
     FILE *File;
     long Index;
     long FatFormat = 32;
-    char FormatCommand[512];
     long FormatPartition = 0;
     long DiskSizeBytes = 0;
     long DiskSizeMB = 0;
@@ -251,9 +1435,11 @@ int main(int argc, char **argv)
     long VbrFileSize = -1;
     long VbrTotalSectors = 0;
     long VbrLastSector = 99;
+    int Preallocate = 0;
+    double Start;
     char VbrInfo[128] = "";
     MBR_PARTITION Partition = {0};
-    char Zero[SECTOR_SIZE] = {0};
+    FAT_VOLUME Volume = {0};
     uint8_t Mbr[SECTOR_SIZE] = {0};
     uint8_t ImageVbr[SECTOR_SIZE * 2] = {0};
     uint8_t *MergedData = NULL;
@@ -264,11 +1450,17 @@ int main(int argc, char **argv)
     const char *PreloadFile = NULL;
     const char *VbrFile = NULL;
     const char *CopyDir = NULL;
+    const char *TraceFile = NULL;
 
     /* Parse command line arguments */
     for(Index = 1; Index < argc; Index++)
     {
-        if(strcmp(argv[Index], "-c") == 0 && Index + 1 < argc)
+        if(strcmp(argv[Index], "-a") == 0)
+        {
+            /* Fully allocate the image */
+            Preallocate = 1;
+        }
+        else if(strcmp(argv[Index], "-c") == 0 && Index + 1 < argc)
         {
             /* Copy directory */
             CopyDir = argv[++Index];
@@ -309,6 +1501,11 @@ int main(int argc, char **argv)
             /* Disk size */
             DiskSizeMB = atol(argv[++Index]);
         }
+        else if(strcmp(argv[Index], "-t") == 0 && Index + 1 < argc)
+        {
+            /* Boot trace file */
+            TraceFile = argv[++Index];
+        }
         else if(strcmp(argv[Index], "-v") == 0 && Index + 1 < argc)
         {
             /* VBR file */
@@ -326,7 +1523,7 @@ int main(int argc, char **argv)
     if(DiskSizeMB <= 0 || FileName == NULL)
     {
         /* Missing required arguments, print usage */
-        fprintf(stderr, "Usage: %s -o <output.img> -s <size_MB> [-b <sector>] [-c <dir>] [-f 16|32] [-m <mbr.img>] [-p <preload.bin>] [-v <vbr.img>]\n", argv[0]);
+        fprintf(stderr, "Usage: %s -o <output.img> -s <size_MB> [-a] [-b <sector>] [-c <dir>] [-f 16|32] [-m <mbr.img>] [-p <preload.bin>] [-t <trace>] [-v <vbr.img>]\n", argv[0]);
         return 1;
     }
 
@@ -338,28 +1535,43 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    /* Validate copy usage */
+    if(CopyDir && !FormatPartition)
+    {
+        /* Files can only be copied to the partition formatted by this tool */
+        fprintf(stderr, "Error: Option -c (copy directory) requires -f (format partition) to be specified as well.\n");
+        return 1;
+    }
+
+    /* Validate boot trace usage */
+    if(TraceFile && !CopyDir)
+    {
+        /* Boot files are placed while copying files */
+        fprintf(stderr, "Error: Option -t (boot trace) requires -c (copy directory) to be specified as well.\n");
+        return 1;
+    }
+
     /* Calculate disk size in bytes */
     DiskSizeBytes = DiskSizeMB * 1024 * 1024;
 
-    /* Open the output file in binary mode */
-    File = fopen(FileName, "wb");
+    /* Open the output file in binary mode, the BPB is read back when writing the VBR */
+    File = fopen(FileName, "w+b");
     if(!File) {
         /* Failed to open file */
         perror("Failed to open disk image file");
         return 1;
     }
 
-    /* Write zeros to the disk image file */
-    for(Index = 0; Index < DiskSizeBytes / SECTOR_SIZE; Index++)
+    /* Allocate the disk image, only sectors holding data are written */
+    Start = get_timestamp();
+    if(AllocateImage(File, DiskSizeBytes, Preallocate) != 0)
     {
-        if(fwrite(Zero, 1, SECTOR_SIZE, File) != SECTOR_SIZE)
-        {
-            /* Failed to write to disk image file */
-            perror("Failed to write to disk image file");
-            fclose(File);
-            return 1;
-        }
+        /* Failed to allocate disk image file */
+        perror("Failed to allocate disk image file");
+        fclose(File);
+        return 1;
     }
+    printf("Allocated %s disk image in %.3f seconds.\n", Preallocate ? "fully" : "sparse", get_timestamp() - Start);
 
     /* Load MBR if provided */
     if(MbrFile)
@@ -397,101 +1609,15 @@ int main(int argc, char **argv)
     /* Check if we need to format the partition */
     if(FormatPartition)
     {
-        /* Close file before calling external formatter */
-        fclose(File);
-
-        /* Build mformat command */
-        if(FatFormat == 16)
-        {
-            /* Format partition as FAT16 */
-            snprintf(FormatCommand, sizeof(FormatCommand),
-                     "mformat -i %s@@%ld",
-                     FileName, (long)(Partition.StartLBA * SECTOR_SIZE));
-        }
-        else
-        {
-            /* Format partition as FAT32 */
-            snprintf(FormatCommand, sizeof(FormatCommand),
-                     "mformat -i %s@@%ld -F",
-                     FileName, (long)(Partition.StartLBA * SECTOR_SIZE));
-        }
-
         /* Format the partition */
-        if(system(FormatCommand) != 0)
+        Volume.File = File;
+        Volume.Offset = (long)(Partition.StartLBA * SECTOR_SIZE);
+        Volume.FatType = FatFormat;
+        Volume.HiddenSectors = Partition.StartLBA;
+        Volume.TotalSectors = Partition.Size;
+        if(FormatVolume(&Volume) != 0)
         {
             /* Failed to format partition */
-            perror("Failed to format partition");
-            return 1;
-        }
-
-        /* Reopen disk image */
-        File = fopen(FileName, "r+b");
-        if(!File) {
-            /* Failed to open file */
-            perror("Failed to reopen disk image");
-            return 1;
-        }
-
-        /* Read the VBR created by mformat */
-        fseek(File, Partition.StartLBA * SECTOR_SIZE, SEEK_SET);
-        if(fread(ImageVbr, 1, SECTOR_SIZE, File) != SECTOR_SIZE)
-        {
-            /* Failed to read VBR */
-            perror("Failed to read VBR from disk image");
-            fclose(File);
-            return 1;
-        }
-
-        /* Set the number of hidden sectors, as mformat sets it to 0 */
-        if(*(uint32_t*)&ImageVbr[0x1C] == 0)
-        {
-            memcpy(&ImageVbr[0x1C], &Partition.StartLBA, sizeof(uint32_t));
-        }
-
-        /* Check FAT format */
-        if(FatFormat == 32)
-        {
-            /* For FAT32, TotalSectors32 must be set */
-            *(uint16_t*)&ImageVbr[0x13] = 0;
-            if(*(uint32_t*)&ImageVbr[0x20] == 0)
-            {
-                /* Mformat did not set the field, update it */
-                memcpy(&ImageVbr[0x20], &Partition.Size, sizeof(uint32_t));
-            }
-        }
-        else
-        {
-            /* For FAT16, check if parition size exceeds 65535 sectors */
-            if(Partition.Size < 65536)
-            {
-                /* Partition smaller than 32MB (65536 sectors), use 16-bit field TotalSectors16 */
-                if(*(uint16_t*)&ImageVbr[0x13] == 0)
-                {
-                    /* Mformat did not set the field, update it */
-                    memcpy(&ImageVbr[0x13], &((uint16_t){Partition.Size}), sizeof(uint16_t));
-                }
-            }
-            else
-            {
-                /* Partition larger than 32MB (65536 sectors), use 32-bit field TotalSectors32 */
-                *(uint16_t*)&ImageVbr[0x13] = 0;
-                if(*(uint32_t*)&ImageVbr[0x20] == 0)
-                {
-                    /* Mformat did not set the field, update it */
-                    memcpy(&ImageVbr[0x20], &Partition.Size, sizeof(uint32_t));
-                }
-            }
-        }
-
-        /* Set DriveNumber to emulate hard disk */
-        ImageVbr[0x40] = 0x80;
-
-        /* Write the corrected VBR back to the disk image */
-        fseek(File, Partition.StartLBA * SECTOR_SIZE, SEEK_SET);
-        if(fwrite(ImageVbr, 1, SECTOR_SIZE, File) != SECTOR_SIZE)
-        {
-            /* Failed to write VBR */
-            perror("Failed to write VBR to disk image");
             fclose(File);
             return 1;
         }
@@ -714,14 +1840,29 @@ int main(int argc, char **argv)
         free(FullVbrData);
     }
 
-    /* Close file */
-    fclose(File);
-
-    /* Copy files if requested */
+    /* Copy files if requested, FATs are written along with them */
     if(CopyDir)
     {
-        CopyData(FileName, (long)(Partition.StartLBA * SECTOR_SIZE), CopyDir, "");
+        if(CopyData(&Volume, CopyDir, TraceFile) != 0)
+        {
+            /* Failed to copy files */
+            fprintf(stderr, "Error: Failed to copy files to disk image.\n");
+            free(Volume.Fat);
+            fclose(File);
+            return 1;
+        }
+    }
+    else if(FormatPartition && FlushVolume(&Volume) != 0)
+    {
+        /* Failed to write FATs */
+        free(Volume.Fat);
+        fclose(File);
+        return 1;
     }
+    free(Volume.Fat);
+
+    /* Close file */
+    fclose(File);
 
     /* Check if VBR was written */
     if(VbrFile)
@@ -7,6 +7,271 @@
  */
 
 #include "xtchain.h"
+#include <errno.h>
+#include <inttypes.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define EXETOOL_X86_KERNELS
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define EXETOOL_NEON_KERNEL
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#define EXETOOL_PARALLEL
+#endif
+
+
+/* Image signatures */
+#define PE_DOS_SIGNATURE            0x5A4D
+#define PE_NT_SIGNATURE             0x00004550
+#define PE_XT_SIGNATURE             0x54584550
+
+/* Optional header magic values */
+#define PE_OPTIONAL_MAGIC_PE32      0x010B
+#define PE_OPTIONAL_MAGIC_PE32PLUS  0x020B
+
+/* Sizes of the headers */
+#define PE_DOS_HEADER_SIZE          64
+#define PE_FILE_HEADER_SIZE         20
+#define PE_SECTION_HEADER_SIZE      40
+#define PE_MAX_DIRECTORIES          16
+
+/* Offsets of DOS and file header fields */
+#define PE_DOS_LFANEW               0x3C
+#define PE_FILE_NUMBER_OF_SECTIONS  2
+#define PE_FILE_OPTIONAL_SIZE       16
+
+/* Offsets of data directory fields */
+#define PE_EXPORT_TIME_DATE_STAMP   4
+#define PE_RESOURCE_TIME_DATE_STAMP 4
+#define PE_DEBUG_ENTRY_SIZE         28
+#define PE_DEBUG_TIME_DATE_STAMP    4
+#define PE_DEBUG_TYPE               12
+#define PE_DEBUG_SIZE_OF_DATA       16
+#define PE_DEBUG_RAW_POINTER        24
+
+/* Import descriptor fields */
+#define PE_IMPORT_DESCRIPTOR_SIZE   20
+#define PE_IMPORT_ORIGINAL_THUNK    0
+#define PE_IMPORT_TIME_DATE_STAMP   4
+#define PE_IMPORT_FORWARDER_CHAIN   8
+#define PE_IMPORT_NAME              12
+#define PE_IMPORT_FIRST_THUNK       16
+
+/* Export directory fields */
+#define PE_EXPORT_BASE              16
+#define PE_EXPORT_NUMBER_OF_FUNCTIONS 20
+#define PE_EXPORT_NUMBER_OF_NAMES   24
+#define PE_EXPORT_FUNCTIONS         28
+#define PE_EXPORT_NAMES             32
+#define PE_EXPORT_NAME_ORDINALS     36
+#define PE_EXPORT_DIRECTORY_SIZE    40
+
+/* Import binding limits */
+#define PE_BOUND_ENTRY_SIZE         8
+#define PE_MAX_BIND_PATHS           32
+#define PE_MAX_FORWARDERS           8
+#define PE_MAX_MODULE_NAME          256
+
+/* CodeView debug information */
+#define PE_DEBUG_TYPE_CODEVIEW      2
+#define PE_CODEVIEW_NB10_SIGNATURE  0x3031424E
+#define PE_CODEVIEW_RSDS_SIGNATURE  0x53445352
+
+/* Base relocation types */
+#define PE_RELOCATION_ABSOLUTE      0
+#define PE_RELOCATION_HIGH          1
+#define PE_RELOCATION_LOW           2
+#define PE_RELOCATION_HIGHLOW       3
+#define PE_RELOCATION_HIGHADJ       4
+#define PE_RELOCATION_DIR64         10
+
+/* Image characteristics related to relocations */
+#define PE_FILE_RELOCS_STRIPPED     0x0001
+#define PE_DLL_HIGH_ENTROPY_VA      0x0020
+#define PE_DLL_DYNAMIC_BASE         0x0040
+
+/* Offsets of section header fields */
+#define PE_SECTION_VIRTUAL_SIZE     8
+#define PE_SECTION_VIRTUAL_ADDRESS  12
+#define PE_SECTION_RAW_SIZE         16
+#define PE_SECTION_RAW_POINTER      20
+#define PE_SECTION_CHARACTERISTICS  36
+
+/* Section characteristics */
+#define PE_SCN_CNT_CODE             0x00000020
+#define PE_SCN_MEM_EXECUTE          0x20000000
+#define PE_SCN_MEM_READ             0x40000000
+#define PE_SCN_MEM_WRITE            0x80000000
+
+/* Machine types supported by the pack stubs */
+#define PE_MACHINE_I386             0x014C
+#define PE_MACHINE_ARMNT            0x01C4
+#define PE_MACHINE_AMD64            0x8664
+#define PE_MACHINE_ARM64            0xAA64
+
+/* Status codes, also used as process exit codes */
+#define PE_STATUS_SUCCESS           0
+#define PE_STATUS_INVALID_EDIT      1
+#define PE_STATUS_OPEN_FAILED       2
+#define PE_STATUS_INVALID_IMAGE     3
+#define PE_STATUS_EDIT_FAILED       4
+
+/* Image normalization modes */
+#define PE_NORMALIZE_NONE           0
+#define PE_NORMALIZE_ZERO           1
+#define PE_NORMALIZE_HASH           2
+
+/* FNV-1a parameters used for deriving normalized identifiers */
+#define PE_FNV_OFFSET               0xCBF29CE484222325ULL
+#define PE_FNV_PRIME                0x00000100000001B3ULL
+
+/* Size of the buffer holding the result of a single edit */
+#define PE_MESSAGE_SIZE             2048
+
+/* Alignment required for the image base */
+#define PE_IMAGE_BASE_ALIGNMENT     0x10000
+
+/* Image analysis modes, files found by scanning a directory are skipped if they are not PE images */
+#define PE_ANALYZE_NONE             0
+#define PE_ANALYZE_FILE             1
+#define PE_ANALYZE_SCANNED          2
+
+/* Size profile limits */
+#define PE_PROFILE_NAME_SIZE        32
+#define PE_PROFILE_TOP              20
+
+/* Pack section, its header follows the stub and holds the block table */
+#define PE_PACK_SECTION_NAME        ".xtpack"
+#define PE_PACK_LINK_BASE           0
+#define PE_PACK_STUB_RVA            8
+#define PE_PACK_ENTRY_POINT         12
+#define PE_PACK_RELOCATIONS         16
+#define PE_PACK_RELOCATIONS_SIZE    20
+#define PE_PACK_BLOCK_COUNT         24
+#define PE_PACK_UNPACKED            28
+#define PE_PACK_HEADER_SIZE         32
+
+/* Offsets of pack block fields */
+#define PE_PACK_BLOCK_TARGET        0
+#define PE_PACK_BLOCK_SOURCE        4
+#define PE_PACK_BLOCK_SOURCE_SIZE   8
+#define PE_PACK_BLOCK_TARGET_SIZE   12
+#define PE_PACK_BLOCK_SIZE          16
+
+/* LZ4 block format parameters */
+#define PE_PACK_HASH_BITS           12
+#define PE_PACK_MAX_OFFSET          65535
+#define PE_PACK_MIN_MATCH           4
+#define PE_PACK_END_LITERALS        5
+
+/* Pack benchmark defaults, media bandwidth is given in KB/s and decompression is timed for at least 0.2s */
+#define PE_PACK_BANDWIDTH           2048
+#define PE_PACK_BENCHMARK_TIME      0.2
+
+enum _PE_HEADERS
+{
+    PE_HEADER_FILE,
+    PE_HEADER_OPTIONAL
+};
+
+enum _PE_FIELDS
+{
+    PE_FIELD_MACHINE,
+    PE_FIELD_TIME_DATE_STAMP,
+    PE_FIELD_CHARACTERISTICS,
+    PE_FIELD_ADDRESS_OF_ENTRY_POINT,
+    PE_FIELD_IMAGE_BASE,
+    PE_FIELD_SECTION_ALIGNMENT,
+    PE_FIELD_FILE_ALIGNMENT,
+    PE_FIELD_MAJOR_SUBSYSTEM_VERSION,
+    PE_FIELD_MINOR_SUBSYSTEM_VERSION,
+    PE_FIELD_SIZE_OF_IMAGE,
+    PE_FIELD_SIZE_OF_HEADERS,
+    PE_FIELD_CHECKSUM,
+    PE_FIELD_SUBSYSTEM,
+    PE_FIELD_DLL_CHARACTERISTICS,
+    PE_FIELD_SIZE_OF_STACK_RESERVE,
+    PE_FIELD_SIZE_OF_STACK_COMMIT,
+    PE_FIELD_SIZE_OF_HEAP_RESERVE,
+    PE_FIELD_SIZE_OF_HEAP_COMMIT,
+    PE_FIELD_NUMBER_OF_RVA_AND_SIZES,
+    PE_FIELD_COUNT
+};
+
+enum _PE_DIRECTORIES
+{
+    PE_DIRECTORY_EXPORT,
+    PE_DIRECTORY_IMPORT,
+    PE_DIRECTORY_RESOURCE,
+    PE_DIRECTORY_EXCEPTION,
+    PE_DIRECTORY_SECURITY,
+    PE_DIRECTORY_BASERELOC,
+    PE_DIRECTORY_DEBUG,
+    PE_DIRECTORY_ARCHITECTURE,
+    PE_DIRECTORY_GLOBALPTR,
+    PE_DIRECTORY_TLS,
+    PE_DIRECTORY_LOAD_CONFIG,
+    PE_DIRECTORY_BOUND_IMPORT,
+    PE_DIRECTORY_IAT,
+    PE_DIRECTORY_DELAY_IMPORT,
+    PE_DIRECTORY_COM_DESCRIPTOR
+};
+
+typedef uint64_t (*PPE_SUM_ROUTINE)(const uint8_t *Data, size_t Length);
+
+typedef struct _PE_FIELD
+{
+    const char *Name;
+    int Header;
+    uint16_t Offset32;
+    uint16_t Offset64;
+    uint8_t Size32;
+    uint8_t Size64;
+    int Editable;
+} PE_FIELD, *PPE_FIELD;
+
+typedef struct _PE_IMAGE
+{
+    const char *FileName;
+    uint8_t *Data;
+    uint8_t *View;
+    uint64_t Size;
+    uint64_t MappedSize;
+    uint32_t HeaderOffset;
+    uint32_t FileHeader;
+    uint32_t OptionalHeader;
+    uint32_t OptionalHeaderSize;
+    uint32_t SectionTable;
+    uint32_t NumberOfSections;
+    uint32_t NumberOfDirectories;
+    int Pe32Plus;
+    int Writable;
+    int Modified;
+#ifdef _WIN32
+    HANDLE FileHandle;
+    HANDLE MappingHandle;
+#else
+    int Descriptor;
+#endif
+} PE_IMAGE, *PPE_IMAGE;
+
+typedef struct _PE_SECTION
+{
+    char Name[9];
+    uint32_t VirtualSize;
+    uint32_t VirtualAddress;
+    uint32_t SizeOfRawData;
+    uint32_t PointerToRawData;
+    uint32_t Characteristics;
+    uint32_t HeaderOffset;
+} PE_SECTION, *PPE_SECTION;
 
 typedef struct _PE_SUBSYSTEM
 {
@@ -14,6 +279,255 @@ typedef struct _PE_SUBSYSTEM
     char *Name;
 } PE_SUBSYSTEM, *PPE_SUBSYSTEM;
 
+typedef struct _PE_SUM_KERNEL
+{
+    const char *Name;
+    PPE_SUM_ROUTINE Sum;
+    int (*IsSupported)(void);
+} PE_SUM_KERNEL, *PPE_SUM_KERNEL;
+
+typedef struct _PE_PROFILE_ITEM
+{
+    char Name[PE_PROFILE_NAME_SIZE];
+    uint64_t Size;
+    uint64_t Count;
+} PE_PROFILE_ITEM, *PPE_PROFILE_ITEM;
+
+typedef struct _PE_PROFILE
+{
+    PPE_PROFILE_ITEM Items;
+    int Count;
+    int Capacity;
+    uint64_t FileSize;
+} PE_PROFILE, *PPE_PROFILE;
+
+typedef struct _PE_PROFILE_CHANGE
+{
+    const char *Name;
+    uint64_t Old;
+    uint64_t New;
+    int64_t Delta;
+    int Image;
+} PE_PROFILE_CHANGE, *PPE_PROFILE_CHANGE;
+
+typedef struct _PE_PACK_STUB
+{
+    uint16_t Machine;
+    uint16_t RelocationType;
+    const uint8_t *Code;
+    uint32_t Size;
+} PE_PACK_STUB, *PPE_PACK_STUB;
+
+typedef struct _PE_PACKAGE
+{
+    PPE_PACK_STUB Stub;
+    uint8_t *Packed;
+    uint8_t *Data;
+    uint32_t Size;
+    uint32_t VirtualAddress;
+    uint32_t BlockCount;
+    uint8_t *Relocations;
+    uint32_t RelocationSize;
+    uint64_t SectionSize;
+    uint64_t FileSize;
+} PE_PACKAGE, *PPE_PACKAGE;
+
+typedef struct _PE_EDIT
+{
+    char *FileName;
+    PPE_SUBSYSTEM SubSystem;
+    uint64_t Values[PE_FIELD_COUNT];
+    uint32_t FieldMask;
+    int Checksum;
+    int Normalize;
+    int Bind;
+    int Rebase;
+    int Relayout;
+    int StripRelocations;
+    int Pack;
+    int Analyze;
+    int HasBaseline;
+    char *BaselineName;
+    PE_PROFILE Profile;
+    PE_PROFILE Baseline;
+    uint32_t Bandwidth;
+    double RawTime;
+    double PackedTime;
+    int Status;
+    char Message[PE_MESSAGE_SIZE];
+} PE_EDIT, *PPE_EDIT;
+
+typedef struct _PE_EDIT_LIST
+{
+    PPE_EDIT Items;
+    int Count;
+    int Capacity;
+    int Next;
+} PE_EDIT_LIST, *PPE_EDIT_LIST;
+
+typedef struct _PE_BOUND_ENTRY
+{
+    char Name[PE_MAX_MODULE_NAME];
+    uint32_t TimeDateStamp;
+    uint16_t References;
+} PE_BOUND_ENTRY, *PPE_BOUND_ENTRY;
+
+typedef struct _PE_BIND_WRITE
+{
+    uint8_t *Target;
+    uint64_t Value;
+    int Size;
+} PE_BIND_WRITE, *PPE_BIND_WRITE;
+
+typedef struct _PE_BIND_CONTEXT
+{
+    const char *FileName;
+    PPE_BOUND_ENTRY Entries;
+    int EntryCount;
+    int EntryCapacity;
+    int Current;
+    PPE_BIND_WRITE Writes;
+    int WriteCount;
+    int WriteCapacity;
+    int Forwarded;
+} PE_BIND_CONTEXT, *PPE_BIND_CONTEXT;
+
+typedef struct _PE_LAYOUT
+{
+    uint64_t Base;
+    uint64_t Limit;
+    const char *PriorityName;
+    const char *MapName;
+} PE_LAYOUT, *PPE_LAYOUT;
+
+typedef struct _PE_MODULE
+{
+    const char *Name;
+    char **Imports;
+    int ImportCount;
+    uint64_t SizeOfImage;
+    int Visited;
+} PE_MODULE, *PPE_MODULE;
+
+/* Forward references */
+static int AddDirectory(PPE_EDIT_LIST List, const char *Path, const char *Baseline);
+static PPE_EDIT AddEdit(PPE_EDIT_LIST List, const char *FileName);
+static int AddGlob(PPE_EDIT_LIST List, const char *Pattern, char **Edits, int Count);
+static PPE_BOUND_ENTRY AddBoundEntry(PPE_BIND_CONTEXT Context, const char *Name, uint32_t TimeDateStamp);
+static int AddBindWrite(PPE_BIND_CONTEXT Context, uint8_t *Target, uint64_t Value, int Size);
+static int AddProfileItem(PPE_PROFILE Profile, const char *Name, uint64_t Size, uint64_t Count);
+static void AddRelocationBlock(uint8_t *Buffer, uint32_t *Length, uint32_t Page, uint16_t *Entries, uint32_t Count);
+static int AnalyzeImage(PPE_EDIT Edit);
+static int ApplyEdit(PPE_EDIT Edit);
+static int BenchmarkImage(PPE_EDIT Edit);
+static int BindImage(PPE_IMAGE Image, char *Message, size_t Size);
+static int BuildPackage(PPE_IMAGE Image, PPE_PACKAGE Package, int Compress, char *Message, size_t Size);
+static int CloseImage(PPE_IMAGE Image);
+static int CommitImage(PPE_IMAGE Image);
+static int CompareChanges(const void *First, const void *Second);
+static uint32_t CompressData(const uint8_t *Input, uint32_t Length, uint8_t *Output);
+static uint32_t ComputeChecksum(PPE_IMAGE Image);
+static int DecompressData(const uint8_t *Input, uint32_t Length, uint8_t *Output, uint32_t Capacity,
+                          uint32_t *Produced);
+static int DiffProfiles(PPE_PROFILE Profile, PPE_PROFILE Baseline, PPE_PROFILE_CHANGE *Changes, int *Count);
+static uint8_t *EmitSequence(uint8_t *Output, const uint8_t *Literals, uint32_t LiteralLength, uint32_t Offset,
+                             uint32_t MatchLength);
+static int FindModule(PPE_MODULE Modules, int Count, const char *Name);
+static int FindSection(PPE_IMAGE Image, uint32_t VirtualAddress);
+static void FreePackage(PPE_PACKAGE Package);
+static int GetDirectory(PPE_IMAGE Image, int Index, uint32_t *VirtualAddress, uint32_t *Size);
+static uint64_t GetEditValue(PPE_IMAGE Image, PPE_EDIT Edit, int Field);
+static int GetExport(PPE_IMAGE Image, const char *Name, uint16_t Hint, uint32_t Ordinal, uint32_t *Function,
+                     const char **Forwarder);
+static uint64_t GetField(PPE_IMAGE Image, int Field);
+static uint8_t *GetImportDescriptor(PPE_IMAGE Image, uint32_t Index);
+static int GetImports(PPE_IMAGE Image, char ***Imports, int *Count);
+static uint8_t *GetPointer(PPE_IMAGE Image, uint64_t Offset, uint64_t Length);
+static int GetProcessorCount(void);
+PPE_SUBSYSTEM getSubSystem(char *Name);
+char *getSubSystemName(int Identifier);
+static int GetSection(PPE_IMAGE Image, uint32_t Index, PPE_SECTION Section);
+static uint64_t HashData(const uint8_t *Data, uint64_t Length, uint64_t Hash);
+static int LoadManifest(PPE_EDIT_LIST List, const char *FileName);
+static int LoadModule(PPE_MODULE Module, const char *FileName);
+static uint32_t MapRawPointer(PPE_IMAGE Image, PPE_SECTION Sections, PPE_SECTION Moved, uint64_t DataEnd,
+                              uint64_t NewEnd, uint32_t Offset);
+static void MoveDebugData(PPE_IMAGE Image, uint8_t *Buffer, PPE_SECTION Sections, PPE_SECTION Moved,
+                          uint64_t DataEnd, uint64_t NewEnd);
+static int NormalizeImage(PPE_IMAGE Image, int Mode, int Apply, char *Message, size_t Size);
+static int OpenImage(PPE_IMAGE Image, const char *FileName, int Writable);
+static int OpenModule(PPE_BIND_CONTEXT Context, PPE_IMAGE Module, const char *Name);
+static int OrderModules(PPE_MODULE Modules, int Count, const char *PriorityName, int *Order);
+static int PackImage(PPE_IMAGE Image, char *Message, size_t Size);
+static int ParseEdit(PPE_EDIT Edit, const char *Token);
+static int ParseNormalize(PPE_EDIT Edit, const char *Mode);
+static int ParseNumber(const char *String, uint64_t *Value);
+static int PlanLayout(PPE_EDIT_LIST List, PPE_LAYOUT Layout, PPE_MODULE *Modules, int **Order);
+static void ProcessEdits(PPE_EDIT_LIST List, int Threads);
+static void *ProcessEditsWorker(void *Context);
+static int ProfileImage(PPE_IMAGE Image, PPE_PROFILE Profile);
+static uint16_t ReadUint16(const uint8_t *Buffer);
+static uint32_t ReadUint32(const uint8_t *Buffer);
+static uint64_t ReadUint64(const uint8_t *Buffer);
+static int RelayoutImage(PPE_IMAGE Image, int Apply, char *Message, size_t Size);
+static int RelocateImage(PPE_IMAGE Image, uint64_t Delta, int Apply, uint32_t *Count);
+static int ResizeImage(PPE_IMAGE Image, uint64_t Size);
+static int ResolveImport(PPE_BIND_CONTEXT Context, PPE_IMAGE Module, const char *Name, uint16_t Hint,
+                         uint32_t Ordinal, uint64_t *Address, int Depth);
+static uint8_t *RvaToPointer(PPE_IMAGE Image, uint32_t VirtualAddress, uint32_t Length);
+static const char *RvaToString(PPE_IMAGE Image, uint32_t VirtualAddress);
+static PPE_SUM_KERNEL SelectSumKernel(void);
+static int SetDirectory(PPE_IMAGE Image, int Index, uint32_t VirtualAddress, uint32_t Size);
+static void SetField(PPE_IMAGE Image, int Field, uint64_t Value);
+static void SetSignature(PPE_IMAGE Image, uint32_t Signature);
+static int StageImage(PPE_IMAGE Image);
+static void StripRelocations(PPE_IMAGE Image, char *Message, size_t Size);
+static uint64_t SumWordsScalar(const uint8_t *Data, size_t Length);
+static uint32_t UpdateChecksum(PPE_IMAGE Image, uint32_t *OldChecksum);
+static int ValidateEdit(PPE_IMAGE Image, PPE_EDIT Edit);
+static void Usage(const char *ExecName);
+static void VisitModule(PPE_MODULE Modules, int Count, int Index, int *Order, int *Position);
+static void WriteJsonString(FILE *File, const char *String);
+static int WriteLayoutMap(PPE_EDIT_LIST List, PPE_MODULE Modules, int *Order, const char *FileName);
+static int WriteProfile(PPE_EDIT_LIST List, const char *FileName, int Diff);
+static void WriteUint16(uint8_t *Buffer, uint16_t Value);
+static void WriteUint32(uint8_t *Buffer, uint32_t Value);
+static void WriteUint64(uint8_t *Buffer, uint64_t Value);
+
+#ifdef EXETOOL_X86_KERNELS
+static int IsAvx2Supported(void);
+static int IsSse2Supported(void);
+static uint64_t SumWordsAvx2(const uint8_t *Data, size_t Length);
+static uint64_t SumWordsSse2(const uint8_t *Data, size_t Length);
+#endif
+
+#ifdef EXETOOL_NEON_KERNEL
+static uint64_t SumWordsNeon(const uint8_t *Data, size_t Length);
+#endif
+
+/* Header fields, located at different offsets in PE32 and PE32+ optional headers */
+static PE_FIELD Fields[] = {
+    {"Machine", PE_HEADER_FILE, 0, 0, 2, 2, 0},
+    {"TimeDateStamp", PE_HEADER_FILE, 4, 4, 4, 4, 1},
+    {"Characteristics", PE_HEADER_FILE, 18, 18, 2, 2, 0},
+    {"AddressOfEntryPoint", PE_HEADER_OPTIONAL, 16, 16, 4, 4, 0},
+    {"ImageBase", PE_HEADER_OPTIONAL, 28, 24, 4, 8, 1},
+    {"SectionAlignment", PE_HEADER_OPTIONAL, 32, 32, 4, 4, 0},
+    {"FileAlignment", PE_HEADER_OPTIONAL, 36, 36, 4, 4, 0},
+    {"MajorSubsystemVersion", PE_HEADER_OPTIONAL, 48, 48, 2, 2, 1},
+    {"MinorSubsystemVersion", PE_HEADER_OPTIONAL, 50, 50, 2, 2, 1},
+    {"SizeOfImage", PE_HEADER_OPTIONAL, 56, 56, 4, 4, 0},
+    {"SizeOfHeaders", PE_HEADER_OPTIONAL, 60, 60, 4, 4, 0},
+    {"CheckSum", PE_HEADER_OPTIONAL, 64, 64, 4, 4, 0},
+    {"Subsystem", PE_HEADER_OPTIONAL, 68, 68, 2, 2, 0},
+    {"DllCharacteristics", PE_HEADER_OPTIONAL, 70, 70, 2, 2, 1},
+    {"SizeOfStackReserve", PE_HEADER_OPTIONAL, 72, 72, 4, 8, 1},
+    {"SizeOfStackCommit", PE_HEADER_OPTIONAL, 76, 80, 4, 8, 1},
+    {"SizeOfHeapReserve", PE_HEADER_OPTIONAL, 80, 88, 4, 8, 1},
+    {"SizeOfHeapCommit", PE_HEADER_OPTIONAL, 84, 96, 4, 8, 1},
+    {"NumberOfRvaAndSizes", PE_HEADER_OPTIONAL, 92, 108, 4, 4, 0}
+};
+
 static PE_SUBSYSTEM SubSystems[] = {
     {0x00, "INVALID_SUBSYSTEM"},
     {0x01, "NT_NATIVE"},
@@ -38,145 +552,4922 @@ static PE_SUBSYSTEM SubSystems[] = {
     {0x19, "XT_APPLICATION_GDI"}
 };
 
-PPE_SUBSYSTEM getSubSystem(char *Name)
+/* Checksum summing kernels, ordered from the slowest to the fastest one */
+static PE_SUM_KERNEL SumKernels[] = {
+    {"scalar", SumWordsScalar, NULL},
+#ifdef EXETOOL_X86_KERNELS
+    {"sse2", SumWordsSse2, IsSse2Supported},
+    {"avx2", SumWordsAvx2, IsAvx2Supported},
+#endif
+#ifdef EXETOOL_NEON_KERNEL
+    {"neon", SumWordsNeon, NULL},
+#endif
+};
+
+/* Kernel used for checksum calculation */
+static PPE_SUM_KERNEL SumKernel = &SumKernels[0];
+
+/* i386 decompression stub */
+static const uint8_t PackStubI386[] = {
+    0x83, 0xEC, 0x04,                           /* sub esp, 4 */
+    0x60,                                       /* pushad */
+    0xFC,                                       /* cld */
+    0xE8, 0x00, 0x00, 0x00, 0x00,               /* call next */
+    /* next: */
+    0x5B,                                       /* pop ebx */
+    0x81, 0xC3, 0xE6, 0x00, 0x00, 0x00,         /* add ebx, desc - next */
+    0x8D, 0xAB, 0x10, 0xFF, 0xFF, 0xFF,         /* lea ebp, [ebx - (desc - stub)] */
+    0x2B, 0x6B, 0x08,                           /* sub ebp, dword ptr [ebx + 8] */
+    0x8B, 0x43, 0x0C,                           /* mov eax, dword ptr [ebx + 12] */
+    0x01, 0xE8,                                 /* add eax, ebp */
+    0x89, 0x44, 0x24, 0x20,                     /* mov dword ptr [esp + 32], eax */
+    0x83, 0x7B, 0x1C, 0x00,                     /* cmp dword ptr [ebx + 28], 0 */
+    0x0F, 0x85, 0xBB, 0x00, 0x00, 0x00,         /* jne done */
+    0x53,                                       /* push ebx */
+    0x8B, 0x4B, 0x18,                           /* mov ecx, dword ptr [ebx + 24] */
+    0x8D, 0x43, 0x20,                           /* lea eax, [ebx + 32] */
+    /* block_loop: */
+    0x85, 0xC9,                                 /* test ecx, ecx */
+    0x74, 0x6A,                                 /* jz blocks_done */
+    0x51,                                       /* push ecx */
+    0x50,                                       /* push eax */
+    0x8B, 0x38,                                 /* mov edi, dword ptr [eax] */
+    0x01, 0xEF,                                 /* add edi, ebp */
+    0x8B, 0x70, 0x04,                           /* mov esi, dword ptr [eax + 4] */
+    0x01, 0xEE,                                 /* add esi, ebp */
+    0x8B, 0x50, 0x08,                           /* mov edx, dword ptr [eax + 8] */
+    0x01, 0xF2,                                 /* add edx, esi */
+    /* lz_loop: */
+    0x39, 0xD6,                                 /* cmp esi, edx */
+    0x73, 0x4E,                                 /* jae lz_done */
+    0x0F, 0xB6, 0x06,                           /* movzx eax, byte ptr [esi] */
+    0x46,                                       /* inc esi */
+    0x89, 0xC1,                                 /* mov ecx, eax */
+    0xC1, 0xE9, 0x04,                           /* shr ecx, 4 */
+    0x83, 0xF9, 0x0F,                           /* cmp ecx, 15 */
+    0x75, 0x0E,                                 /* jne literals */
+    /* literals_ext: */
+    0x0F, 0xB6, 0x1E,                           /* movzx ebx, byte ptr [esi] */
+    0x46,                                       /* inc esi */
+    0x01, 0xD9,                                 /* add ecx, ebx */
+    0x81, 0xFB, 0xFF, 0x00, 0x00, 0x00,         /* cmp ebx, 255 */
+    0x74, 0xF2,                                 /* je literals_ext */
+    /* literals: */
+    0xF3, 0xA4,                                 /* rep movsb */
+    0x39, 0xD6,                                 /* cmp esi, edx */
+    0x73, 0x2C,                                 /* jae lz_done */
+    0x0F, 0xB7, 0x1E,                           /* movzx ebx, word ptr [esi] */
+    0x83, 0xC6, 0x02,                           /* add esi, 2 */
+    0x89, 0xC1,                                 /* mov ecx, eax */
+    0x83, 0xE1, 0x0F,                           /* and ecx, 15 */
+    0x83, 0xF9, 0x0F,                           /* cmp ecx, 15 */
+    0x75, 0x0D,                                 /* jne match */
+    /* match_ext: */
+    0x0F, 0xB6, 0x06,                           /* movzx eax, byte ptr [esi] */
+    0x46,                                       /* inc esi */
+    0x01, 0xC1,                                 /* add ecx, eax */
+    0x3D, 0xFF, 0x00, 0x00, 0x00,               /* cmp eax, 255 */
+    0x74, 0xF3,                                 /* je match_ext */
+    /* match: */
+    0x83, 0xC1, 0x04,                           /* add ecx, 4 */
+    0x89, 0xF0,                                 /* mov eax, esi */
+    0x89, 0xFE,                                 /* mov esi, edi */
+    0x29, 0xDE,                                 /* sub esi, ebx */
+    0xF3, 0xA4,                                 /* rep movsb */
+    0x89, 0xC6,                                 /* mov esi, eax */
+    0xEB, 0xAE,                                 /* jmp lz_loop */
+    /* lz_done: */
+    0x58,                                       /* pop eax */
+    0x59,                                       /* pop ecx */
+    0x83, 0xC0, 0x10,                           /* add eax, 16 */
+    0x49,                                       /* dec ecx */
+    0xEB, 0x92,                                 /* jmp block_loop */
+    /* blocks_done: */
+    0x5B,                                       /* pop ebx */
+    0xC7, 0x43, 0x1C, 0x01, 0x00, 0x00, 0x00,   /* mov dword ptr [ebx + 28], 1 */
+    0x89, 0xEA,                                 /* mov edx, ebp */
+    0x2B, 0x13,                                 /* sub edx, dword ptr [ebx] */
+    0x74, 0x38,                                 /* jz done */
+    0x8B, 0x73, 0x10,                           /* mov esi, dword ptr [ebx + 16] */
+    0x01, 0xEE,                                 /* add esi, ebp */
+    0x8B, 0x5B, 0x14,                           /* mov ebx, dword ptr [ebx + 20] */
+    0x01, 0xF3,                                 /* add ebx, esi */
+    /* reloc_block: */
+    0x39, 0xDE,                                 /* cmp esi, ebx */
+    0x73, 0x2A,                                 /* jae done */
+    0x8B, 0x3E,                                 /* mov edi, dword ptr [esi] */
+    0x01, 0xEF,                                 /* add edi, ebp */
+    0x8B, 0x4E, 0x04,                           /* mov ecx, dword ptr [esi + 4] */
+    0x01, 0xF1,                                 /* add ecx, esi */
+    0x83, 0xC6, 0x08,                           /* add esi, 8 */
+    /* reloc_entry: */
+    0x39, 0xCE,                                 /* cmp esi, ecx */
+    0x73, 0xEC,                                 /* jae reloc_block */
+    0x0F, 0xB7, 0x06,                           /* movzx eax, word ptr [esi] */
+    0x83, 0xC6, 0x02,                           /* add esi, 2 */
+    0x80, 0xFC, 0x30,                           /* cmp ah, 0x30 */
+    0x72, 0xF1,                                 /* jb reloc_entry */
+    0x80, 0xFC, 0x40,                           /* cmp ah, 0x40 */
+    0x73, 0xEC,                                 /* jae reloc_entry */
+    0x25, 0xFF, 0x0F, 0x00, 0x00,               /* and eax, 0xFFF */
+    0x01, 0x14, 0x07,                           /* add dword ptr [edi + eax], edx */
+    0xEB, 0xE2,                                 /* jmp reloc_entry */
+    /* done: */
+    0x61,                                       /* popad */
+    0xC3,                                       /* ret */
+    0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC,         /* padding */
+};
+
+/* x86_64 decompression stub */
+static const uint8_t PackStubAmd64[] = {
+    0x48, 0x83, 0xEC, 0x08,                     /* sub rsp, 8 */
+    0x51,                                       /* push rcx */
+    0x52,                                       /* push rdx */
+    0x41, 0x50,                                 /* push r8 */
+    0x41, 0x51,                                 /* push r9 */
+    0x53,                                       /* push rbx */
+    0x56,                                       /* push rsi */
+    0x57,                                       /* push rdi */
+    0x55,                                       /* push rbp */
+    0xFC,                                       /* cld */
+    0x4C, 0x8D, 0x15, 0x12, 0x01, 0x00, 0x00,   /* lea r10, [rip + desc] */
+    0x48, 0x8D, 0x2D, 0xE3, 0xFF, 0xFF, 0xFF,   /* lea rbp, [rip + stub] */
+    0x41, 0x8B, 0x42, 0x08,                     /* mov eax, dword ptr [r10 + 8] */
+    0x48, 0x29, 0xC5,                           /* sub rbp, rax */
+    0x41, 0x8B, 0x42, 0x0C,                     /* mov eax, dword ptr [r10 + 12] */
+    0x48, 0x01, 0xE8,                           /* add rax, rbp */
+    0x48, 0x89, 0x44, 0x24, 0x40,               /* mov qword ptr [rsp + 64], rax */
+    0x41, 0x83, 0x7A, 0x1C, 0x00,               /* cmp dword ptr [r10 + 28], 0 */
+    0x0F, 0x85, 0xDF, 0x00, 0x00, 0x00,         /* jne done */
+    0x45, 0x8B, 0x5A, 0x18,                     /* mov r11d, dword ptr [r10 + 24] */
+    0x4D, 0x8D, 0x4A, 0x20,                     /* lea r9, [r10 + 32] */
+    /* block_loop: */
+    0x45, 0x85, 0xDB,                           /* test r11d, r11d */
+    0x74, 0x7F,                                 /* jz blocks_done */
+    0x41, 0x8B, 0x39,                           /* mov edi, dword ptr [r9] */
+    0x48, 0x01, 0xEF,                           /* add rdi, rbp */
+    0x41, 0x8B, 0x71, 0x04,                     /* mov esi, dword ptr [r9 + 4] */
+    0x48, 0x01, 0xEE,                           /* add rsi, rbp */
+    0x41, 0x8B, 0x51, 0x08,                     /* mov edx, dword ptr [r9 + 8] */
+    0x48, 0x01, 0xF2,                           /* add rdx, rsi */
+    /* lz_loop: */
+    0x48, 0x39, 0xD6,                           /* cmp rsi, rdx */
+    0x73, 0x5A,                                 /* jae lz_done */
+    0x0F, 0xB6, 0x06,                           /* movzx eax, byte ptr [rsi] */
+    0x48, 0xFF, 0xC6,                           /* inc rsi */
+    0x89, 0xC1,                                 /* mov ecx, eax */
+    0xC1, 0xE9, 0x04,                           /* shr ecx, 4 */
+    0x83, 0xF9, 0x0F,                           /* cmp ecx, 15 */
+    0x75, 0x10,                                 /* jne literals */
+    /* literals_ext: */
+    0x0F, 0xB6, 0x1E,                           /* movzx ebx, byte ptr [rsi] */
+    0x48, 0xFF, 0xC6,                           /* inc rsi */
+    0x01, 0xD9,                                 /* add ecx, ebx */
+    0x81, 0xFB, 0xFF, 0x00, 0x00, 0x00,         /* cmp ebx, 255 */
+    0x74, 0xF0,                                 /* je literals_ext */
+    /* literals: */
+    0xF3, 0xA4,                                 /* rep movsb */
+    0x48, 0x39, 0xD6,                           /* cmp rsi, rdx */
+    0x73, 0x33,                                 /* jae lz_done */
+    0x0F, 0xB7, 0x1E,                           /* movzx ebx, word ptr [rsi] */
+    0x48, 0x83, 0xC6, 0x02,                     /* add rsi, 2 */
+    0x89, 0xC1,                                 /* mov ecx, eax */
+    0x83, 0xE1, 0x0F,                           /* and ecx, 15 */
+    0x83, 0xF9, 0x0F,                           /* cmp ecx, 15 */
+    0x75, 0x0F,                                 /* jne match */
+    /* match_ext: */
+    0x0F, 0xB6, 0x06,                           /* movzx eax, byte ptr [rsi] */
+    0x48, 0xFF, 0xC6,                           /* inc rsi */
+    0x01, 0xC1,                                 /* add ecx, eax */
+    0x3D, 0xFF, 0x00, 0x00, 0x00,               /* cmp eax, 255 */
+    0x74, 0xF1,                                 /* je match_ext */
+    /* match: */
+    0x83, 0xC1, 0x04,                           /* add ecx, 4 */
+    0x48, 0x89, 0xF0,                           /* mov rax, rsi */
+    0x48, 0x89, 0xFE,                           /* mov rsi, rdi */
+    0x48, 0x29, 0xDE,                           /* sub rsi, rbx */
+    0xF3, 0xA4,                                 /* rep movsb */
+    0x48, 0x89, 0xC6,                           /* mov rsi, rax */
+    0xEB, 0xA1,                                 /* jmp lz_loop */
+    /* lz_done: */
+    0x49, 0x83, 0xC1, 0x10,                     /* add r9, 16 */
+    0x41, 0xFF, 0xCB,                           /* dec r11d */
+    0xE9, 0x7C, 0xFF, 0xFF, 0xFF,               /* jmp block_loop */
+    /* blocks_done: */
+    0x48, 0x89, 0xEA,                           /* mov rdx, rbp */
+    0x49, 0x2B, 0x12,                           /* sub rdx, qword ptr [r10] */
+    0x74, 0x43,                                 /* jz relocs_done */
+    0x41, 0x8B, 0x72, 0x10,                     /* mov esi, dword ptr [r10 + 16] */
+    0x48, 0x01, 0xEE,                           /* add rsi, rbp */
+    0x45, 0x8B, 0x42, 0x14,                     /* mov r8d, dword ptr [r10 + 20] */
+    0x49, 0x01, 0xF0,                           /* add r8, rsi */
+    /* reloc_block: */
+    0x4C, 0x39, 0xC6,                           /* cmp rsi, r8 */
+    0x73, 0x30,                                 /* jae relocs_done */
+    0x8B, 0x3E,                                 /* mov edi, dword ptr [rsi] */
+    0x48, 0x01, 0xEF,                           /* add rdi, rbp */
+    0x8B, 0x4E, 0x04,                           /* mov ecx, dword ptr [rsi + 4] */
+    0x48, 0x01, 0xF1,                           /* add rcx, rsi */
+    0x48, 0x83, 0xC6, 0x08,                     /* add rsi, 8 */
+    /* reloc_entry: */
+    0x48, 0x39, 0xCE,                           /* cmp rsi, rcx */
+    0x73, 0xE7,                                 /* jae reloc_block */
+    0x0F, 0xB7, 0x06,                           /* movzx eax, word ptr [rsi] */
+    0x48, 0x83, 0xC6, 0x02,                     /* add rsi, 2 */
+    0x89, 0xC3,                                 /* mov ebx, eax */
+    0xC1, 0xEB, 0x0C,                           /* shr ebx, 12 */
+    0x83, 0xFB, 0x0A,                           /* cmp ebx, 10 */
+    0x75, 0xEA,                                 /* jne reloc_entry */
+    0x25, 0xFF, 0x0F, 0x00, 0x00,               /* and eax, 0xFFF */
+    0x48, 0x01, 0x14, 0x07,                     /* add qword ptr [rdi + rax], rdx */
+    0xEB, 0xDF,                                 /* jmp reloc_entry */
+    /* relocs_done: */
+    0x41, 0xC7, 0x42, 0x1C, 0x01, 0x00, 0x00, 0x00,/* mov dword ptr [r10 + 28], 1 */
+    /* done: */
+    0x5D,                                       /* pop rbp */
+    0x5F,                                       /* pop rdi */
+    0x5E,                                       /* pop rsi */
+    0x5B,                                       /* pop rbx */
+    0x41, 0x59,                                 /* pop r9 */
+    0x41, 0x58,                                 /* pop r8 */
+    0x5A,                                       /* pop rdx */
+    0x59,                                       /* pop rcx */
+    0xC3,                                       /* ret */
+    0xCC, 0xCC, 0xCC,                           /* padding */
+};
+
+/* ARMv7 Thumb-2 decompression stub */
+static const uint8_t PackStubArmNt[] = {
+    0x2D, 0xE9, 0xFF, 0x4F,                     /* push {r0-r11, lr} */
+    0xAF, 0xF2, 0x08, 0x04,                     /* adr r4, stub */
+    0x55, 0xA5,                                 /* adr r5, desc */
+    0xAE, 0x68,                                 /* ldr r6, [r5, #8] */
+    0xA4, 0x1B,                                 /* subs r4, r4, r6 */
+    0xEE, 0x69,                                 /* ldr r6, [r5, #28] */
+    0x00, 0x2E,                                 /* cmp r6, #0 */
+    0x40, 0xF0, 0x9E, 0x80,                     /* bne done */
+    0xAE, 0x69,                                 /* ldr r6, [r5, #24] */
+    0x05, 0xF1, 0x20, 0x07,                     /* add r7, r5, #32 */
+    /* block_loop: */
+    0x00, 0x2E,                                 /* cmp r6, #0 */
+    0x43, 0xD0,                                 /* beq blocks_done */
+    0xD7, 0xF8, 0x00, 0x80,                     /* ldr r8, [r7] */
+    0xA0, 0x44,                                 /* add r8, r4 */
+    0xD7, 0xF8, 0x04, 0x90,                     /* ldr r9, [r7, #4] */
+    0xA1, 0x44,                                 /* add r9, r4 */
+    0xD7, 0xF8, 0x08, 0xA0,                     /* ldr r10, [r7, #8] */
+    0xCA, 0x44,                                 /* add r10, r9 */
+    /* lz_loop: */
+    0xD1, 0x45,                                 /* cmp r9, r10 */
+    0x34, 0xD2,                                 /* bhs lz_done */
+    0x19, 0xF8, 0x01, 0xBB,                     /* ldrb r11, [r9], #1 */
+    0x4F, 0xEA, 0x1B, 0x1C,                     /* lsr r12, r11, #4 */
+    0xBC, 0xF1, 0x0F, 0x0F,                     /* cmp r12, #15 */
+    0x04, 0xD1,                                 /* bne literals */
+    /* literals_ext: */
+    0x19, 0xF8, 0x01, 0x5B,                     /* ldrb r5, [r9], #1 */
+    0xAC, 0x44,                                 /* add r12, r5 */
+    0xFF, 0x2D,                                 /* cmp r5, #255 */
+    0xFA, 0xD0,                                 /* beq literals_ext */
+    /* literals: */
+    0xBC, 0xF1, 0x00, 0x0F,                     /* cmp r12, #0 */
+    0x06, 0xD0,                                 /* beq literals_done */
+    /* literals_copy: */
+    0x19, 0xF8, 0x01, 0x5B,                     /* ldrb r5, [r9], #1 */
+    0x08, 0xF8, 0x01, 0x5B,                     /* strb r5, [r8], #1 */
+    0xBC, 0xF1, 0x01, 0x0C,                     /* subs r12, #1 */
+    0xF8, 0xD1,                                 /* bne literals_copy */
+    /* literals_done: */
+    0xD1, 0x45,                                 /* cmp r9, r10 */
+    0x1C, 0xD2,                                 /* bhs lz_done */
+    0x19, 0xF8, 0x01, 0x5B,                     /* ldrb r5, [r9], #1 */
+    0x19, 0xF8, 0x01, 0xCB,                     /* ldrb r12, [r9], #1 */
+    0x45, 0xEA, 0x0C, 0x25,                     /* orr r5, r5, r12, lsl #8 */
+    0x0B, 0xF0, 0x0F, 0x0C,                     /* and r12, r11, #15 */
+    0xBC, 0xF1, 0x0F, 0x0F,                     /* cmp r12, #15 */
+    0x05, 0xD1,                                 /* bne match */
+    /* match_ext: */
+    0x19, 0xF8, 0x01, 0xBB,                     /* ldrb r11, [r9], #1 */
+    0xDC, 0x44,                                 /* add r12, r11 */
+    0xBB, 0xF1, 0xFF, 0x0F,                     /* cmp r11, #255 */
+    0xF9, 0xD0,                                 /* beq match_ext */
+    /* match: */
+    0x0C, 0xF1, 0x04, 0x0C,                     /* add r12, #4 */
+    0xA8, 0xEB, 0x05, 0x0B,                     /* sub r11, r8, r5 */
+    /* match_copy: */
+    0x1B, 0xF8, 0x01, 0x5B,                     /* ldrb r5, [r11], #1 */
+    0x08, 0xF8, 0x01, 0x5B,                     /* strb r5, [r8], #1 */
+    0xBC, 0xF1, 0x01, 0x0C,                     /* subs r12, #1 */
+    0xF8, 0xD1,                                 /* bne match_copy */
+    0xC8, 0xE7,                                 /* b lz_loop */
+    /* lz_done: */
+    0x07, 0xF1, 0x10, 0x07,                     /* add r7, #16 */
+    0x01, 0x3E,                                 /* subs r6, #1 */
+    0xB9, 0xE7,                                 /* b block_loop */
+    /* blocks_done: */
+    0x2D, 0xA5,                                 /* adr r5, desc */
+    0x2E, 0x68,                                 /* ldr r6, [r5] */
+    0xA6, 0x1B,                                 /* subs r6, r4, r6 */
+    0x1F, 0xD0,                                 /* beq relocs_done */
+    0x2F, 0x69,                                 /* ldr r7, [r5, #16] */
+    0x27, 0x44,                                 /* add r7, r4 */
+    0xD5, 0xF8, 0x14, 0x80,                     /* ldr r8, [r5, #20] */
+    0xB8, 0x44,                                 /* add r8, r7 */
+    /* reloc_block: */
+    0x47, 0x45,                                 /* cmp r7, r8 */
+    0x18, 0xD2,                                 /* bhs relocs_done */
+    0xD7, 0xF8, 0x00, 0x90,                     /* ldr r9, [r7] */
+    0xA1, 0x44,                                 /* add r9, r4 */
+    0xD7, 0xF8, 0x04, 0xA0,                     /* ldr r10, [r7, #4] */
+    0xBA, 0x44,                                 /* add r10, r7 */
+    0x07, 0xF1, 0x08, 0x07,                     /* add r7, #8 */
+    /* reloc_entry: */
+    0x57, 0x45,                                 /* cmp r7, r10 */
+    0xF3, 0xD2,                                 /* bhs reloc_block */
+    0x37, 0xF8, 0x02, 0xBB,                     /* ldrh r11, [r7], #2 */
+    0x4F, 0xEA, 0x1B, 0x3C,                     /* lsr r12, r11, #12 */
+    0xBC, 0xF1, 0x03, 0x0F,                     /* cmp r12, #3 */
+    0xF6, 0xD1,                                 /* bne reloc_entry */
+    0xCB, 0xF3, 0x0B, 0x0B,                     /* ubfx r11, r11, #0, #12 */
+    0x59, 0xF8, 0x0B, 0xC0,                     /* ldr r12, [r9, r11] */
+    0xB4, 0x44,                                 /* add r12, r6 */
+    0x49, 0xF8, 0x0B, 0xC0,                     /* str r12, [r9, r11] */
+    0xEE, 0xE7,                                 /* b reloc_entry */
+    /* relocs_done: */
+    0x10, 0xEE, 0x30, 0xBF,                     /* mrc p15, 0, r11, c0, c0, 1 */
+    0xCB, 0xF3, 0x03, 0x4C,                     /* ubfx r12, r11, #16, #4 */
+    0x0B, 0xF0, 0x0F, 0x0B,                     /* and r11, r11, #15 */
+    0xE3, 0x45,                                 /* cmp r11, r12 */
+    0x88, 0xBF,                                 /* it hi */
+    0xE3, 0x46,                                 /* movhi r11, r12 */
+    0x5F, 0xF0, 0x04, 0x0C,                     /* movs r12, #4 */
+    0x0C, 0xFA, 0x0B, 0xFC,                     /* lsl r12, r12, r11 */
+    0xAC, 0xF1, 0x01, 0x0B,                     /* sub r11, r12, #1 */
+    0xAE, 0x69,                                 /* ldr r6, [r5, #24] */
+    0x05, 0xF1, 0x20, 0x07,                     /* add r7, r5, #32 */
+    /* flush_loop: */
+    0x00, 0x2E,                                 /* cmp r6, #0 */
+    0x10, 0xD0,                                 /* beq flush_done */
+    0xD7, 0xF8, 0x00, 0x80,                     /* ldr r8, [r7] */
+    0xA0, 0x44,                                 /* add r8, r4 */
+    0xD7, 0xF8, 0x0C, 0x90,                     /* ldr r9, [r7, #12] */
+    0xC1, 0x44,                                 /* add r9, r8 */
+    0x28, 0xEA, 0x0B, 0x08,                     /* bic r8, r8, r11 */
+    /* clean_line: */
+    0x07, 0xEE, 0x3B, 0x8F,                     /* mcr p15, 0, r8, c7, c11, 1 */
+    0xE0, 0x44,                                 /* add r8, r12 */
+    0xC8, 0x45,                                 /* cmp r8, r9 */
+    0xFA, 0xD3,                                 /* blo clean_line */
+    0x07, 0xF1, 0x10, 0x07,                     /* add r7, #16 */
+    0x01, 0x3E,                                 /* subs r6, #1 */
+    0xEC, 0xE7,                                 /* b flush_loop */
+    /* flush_done: */
+    0xBF, 0xF3, 0x4B, 0x8F,                     /* dsb ish */
+    0x07, 0xEE, 0x15, 0x6F,                     /* mcr p15, 0, r6, c7, c5, 0 */
+    0x07, 0xEE, 0xD5, 0x6F,                     /* mcr p15, 0, r6, c7, c5, 6 */
+    0xBF, 0xF3, 0x4B, 0x8F,                     /* dsb ish */
+    0xBF, 0xF3, 0x6F, 0x8F,                     /* isb */
+    0x01, 0x26,                                 /* movs r6, #1 */
+    0xEE, 0x61,                                 /* str r6, [r5, #28] */
+    /* done: */
+    0x03, 0xA5,                                 /* adr r5, desc */
+    0xD5, 0xF8, 0x0C, 0xC0,                     /* ldr r12, [r5, #12] */
+    0xA4, 0x44,                                 /* add r12, r4 */
+    0xBD, 0xE8, 0xFF, 0x4F,                     /* pop {r0-r11, lr} */
+    0x60, 0x47,                                 /* bx r12 */
+};
+
+/* AArch64 decompression stub */
+static const uint8_t PackStubArm64[] = {
+    0x09, 0x00, 0x00, 0x10,                     /* adr x9, stub */
+    0xEA, 0x0D, 0x00, 0x10,                     /* adr x10, desc */
+    0x4B, 0x09, 0x40, 0xB9,                     /* ldr w11, [x10, #8] */
+    0x29, 0x01, 0x0B, 0xCB,                     /* sub x9, x9, x11 */
+    0x4B, 0x1D, 0x40, 0xB9,                     /* ldr w11, [x10, #28] */
+    0xEB, 0x0C, 0x00, 0x35,                     /* cbnz w11, done */
+    0x4B, 0x19, 0x40, 0xB9,                     /* ldr w11, [x10, #24] */
+    0x4C, 0x81, 0x00, 0x91,                     /* add x12, x10, #32 */
+    /* block_loop: */
+    0x6B, 0x05, 0x00, 0x34,                     /* cbz w11, blocks_done */
+    0x8D, 0x39, 0x40, 0x29,                     /* ldp w13, w14, [x12] */
+    0x8F, 0x09, 0x40, 0xB9,                     /* ldr w15, [x12, #8] */
+    0x2D, 0x01, 0x0D, 0x8B,                     /* add x13, x9, x13 */
+    0x2E, 0x01, 0x0E, 0x8B,                     /* add x14, x9, x14 */
+    0xCF, 0x01, 0x0F, 0x8B,                     /* add x15, x14, x15 */
+    /* lz_loop: */
+    0xDF, 0x01, 0x0F, 0xEB,                     /* cmp x14, x15 */
+    0x22, 0x04, 0x00, 0x54,                     /* b.hs lz_done */
+    0xD0, 0x15, 0x40, 0x38,                     /* ldrb w16, [x14], #1 */
+    0x11, 0x7E, 0x04, 0x53,                     /* lsr w17, w16, #4 */
+    0x3F, 0x3E, 0x00, 0x71,                     /* cmp w17, #15 */
+    0xA1, 0x00, 0x00, 0x54,                     /* b.ne literals */
+    /* literals_ext: */
+    0xCA, 0x15, 0x40, 0x38,                     /* ldrb w10, [x14], #1 */
+    0x31, 0x02, 0x0A, 0x0B,                     /* add w17, w17, w10 */
+    0x5F, 0xFD, 0x03, 0x71,                     /* cmp w10, #255 */
+    0xA0, 0xFF, 0xFF, 0x54,                     /* b.eq literals_ext */
+    /* literals: */
+    0xB1, 0x00, 0x00, 0x34,                     /* cbz w17, literals_done */
+    /* literals_copy: */
+    0xCA, 0x15, 0x40, 0x38,                     /* ldrb w10, [x14], #1 */
+    0xAA, 0x15, 0x00, 0x38,                     /* strb w10, [x13], #1 */
+    0x31, 0x06, 0x00, 0x71,                     /* subs w17, w17, #1 */
+    0xA1, 0xFF, 0xFF, 0x54,                     /* b.ne literals_copy */
+    /* literals_done: */
+    0xDF, 0x01, 0x0F, 0xEB,                     /* cmp x14, x15 */
+    0x42, 0x02, 0x00, 0x54,                     /* b.hs lz_done */
+    0xCA, 0x15, 0x40, 0x38,                     /* ldrb w10, [x14], #1 */
+    0xD1, 0x15, 0x40, 0x38,                     /* ldrb w17, [x14], #1 */
+    0x4A, 0x21, 0x11, 0x2A,                     /* orr w10, w10, w17, lsl #8 */
+    0x11, 0x0E, 0x00, 0x12,                     /* and w17, w16, #15 */
+    0x3F, 0x3E, 0x00, 0x71,                     /* cmp w17, #15 */
+    0xA1, 0x00, 0x00, 0x54,                     /* b.ne match */
+    /* match_ext: */
+    0xD0, 0x15, 0x40, 0x38,                     /* ldrb w16, [x14], #1 */
+    0x31, 0x02, 0x10, 0x0B,                     /* add w17, w17, w16 */
+    0x1F, 0xFE, 0x03, 0x71,                     /* cmp w16, #255 */
+    0xA0, 0xFF, 0xFF, 0x54,                     /* b.eq match_ext */
+    /* match: */
+    0x31, 0x12, 0x00, 0x11,                     /* add w17, w17, #4 */
+    0xB0, 0x01, 0x0A, 0xCB,                     /* sub x16, x13, x10 */
+    /* match_copy: */
+    0x0A, 0x16, 0x40, 0x38,                     /* ldrb w10, [x16], #1 */
+    0xAA, 0x15, 0x00, 0x38,                     /* strb w10, [x13], #1 */
+    0x31, 0x06, 0x00, 0x71,                     /* subs w17, w17, #1 */
+    0xA1, 0xFF, 0xFF, 0x54,                     /* b.ne match_copy */
+    0xDF, 0xFF, 0xFF, 0x17,                     /* b lz_loop */
+    /* lz_done: */
+    0x8C, 0x41, 0x00, 0x91,                     /* add x12, x12, #16 */
+    0x6B, 0x05, 0x00, 0x51,                     /* sub w11, w11, #1 */
+    0xD6, 0xFF, 0xFF, 0x17,                     /* b block_loop */
+    /* blocks_done: */
+    0xAA, 0x07, 0x00, 0x10,                     /* adr x10, desc */
+    0x4B, 0x01, 0x40, 0xF9,                     /* ldr x11, [x10] */
+    0x2B, 0x01, 0x0B, 0xEB,                     /* subs x11, x9, x11 */
+    0xA0, 0x02, 0x00, 0x54,                     /* b.eq relocs_done */
+    0x4C, 0x35, 0x42, 0x29,                     /* ldp w12, w13, [x10, #16] */
+    0x2C, 0x01, 0x0C, 0x8B,                     /* add x12, x9, x12 */
+    0x8D, 0x01, 0x0D, 0x8B,                     /* add x13, x12, x13 */
+    /* reloc_block: */
+    0x9F, 0x01, 0x0D, 0xEB,                     /* cmp x12, x13 */
+    0x02, 0x02, 0x00, 0x54,                     /* b.hs relocs_done */
+    0x8E, 0x3D, 0x40, 0x29,                     /* ldp w14, w15, [x12] */
+    0x2E, 0x01, 0x0E, 0x8B,                     /* add x14, x9, x14 */
+    0x8F, 0x01, 0x0F, 0x8B,                     /* add x15, x12, x15 */
+    0x8C, 0x21, 0x00, 0x91,                     /* add x12, x12, #8 */
+    /* reloc_entry: */
+    0x9F, 0x01, 0x0F, 0xEB,                     /* cmp x12, x15 */
+    0x22, 0xFF, 0xFF, 0x54,                     /* b.hs reloc_block */
+    0x90, 0x25, 0x40, 0x78,                     /* ldrh w16, [x12], #2 */
+    0x11, 0x7E, 0x0C, 0x53,                     /* lsr w17, w16, #12 */
+    0x3F, 0x2A, 0x00, 0x71,                     /* cmp w17, #10 */
+    0x61, 0xFF, 0xFF, 0x54,                     /* b.ne reloc_entry */
+    0x10, 0x2E, 0x40, 0x92,                     /* and x16, x16, #0xFFF */
+    0xD1, 0x69, 0x70, 0xF8,                     /* ldr x17, [x14, x16] */
+    0x31, 0x02, 0x0B, 0x8B,                     /* add x17, x17, x11 */
+    0xD1, 0x69, 0x30, 0xF8,                     /* str x17, [x14, x16] */
+    0xF6, 0xFF, 0xFF, 0x17,                     /* b reloc_entry */
+    /* relocs_done: */
+    0x30, 0x00, 0x3B, 0xD5,                     /* mrs x16, ctr_el0 */
+    0x11, 0x4E, 0x50, 0xD3,                     /* ubfx x17, x16, #16, #4 */
+    0x10, 0x0E, 0x40, 0x92,                     /* and x16, x16, #0xF */
+    0x1F, 0x02, 0x11, 0xEB,                     /* cmp x16, x17 */
+    0x10, 0x32, 0x91, 0x9A,                     /* csel x16, x16, x17, lo */
+    0x91, 0x00, 0x80, 0xD2,                     /* mov x17, #4 */
+    0x31, 0x22, 0xD0, 0x9A,                     /* lsl x17, x17, x16 */
+    0x30, 0x06, 0x00, 0xD1,                     /* sub x16, x17, #1 */
+    0x4B, 0x19, 0x40, 0xB9,                     /* ldr w11, [x10, #24] */
+    0x4C, 0x81, 0x00, 0x91,                     /* add x12, x10, #32 */
+    /* flush_loop: */
+    0x6B, 0x02, 0x00, 0x34,                     /* cbz w11, flush_done */
+    0x8D, 0x01, 0x40, 0xB9,                     /* ldr w13, [x12] */
+    0x8E, 0x0D, 0x40, 0xB9,                     /* ldr w14, [x12, #12] */
+    0x2D, 0x01, 0x0D, 0x8B,                     /* add x13, x9, x13 */
+    0xAE, 0x01, 0x0E, 0x8B,                     /* add x14, x13, x14 */
+    0xAD, 0x01, 0x30, 0x8A,                     /* bic x13, x13, x16 */
+    0xEF, 0x03, 0x0D, 0xAA,                     /* mov x15, x13 */
+    /* clean_line: */
+    0x2F, 0x7B, 0x0B, 0xD5,                     /* dc cvau, x15 */
+    0xEF, 0x01, 0x11, 0x8B,                     /* add x15, x15, x17 */
+    0xFF, 0x01, 0x0E, 0xEB,                     /* cmp x15, x14 */
+    0xA3, 0xFF, 0xFF, 0x54,                     /* b.lo clean_line */
+    0x9F, 0x3B, 0x03, 0xD5,                     /* dsb ish */
+    /* invalidate_line: */
+    0x2D, 0x75, 0x0B, 0xD5,                     /* ic ivau, x13 */
+    0xAD, 0x01, 0x11, 0x8B,                     /* add x13, x13, x17 */
+    0xBF, 0x01, 0x0E, 0xEB,                     /* cmp x13, x14 */
+    0xA3, 0xFF, 0xFF, 0x54,                     /* b.lo invalidate_line */
+    0x8C, 0x41, 0x00, 0x91,                     /* add x12, x12, #16 */
+    0x6B, 0x05, 0x00, 0x51,                     /* sub w11, w11, #1 */
+    0xEE, 0xFF, 0xFF, 0x17,                     /* b flush_loop */
+    /* flush_done: */
+    0x9F, 0x3B, 0x03, 0xD5,                     /* dsb ish */
+    0xDF, 0x3F, 0x03, 0xD5,                     /* isb */
+    0x2B, 0x00, 0x80, 0x52,                     /* mov w11, #1 */
+    0x4B, 0x1D, 0x00, 0xB9,                     /* str w11, [x10, #28] */
+    /* done: */
+    0x8A, 0x00, 0x00, 0x10,                     /* adr x10, desc */
+    0x50, 0x0D, 0x40, 0xB9,                     /* ldr w16, [x10, #12] */
+    0x30, 0x01, 0x10, 0x8B,                     /* add x16, x9, x16 */
+    0x00, 0x02, 0x1F, 0xD6,                     /* br x16 */
+};
+
+/* Pack stubs, each decompresses all blocks, relocates them and jumps to the original entry point */
+static PE_PACK_STUB PackStubs[] = {
+    {PE_MACHINE_I386, PE_RELOCATION_HIGHLOW, PackStubI386, sizeof(PackStubI386)},
+    {PE_MACHINE_AMD64, PE_RELOCATION_DIR64, PackStubAmd64, sizeof(PackStubAmd64)},
+    {PE_MACHINE_ARMNT, PE_RELOCATION_HIGHLOW, PackStubArmNt, sizeof(PackStubArmNt)},
+    {PE_MACHINE_ARM64, PE_RELOCATION_DIR64, PackStubArm64, sizeof(PackStubArm64)}
+};
+
+/* Directories searched for DLLs when binding imports */
+static const char *BindPaths[PE_MAX_BIND_PATHS];
+static int BindPathCount;
+
+/* Adds a module to the bound import directory */
+static PPE_BOUND_ENTRY AddBoundEntry(PPE_BIND_CONTEXT Context, const char *Name, uint32_t TimeDateStamp)
+{
+    PPE_BOUND_ENTRY Entries;
+
+    /* Grow the list if needed */
+    if(Context->EntryCount == Context->EntryCapacity)
+    {
+        Context->EntryCapacity = Context->EntryCapacity ? Context->EntryCapacity * 2 : 16;
+        Entries = (PPE_BOUND_ENTRY)realloc(Context->Entries, Context->EntryCapacity * sizeof(PE_BOUND_ENTRY));
+        if(Entries == NULL)
+        {
+            return NULL;
+        }
+        Context->Entries = Entries;
+    }
+
+    /* Initialize the entry */
+    Entries = &Context->Entries[Context->EntryCount++];
+    snprintf(Entries->Name, PE_MAX_MODULE_NAME, "%s", Name);
+    Entries->TimeDateStamp = TimeDateStamp;
+    Entries->References = 0;
+    return Entries;
+}
+
+/* Queues a value to be written to the image once all imports are resolved */
+static int AddBindWrite(PPE_BIND_CONTEXT Context, uint8_t *Target, uint64_t Value, int Size)
+{
+    PPE_BIND_WRITE Writes;
+
+    /* Grow the list if needed */
+    if(Context->WriteCount == Context->WriteCapacity)
+    {
+        Context->WriteCapacity = Context->WriteCapacity ? Context->WriteCapacity * 2 : 256;
+        Writes = (PPE_BIND_WRITE)realloc(Context->Writes, Context->WriteCapacity * sizeof(PE_BIND_WRITE));
+        if(Writes == NULL)
+        {
+            return -1;
+        }
+        Context->Writes = Writes;
+    }
+
+    /* Store the write */
+    Context->Writes[Context->WriteCount].Target = Target;
+    Context->Writes[Context->WriteCount].Value = Value;
+    Context->Writes[Context->WriteCount].Size = Size;
+    Context->WriteCount++;
+    return 0;
+}
+
+/* Adds every file found in the directory tree for analysis, along with its counterpart in the baseline tree */
+static int AddDirectory(PPE_EDIT_LIST List, const char *Path, const char *Baseline)
+{
+    char BaselinePath[2048];
+    char EntryPath[2048];
+    struct dirent *Entry;
+    struct stat Stat;
+    PPE_EDIT Edit;
+    DIR *Directory;
+    int Result = 0;
+
+    /* Open the directory */
+    Directory = opendir(Path);
+    if(Directory == NULL)
+    {
+        printf("Error: unable to open directory %s\n", Path);
+        return -1;
+    }
+
+    /* Walk all entries, skipping . and .. */
+    while(Result == 0 && (Entry = readdir(Directory)) != NULL)
+    {
+        if(strcmp(Entry->d_name, ".") == 0 || strcmp(Entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        snprintf(EntryPath, sizeof(EntryPath), "%s%c%s", Path, PATH_SEP, Entry->d_name);
+        if(Baseline)
+        {
+            snprintf(BaselinePath, sizeof(BaselinePath), "%s%c%s", Baseline, PATH_SEP, Entry->d_name);
+        }
+        if(stat(EntryPath, &Stat) != 0)
+        {
+            continue;
+        }
+
+        /* Descend into subdirectories, files that turn out not to be PE images are skipped later */
+        if(S_ISDIR(Stat.st_mode))
+        {
+            Result = AddDirectory(List, EntryPath, Baseline ? BaselinePath : NULL);
+        }
+        else if(S_ISREG(Stat.st_mode))
+        {
+            Edit = AddEdit(List, EntryPath);
+            if(Edit == NULL || (Baseline && (Edit->BaselineName = strdup(BaselinePath)) == NULL))
+            {
+                Result = -1;
+                break;
+            }
+            Edit->Analyze = PE_ANALYZE_SCANNED;
+        }
+    }
+
+    /* Close the directory */
+    closedir(Directory);
+    return Result;
+}
+
+/* Adds a new image edit to the list */
+static PPE_EDIT AddEdit(PPE_EDIT_LIST List, const char *FileName)
+{
+    PPE_EDIT Edit;
+    PPE_EDIT Items;
+
+    /* Grow the list if needed */
+    if(List->Count == List->Capacity)
+    {
+        List->Capacity = List->Capacity ? List->Capacity * 2 : 64;
+        Items = (PPE_EDIT)realloc(List->Items, List->Capacity * sizeof(PE_EDIT));
+        if(Items == NULL)
+        {
+            /* Memory allocation failed */
+            printf("Error: unable to allocate memory for edit list\n");
+            return NULL;
+        }
+        List->Items = Items;
+    }
+
+    /* Initialize the edit */
+    Edit = &List->Items[List->Count];
+    memset(Edit, 0, sizeof(PE_EDIT));
+    Edit->FileName = strdup(FileName);
+    if(Edit->FileName == NULL)
+    {
+        /* Memory allocation failed */
+        printf("Error: unable to allocate memory for edit list\n");
+        return NULL;
+    }
+
+    /* Return the new edit */
+    List->Count++;
+    return Edit;
+}
+
+/* Adds the same set of edits for every file matching the pattern */
+static int AddGlob(PPE_EDIT_LIST List, const char *Pattern, char **Edits, int Count)
 {
+    PPE_EDIT Edit;
     int Index;
-    int SubSystemsCount;
-    PPE_SUBSYSTEM SubSystem;
+    int Token;
+#ifdef _WIN32
+    WIN32_FIND_DATAA FindData;
+    HANDLE FindHandle;
+    const char *Separator;
+    char Path[2048];
+    int Result = 0;
 
-    /* Count number of subsystems avaialble */
-    SubSystemsCount = sizeof(SubSystems) / sizeof(PE_SUBSYSTEM);
+    /* Find all matching files, the pattern can contain wildcards in its last component only */
+    FindHandle = FindFirstFileA(Pattern, &FindData);
+    if(FindHandle == INVALID_HANDLE_VALUE)
+    {
+        printf("Error: no files match %s\n", Pattern);
+        return -1;
+    }
+    Separator = _tcsrchrs(Pattern, '/', '\\');
+    do
+    {
+        /* Skip directories */
+        if(FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            continue;
+        }
 
-    /* Find subsystem */
-    for(Index = 0; Index < SubSystemsCount; Index++)
+        /* Build the full path and add the edit */
+        snprintf(Path, sizeof(Path), "%.*s%s", Separator ? (int)(Separator - Pattern + 1) : 0, Pattern,
+                 FindData.cFileName);
+        Edit = AddEdit(List, Path);
+        for(Token = 0; Edit && Token < Count; Token++)
+        {
+            if(ParseEdit(Edit, Edits[Token]) != 0)
+            {
+                Edit = NULL;
+            }
+        }
+        if(Edit == NULL)
+        {
+            Result = -1;
+            break;
+        }
+    }
+    while(FindNextFileA(FindHandle, &FindData));
+    FindClose(FindHandle);
+    return Result;
+#else
+    glob_t Matches;
+
+    /* Find all matching files */
+    if(glob(Pattern, 0, NULL, &Matches) != 0)
     {
-        SubSystem = &SubSystems[Index];
-        if(strcasecmp(SubSystem->Name, Name) == 0)
+        printf("Error: no files match %s\n", Pattern);
+        return -1;
+    }
+
+    /* Add the edits for every file */
+    for(Index = 0; Index < (int)Matches.gl_pathc; Index++)
+    {
+        Edit = AddEdit(List, Matches.gl_pathv[Index]);
+        if(Edit == NULL)
         {
-            /* Subsystem found, return its ID */
-            return SubSystem;
+            globfree(&Matches);
+            return -1;
+        }
+        for(Token = 0; Token < Count; Token++)
+        {
+            if(ParseEdit(Edit, Edits[Token]) != 0)
+            {
+                globfree(&Matches);
+                return -1;
+            }
         }
     }
 
-	/* No valid subsystem found */
-    return &SubSystems[0];
+    /* Free the matches */
+    globfree(&Matches);
+    return 0;
+#endif
 }
 
-char *getSubSystemName(int Identifier)
+/* Adds the size to the profile item, creating it if needed */
+static int AddProfileItem(PPE_PROFILE Profile, const char *Name, uint64_t Size, uint64_t Count)
 {
+    PPE_PROFILE_ITEM Items;
     int Index;
-    int SubSystemsCount;
-    PPE_SUBSYSTEM SubSystem;
 
-    /* Count number of subsystems avaialble */
-    SubSystemsCount = sizeof(SubSystems) / sizeof(PE_SUBSYSTEM);
+    /* Items with the same name, like debug entries of the same type, are merged */
+    for(Index = 0; Index < Profile->Count; Index++)
+    {
+        if(strcmp(Profile->Items[Index].Name, Name) == 0)
+        {
+            Profile->Items[Index].Size += Size;
+            Profile->Items[Index].Count += Count;
+            return 0;
+        }
+    }
 
-    /* Find subsystem */
-    for(Index = 0; Index < SubSystemsCount; Index++)
+    /* Grow the list if needed */
+    if(Profile->Count == Profile->Capacity)
     {
-        SubSystem = &SubSystems[Index];
-        if(SubSystem->Identifier == Identifier)
+        Profile->Capacity = Profile->Capacity ? Profile->Capacity * 2 : 32;
+        Items = (PPE_PROFILE_ITEM)realloc(Profile->Items, Profile->Capacity * sizeof(PE_PROFILE_ITEM));
+        if(Items == NULL)
         {
-            /* Subsystem found, return its ID */
-            return SubSystem->Name;
+            return -1;
         }
+        Profile->Items = Items;
     }
 
-	/* No valid subsystem found */
-    return SubSystems[0].Name;
+    /* Add the item */
+    snprintf(Profile->Items[Profile->Count].Name, PE_PROFILE_NAME_SIZE, "%s", Name);
+    Profile->Items[Profile->Count].Size = Size;
+    Profile->Items[Profile->Count].Count = Count;
+    Profile->Count++;
+    return 0;
 }
 
-int main(int argc, char *argv[])
+/* Applies all edits to a single image in one pass over the mapped file */
+static int ApplyEdit(PPE_EDIT Edit)
 {
-    FILE *ExeFile;
-    unsigned char Signature[4];
-    unsigned int HeaderOffset;
+    PE_IMAGE Image;
     unsigned int ImageSignature;
     unsigned short SubSystem;
-    PPE_SUBSYSTEM NewSubSystem;
+    uint32_t OldChecksum;
+    uint32_t Relocations;
+    uint32_t Checksum;
+    uint64_t Value;
+    size_t Length;
+    int Field;
 
-    /* Check for proper number of arguments */
-    if(argc != 3)
+    /* Map the EXE file and validate its headers */
+    Edit->Status = OpenImage(&Image, Edit->FileName, 1);
+    if(Edit->Status == PE_STATUS_OPEN_FAILED)
     {
-        printf("Usage: %s <filename> <new SubSystem>\n", argv[0]);
-        return 1;
+        /* Failed to open PE file */
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "ERROR: Unable to open file %s\n", Edit->FileName);
+        return Edit->Status;
+    }
+    else if(Edit->Status != PE_STATUS_SUCCESS)
+    {
+        /* Invalid PE file */
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: %s is not a valid PE file\n", Edit->FileName);
+        return Edit->Status;
     }
 
-    /* Parse the new SubSystem value from the command line argument */
-    NewSubSystem = getSubSystem(argv[2]);
-    if(NewSubSystem->Identifier == 0)
+    /* Validate all edits before touching the image, so it is either fully edited or left intact */
+    if(ValidateEdit(&Image, Edit) != 0)
     {
-        /* Invalid SubSystem provided */
-        printf("Error: %s is not a valid PE SubSystem\n", argv[2]);
-        return 1;
+        CloseImage(&Image);
+        Edit->Status = PE_STATUS_INVALID_EDIT;
+        return Edit->Status;
     }
 
-    /* Open the EXE file in binary mode */
-    ExeFile = fopen(argv[1], "r+b");
-    if(ExeFile == NULL)
+    /* Packing and relayout can still fail to allocate memory or grow the file, so they edit a private copy */
+    if((Edit->Pack || Edit->Relayout) && StageImage(&Image) != 0)
     {
-        /* Failed to open PE file */
-        printf("ERROR: Unable to open file %s\n", argv[1]);
-        return 2;
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: out of memory\n");
+        CloseImage(&Image);
+        Edit->Status = PE_STATUS_EDIT_FAILED;
+        return Edit->Status;
     }
-    
-    /* Verify that the input file has a valid DOS header */
-    fread(Signature, sizeof(unsigned char), 4, ExeFile);
-    if(Signature[0] != 'M' || Signature[1] != 'Z')
+
+    /* Bind imports first, this fails without modifying the image if the bound imports do not fit */
+    if(Edit->Bind)
     {
-        /* Invalid DOS header */
-        printf("ERROR: %s is not a valid EXE file\n", argv[1]);
-        fclose(ExeFile);
-        return 3;
+        if(BindImage(&Image, Edit->Message, PE_MESSAGE_SIZE) != 0)
+        {
+            CloseImage(&Image);
+            Edit->Status = PE_STATUS_INVALID_EDIT;
+            return Edit->Status;
+        }
     }
 
-    /* Verify that the input file has a valid PE header */
-    fseek(ExeFile, 0x3C, SEEK_SET);
-    fread(&HeaderOffset, sizeof(unsigned int), 1, ExeFile);
-    fseek(ExeFile, HeaderOffset, SEEK_SET);
-    fread(Signature, sizeof(unsigned char), 4, ExeFile);
-    if((Signature[0] != 'P' || Signature[1] != 'E' || Signature[2] != 0 || Signature[3] != 0) &&
-       (Signature[0] != 'P' || Signature[1] != 'E' || Signature[2] != 'X' || Signature[3] != 'T'))
+    /* Check if changing the subsystem */
+    if(Edit->SubSystem)
     {
-        /* Invalid PE header */
-        printf("Error: %s is not a valid PE file\n", argv[1]);
-        fclose(ExeFile);
-        return 3;
+        /* Check if setting XT subsystem */
+        if(Edit->SubSystem->Identifier >= 0x14 && Edit->SubSystem->Identifier <= 0x19)
+        {
+            /* Write PEXT signature */
+            ImageSignature = PE_XT_SIGNATURE;
+        }
+        else
+        {
+            /* Write PE00 signature */
+            ImageSignature = PE_NT_SIGNATURE;
+        }
+
+        /* Update the signature and the SubSystem field in the optional header */
+        SubSystem = (unsigned short)GetField(&Image, PE_FIELD_SUBSYSTEM);
+        SetSignature(&Image, ImageSignature);
+        SetField(&Image, PE_FIELD_SUBSYSTEM, Edit->SubSystem->Identifier);
+        Length = strlen(Edit->Message);
+        snprintf(Edit->Message + Length, PE_MESSAGE_SIZE - Length, "PE SubSystem modified: 0x%02X <%s> to 0x%02X <%s>\n",
+                 SubSystem, getSubSystemName(SubSystem), Edit->SubSystem->Identifier, Edit->SubSystem->Name);
     }
 
-    /* Check if setting XT subsystem */
-    if(NewSubSystem->Identifier >= 0x14 && NewSubSystem->Identifier <= 0x19)
+    /* Apply base relocations before the new ImageBase is written */
+    if(Edit->Rebase)
     {
-        /* Write PEXT signature */
-        ImageSignature = 0x54584550;
+        RelocateImage(&Image, Edit->Values[PE_FIELD_IMAGE_BASE] - GetField(&Image, PE_FIELD_IMAGE_BASE), 1,
+                      &Relocations);
+        Length = strlen(Edit->Message);
+        snprintf(Edit->Message + Length, PE_MESSAGE_SIZE - Length, "PE image rebased: %u relocations applied\n",
+                 Relocations);
     }
-    else
+
+    /* Update all other header fields */
+    for(Field = 0; Field < PE_FIELD_COUNT; Field++)
+    {
+        if(Edit->FieldMask & (1U << Field))
+        {
+            Value = GetField(&Image, Field);
+            SetField(&Image, Field, Edit->Values[Field]);
+            Length = strlen(Edit->Message);
+            snprintf(Edit->Message + Length, PE_MESSAGE_SIZE - Length, "PE %s modified: 0x%" PRIX64 " to 0x%" PRIX64 "\n",
+                     Fields[Field].Name, Value, Edit->Values[Field]);
+        }
+    }
+
+    /* Strip relocations, so that the image can only be loaded at its ImageBase */
+    if(Edit->StripRelocations)
+    {
+        Length = strlen(Edit->Message);
+        StripRelocations(&Image, Edit->Message + Length, PE_MESSAGE_SIZE - Length);
+    }
+
+    /* Pack sections once their contents and relocations are final */
+    if(Edit->Pack)
+    {
+        Length = strlen(Edit->Message);
+        if(PackImage(&Image, Edit->Message + Length, PE_MESSAGE_SIZE - Length) != 0)
+        {
+            /* Private copy is discarded, the file is left intact */
+            CloseImage(&Image);
+            Edit->Status = PE_STATUS_EDIT_FAILED;
+            return Edit->Status;
+        }
+    }
+
+    /* Move sections to their RVAs once no more sections are added or removed */
+    if(Edit->Relayout)
+    {
+        Length = strlen(Edit->Message);
+        if(RelayoutImage(&Image, 1, Edit->Message + Length, PE_MESSAGE_SIZE - Length) != 0)
+        {
+            /* Private copy is discarded, the file is left intact */
+            CloseImage(&Image);
+            Edit->Status = PE_STATUS_EDIT_FAILED;
+            return Edit->Status;
+        }
+    }
+
+    /* Normalize build-specific identifiers once the rest of the headers is final */
+    if(Edit->Normalize != PE_NORMALIZE_NONE)
     {
-        /* Write PE00 signature */
-        ImageSignature = 0x00004550;
+        Length = strlen(Edit->Message);
+        NormalizeImage(&Image, Edit->Normalize, 1, Edit->Message + Length, PE_MESSAGE_SIZE - Length);
     }
 
-    /* Seek back to header offset and write new signature */
-    fseek(ExeFile, HeaderOffset, SEEK_SET);
-    fwrite(&ImageSignature, sizeof(ImageSignature), 1, ExeFile);
+    /* Fix the checksum once all other fields are in place */
+    Checksum = UpdateChecksum(&Image, &OldChecksum);
+    if(Edit->Checksum || Checksum != OldChecksum)
+    {
+        Length = strlen(Edit->Message);
+        snprintf(Edit->Message + Length, PE_MESSAGE_SIZE - Length, "PE CheckSum %s: 0x%08X to 0x%08X\n",
+                 (Checksum != OldChecksum) ? "updated" : "verified", OldChecksum, Checksum);
+    }
 
-    /* Seek to the offset of the SubSystem field in the optional header */
-    fseek(ExeFile, HeaderOffset + 0x5C, SEEK_SET);
+    /* Write back the private copy, the file is left intact if it cannot be grown */
+    if(Image.View && CommitImage(&Image) != 0)
+    {
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: unable to resize file %s\n", Edit->FileName);
+        CloseImage(&Image);
+        Edit->Status = PE_STATUS_EDIT_FAILED;
+        return Edit->Status;
+    }
 
-    /* Read the current SubSystem value */
-    fread(&SubSystem, sizeof(unsigned short), 1, ExeFile);
+    /* Write back all changes at once and unmap the file */
+    if(CloseImage(&Image) != 0)
+    {
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: unable to write file %s\n", Edit->FileName);
+        Edit->Status = PE_STATUS_OPEN_FAILED;
+    }
 
-    /* Seek back to the SubSystem field in the optional header */
-    fseek(ExeFile, -(long)sizeof(unsigned short), SEEK_CUR);
+    /* Return status */
+    return Edit->Status;
+}
 
-    /* Write the new SubSystem value */
-    fwrite(&NewSubSystem->Identifier, sizeof(unsigned short), 1, ExeFile);
+/* Appends the base relocation block, padding it to a 32-bit boundary */
+static void AddRelocationBlock(uint8_t *Buffer, uint32_t *Length, uint32_t Page, uint16_t *Entries, uint32_t Count)
+{
+    uint32_t Index;
 
-    /* Close the file */
-    fclose(ExeFile);
+    /* Skip empty blocks */
+    if(Count == 0)
+    {
+        return;
+    }
 
-    /* Finished successfully */
-    printf("PE SubSystem modified: 0x%02X <%s> to 0x%02X <%s>\n",
-           SubSystem, getSubSystemName(SubSystem), NewSubSystem->Identifier, NewSubSystem->Name);
-    return 0;
+    /* Pad with an absolute entry */
+    if(Count & 1)
+    {
+        Entries[Count++] = PE_RELOCATION_ABSOLUTE;
+    }
+
+    /* Write the block header and its entries */
+    WriteUint32(Buffer + *Length, Page);
+    WriteUint32(Buffer + *Length + 4, 8 + Count * 2);
+    for(Index = 0; Index < Count; Index++)
+    {
+        WriteUint16(Buffer + *Length + 8 + Index * 2, Entries[Index]);
+    }
+    *Length += 8 + Count * 2;
+}
+
+/* Profiles the image and its baseline build without modifying them */
+static int AnalyzeImage(PPE_EDIT Edit)
+{
+    PE_IMAGE Image;
+
+    /* Map the image read-only and break it down */
+    Edit->Status = OpenImage(&Image, Edit->FileName, 0);
+    if(Edit->Status != PE_STATUS_SUCCESS)
+    {
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, (Edit->Status == PE_STATUS_OPEN_FAILED) ? "unable to open file" :
+                 "not a valid PE file");
+        return Edit->Status;
+    }
+    if(ProfileImage(&Image, &Edit->Profile) != 0)
+    {
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "unable to allocate memory for the profile");
+        Edit->Status = PE_STATUS_OPEN_FAILED;
+    }
+    CloseImage(&Image);
+
+    /* Baseline is optional, images missing in the old build are reported as added */
+    if(Edit->Status == PE_STATUS_SUCCESS && Edit->BaselineName &&
+       OpenImage(&Image, Edit->BaselineName, 0) == PE_STATUS_SUCCESS)
+    {
+        Edit->HasBaseline = 1;
+        if(ProfileImage(&Image, &Edit->Baseline) != 0)
+        {
+            snprintf(Edit->Message, PE_MESSAGE_SIZE, "unable to allocate memory for the profile");
+            Edit->Status = PE_STATUS_OPEN_FAILED;
+        }
+        CloseImage(&Image);
+    }
+
+    /* Return status */
+    return Edit->Status;
+}
+
+/* Compares the time needed to read the raw image with reading the packed image and decompressing it,
+   the decompression time is an estimate measured with the host decoder rather than the boot stub */
+static int BenchmarkImage(PPE_EDIT Edit)
+{
+    PE_PACKAGE Package;
+    PE_IMAGE Image;
+    uint8_t *Block;
+    uint8_t *Output;
+    uint32_t Produced;
+    uint32_t Capacity = 0;
+    uint32_t Index;
+    double Bandwidth;
+    double Elapsed;
+    double Start;
+    int Runs = 0;
+
+    /* Map the image read-only */
+    Edit->Status = OpenImage(&Image, Edit->FileName, 0);
+    if(Edit->Status != PE_STATUS_SUCCESS)
+    {
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: %s is not a valid PE file\n", Edit->FileName);
+        return Edit->Status;
+    }
+
+    /* Pack the image in memory */
+    if(BuildPackage(&Image, &Package, 1, Edit->Message, PE_MESSAGE_SIZE) != 0)
+    {
+        FreePackage(&Package);
+        CloseImage(&Image);
+        Edit->Status = PE_STATUS_INVALID_EDIT;
+        return Edit->Status;
+    }
+    for(Index = 0; Index < Package.BlockCount; Index++)
+    {
+        Block = Package.Data + Package.Stub->Size + PE_PACK_HEADER_SIZE + Index * PE_PACK_BLOCK_SIZE;
+        Capacity = (ReadUint32(Block + PE_PACK_BLOCK_TARGET_SIZE) > Capacity) ?
+                   ReadUint32(Block + PE_PACK_BLOCK_TARGET_SIZE) : Capacity;
+    }
+    Output = (uint8_t *)malloc(Capacity ? Capacity : 1);
+    if(Output == NULL)
+    {
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: out of memory\n");
+        FreePackage(&Package);
+        CloseImage(&Image);
+        Edit->Status = PE_STATUS_OPEN_FAILED;
+        return Edit->Status;
+    }
+
+    /* Decompress all blocks until the measurement is long enough */
+    Start = get_timestamp();
+    do
+    {
+        for(Index = 0; Index < Package.BlockCount; Index++)
+        {
+            Block = Package.Data + Package.Stub->Size + PE_PACK_HEADER_SIZE + Index * PE_PACK_BLOCK_SIZE;
+            DecompressData(Package.Data + ReadUint32(Block + PE_PACK_BLOCK_SOURCE) - Package.VirtualAddress,
+                           ReadUint32(Block + PE_PACK_BLOCK_SOURCE_SIZE), Output,
+                           ReadUint32(Block + PE_PACK_BLOCK_TARGET_SIZE), &Produced);
+        }
+        Runs++;
+        Elapsed = get_timestamp() - Start;
+    }
+    while(Elapsed < PE_PACK_BENCHMARK_TIME);
+
+    /* Simulate reading both images at the given media bandwidth */
+    Bandwidth = Edit->Bandwidth * 1024.0;
+    Edit->RawTime = Image.Size / Bandwidth;
+    Edit->PackedTime = Package.FileSize / Bandwidth + Elapsed / Runs;
+    snprintf(Edit->Message, PE_MESSAGE_SIZE, "PE pack benchmark at %u KB/s: raw %" PRIu64 " bytes in %.2f ms, "
+             "packed %" PRIu64 " bytes in %.2f ms including %.2f ms of decompression estimated with the host "
+             "decoder, %.2fx\n", Edit->Bandwidth,
+             Image.Size, Edit->RawTime * 1000, Package.FileSize, Edit->PackedTime * 1000, Elapsed / Runs * 1000,
+             Edit->RawTime / Edit->PackedTime);
+
+    /* Release resources */
+    free(Output);
+    FreePackage(&Package);
+    CloseImage(&Image);
+    return Edit->Status;
+}
+
+/* Resolves all imports against the DLL set, fills the IAT and writes the bound import directory */
+static int BindImage(PPE_IMAGE Image, char *Message, size_t Size)
+{
+    PE_BIND_CONTEXT Context;
+    PE_IMAGE Module;
+    PE_SECTION Section;
+    uint8_t *Descriptor;
+    uint8_t *NameThunk;
+    uint8_t *AddressThunk;
+    uint8_t *HintName;
+    const char *ModuleName;
+    const char *Name;
+    uint64_t Thunk;
+    uint64_t Address;
+    uint64_t OrdinalFlag;
+    uint32_t VirtualAddress;
+    uint32_t DirectorySize;
+    uint32_t PreviousSize;
+    uint32_t Directory;
+    uint32_t Limit;
+    uint32_t NameOffset;
+    uint32_t Index;
+    uint32_t Entry;
+    size_t Length;
+    int ThunkSize;
+    int Symbols = 0;
+    int Modules = 0;
+    int Bound = 0;
+    int Forwarded;
+    int Resolved;
+    int Entries;
+    int Writes;
+    int Result;
+
+    /* Initialize the context */
+    memset(&Context, 0, sizeof(PE_BIND_CONTEXT));
+    Context.FileName = Image->FileName;
+    ThunkSize = Image->Pe32Plus ? 8 : 4;
+    OrdinalFlag = 1ULL << (ThunkSize * 8 - 1);
+    Message[0] = '\0';
+
+    /* Resolve imports from every module */
+    for(Index = 0; (Descriptor = GetImportDescriptor(Image, Index)) != NULL; Index++)
+    {
+        Modules++;
+        ModuleName = RvaToString(Image, ReadUint32(Descriptor + PE_IMPORT_NAME));
+        NameThunk = RvaToPointer(Image, ReadUint32(Descriptor + PE_IMPORT_ORIGINAL_THUNK), ThunkSize);
+        if(ModuleName == NULL || NameThunk == NULL)
+        {
+            /* Without the lookup table binding would destroy the import names */
+            continue;
+        }
+
+        /* Remember the state, so that this module can be rolled back */
+        Entries = Context.EntryCount;
+        Writes = Context.WriteCount;
+        Forwarded = Context.Forwarded;
+        Resolved = Symbols;
+        Result = OpenModule(&Context, &Module, ModuleName);
+        if(Result != PE_STATUS_SUCCESS)
+        {
+            Length = strlen(Message);
+            snprintf(Message + Length, Size - Length, "PE import from %s not bound: module not found\n", ModuleName);
+        }
+        else
+        {
+            /* Add the module to the bound import directory, forwarder references follow it */
+            Context.Current = Context.EntryCount;
+            Result = AddBoundEntry(&Context, ModuleName, (uint32_t)GetField(&Module, PE_FIELD_TIME_DATE_STAMP)) ? 0 : -1;
+
+            /* Resolve every thunk */
+            for(Entry = 0; Result == 0; Entry++)
+            {
+                NameThunk = RvaToPointer(Image, ReadUint32(Descriptor + PE_IMPORT_ORIGINAL_THUNK) + Entry * ThunkSize,
+                                         ThunkSize);
+                AddressThunk = RvaToPointer(Image, ReadUint32(Descriptor + PE_IMPORT_FIRST_THUNK) + Entry * ThunkSize,
+                                            ThunkSize);
+                if(NameThunk == NULL || AddressThunk == NULL)
+                {
+                    Result = -1;
+                    break;
+                }
+                Thunk = (ThunkSize == 8) ? ReadUint64(NameThunk) : ReadUint32(NameThunk);
+                if(Thunk == 0)
+                {
+                    /* End of the table */
+                    break;
+                }
+
+                /* Import by ordinal or by name */
+                if(Thunk & OrdinalFlag)
+                {
+                    Name = NULL;
+                    HintName = NULL;
+                }
+                else
+                {
+                    HintName = RvaToPointer(Image, (uint32_t)Thunk, 2);
+                    Name = RvaToString(Image, (uint32_t)Thunk + 2);
+                    if(HintName == NULL || Name == NULL)
+                    {
+                        Result = -1;
+                        break;
+                    }
+                }
+                Result = ResolveImport(&Context, &Module, Name, HintName ? ReadUint16(HintName) : 0,
+                                       (uint32_t)(Thunk & 0xFFFF), &Address, 0);
+                if(Result != 0)
+                {
+                    Length = strlen(Message);
+                    if(Name)
+                    {
+                        snprintf(Message + Length, Size - Length, "PE import from %s not bound: %s not found\n",
+                                 ModuleName, Name);
+                    }
+                    else
+                    {
+                        snprintf(Message + Length, Size - Length, "PE import from %s not bound: ordinal %u not found\n",
+                                 ModuleName, (uint32_t)(Thunk & 0xFFFF));
+                    }
+                    break;
+                }
+                Result = AddBindWrite(&Context, AddressThunk, Address, ThunkSize);
+                Symbols++;
+            }
+            CloseImage(&Module);
+        }
+
+        /* Mark the descriptor as bound with the new-style bound import directory */
+        if(Result == 0)
+        {
+            Result = AddBindWrite(&Context, Descriptor + PE_IMPORT_TIME_DATE_STAMP, 0xFFFFFFFF, 4);
+        }
+        if(Result == 0)
+        {
+            Bound++;
+            continue;
+        }
+
+        /* Roll back and restore the IAT from the lookup table, in case the image was bound before */
+        Context.EntryCount = Entries;
+        Context.WriteCount = Writes;
+        Context.Forwarded = Forwarded;
+        Symbols = Resolved;
+        for(Entry = 0; ; Entry++)
+        {
+            NameThunk = RvaToPointer(Image, ReadUint32(Descriptor + PE_IMPORT_ORIGINAL_THUNK) + Entry * ThunkSize,
+                                     ThunkSize);
+            AddressThunk = RvaToPointer(Image, ReadUint32(Descriptor + PE_IMPORT_FIRST_THUNK) + Entry * ThunkSize,
+                                        ThunkSize);
+            if(NameThunk == NULL || AddressThunk == NULL)
+            {
+                break;
+            }
+            Thunk = (ThunkSize == 8) ? ReadUint64(NameThunk) : ReadUint32(NameThunk);
+            AddBindWrite(&Context, AddressThunk, Thunk, ThunkSize);
+            if(Thunk == 0)
+            {
+                break;
+            }
+        }
+        AddBindWrite(&Context, Descriptor + PE_IMPORT_TIME_DATE_STAMP, 0, 4);
+    }
+
+    /* Bound import directory is placed in the headers, right after the section table */
+    Directory = Image->SectionTable + Image->NumberOfSections * PE_SECTION_HEADER_SIZE;
+    Limit = (uint32_t)GetField(Image, PE_FIELD_SIZE_OF_HEADERS);
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        GetSection(Image, Index, &Section);
+        if(Section.SizeOfRawData && Section.PointerToRawData < Limit)
+        {
+            Limit = Section.PointerToRawData;
+        }
+    }
+    Limit = (Limit > Image->Size) ? (uint32_t)Image->Size : Limit;
+
+    /* Calculate the directory size, module names follow the descriptors */
+    DirectorySize = (Context.EntryCount + 1) * PE_BOUND_ENTRY_SIZE;
+    for(Index = 0; Index < (uint32_t)Context.EntryCount; Index++)
+    {
+        DirectorySize += (uint32_t)strlen(Context.Entries[Index].Name) + 1;
+    }
+
+    /* Make sure the directory fits in free space, possibly replacing the previous one */
+    GetDirectory(Image, PE_DIRECTORY_BOUND_IMPORT, &VirtualAddress, &PreviousSize);
+    if(Context.EntryCount && (Directory > Limit || DirectorySize > Limit - Directory))
+    {
+        snprintf(Message, Size, "Error: not enough space in headers for the bound import directory\n");
+        free(Context.Entries);
+        free(Context.Writes);
+        return -1;
+    }
+    for(Index = Directory; Context.EntryCount && Index < Directory + DirectorySize; Index++)
+    {
+        if(Image->Data[Index] && !(Index >= VirtualAddress && Index < VirtualAddress + PreviousSize))
+        {
+            snprintf(Message, Size, "Error: headers have no free space for the bound import directory\n");
+            free(Context.Entries);
+            free(Context.Writes);
+            return -1;
+        }
+    }
+
+    /* Clear the previous bound import directory */
+    if(PreviousSize && GetPointer(Image, VirtualAddress, PreviousSize) && VirtualAddress < Limit)
+    {
+        memset(Image->Data + VirtualAddress, 0, PreviousSize);
+    }
+
+    /* Apply all queued writes */
+    for(Index = 0; Index < (uint32_t)Context.WriteCount; Index++)
+    {
+        if(Context.Writes[Index].Size == 8)
+        {
+            WriteUint64(Context.Writes[Index].Target, Context.Writes[Index].Value);
+        }
+        else
+        {
+            WriteUint32(Context.Writes[Index].Target, (uint32_t)Context.Writes[Index].Value);
+        }
+    }
+    Image->Modified = 1;
+
+    /* Write the bound import directory */
+    if(Context.EntryCount)
+    {
+        NameOffset = (Context.EntryCount + 1) * PE_BOUND_ENTRY_SIZE;
+        memset(Image->Data + Directory, 0, DirectorySize);
+        for(Index = 0; Index < (uint32_t)Context.EntryCount; Index++)
+        {
+            WriteUint32(Image->Data + Directory + Index * PE_BOUND_ENTRY_SIZE, Context.Entries[Index].TimeDateStamp);
+            WriteUint16(Image->Data + Directory + Index * PE_BOUND_ENTRY_SIZE + 4, (uint16_t)NameOffset);
+            WriteUint16(Image->Data + Directory + Index * PE_BOUND_ENTRY_SIZE + 6, Context.Entries[Index].References);
+            strcpy((char *)Image->Data + Directory + NameOffset, Context.Entries[Index].Name);
+            NameOffset += (uint32_t)strlen(Context.Entries[Index].Name) + 1;
+        }
+        SetDirectory(Image, PE_DIRECTORY_BOUND_IMPORT, Directory, DirectorySize);
+    }
+    else
+    {
+        SetDirectory(Image, PE_DIRECTORY_BOUND_IMPORT, 0, 0);
+    }
+
+    /* Report the result */
+    Length = strlen(Message);
+    snprintf(Message + Length, Size - Length, "PE imports bound: %d of %d modules, %d symbols, %d forwarded\n",
+             Bound, Modules, Symbols, Context.Forwarded);
+    free(Context.Entries);
+    free(Context.Writes);
+    return 0;
+}
+
+/* Compresses all sections the loader does not need before the entry point and builds the pack section */
+static int BuildPackage(PPE_IMAGE Image, PPE_PACKAGE Package, int Compress, char *Message, size_t Size)
+{
+    PE_SECTION Section;
+    uint16_t *KeptEntries = NULL;
+    uint16_t *MovedEntries = NULL;
+    uint8_t *Directory = NULL;
+    uint8_t *Moved = NULL;
+    uint8_t *Header;
+    uint8_t *Block;
+    uint32_t VirtualAddress;
+    uint32_t DirectorySize = 0;
+    uint32_t BlockAddress;
+    uint32_t BlockSize;
+    uint32_t KeptCount;
+    uint32_t MovedCount;
+    uint32_t MovedSize = 0;
+    uint32_t Alignment;
+    uint32_t Capacity;
+    uint32_t Produced;
+    uint32_t Length;
+    uint32_t Offset;
+    uint32_t Target;
+    uint32_t Index;
+    uint32_t Entry;
+    uint64_t DataEnd;
+    uint64_t End = 0;
+    uint8_t *Output;
+    int Result = -1;
+    int Item;
+
+    /* Find the decompression stub for the target architecture */
+    memset(Package, 0, sizeof(PE_PACKAGE));
+    for(Index = 0; Index < sizeof(PackStubs) / sizeof(PackStubs[0]); Index++)
+    {
+        if(PackStubs[Index].Machine == GetField(Image, PE_FIELD_MACHINE))
+        {
+            Package->Stub = &PackStubs[Index];
+        }
+    }
+    if(Package->Stub == NULL)
+    {
+        snprintf(Message, Size, "Error: machine type 0x%04X cannot be packed\n",
+                 (unsigned int)GetField(Image, PE_FIELD_MACHINE));
+        return -1;
+    }
+
+    /* Signatures, TLS callbacks and managed code are used before the stub could run */
+    if(GetDirectory(Image, PE_DIRECTORY_SECURITY, &VirtualAddress, &Length) ||
+       GetDirectory(Image, PE_DIRECTORY_TLS, &VirtualAddress, &Length) ||
+       GetDirectory(Image, PE_DIRECTORY_COM_DESCRIPTOR, &VirtualAddress, &Length))
+    {
+        snprintf(Message, Size, "Error: signed images, images with TLS and managed images cannot be packed\n");
+        return -1;
+    }
+
+    /* Header of the pack section has to fit after the section table */
+    Offset = Image->SectionTable + Image->NumberOfSections * PE_SECTION_HEADER_SIZE;
+    Header = GetPointer(Image, Offset, PE_SECTION_HEADER_SIZE);
+    for(Index = 0; Header && Index < PE_SECTION_HEADER_SIZE && Header[Index] == 0; Index++);
+    if(Header == NULL || Index < PE_SECTION_HEADER_SIZE ||
+       Offset + PE_SECTION_HEADER_SIZE > GetField(Image, PE_FIELD_SIZE_OF_HEADERS))
+    {
+        snprintf(Message, Size, "Error: no room for another section header\n");
+        return -1;
+    }
+
+    /* Pack sections holding nothing the loader reads before the entry point runs */
+    Package->Packed = (uint8_t *)calloc(Image->NumberOfSections + 1, 1);
+    if(Package->Packed == NULL)
+    {
+        snprintf(Message, Size, "Error: out of memory\n");
+        return -1;
+    }
+    DataEnd = GetField(Image, PE_FIELD_SIZE_OF_HEADERS);
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        GetSection(Image, Index, &Section);
+        if(strcmp(Section.Name, PE_PACK_SECTION_NAME) == 0)
+        {
+            snprintf(Message, Size, "Error: image is already packed\n");
+            return -1;
+        }
+        if(Section.SizeOfRawData && (uint64_t)Section.PointerToRawData + Section.SizeOfRawData > Image->Size)
+        {
+            snprintf(Message, Size, "Error: raw data of section %s lies outside the file\n", Section.Name);
+            return -1;
+        }
+        Length = (Section.VirtualSize > Section.SizeOfRawData) ? Section.VirtualSize : Section.SizeOfRawData;
+        End = ((uint64_t)Section.VirtualAddress + Length > End) ? (uint64_t)Section.VirtualAddress + Length : End;
+        if(Section.SizeOfRawData && (uint64_t)Section.PointerToRawData + Section.SizeOfRawData > DataEnd)
+        {
+            DataEnd = (uint64_t)Section.PointerToRawData + Section.SizeOfRawData;
+        }
+
+        /* Exception data is only used after the entry point, everything else is needed by the loader */
+        Package->Packed[Index] = (Section.SizeOfRawData != 0);
+        for(Item = 0; Item < (int)Image->NumberOfDirectories; Item++)
+        {
+            if(Item != PE_DIRECTORY_EXCEPTION && GetDirectory(Image, Item, &VirtualAddress, &DirectorySize) &&
+               VirtualAddress < (uint64_t)Section.VirtualAddress + Length &&
+               (uint64_t)VirtualAddress + DirectorySize > Section.VirtualAddress)
+            {
+                Package->Packed[Index] = 0;
+            }
+        }
+    }
+
+    /* Sections with relocations the stub cannot apply stay unpacked */
+    DirectorySize = 0;
+    if(GetDirectory(Image, PE_DIRECTORY_BASERELOC, &VirtualAddress, &DirectorySize) &&
+       !(GetField(Image, PE_FIELD_CHARACTERISTICS) & PE_FILE_RELOCS_STRIPPED))
+    {
+        Directory = RvaToPointer(Image, VirtualAddress, DirectorySize);
+        if(Directory == NULL)
+        {
+            snprintf(Message, Size, "Error: relocation directory is malformed\n");
+            return -1;
+        }
+        for(Offset = 0; Offset + 8 <= DirectorySize; Offset += BlockSize)
+        {
+            BlockAddress = ReadUint32(Directory + Offset);
+            BlockSize = ReadUint32(Directory + Offset + 4);
+            if(BlockSize < 8 || BlockSize > DirectorySize - Offset || (BlockSize & 1))
+            {
+                snprintf(Message, Size, "Error: relocation directory is malformed\n");
+                return -1;
+            }
+            for(Entry = 8; Entry + 2 <= BlockSize; Entry += 2)
+            {
+                Target = BlockAddress + (ReadUint16(Directory + Offset + Entry) & 0xFFF);
+                Item = FindSection(Image, Target);
+                if(Item >= 0 && (ReadUint16(Directory + Offset + Entry) >> 12) != PE_RELOCATION_ABSOLUTE &&
+                   (ReadUint16(Directory + Offset + Entry) >> 12) != Package->Stub->RelocationType)
+                {
+                    Package->Packed[Item] = 0;
+                }
+            }
+        }
+    }
+    for(Index = 0; Index < Image->NumberOfSections && !Package->Packed[Index]; Index++);
+    if(Index == Image->NumberOfSections)
+    {
+        snprintf(Message, Size, "Error: no section can be packed\n");
+        return -1;
+    }
+    if(!Compress)
+    {
+        return 0;
+    }
+
+    /* Split relocations between the loader and the stub, an empty block keeps the image relocatable */
+    if(Directory)
+    {
+        Package->Relocations = (uint8_t *)calloc(DirectorySize + 12, 1);
+        Moved = (uint8_t *)malloc(DirectorySize);
+        KeptEntries = (uint16_t *)malloc(DirectorySize + 2);
+        MovedEntries = (uint16_t *)malloc(DirectorySize + 2);
+        if(Package->Relocations == NULL || Moved == NULL || KeptEntries == NULL || MovedEntries == NULL)
+        {
+            snprintf(Message, Size, "Error: out of memory\n");
+            goto Cleanup;
+        }
+        for(Offset = 0; Offset + 8 <= DirectorySize; Offset += BlockSize)
+        {
+            BlockAddress = ReadUint32(Directory + Offset);
+            BlockSize = ReadUint32(Directory + Offset + 4);
+            KeptCount = 0;
+            MovedCount = 0;
+            for(Entry = 8; Entry + 2 <= BlockSize; Entry += 2)
+            {
+                if((ReadUint16(Directory + Offset + Entry) >> 12) == PE_RELOCATION_ABSOLUTE)
+                {
+                    continue;
+                }
+                Item = FindSection(Image, BlockAddress + (ReadUint16(Directory + Offset + Entry) & 0xFFF));
+                if(Item >= 0 && Package->Packed[Item])
+                {
+                    MovedEntries[MovedCount++] = ReadUint16(Directory + Offset + Entry);
+                }
+                else
+                {
+                    KeptEntries[KeptCount++] = ReadUint16(Directory + Offset + Entry);
+                }
+            }
+            AddRelocationBlock(Package->Relocations, &Package->RelocationSize, BlockAddress, KeptEntries, KeptCount);
+            AddRelocationBlock(Moved, &MovedSize, BlockAddress, MovedEntries, MovedCount);
+        }
+        if(Package->RelocationSize == 0)
+        {
+            KeptEntries[0] = PE_RELOCATION_ABSOLUTE;
+            AddRelocationBlock(Package->Relocations, &Package->RelocationSize, 0, KeptEntries, 1);
+        }
+    }
+
+    /* Pack section holds the stub, its header with the block table, relocations and compressed data */
+    Capacity = Package->Stub->Size + PE_PACK_HEADER_SIZE + MovedSize;
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        GetSection(Image, Index, &Section);
+        if(Package->Packed[Index])
+        {
+            Capacity += PE_PACK_BLOCK_SIZE + Section.SizeOfRawData + Section.SizeOfRawData / 255 + 16;
+        }
+    }
+    Package->Data = (uint8_t *)calloc(Capacity, 1);
+    if(Package->Data == NULL)
+    {
+        snprintf(Message, Size, "Error: out of memory\n");
+        goto Cleanup;
+    }
+    Alignment = (uint32_t)GetField(Image, PE_FIELD_SECTION_ALIGNMENT);
+    Package->VirtualAddress = (uint32_t)((End + Alignment - 1) & ~(uint64_t)(Alignment - 1));
+    memcpy(Package->Data, Package->Stub->Code, Package->Stub->Size);
+    Header = Package->Data + Package->Stub->Size;
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        Package->BlockCount += Package->Packed[Index];
+    }
+    Offset = Package->Stub->Size + PE_PACK_HEADER_SIZE + Package->BlockCount * PE_PACK_BLOCK_SIZE;
+    if(MovedSize)
+    {
+        memcpy(Package->Data + Offset, Moved, MovedSize);
+        WriteUint32(Header + PE_PACK_RELOCATIONS, Package->VirtualAddress + Offset);
+        WriteUint32(Header + PE_PACK_RELOCATIONS_SIZE, MovedSize);
+        Offset += MovedSize;
+    }
+    WriteUint64(Header + PE_PACK_LINK_BASE, GetField(Image, PE_FIELD_IMAGE_BASE));
+    WriteUint32(Header + PE_PACK_STUB_RVA, Package->VirtualAddress);
+    WriteUint32(Header + PE_PACK_ENTRY_POINT, (uint32_t)GetField(Image, PE_FIELD_ADDRESS_OF_ENTRY_POINT));
+    WriteUint32(Header + PE_PACK_BLOCK_COUNT, Package->BlockCount);
+
+    /* Compress the sections and make sure they decompress back */
+    Block = Header + PE_PACK_HEADER_SIZE;
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        GetSection(Image, Index, &Section);
+        if(!Package->Packed[Index])
+        {
+            continue;
+        }
+        Length = (Section.VirtualSize && Section.VirtualSize < Section.SizeOfRawData) ? Section.VirtualSize :
+                                                                                         Section.SizeOfRawData;
+        Produced = CompressData(Image->Data + Section.PointerToRawData, Length, Package->Data + Offset);
+        Output = (uint8_t *)malloc(Length);
+        if(Output == NULL || DecompressData(Package->Data + Offset, Produced, Output, Length, &Target) != 0 ||
+           Target != Length || memcmp(Output, Image->Data + Section.PointerToRawData, Length) != 0)
+        {
+            snprintf(Message, Size, "Error: unable to compress section %s\n", Section.Name);
+            free(Output);
+            goto Cleanup;
+        }
+        free(Output);
+        WriteUint32(Block + PE_PACK_BLOCK_TARGET, Section.VirtualAddress);
+        WriteUint32(Block + PE_PACK_BLOCK_SOURCE, Package->VirtualAddress + Offset);
+        WriteUint32(Block + PE_PACK_BLOCK_SOURCE_SIZE, Produced);
+        WriteUint32(Block + PE_PACK_BLOCK_TARGET_SIZE, Length);
+        Block += PE_PACK_BLOCK_SIZE;
+        Offset += Produced;
+        Package->SectionSize += Length;
+    }
+    Package->Size = Offset;
+
+    /* Calculate the size of the packed image, unpacked sections and appended data are kept */
+    Alignment = (uint32_t)GetField(Image, PE_FIELD_FILE_ALIGNMENT);
+    Package->FileSize = (GetField(Image, PE_FIELD_SIZE_OF_HEADERS) + Alignment - 1) & ~(uint64_t)(Alignment - 1);
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        GetSection(Image, Index, &Section);
+        if(!Package->Packed[Index])
+        {
+            Package->FileSize += ((uint64_t)Section.SizeOfRawData + Alignment - 1) & ~(uint64_t)(Alignment - 1);
+        }
+    }
+    Package->FileSize += ((uint64_t)Package->Size + Alignment - 1) & ~(uint64_t)(Alignment - 1);
+    Package->FileSize += Image->Size - DataEnd;
+    Result = 0;
+
+Cleanup:
+    /* Release temporary buffers */
+    free(KeptEntries);
+    free(MovedEntries);
+    free(Moved);
+    return Result;
+}
+
+/* Writes back all changes and unmaps the image */
+static int CloseImage(PPE_IMAGE Image)
+{
+#ifdef _WIN32
+    LARGE_INTEGER FileSize;
+#endif
+    int Result = 0;
+
+    /* Discard the private copy of an image that could not be edited */
+    if(Image->View)
+    {
+        free(Image->Data);
+        Image->Data = Image->View;
+        Image->View = NULL;
+        Image->Size = Image->MappedSize;
+    }
+
+#ifdef _WIN32
+    /* Flush modified pages at once */
+    if(Image->Modified && !FlushViewOfFile(Image->Data, 0))
+    {
+        Result = -1;
+    }
+
+    /* Unmap the view and truncate the file if the image has shrunk */
+    UnmapViewOfFile(Image->Data);
+    CloseHandle(Image->MappingHandle);
+    if(Image->Size < Image->MappedSize)
+    {
+        FileSize.QuadPart = (LONGLONG)Image->Size;
+        if(!SetFilePointerEx(Image->FileHandle, FileSize, NULL, FILE_BEGIN) || !SetEndOfFile(Image->FileHandle))
+        {
+            Result = -1;
+        }
+    }
+    CloseHandle(Image->FileHandle);
+#else
+    /* Flush modified pages at once */
+    if(Image->Modified && msync(Image->Data, (size_t)Image->MappedSize, MS_SYNC) != 0)
+    {
+        Result = -1;
+    }
+
+    /* Unmap the file, truncate it if the image has shrunk and close it */
+    munmap(Image->Data, (size_t)Image->MappedSize);
+    if(Image->Size < Image->MappedSize && ftruncate(Image->Descriptor, (off_t)Image->Size) != 0)
+    {
+        Result = -1;
+    }
+    close(Image->Descriptor);
+#endif
+
+    /* Return result */
+    Image->Data = NULL;
+    return Result;
+}
+
+/* Writes the private copy of the image back to the file, growing the file first */
+static int CommitImage(PPE_IMAGE Image)
+{
+    uint8_t *Copy = Image->Data;
+    uint64_t Size = Image->Size;
+    int Result = 0;
+
+    /* Switch back to the file mapping */
+    Image->Data = Image->View;
+    Image->View = NULL;
+    Image->Size = Image->MappedSize;
+
+    /* File is left intact if it cannot be grown, a shrunk image is truncated once it is closed */
+    if(Size > Image->MappedSize && ResizeImage(Image, Size) != 0)
+    {
+        Result = -1;
+    }
+    else
+    {
+        memcpy(Image->Data, Copy, (size_t)Size);
+        Image->Size = Size;
+        Image->Modified = 1;
+    }
+
+    /* Free the copy */
+    free(Copy);
+    return Result;
+}
+
+/* Orders profile changes by growth, largest first */
+static int CompareChanges(const void *First, const void *Second)
+{
+    const PE_PROFILE_CHANGE *Left = (const PE_PROFILE_CHANGE *)First;
+    const PE_PROFILE_CHANGE *Right = (const PE_PROFILE_CHANGE *)Second;
+
+    /* Sort by delta, then by name to keep the order stable */
+    if(Left->Delta != Right->Delta)
+    {
+        return (Left->Delta < Right->Delta) ? 1 : -1;
+    }
+    return strcmp(Left->Name, Right->Name);
+}
+
+/* Compresses the data into LZ4 block format, output has to hold Length + Length / 255 + 16 bytes */
+static uint32_t CompressData(const uint8_t *Input, uint32_t Length, uint8_t *Output)
+{
+    uint32_t Table[1 << PE_PACK_HASH_BITS];
+    uint32_t MatchLength;
+    uint32_t Sequence;
+    uint32_t Position = 0;
+    uint32_t Anchor = 0;
+    uint32_t Match;
+    uint32_t Hash;
+    uint8_t *Start = Output;
+
+    /* Find matches using a table of last positions of every hashed 4-byte sequence */
+    memset(Table, 0, sizeof(Table));
+    while(Length >= PE_PACK_END_LITERALS + 7 && Position <= Length - PE_PACK_END_LITERALS - 7)
+    {
+        Sequence = ReadUint32(Input + Position);
+        Hash = (Sequence * 2654435761U) >> (32 - PE_PACK_HASH_BITS);
+        Match = Table[Hash];
+        Table[Hash] = Position + 1;
+        if(Match == 0 || Position - (Match - 1) > PE_PACK_MAX_OFFSET || ReadUint32(Input + Match - 1) != Sequence)
+        {
+            Position++;
+            continue;
+        }
+
+        /* Extend the match, the last bytes are always stored as literals */
+        Match--;
+        MatchLength = PE_PACK_MIN_MATCH;
+        while(Position + MatchLength < Length - PE_PACK_END_LITERALS &&
+              Input[Match + MatchLength] == Input[Position + MatchLength])
+        {
+            MatchLength++;
+        }
+        Output = EmitSequence(Output, Input + Anchor, Position - Anchor, Position - Match, MatchLength);
+        Position += MatchLength;
+        Anchor = Position;
+    }
+
+    /* Store the remaining literals */
+    Output = EmitSequence(Output, Input + Anchor, Length - Anchor, 0, 0);
+    return (uint32_t)(Output - Start);
+}
+
+/* Calculates the image checksum the same way as the loader does */
+static uint32_t ComputeChecksum(PPE_IMAGE Image)
+{
+    uint64_t Offset;
+    uint64_t Sum;
+    int Index;
+
+    /* Sum all 16-bit words, carries are folded at the very end */
+    Sum = SumKernel->Sum(Image->Data, (size_t)(Image->Size & ~1ULL));
+    if(Image->Size & 1)
+    {
+        /* Odd trailing byte is padded with zero */
+        Sum += Image->Data[Image->Size - 1];
+    }
+
+    /* The checksum field itself is treated as zero */
+    Offset = Image->OptionalHeader + Fields[PE_FIELD_CHECKSUM].Offset32;
+    for(Index = 0; Index < 4; Index++)
+    {
+        Sum -= (uint64_t)Image->Data[Offset + Index] << (((Offset + Index) & 1) ? 8 : 0);
+    }
+
+    /* Fold the sum into 16 bits with end-around carry */
+    while(Sum >> 16)
+    {
+        Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    }
+
+    /* Add the file size */
+    return (uint32_t)Sum + (uint32_t)Image->Size;
+}
+
+/* Decompresses the LZ4 block the same way the stub does, with bounds checking */
+static int DecompressData(const uint8_t *Input, uint32_t Length, uint8_t *Output, uint32_t Capacity,
+                          uint32_t *Produced)
+{
+    const uint8_t *End = Input + Length;
+    uint32_t LiteralLength;
+    uint32_t MatchLength;
+    uint32_t Position = 0;
+    uint32_t Offset;
+    uint8_t Token;
+
+    /* Decode all sequences */
+    *Produced = 0;
+    while(Input < End)
+    {
+        /* Copy the literals */
+        Token = *Input++;
+        LiteralLength = Token >> 4;
+        if(LiteralLength == 15)
+        {
+            do
+            {
+                if(Input == End)
+                {
+                    return -1;
+                }
+                LiteralLength += *Input;
+            }
+            while(*Input++ == 255);
+        }
+        if(LiteralLength > (uint32_t)(End - Input) || LiteralLength > Capacity - Position)
+        {
+            return -1;
+        }
+        memcpy(Output + Position, Input, LiteralLength);
+        Input += LiteralLength;
+        Position += LiteralLength;
+
+        /* Last sequence has no match */
+        if(Input == End)
+        {
+            break;
+        }
+
+        /* Copy the match, it can overlap with the output */
+        if(End - Input < 2)
+        {
+            return -1;
+        }
+        Offset = ReadUint16(Input);
+        Input += 2;
+        MatchLength = Token & 15;
+        if(MatchLength == 15)
+        {
+            do
+            {
+                if(Input == End)
+                {
+                    return -1;
+                }
+                MatchLength += *Input;
+            }
+            while(*Input++ == 255);
+        }
+        MatchLength += PE_PACK_MIN_MATCH;
+        if(Offset == 0 || Offset > Position || MatchLength > Capacity - Position)
+        {
+            return -1;
+        }
+        for(; MatchLength; MatchLength--, Position++)
+        {
+            Output[Position] = Output[Position - Offset];
+        }
+    }
+
+    /* Return the decompressed size */
+    *Produced = Position;
+    return 0;
+}
+
+/* Compares the profile against its baseline, returns the changed items ordered by growth */
+static int DiffProfiles(PPE_PROFILE Profile, PPE_PROFILE Baseline, PPE_PROFILE_CHANGE *Changes, int *Count)
+{
+    PPE_PROFILE_CHANGE List;
+    int Found;
+    int Index;
+    int Item;
+
+    /* Every item is either in one of the profiles or in both */
+    *Count = 0;
+    *Changes = NULL;
+    List = (PPE_PROFILE_CHANGE)malloc((Profile->Count + Baseline->Count + 1) * sizeof(PE_PROFILE_CHANGE));
+    if(List == NULL)
+    {
+        return -1;
+    }
+
+    /* Match items of the new build with the baseline */
+    for(Index = 0; Index < Profile->Count; Index++)
+    {
+        List[*Count].Name = Profile->Items[Index].Name;
+        List[*Count].New = Profile->Items[Index].Size;
+        List[*Count].Old = 0;
+        for(Item = 0; Item < Baseline->Count; Item++)
+        {
+            if(strcmp(Baseline->Items[Item].Name, Profile->Items[Index].Name) == 0)
+            {
+                List[*Count].Old = Baseline->Items[Item].Size;
+                break;
+            }
+        }
+        List[*Count].Delta = (int64_t)(List[*Count].New - List[*Count].Old);
+        if(List[*Count].Delta != 0)
+        {
+            (*Count)++;
+        }
+    }
+
+    /* Add items removed since the baseline */
+    for(Item = 0; Item < Baseline->Count; Item++)
+    {
+        for(Found = 0, Index = 0; !Found && Index < Profile->Count; Index++)
+        {
+            Found = (strcmp(Baseline->Items[Item].Name, Profile->Items[Index].Name) == 0);
+        }
+        if(!Found && Baseline->Items[Item].Size)
+        {
+            List[*Count].Name = Baseline->Items[Item].Name;
+            List[*Count].Old = Baseline->Items[Item].Size;
+            List[*Count].New = 0;
+            List[*Count].Delta = -(int64_t)Baseline->Items[Item].Size;
+            (*Count)++;
+        }
+    }
+
+    /* Order by growth */
+    qsort(List, *Count, sizeof(PE_PROFILE_CHANGE), CompareChanges);
+    *Changes = List;
+    return 0;
+}
+
+/* Writes a single LZ4 sequence of literals followed by a match, the last sequence has no match */
+static uint8_t *EmitSequence(uint8_t *Output, const uint8_t *Literals, uint32_t LiteralLength, uint32_t Offset,
+                             uint32_t MatchLength)
+{
+    uint8_t *Token = Output++;
+    uint32_t Length;
+
+    /* Store the literals, lengths of 15 and more continue in the following bytes */
+    *Token = (uint8_t)(((LiteralLength >= 15) ? 15 : LiteralLength) << 4);
+    if(LiteralLength >= 15)
+    {
+        for(Length = LiteralLength - 15; Length >= 255; Length -= 255)
+        {
+            *Output++ = 255;
+        }
+        *Output++ = (uint8_t)Length;
+    }
+    memcpy(Output, Literals, LiteralLength);
+    Output += LiteralLength;
+
+    /* Store the match offset and its length */
+    if(MatchLength)
+    {
+        WriteUint16(Output, (uint16_t)Offset);
+        Output += 2;
+        Length = MatchLength - PE_PACK_MIN_MATCH;
+        *Token |= (uint8_t)((Length >= 15) ? 15 : Length);
+        if(Length >= 15)
+        {
+            for(Length -= 15; Length >= 255; Length -= 255)
+            {
+                *Output++ = 255;
+            }
+            *Output++ = (uint8_t)Length;
+        }
+    }
+    return Output;
+}
+
+/* Finds the module by its file name, returns -1 if it is not in the set */
+static int FindModule(PPE_MODULE Modules, int Count, const char *Name)
+{
+    int Index;
+
+    /* Compare names case-insensitively, as the loader does */
+    for(Index = 0; Index < Count; Index++)
+    {
+        if(strcasecmp(Modules[Index].Name, Name) == 0)
+        {
+            return Index;
+        }
+    }
+
+    /* Module not found */
+    return -1;
+}
+
+/* Finds the section holding the RVA */
+static int FindSection(PPE_IMAGE Image, uint32_t VirtualAddress)
+{
+    PE_SECTION Section;
+    uint32_t Length;
+    uint32_t Index;
+
+    /* Check all sections, including their uninitialized data */
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        GetSection(Image, Index, &Section);
+        Length = (Section.VirtualSize > Section.SizeOfRawData) ? Section.VirtualSize : Section.SizeOfRawData;
+        if(VirtualAddress >= Section.VirtualAddress && VirtualAddress - Section.VirtualAddress < Length)
+        {
+            return (int)Index;
+        }
+    }
+
+    /* RVA is not within any section */
+    return -1;
+}
+
+/* Releases the pack section built for the image */
+static void FreePackage(PPE_PACKAGE Package)
+{
+    free(Package->Packed);
+    free(Package->Data);
+    free(Package->Relocations);
+    memset(Package, 0, sizeof(PE_PACKAGE));
+}
+
+/* Gets the location and size of the data directory, returns zero if the image does not have it */
+static int GetDirectory(PPE_IMAGE Image, int Index, uint32_t *VirtualAddress, uint32_t *Size)
+{
+    uint8_t *Entry;
+
+    /* Check if the directory is present */
+    if((uint32_t)Index >= Image->NumberOfDirectories)
+    {
+        *VirtualAddress = 0;
+        *Size = 0;
+        return 0;
+    }
+
+    /* Read the directory entry */
+    Entry = Image->Data + Image->OptionalHeader + (Image->Pe32Plus ? 112 : 96) + Index * 8;
+    *VirtualAddress = ReadUint32(Entry);
+    *Size = ReadUint32(Entry + 4);
+    return (*VirtualAddress != 0 && *Size != 0);
+}
+
+/* Gets the header field value as it will be after applying the edit */
+static uint64_t GetEditValue(PPE_IMAGE Image, PPE_EDIT Edit, int Field)
+{
+    return (Edit->FieldMask & (1U << Field)) ? Edit->Values[Field] : GetField(Image, Field);
+}
+
+/* Finds the exported function by name or ordinal, forwarded exports return the forwarder string */
+static int GetExport(PPE_IMAGE Image, const char *Name, uint16_t Hint, uint32_t Ordinal, uint32_t *Function,
+                     const char **Forwarder)
+{
+    uint8_t *Directory;
+    uint8_t *Functions;
+    uint8_t *Names;
+    uint8_t *Ordinals;
+    const char *String;
+    uint32_t VirtualAddress;
+    uint32_t NumberOfFunctions;
+    uint32_t NumberOfNames;
+    uint32_t Size;
+    int Compare;
+    int High;
+    int Low;
+    int Middle;
+
+    /* Read the export directory */
+    *Forwarder = NULL;
+    if(!GetDirectory(Image, PE_DIRECTORY_EXPORT, &VirtualAddress, &Size) ||
+       (Directory = RvaToPointer(Image, VirtualAddress, PE_EXPORT_DIRECTORY_SIZE)) == NULL)
+    {
+        return -1;
+    }
+    NumberOfFunctions = ReadUint32(Directory + PE_EXPORT_NUMBER_OF_FUNCTIONS);
+    NumberOfNames = ReadUint32(Directory + PE_EXPORT_NUMBER_OF_NAMES);
+    Functions = RvaToPointer(Image, ReadUint32(Directory + PE_EXPORT_FUNCTIONS), NumberOfFunctions * 4);
+    Names = RvaToPointer(Image, ReadUint32(Directory + PE_EXPORT_NAMES), NumberOfNames * 4);
+    Ordinals = RvaToPointer(Image, ReadUint32(Directory + PE_EXPORT_NAME_ORDINALS), NumberOfNames * 2);
+    if(Functions == NULL || (NumberOfNames && (Names == NULL || Ordinals == NULL)))
+    {
+        return -1;
+    }
+
+    /* Look up the name, trying the hint first and then the sorted name table */
+    if(Name)
+    {
+        String = (Hint < NumberOfNames) ? RvaToString(Image, ReadUint32(Names + Hint * 4)) : NULL;
+        if(String && strcmp(String, Name) == 0)
+        {
+            Ordinal = ReadUint16(Ordinals + Hint * 2);
+        }
+        else
+        {
+            Low = 0;
+            High = (int)NumberOfNames - 1;
+            Ordinal = NumberOfFunctions;
+            while(Low <= High)
+            {
+                Middle = Low + (High - Low) / 2;
+                String = RvaToString(Image, ReadUint32(Names + Middle * 4));
+                if(String == NULL)
+                {
+                    return -1;
+                }
+                Compare = strcmp(String, Name);
+                if(Compare == 0)
+                {
+                    Ordinal = ReadUint16(Ordinals + Middle * 2);
+                    break;
+                }
+                if(Compare < 0)
+                {
+                    Low = Middle + 1;
+                }
+                else
+                {
+                    High = Middle - 1;
+                }
+            }
+        }
+    }
+    else
+    {
+        /* Ordinals are biased by the export base */
+        Ordinal -= ReadUint32(Directory + PE_EXPORT_BASE);
+    }
+
+    /* Get the function address */
+    if(Ordinal >= NumberOfFunctions || (*Function = ReadUint32(Functions + Ordinal * 4)) == 0)
+    {
+        return -1;
+    }
+
+    /* Addresses pointing into the export directory are forwarders */
+    if(*Function >= VirtualAddress && *Function < VirtualAddress + Size)
+    {
+        *Forwarder = RvaToString(Image, *Function);
+        if(*Forwarder == NULL)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Reads the header field */
+static uint64_t GetField(PPE_IMAGE Image, int Field)
+{
+    uint8_t *Pointer;
+    uint8_t Size;
+
+    /* Locate the field */
+    Pointer = Image->Data + (Fields[Field].Header == PE_HEADER_FILE ? Image->FileHeader : Image->OptionalHeader) +
+              (Image->Pe32Plus ? Fields[Field].Offset64 : Fields[Field].Offset32);
+    Size = Image->Pe32Plus ? Fields[Field].Size64 : Fields[Field].Size32;
+
+    /* Read the value */
+    switch(Size)
+    {
+        case 2:
+            return ReadUint16(Pointer);
+        case 4:
+            return ReadUint32(Pointer);
+        default:
+            return ReadUint64(Pointer);
+    }
+}
+
+/* Gets pointer to the import descriptor, or NULL after the last one */
+static uint8_t *GetImportDescriptor(PPE_IMAGE Image, uint32_t Index)
+{
+    uint32_t VirtualAddress;
+    uint32_t Size;
+    uint8_t *Descriptor;
+
+    /* Check if the image imports anything */
+    if(!GetDirectory(Image, PE_DIRECTORY_IMPORT, &VirtualAddress, &Size))
+    {
+        return NULL;
+    }
+
+    /* Descriptors end with an all-zero entry, the directory size is not reliable */
+    Descriptor = RvaToPointer(Image, VirtualAddress + Index * PE_IMPORT_DESCRIPTOR_SIZE, PE_IMPORT_DESCRIPTOR_SIZE);
+    if(Descriptor == NULL || (ReadUint32(Descriptor + PE_IMPORT_NAME) == 0 &&
+                              ReadUint32(Descriptor + PE_IMPORT_FIRST_THUNK) == 0))
+    {
+        return NULL;
+    }
+
+    /* Return the descriptor */
+    return Descriptor;
+}
+
+/* Gets names of all modules imported by the image */
+static int GetImports(PPE_IMAGE Image, char ***Imports, int *Count)
+{
+    uint8_t *Descriptor;
+    const char *Name;
+    char **Names;
+
+    /* Walk all import descriptors */
+    *Imports = NULL;
+    *Count = 0;
+    while((Descriptor = GetImportDescriptor(Image, *Count)) != NULL)
+    {
+        /* Get the module name */
+        Name = RvaToString(Image, ReadUint32(Descriptor + PE_IMPORT_NAME));
+        if(Name == NULL)
+        {
+            return -1;
+        }
+
+        /* Store the name */
+        Names = (char **)realloc(*Imports, (*Count + 1) * sizeof(char *));
+        if(Names == NULL)
+        {
+            return -1;
+        }
+        *Imports = Names;
+        Names[(*Count)++] = strdup(Name);
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/* Gets pointer to the given range of the file, or NULL if it does not fit in the file */
+static uint8_t *GetPointer(PPE_IMAGE Image, uint64_t Offset, uint64_t Length)
+{
+    /* Check bounds */
+    if(Offset > Image->Size || Length > Image->Size - Offset)
+    {
+        return NULL;
+    }
+
+    /* Return pointer to the mapped data */
+    return Image->Data + Offset;
+}
+
+/* Reads the section header */
+static int GetSection(PPE_IMAGE Image, uint32_t Index, PPE_SECTION Section)
+{
+    uint8_t *Header;
+
+    /* Check section index */
+    if(Index >= Image->NumberOfSections)
+    {
+        return -1;
+    }
+
+    /* Decode the section header */
+    Header = Image->Data + Image->SectionTable + Index * PE_SECTION_HEADER_SIZE;
+    memcpy(Section->Name, Header, 8);
+    Section->Name[8] = '\0';
+    Section->VirtualSize = ReadUint32(Header + PE_SECTION_VIRTUAL_SIZE);
+    Section->VirtualAddress = ReadUint32(Header + PE_SECTION_VIRTUAL_ADDRESS);
+    Section->SizeOfRawData = ReadUint32(Header + PE_SECTION_RAW_SIZE);
+    Section->PointerToRawData = ReadUint32(Header + PE_SECTION_RAW_POINTER);
+    Section->Characteristics = ReadUint32(Header + PE_SECTION_CHARACTERISTICS);
+    Section->HeaderOffset = (uint32_t)(Header - Image->Data);
+    return 0;
+}
+
+/* Gets the number of online processors */
+static int GetProcessorCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO SystemInfo;
+
+    /* Query the system */
+    GetSystemInfo(&SystemInfo);
+    return (int)SystemInfo.dwNumberOfProcessors;
+#else
+    long Count;
+
+    /* Query the system */
+    Count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (Count > 0) ? (int)Count : 1;
+#endif
+}
+
+PPE_SUBSYSTEM getSubSystem(char *Name)
+{
+    int Index;
+    int SubSystemsCount;
+    PPE_SUBSYSTEM SubSystem;
+
+    /* Count number of subsystems avaialble */
+    SubSystemsCount = sizeof(SubSystems) / sizeof(PE_SUBSYSTEM);
+
+    /* Find subsystem */
+    for(Index = 0; Index < SubSystemsCount; Index++)
+    {
+        SubSystem = &SubSystems[Index];
+        if(strcasecmp(SubSystem->Name, Name) == 0)
+        {
+            /* Subsystem found, return its ID */
+            return SubSystem;
+        }
+    }
+
+	/* No valid subsystem found */
+    return &SubSystems[0];
+}
+
+char *getSubSystemName(int Identifier)
+{
+    int Index;
+    int SubSystemsCount;
+    PPE_SUBSYSTEM SubSystem;
+
+    /* Count number of subsystems avaialble */
+    SubSystemsCount = sizeof(SubSystems) / sizeof(PE_SUBSYSTEM);
+
+    /* Find subsystem */
+    for(Index = 0; Index < SubSystemsCount; Index++)
+    {
+        SubSystem = &SubSystems[Index];
+        if(SubSystem->Identifier == Identifier)
+        {
+            /* Subsystem found, return its ID */
+            return SubSystem->Name;
+        }
+    }
+
+	/* No valid subsystem found */
+    return SubSystems[0].Name;
+}
+
+/* Updates FNV-1a hash with the data */
+static uint64_t HashData(const uint8_t *Data, uint64_t Length, uint64_t Hash)
+{
+    uint64_t Index;
+
+    /* Hash all bytes */
+    for(Index = 0; Index < Length; Index++)
+    {
+        Hash = (Hash ^ Data[Index]) * PE_FNV_PRIME;
+    }
+
+    /* Return updated hash */
+    return Hash;
+}
+
+#ifdef EXETOOL_X86_KERNELS
+/* Checks whether the CPU supports AVX2 instructions */
+static int IsAvx2Supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/* Checks whether the CPU supports SSE2 instructions */
+static int IsSse2Supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+#endif
+
+/* Adds edits listed in the manifest file, one image per line followed by its edits */
+static int LoadManifest(PPE_EDIT_LIST List, const char *FileName)
+{
+    PPE_EDIT Edit;
+    FILE *File;
+    char Line[4096];
+    char *Token;
+    int Edits;
+    int LineNumber = 0;
+
+    /* Open the manifest file */
+    File = fopen(FileName, "r");
+    if(File == NULL)
+    {
+        printf("Error: unable to open file %s\n", FileName);
+        return -1;
+    }
+
+    /* Read all lines */
+    while(fgets(Line, sizeof(Line), File))
+    {
+        /* Skip empty lines and comments */
+        LineNumber++;
+        Token = strtok(Line, " \t\r\n");
+        if(Token == NULL || Token[0] == '#')
+        {
+            continue;
+        }
+
+        /* Add image and parse its edits */
+        Edit = AddEdit(List, Token);
+        if(Edit == NULL)
+        {
+            fclose(File);
+            return -1;
+        }
+        for(Edits = 0; (Token = strtok(NULL, " \t\r\n")) != NULL; Edits++)
+        {
+            if(ParseEdit(Edit, Token) != 0)
+            {
+                printf("Error: invalid edit in %s at line %d\n", FileName, LineNumber);
+                fclose(File);
+                return -1;
+            }
+        }
+
+        /* Every image needs at least one edit */
+        if(Edits == 0)
+        {
+            printf("Error: no edits specified in %s at line %d\n", FileName, LineNumber);
+            fclose(File);
+            return -1;
+        }
+    }
+
+    /* Close the manifest file */
+    fclose(File);
+    return 0;
+}
+
+/* Reads the image size and imports of a module taking part in the layout */
+static int LoadModule(PPE_MODULE Module, const char *FileName)
+{
+    PE_IMAGE Image;
+    const char *Separator;
+    int Status;
+
+    /* Module is identified by its file name */
+    Separator = _tcsrchrs(FileName, '/', '\\');
+    Module->Name = Separator ? Separator + 1 : FileName;
+    Module->Visited = 0;
+
+    /* Read the image headers and imports */
+    Status = OpenImage(&Image, FileName, 0);
+    if(Status != PE_STATUS_SUCCESS)
+    {
+        return Status;
+    }
+    Module->SizeOfImage = GetField(&Image, PE_FIELD_SIZE_OF_IMAGE);
+    if(GetImports(&Image, &Module->Imports, &Module->ImportCount) != 0)
+    {
+        Status = PE_STATUS_INVALID_IMAGE;
+    }
+    CloseImage(&Image);
+    return Status;
+}
+
+/* Translates the file offset into the new layout of section data, returns 0 if the data is gone */
+static uint32_t MapRawPointer(PPE_IMAGE Image, PPE_SECTION Sections, PPE_SECTION Moved, uint64_t DataEnd,
+                              uint64_t NewEnd, uint32_t Offset)
+{
+    uint32_t Index;
+
+    /* Data appended past the last section moves along with the end of section data */
+    if(Offset >= DataEnd)
+    {
+        return (uint32_t)(NewEnd + Offset - DataEnd);
+    }
+
+    /* Find the section holding the data */
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        if(Sections[Index].SizeOfRawData && Offset >= Sections[Index].PointerToRawData &&
+           Offset - Sections[Index].PointerToRawData < Sections[Index].SizeOfRawData)
+        {
+            return Moved[Index].SizeOfRawData ?
+                   Offset - Sections[Index].PointerToRawData + Moved[Index].PointerToRawData : 0;
+        }
+    }
+
+    /* Headers stay in place */
+    return Offset;
+}
+
+/* Updates file offsets of debug data in the new layout of the image held by the buffer */
+static void MoveDebugData(PPE_IMAGE Image, uint8_t *Buffer, PPE_SECTION Sections, PPE_SECTION Moved,
+                          uint64_t DataEnd, uint64_t NewEnd)
+{
+    uint32_t VirtualAddress;
+    uint32_t DirectorySize;
+    uint32_t Offset;
+    uint32_t Entry;
+    uint8_t *Debug;
+
+    /* Locate the debug directory in the new layout */
+    if(!GetDirectory(Image, PE_DIRECTORY_DEBUG, &VirtualAddress, &DirectorySize) ||
+       (Debug = RvaToPointer(Image, VirtualAddress, DirectorySize)) == NULL ||
+       (Offset = MapRawPointer(Image, Sections, Moved, DataEnd, NewEnd, (uint32_t)(Debug - Image->Data))) == 0)
+    {
+        return;
+    }
+
+    /* Translate raw data pointers of all entries */
+    Debug = Buffer + Offset;
+    for(Entry = 0; Entry < DirectorySize / PE_DEBUG_ENTRY_SIZE; Entry++)
+    {
+        Offset = ReadUint32(Debug + Entry * PE_DEBUG_ENTRY_SIZE + PE_DEBUG_RAW_POINTER);
+        if(Offset)
+        {
+            WriteUint32(Debug + Entry * PE_DEBUG_ENTRY_SIZE + PE_DEBUG_RAW_POINTER,
+                        MapRawPointer(Image, Sections, Moved, DataEnd, NewEnd, Offset));
+        }
+    }
+}
+
+/* Replaces timestamps and debug identifiers with zeroes or with values derived from the image contents */
+static int NormalizeImage(PPE_IMAGE Image, int Mode, int Apply, char *Message, size_t Size)
+{
+    uint8_t *CodeView[PE_MAX_DIRECTORIES];
+    uint8_t *Stamps[PE_MAX_DIRECTORIES + 3];
+    uint8_t *Debug = NULL;
+    uint8_t *Record;
+    uint8_t Guid[16];
+    uint32_t DebugSize = 0;
+    uint32_t VirtualAddress;
+    uint32_t DirectorySize;
+    uint32_t RecordSize;
+    uint32_t Signature;
+    uint32_t Stamp = 0;
+    uint64_t Checksum;
+    uint64_t Hash;
+    int CodeViews = 0;
+    int Count = 0;
+    int Index;
+
+    /* Locate the COFF header timestamp */
+    Stamps[Count++] = Image->Data + Image->FileHeader + Fields[PE_FIELD_TIME_DATE_STAMP].Offset32;
+
+    /* Locate export and resource directory timestamps */
+    if(GetDirectory(Image, PE_DIRECTORY_EXPORT, &VirtualAddress, &DirectorySize) &&
+       (Record = RvaToPointer(Image, VirtualAddress, PE_EXPORT_TIME_DATE_STAMP + 4)) != NULL)
+    {
+        Stamps[Count++] = Record + PE_EXPORT_TIME_DATE_STAMP;
+    }
+    if(GetDirectory(Image, PE_DIRECTORY_RESOURCE, &VirtualAddress, &DirectorySize) &&
+       (Record = RvaToPointer(Image, VirtualAddress, PE_RESOURCE_TIME_DATE_STAMP + 4)) != NULL)
+    {
+        Stamps[Count++] = Record + PE_RESOURCE_TIME_DATE_STAMP;
+    }
+
+    /* Locate debug directory entries and their CodeView records */
+    if(GetDirectory(Image, PE_DIRECTORY_DEBUG, &VirtualAddress, &DebugSize))
+    {
+        Debug = RvaToPointer(Image, VirtualAddress, DebugSize);
+        if(Debug == NULL || DebugSize % PE_DEBUG_ENTRY_SIZE || DebugSize / PE_DEBUG_ENTRY_SIZE > PE_MAX_DIRECTORIES)
+        {
+            snprintf(Message, Size, "Error: debug directory is malformed\n");
+            return -1;
+        }
+        for(Index = 0; Index < (int)(DebugSize / PE_DEBUG_ENTRY_SIZE); Index++)
+        {
+            Record = Debug + Index * PE_DEBUG_ENTRY_SIZE;
+            Stamps[Count++] = Record + PE_DEBUG_TIME_DATE_STAMP;
+            if(ReadUint32(Record + PE_DEBUG_TYPE) != PE_DEBUG_TYPE_CODEVIEW)
+            {
+                continue;
+            }
+
+            /* Only RSDS (GUID and age) and NB10 (timestamp and age) records hold build identifiers */
+            RecordSize = ReadUint32(Record + PE_DEBUG_SIZE_OF_DATA);
+            Record = GetPointer(Image, ReadUint32(Record + PE_DEBUG_RAW_POINTER), RecordSize);
+            if(Record == NULL || RecordSize < 16)
+            {
+                continue;
+            }
+            Signature = ReadUint32(Record);
+            if((Signature == PE_CODEVIEW_RSDS_SIGNATURE && RecordSize >= 24) ||
+               Signature == PE_CODEVIEW_NB10_SIGNATURE)
+            {
+                CodeView[CodeViews++] = Record;
+            }
+        }
+    }
+
+    /* Check if the identifiers should be replaced */
+    if(!Apply)
+    {
+        return 0;
+    }
+
+    /* Clear all identifiers, so that the hash covers only the reproducible contents */
+    for(Index = 0; Index < Count; Index++)
+    {
+        WriteUint32(Stamps[Index], 0);
+    }
+    for(Index = 0; Index < CodeViews; Index++)
+    {
+        if(ReadUint32(CodeView[Index]) == PE_CODEVIEW_RSDS_SIGNATURE)
+        {
+            memset(CodeView[Index] + 4, 0, 16);
+            WriteUint32(CodeView[Index] + 20, 1);
+        }
+        else
+        {
+            WriteUint32(CodeView[Index] + 8, 0);
+            WriteUint32(CodeView[Index] + 12, 1);
+        }
+    }
+    memset(Guid, 0, sizeof(Guid));
+    Image->Modified = 1;
+
+    /* Derive identifiers from the image contents, skipping the checksum field */
+    if(Mode == PE_NORMALIZE_HASH)
+    {
+        Checksum = Image->OptionalHeader + Fields[PE_FIELD_CHECKSUM].Offset32;
+        Hash = HashData(Image->Data, Checksum, PE_FNV_OFFSET);
+        Hash = HashData(Image->Data + Checksum + 4, Image->Size - Checksum - 4, Hash);
+        Stamp = (uint32_t)(Hash ^ (Hash >> 32));
+        WriteUint64(Guid, Hash);
+        WriteUint64(Guid + 8, HashData(Guid, 8, Hash));
+        for(Index = 0; Index < Count; Index++)
+        {
+            WriteUint32(Stamps[Index], Stamp);
+        }
+        for(Index = 0; Index < CodeViews; Index++)
+        {
+            if(ReadUint32(CodeView[Index]) == PE_CODEVIEW_RSDS_SIGNATURE)
+            {
+                memcpy(CodeView[Index] + 4, Guid, 16);
+            }
+            else
+            {
+                WriteUint32(CodeView[Index] + 8, Stamp);
+            }
+        }
+    }
+
+    /* Report the result */
+    snprintf(Message, Size, "PE image normalized: %d timestamps and %d debug records set to 0x%08X\n",
+             Count, CodeViews, Stamp);
+    return 0;
+}
+
+/* Maps the image file into memory and validates its headers */
+static int OpenImage(PPE_IMAGE Image, const char *FileName, int Writable)
+{
+#ifdef _WIN32
+    LARGE_INTEGER FileSize;
+#else
+    struct stat Stat;
+#endif
+    uint32_t Signature;
+    uint16_t Magic;
+
+    /* Initialize the image */
+    memset(Image, 0, sizeof(PE_IMAGE));
+    Image->FileName = FileName;
+    Image->Writable = Writable;
+
+#ifdef _WIN32
+    /* Open the file and map it into memory */
+    Image->FileHandle = CreateFileA(FileName, Writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+                                    FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(Image->FileHandle == INVALID_HANDLE_VALUE)
+    {
+        return PE_STATUS_OPEN_FAILED;
+    }
+    if(!GetFileSizeEx(Image->FileHandle, &FileSize) || FileSize.QuadPart < PE_DOS_HEADER_SIZE)
+    {
+        CloseHandle(Image->FileHandle);
+        return PE_STATUS_INVALID_IMAGE;
+    }
+    Image->Size = (uint64_t)FileSize.QuadPart;
+    Image->MappedSize = Image->Size;
+    Image->MappingHandle = CreateFileMappingA(Image->FileHandle, NULL, Writable ? PAGE_READWRITE : PAGE_READONLY,
+                                              0, 0, NULL);
+    Image->Data = Image->MappingHandle ? (uint8_t *)MapViewOfFile(Image->MappingHandle,
+                                                                  Writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                                                                  0, 0, 0) : NULL;
+    if(Image->Data == NULL)
+    {
+        if(Image->MappingHandle)
+        {
+            CloseHandle(Image->MappingHandle);
+        }
+        CloseHandle(Image->FileHandle);
+        return PE_STATUS_OPEN_FAILED;
+    }
+#else
+    /* Open the file and map it into memory */
+    Image->Descriptor = open(FileName, Writable ? O_RDWR : O_RDONLY);
+    if(Image->Descriptor < 0)
+    {
+        return PE_STATUS_OPEN_FAILED;
+    }
+    if(fstat(Image->Descriptor, &Stat) != 0 || Stat.st_size < PE_DOS_HEADER_SIZE)
+    {
+        close(Image->Descriptor);
+        return PE_STATUS_INVALID_IMAGE;
+    }
+    Image->Size = (uint64_t)Stat.st_size;
+    Image->MappedSize = Image->Size;
+    Image->Data = (uint8_t *)mmap(NULL, (size_t)Image->Size, Writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                                  MAP_SHARED, Image->Descriptor, 0);
+    if(Image->Data == MAP_FAILED)
+    {
+        close(Image->Descriptor);
+        Image->Data = NULL;
+        return PE_STATUS_OPEN_FAILED;
+    }
+#endif
+
+    /* Verify that the input file has a valid DOS header */
+    if(ReadUint16(Image->Data) != PE_DOS_SIGNATURE)
+    {
+        CloseImage(Image);
+        return PE_STATUS_INVALID_IMAGE;
+    }
+
+    /* Verify that the input file has a valid PE header, either with PE00 or PEXT signature */
+    Image->HeaderOffset = ReadUint32(Image->Data + PE_DOS_LFANEW);
+    if(!GetPointer(Image, Image->HeaderOffset, 4 + PE_FILE_HEADER_SIZE + 2))
+    {
+        CloseImage(Image);
+        return PE_STATUS_INVALID_IMAGE;
+    }
+    Signature = ReadUint32(Image->Data + Image->HeaderOffset);
+    if(Signature != PE_NT_SIGNATURE && Signature != PE_XT_SIGNATURE)
+    {
+        CloseImage(Image);
+        return PE_STATUS_INVALID_IMAGE;
+    }
+
+    /* Locate the optional header and check whether it is PE32 or PE32+ */
+    Image->FileHeader = Image->HeaderOffset + 4;
+    Image->OptionalHeader = Image->FileHeader + PE_FILE_HEADER_SIZE;
+    Image->OptionalHeaderSize = ReadUint16(Image->Data + Image->FileHeader + PE_FILE_OPTIONAL_SIZE);
+    Image->NumberOfSections = ReadUint16(Image->Data + Image->FileHeader + PE_FILE_NUMBER_OF_SECTIONS);
+    Magic = ReadUint16(Image->Data + Image->OptionalHeader);
+    if(Magic != PE_OPTIONAL_MAGIC_PE32 && Magic != PE_OPTIONAL_MAGIC_PE32PLUS)
+    {
+        CloseImage(Image);
+        return PE_STATUS_INVALID_IMAGE;
+    }
+    Image->Pe32Plus = (Magic == PE_OPTIONAL_MAGIC_PE32PLUS);
+
+    /* Make sure the whole optional header, including all data directories, fits in the file */
+    if(Image->OptionalHeaderSize < (uint32_t)(Image->Pe32Plus ? 112 : 96) ||
+       !GetPointer(Image, Image->OptionalHeader, Image->OptionalHeaderSize))
+    {
+        CloseImage(Image);
+        return PE_STATUS_INVALID_IMAGE;
+    }
+    Image->NumberOfDirectories = (uint32_t)GetField(Image, PE_FIELD_NUMBER_OF_RVA_AND_SIZES);
+    if(Image->NumberOfDirectories > PE_MAX_DIRECTORIES ||
+       (Image->Pe32Plus ? 112 : 96) + Image->NumberOfDirectories * 8 > Image->OptionalHeaderSize)
+    {
+        CloseImage(Image);
+        return PE_STATUS_INVALID_IMAGE;
+    }
+
+    /* Make sure the section table fits in the file */
+    Image->SectionTable = Image->OptionalHeader + Image->OptionalHeaderSize;
+    if(!GetPointer(Image, Image->SectionTable, (uint64_t)Image->NumberOfSections * PE_SECTION_HEADER_SIZE))
+    {
+        CloseImage(Image);
+        return PE_STATUS_INVALID_IMAGE;
+    }
+
+    /* Image is valid */
+    return PE_STATUS_SUCCESS;
+}
+
+/* Opens the DLL the image is bound against, looking in the bind paths and in the directory of the image */
+static int OpenModule(PPE_BIND_CONTEXT Context, PPE_IMAGE Module, const char *Name)
+{
+    const char *Separator;
+    char Path[2048];
+    int Index;
+    int Status;
+
+    /* Look in all bind paths first */
+    for(Index = 0; Index < BindPathCount; Index++)
+    {
+        snprintf(Path, sizeof(Path), "%s%c%s", BindPaths[Index], PATH_SEP, Name);
+        Status = OpenImage(Module, Path, 0);
+        if(Status == PE_STATUS_SUCCESS)
+        {
+            return Status;
+        }
+    }
+
+    /* Look next to the image */
+    Separator = _tcsrchrs(Context->FileName, '/', '\\');
+    snprintf(Path, sizeof(Path), "%.*s%s", Separator ? (int)(Separator - Context->FileName + 1) : 0,
+             Context->FileName, Name);
+    return OpenImage(Module, Path, 0);
+}
+
+/* Orders modules by the priority list first, then all others with their dependencies placed first */
+static int OrderModules(PPE_MODULE Modules, int Count, const char *PriorityName, int *Order)
+{
+    FILE *File;
+    char Line[1024];
+    char *Token;
+    int Position = 0;
+    int Index;
+
+    /* Place modules listed in the priority file in the given order */
+    if(PriorityName)
+    {
+        File = fopen(PriorityName, "r");
+        if(File == NULL)
+        {
+            printf("Error: unable to open file %s\n", PriorityName);
+            return -1;
+        }
+        while(fgets(Line, sizeof(Line), File))
+        {
+            /* Skip empty lines, comments and modules not in the set */
+            Token = strtok(Line, " \t\r\n");
+            if(Token == NULL || Token[0] == '#' || (Index = FindModule(Modules, Count, Token)) < 0 ||
+               Modules[Index].Visited)
+            {
+                continue;
+            }
+            Modules[Index].Visited = 1;
+            Order[Position++] = Index;
+        }
+        fclose(File);
+    }
+
+    /* Place all remaining modules in the import dependency order */
+    for(Index = 0; Index < Count; Index++)
+    {
+        VisitModule(Modules, Count, Index, Order, &Position);
+    }
+    return 0;
+}
+
+/* Replaces section data with compressed blocks, the stub restores them before jumping to the entry point */
+static int PackImage(PPE_IMAGE Image, char *Message, size_t Size)
+{
+    PE_PACKAGE Package;
+    PPE_SECTION Sections;
+    PPE_SECTION Moved;
+    uint8_t *Buffer;
+    uint8_t *Header;
+    uint8_t *Block;
+    uint32_t VirtualAddress;
+    uint32_t DirectorySize;
+    uint32_t FileAlignment;
+    uint32_t Alignment;
+    uint32_t Headers;
+    uint32_t Index;
+    uint64_t DataEnd;
+    uint64_t OldSize;
+    uint64_t Offset;
+    uint64_t PackOffset;
+
+    /* Compress the sections */
+    if(BuildPackage(Image, &Package, 1, Message, Size) != 0)
+    {
+        FreePackage(&Package);
+        return -1;
+    }
+    Sections = (PPE_SECTION)calloc(Image->NumberOfSections + 1, sizeof(PE_SECTION));
+    Moved = (PPE_SECTION)calloc(Image->NumberOfSections + 1, sizeof(PE_SECTION));
+    Buffer = (uint8_t *)calloc(1, (size_t)Package.FileSize);
+    if(Sections == NULL || Moved == NULL || Buffer == NULL)
+    {
+        snprintf(Message, Size, "Error: out of memory\n");
+        free(Sections);
+        free(Moved);
+        free(Buffer);
+        FreePackage(&Package);
+        return -1;
+    }
+
+    /* Build the new layout, packed sections have no raw data and the pack section follows all others */
+    FileAlignment = (uint32_t)GetField(Image, PE_FIELD_FILE_ALIGNMENT);
+    Headers = (uint32_t)GetField(Image, PE_FIELD_SIZE_OF_HEADERS);
+    memcpy(Buffer, Image->Data, Headers);
+    Offset = ((uint64_t)Headers + FileAlignment - 1) & ~(uint64_t)(FileAlignment - 1);
+    DataEnd = Headers;
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        GetSection(Image, Index, &Sections[Index]);
+        Moved[Index] = Sections[Index];
+        if(Sections[Index].SizeOfRawData &&
+           (uint64_t)Sections[Index].PointerToRawData + Sections[Index].SizeOfRawData > DataEnd)
+        {
+            DataEnd = (uint64_t)Sections[Index].PointerToRawData + Sections[Index].SizeOfRawData;
+        }
+        if(Package.Packed[Index] || Sections[Index].SizeOfRawData == 0)
+        {
+            Moved[Index].PointerToRawData = 0;
+            Moved[Index].SizeOfRawData = 0;
+            continue;
+        }
+        memcpy(Buffer + Offset, Image->Data + Sections[Index].PointerToRawData, Sections[Index].SizeOfRawData);
+        Moved[Index].PointerToRawData = (uint32_t)Offset;
+        Offset += ((uint64_t)Sections[Index].SizeOfRawData + FileAlignment - 1) & ~(uint64_t)(FileAlignment - 1);
+    }
+    PackOffset = Offset;
+    memcpy(Buffer + Offset, Package.Data, Package.Size);
+    Offset += ((uint64_t)Package.Size + FileAlignment - 1) & ~(uint64_t)(FileAlignment - 1);
+    memcpy(Buffer + Offset, Image->Data + DataEnd, (size_t)(Image->Size - DataEnd));
+    MoveDebugData(Image, Buffer, Sections, Moved, DataEnd, Offset);
+
+    /* Resize the file and write the new layout */
+    OldSize = Image->Size;
+    if(Package.FileSize != Image->Size && ResizeImage(Image, Package.FileSize) != 0)
+    {
+        snprintf(Message, Size, "Error: unable to resize image\n");
+        free(Sections);
+        free(Moved);
+        free(Buffer);
+        FreePackage(&Package);
+        return -1;
+    }
+    memcpy(Image->Data, Buffer, (size_t)Package.FileSize);
+    free(Buffer);
+
+    /* Packed sections are restored by the stub, so they have to be writable */
+    Block = Package.Data + Package.Stub->Size + PE_PACK_HEADER_SIZE;
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        Header = Image->Data + Sections[Index].HeaderOffset;
+        WriteUint32(Header + PE_SECTION_RAW_POINTER, Moved[Index].PointerToRawData);
+        WriteUint32(Header + PE_SECTION_RAW_SIZE, Moved[Index].SizeOfRawData);
+        if(Package.Packed[Index])
+        {
+            if(Sections[Index].VirtualSize == 0)
+            {
+                WriteUint32(Header + PE_SECTION_VIRTUAL_SIZE, ReadUint32(Block + PE_PACK_BLOCK_TARGET_SIZE));
+            }
+            WriteUint32(Header + PE_SECTION_CHARACTERISTICS, Sections[Index].Characteristics | PE_SCN_MEM_WRITE);
+            Block += PE_PACK_BLOCK_SIZE;
+        }
+    }
+
+    /* Add the pack section, its header holds the stub state */
+    Header = Image->Data + Image->SectionTable + Image->NumberOfSections * PE_SECTION_HEADER_SIZE;
+    memcpy(Header, PE_PACK_SECTION_NAME, strlen(PE_PACK_SECTION_NAME));
+    WriteUint32(Header + PE_SECTION_VIRTUAL_SIZE, Package.Size);
+    WriteUint32(Header + PE_SECTION_VIRTUAL_ADDRESS, Package.VirtualAddress);
+    WriteUint32(Header + PE_SECTION_RAW_SIZE, (Package.Size + FileAlignment - 1) & ~(FileAlignment - 1));
+    WriteUint32(Header + PE_SECTION_RAW_POINTER, (uint32_t)PackOffset);
+    WriteUint32(Header + PE_SECTION_CHARACTERISTICS,
+                PE_SCN_CNT_CODE | PE_SCN_MEM_EXECUTE | PE_SCN_MEM_READ | PE_SCN_MEM_WRITE);
+    Image->NumberOfSections++;
+    WriteUint16(Image->Data + Image->FileHeader + PE_FILE_NUMBER_OF_SECTIONS, (uint16_t)Image->NumberOfSections);
+
+    /* Leave only relocations of unpacked sections to the loader */
+    if(Package.Relocations && GetDirectory(Image, PE_DIRECTORY_BASERELOC, &VirtualAddress, &DirectorySize) &&
+       (Buffer = RvaToPointer(Image, VirtualAddress, DirectorySize)) != NULL)
+    {
+        memset(Buffer, 0, DirectorySize);
+        memcpy(Buffer, Package.Relocations, Package.RelocationSize);
+        SetDirectory(Image, PE_DIRECTORY_BASERELOC, VirtualAddress, Package.RelocationSize);
+    }
+
+    /* Enter the image through the stub, Thumb code is entered with the lowest bit set */
+    Alignment = (uint32_t)GetField(Image, PE_FIELD_SECTION_ALIGNMENT);
+    SetField(Image, PE_FIELD_SIZE_OF_IMAGE,
+             ((uint64_t)Package.VirtualAddress + Package.Size + Alignment - 1) & ~(uint64_t)(Alignment - 1));
+    SetField(Image, PE_FIELD_ADDRESS_OF_ENTRY_POINT,
+             Package.VirtualAddress | (GetField(Image, PE_FIELD_MACHINE) == PE_MACHINE_ARMNT));
+
+    /* Report the result */
+    snprintf(Message, Size, "PE image packed: %u sections, %" PRIu64 " to %u bytes of section data, "
+             "file %" PRIu64 " to %" PRIu64 " bytes\n", Package.BlockCount, Package.SectionSize,
+             Package.Size - Package.Stub->Size, OldSize, Package.FileSize);
+    free(Sections);
+    free(Moved);
+    FreePackage(&Package);
+    return 0;
+}
+
+/* Parses a single edit given on the command line or in the manifest */
+static int ParseEdit(PPE_EDIT Edit, const char *Token)
+{
+    const char *Value;
+    int Field;
+
+    /* Check if rebasing the image, the new ImageBase is validated along with other fields */
+    if(strncasecmp(Token, "rebase=", 7) == 0)
+    {
+        if(ParseNumber(Token + 7, &Edit->Values[PE_FIELD_IMAGE_BASE]) != 0)
+        {
+            printf("Error: %s is not a valid ImageBase\n", Token + 7);
+            return -1;
+        }
+        Edit->FieldMask |= (1U << PE_FIELD_IMAGE_BASE);
+        Edit->Rebase = 1;
+        return 0;
+    }
+
+    /* Check if binding imports */
+    if(strcasecmp(Token, "bind") == 0)
+    {
+        Edit->Bind = 1;
+        return 0;
+    }
+
+    /* Check if packing the image */
+    if(strcasecmp(Token, "pack") == 0)
+    {
+        Edit->Pack = 1;
+        return 0;
+    }
+
+    /* Check if laying out sections at their RVAs */
+    if(strcasecmp(Token, "relayout") == 0)
+    {
+        Edit->Relayout = 1;
+        return 0;
+    }
+
+    /* Check if stripping relocations */
+    if(strcasecmp(Token, "striprelocs") == 0)
+    {
+        Edit->StripRelocations = 1;
+        return 0;
+    }
+
+    /* Check if normalizing the image */
+    if(strcasecmp(Token, "normalize") == 0 || strncasecmp(Token, "normalize=", 10) == 0)
+    {
+        return ParseNormalize(Edit, Token[9] ? Token + 10 : "hash");
+    }
+
+    /* Check if setting a header field */
+    Value = strchr(Token, '=');
+    if(Value)
+    {
+        /* Find the field */
+        for(Field = 0; Field < PE_FIELD_COUNT; Field++)
+        {
+            if(strncasecmp(Fields[Field].Name, Token, Value - Token) == 0 &&
+               Fields[Field].Name[Value - Token] == '\0')
+            {
+                break;
+            }
+        }
+
+        /* SubSystem is set by its name, along with the image signature */
+        if(Field == PE_FIELD_SUBSYSTEM)
+        {
+            Token = Value + 1;
+        }
+        else if(Field == PE_FIELD_COUNT || !Fields[Field].Editable)
+        {
+            /* Unknown or read-only field */
+            printf("Error: %.*s is not an editable PE header field\n", (int)(Value - Token), Token);
+            return -1;
+        }
+        else
+        {
+            /* Parse the new value */
+            if(ParseNumber(Value + 1, &Edit->Values[Field]) != 0)
+            {
+                printf("Error: %s is not a valid value for %s\n", Value + 1, Fields[Field].Name);
+                return -1;
+            }
+            Edit->FieldMask |= (1U << Field);
+            return 0;
+        }
+    }
+
+    /* Check if only reporting the checksum */
+    if(strcasecmp(Token, "checksum") == 0)
+    {
+        Edit->Checksum = 1;
+        return 0;
+    }
+
+    /* Parse the new SubSystem value */
+    Edit->SubSystem = getSubSystem((char *)Token);
+    if(Edit->SubSystem->Identifier == 0)
+    {
+        /* Invalid SubSystem provided */
+        printf("Error: %s is not a valid PE SubSystem\n", Token);
+        return -1;
+    }
+
+    /* Edit parsed successfully */
+    return 0;
+}
+
+/* Parses the image normalization mode */
+static int ParseNormalize(PPE_EDIT Edit, const char *Mode)
+{
+    /* Check the mode */
+    if(strcasecmp(Mode, "hash") == 0)
+    {
+        Edit->Normalize = PE_NORMALIZE_HASH;
+    }
+    else if(strcasecmp(Mode, "zero") == 0)
+    {
+        Edit->Normalize = PE_NORMALIZE_ZERO;
+    }
+    else
+    {
+        /* Invalid mode provided */
+        printf("Error: %s is not a valid normalization mode\n", Mode);
+        return -1;
+    }
+
+    /* Mode parsed successfully */
+    return 0;
+}
+
+/* Parses an unsigned decimal, octal or hexadecimal number */
+static int ParseNumber(const char *String, uint64_t *Value)
+{
+    char *End;
+
+    /* Parse the number */
+    errno = 0;
+    *Value = strtoull(String, &End, 0);
+    if(String[0] == '\0' || String[0] == '-' || *End != '\0' || errno != 0)
+    {
+        return -1;
+    }
+
+    /* Number parsed successfully */
+    return 0;
+}
+
+/* Assigns non-overlapping image bases to all images and turns their edits into rebases */
+static int PlanLayout(PPE_EDIT_LIST List, PPE_LAYOUT Layout, PPE_MODULE *Modules, int **Order)
+{
+    uint64_t Address;
+    uint64_t Size;
+    int Index;
+
+    /* Allocate memory for modules */
+    *Modules = (PPE_MODULE)calloc(List->Count, sizeof(PE_MODULE));
+    *Order = (int *)malloc(List->Count * sizeof(int));
+    if(*Modules == NULL || *Order == NULL)
+    {
+        printf("Error: unable to allocate memory for layout\n");
+        return -1;
+    }
+
+    /* Read sizes and imports of all images */
+    for(Index = 0; Index < List->Count; Index++)
+    {
+        if(LoadModule(&(*Modules)[Index], List->Items[Index].FileName) != PE_STATUS_SUCCESS)
+        {
+            printf("Error: %s is not a valid PE file\n", List->Items[Index].FileName);
+            return -1;
+        }
+    }
+
+    /* Determine the order of images */
+    if(OrderModules(*Modules, List->Count, Layout->PriorityName, *Order) != 0)
+    {
+        return -1;
+    }
+
+    /* Place images one after another, every one aligned on 64KB boundary */
+    Address = (Layout->Base + PE_IMAGE_BASE_ALIGNMENT - 1) & ~(uint64_t)(PE_IMAGE_BASE_ALIGNMENT - 1);
+    for(Index = 0; Index < List->Count; Index++)
+    {
+        Size = ((*Modules)[(*Order)[Index]].SizeOfImage + PE_IMAGE_BASE_ALIGNMENT - 1) &
+               ~(uint64_t)(PE_IMAGE_BASE_ALIGNMENT - 1);
+        if(Address < Layout->Base || Size > Layout->Limit - Address)
+        {
+            printf("Error: images do not fit between 0x%" PRIX64 " and 0x%" PRIX64 "\n", Layout->Base, Layout->Limit);
+            return -1;
+        }
+        List->Items[(*Order)[Index]].Values[PE_FIELD_IMAGE_BASE] = Address;
+        List->Items[(*Order)[Index]].FieldMask |= (1U << PE_FIELD_IMAGE_BASE);
+        List->Items[(*Order)[Index]].Rebase = 1;
+        Address += Size;
+    }
+
+    /* Layout planned successfully */
+    return 0;
+}
+
+/* Applies all edits from the list on a pool of worker threads */
+static void ProcessEdits(PPE_EDIT_LIST List, int Threads)
+{
+#ifdef EXETOOL_PARALLEL
+    pthread_t *Workers;
+    int Created = 0;
+
+    /* Never start more threads than there are images */
+    Threads = (Threads > List->Count) ? List->Count : Threads;
+    List->Next = 0;
+
+    /* Start the workers, the calling thread works as well */
+    Workers = (Threads > 1) ? (pthread_t *)malloc(sizeof(pthread_t) * (Threads - 1)) : NULL;
+    if(Workers)
+    {
+        for(Created = 0; Created < Threads - 1; Created++)
+        {
+            if(pthread_create(&Workers[Created], NULL, ProcessEditsWorker, List) != 0)
+            {
+                /* Continue with threads started so far */
+                break;
+            }
+        }
+    }
+    ProcessEditsWorker(List);
+
+    /* Wait for all workers to finish */
+    while(Created > 0)
+    {
+        pthread_join(Workers[--Created], NULL);
+    }
+    free(Workers);
+#else
+    /* Apply edits one by one */
+    List->Next = 0;
+    ProcessEditsWorker(List);
+#endif
+}
+
+/* Worker thread taking images from the list until all of them are done */
+static void *ProcessEditsWorker(void *Context)
+{
+    PPE_EDIT_LIST List = (PPE_EDIT_LIST)Context;
+    int Index;
+
+    /* Take the next image */
+    while((Index = __atomic_fetch_add(&List->Next, 1, __ATOMIC_RELAXED)) < List->Count)
+    {
+        if(List->Items[Index].Analyze)
+        {
+            AnalyzeImage(&List->Items[Index]);
+        }
+        else if(List->Items[Index].Bandwidth)
+        {
+            BenchmarkImage(&List->Items[Index]);
+        }
+        else
+        {
+            ApplyEdit(&List->Items[Index]);
+        }
+    }
+    return NULL;
+}
+
+/* Breaks the image size down by headers, sections, data directories, imports, exports, relocations and debug data */
+static int ProfileImage(PPE_IMAGE Image, PPE_PROFILE Profile)
+{
+    static const char *Directories[PE_MAX_DIRECTORIES] = {
+        "export", "import", "resource", "exception", "security", "basereloc", "debug", "architecture",
+        "globalptr", "tls", "loadconfig", "boundimport", "iat", "delayimport", "clr", "reserved"
+    };
+    char Name[PE_PROFILE_NAME_SIZE];
+    PE_SECTION Section;
+    const char *String;
+    uint8_t *Descriptor;
+    uint8_t *Directory;
+    uint8_t *Thunk;
+    uint32_t VirtualAddress;
+    uint32_t DirectorySize;
+    uint32_t BlockSize;
+    uint32_t ThunkSize;
+    uint32_t Offset;
+    uint32_t Index;
+    uint32_t Count;
+    uint64_t DataEnd;
+    uint64_t Value;
+    uint64_t Modules = 0;
+    uint64_t Functions = 0;
+    uint64_t NameBytes = 0;
+    uint64_t ThunkBytes = 0;
+    uint64_t Blocks = 0;
+    uint64_t Entries = 0;
+    int Result;
+
+    /* Headers, including the DOS stub and the section table */
+    Profile->FileSize = Image->Size;
+    DataEnd = GetField(Image, PE_FIELD_SIZE_OF_HEADERS);
+    DataEnd = (DataEnd > Image->Size) ? Image->Size : DataEnd;
+    Result = AddProfileItem(Profile, "headers", DataEnd, 1);
+
+    /* Raw data of every section */
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        GetSection(Image, Index, &Section);
+        snprintf(Name, sizeof(Name), "section/%s", Section.Name);
+        Result |= AddProfileItem(Profile, Name, Section.SizeOfRawData, 1);
+        if(Section.SizeOfRawData && (uint64_t)Section.PointerToRawData + Section.SizeOfRawData > DataEnd)
+        {
+            DataEnd = (uint64_t)Section.PointerToRawData + Section.SizeOfRawData;
+        }
+    }
+
+    /* Data directories, these overlap with the sections holding them */
+    for(Index = 0; Index < Image->NumberOfDirectories; Index++)
+    {
+        if(GetDirectory(Image, Index, &VirtualAddress, &DirectorySize))
+        {
+            snprintf(Name, sizeof(Name), "directory/%s", Directories[Index]);
+            Result |= AddProfileItem(Profile, Name, DirectorySize, 1);
+        }
+    }
+
+    /* Import descriptors, thunk tables and names of imported modules and functions */
+    ThunkSize = Image->Pe32Plus ? 8 : 4;
+    while((Descriptor = GetImportDescriptor(Image, (uint32_t)Modules)) != NULL)
+    {
+        Modules++;
+        String = RvaToString(Image, ReadUint32(Descriptor + PE_IMPORT_NAME));
+        NameBytes += String ? strlen(String) + 1 : 0;
+        VirtualAddress = ReadUint32(Descriptor + PE_IMPORT_ORIGINAL_THUNK);
+        VirtualAddress = VirtualAddress ? VirtualAddress : ReadUint32(Descriptor + PE_IMPORT_FIRST_THUNK);
+        for(Count = 0; (Thunk = RvaToPointer(Image, VirtualAddress + Count * ThunkSize, ThunkSize)) != NULL; Count++)
+        {
+            Value = Image->Pe32Plus ? ReadUint64(Thunk) : ReadUint32(Thunk);
+            if(Value == 0)
+            {
+                break;
+            }
+            if(!(Value >> (ThunkSize * 8 - 1)) && (String = RvaToString(Image, (uint32_t)Value + 2)) != NULL)
+            {
+                /* Hint/name entry, padded to even size */
+                NameBytes += (2 + strlen(String) + 1 + 1) & ~1ULL;
+            }
+        }
+        Functions += Count;
+        ThunkBytes += (uint64_t)(Count + 1) * ThunkSize * (ReadUint32(Descriptor + PE_IMPORT_ORIGINAL_THUNK) ? 2 : 1);
+    }
+    if(Modules)
+    {
+        Result |= AddProfileItem(Profile, "imports/descriptors", (Modules + 1) * PE_IMPORT_DESCRIPTOR_SIZE, Modules);
+        Result |= AddProfileItem(Profile, "imports/thunks", ThunkBytes, Functions);
+        Result |= AddProfileItem(Profile, "imports/names", NameBytes, Modules + Functions);
+    }
+
+    /* Export address table, name pointers, ordinals and names */
+    if(GetDirectory(Image, PE_DIRECTORY_EXPORT, &VirtualAddress, &DirectorySize) &&
+       (Directory = RvaToPointer(Image, VirtualAddress, PE_EXPORT_DIRECTORY_SIZE)) != NULL)
+    {
+        Count = ReadUint32(Directory + PE_EXPORT_NUMBER_OF_FUNCTIONS);
+        Result |= AddProfileItem(Profile, "exports/functions", (uint64_t)Count * 4, Count);
+        Count = ReadUint32(Directory + PE_EXPORT_NUMBER_OF_NAMES);
+        NameBytes = (uint64_t)Count * 6;
+        for(Index = 0; Index < Count; Index++)
+        {
+            Thunk = RvaToPointer(Image, ReadUint32(Directory + PE_EXPORT_NAMES) + Index * 4, 4);
+            if(Thunk == NULL)
+            {
+                break;
+            }
+            String = RvaToString(Image, ReadUint32(Thunk));
+            NameBytes += String ? strlen(String) + 1 : 0;
+        }
+        Result |= AddProfileItem(Profile, "exports/names", NameBytes, Count);
+    }
+
+    /* Base relocation blocks and their entries */
+    if(GetDirectory(Image, PE_DIRECTORY_BASERELOC, &VirtualAddress, &DirectorySize) &&
+       (Directory = RvaToPointer(Image, VirtualAddress, DirectorySize)) != NULL)
+    {
+        for(Offset = 0; Offset + 8 <= DirectorySize; Offset += BlockSize)
+        {
+            BlockSize = ReadUint32(Directory + Offset + 4);
+            if(BlockSize < 8 || BlockSize > DirectorySize - Offset)
+            {
+                break;
+            }
+            Blocks++;
+            for(Index = 8; Index + 2 <= BlockSize; Index += 2)
+            {
+                Entries += ((ReadUint16(Directory + Offset + Index) >> 12) != PE_RELOCATION_ABSOLUTE);
+            }
+        }
+        Result |= AddProfileItem(Profile, "relocations/blocks", Blocks * 8, Blocks);
+        Result |= AddProfileItem(Profile, "relocations/entries", Offset - Blocks * 8, Entries);
+    }
+
+    /* Debug data, grouped by its type */
+    if(GetDirectory(Image, PE_DIRECTORY_DEBUG, &VirtualAddress, &DirectorySize) &&
+       (Directory = RvaToPointer(Image, VirtualAddress, DirectorySize)) != NULL)
+    {
+        for(Offset = 0; Offset + PE_DEBUG_ENTRY_SIZE <= DirectorySize; Offset += PE_DEBUG_ENTRY_SIZE)
+        {
+            Count = ReadUint32(Directory + Offset + PE_DEBUG_TYPE);
+            if(Count == PE_DEBUG_TYPE_CODEVIEW)
+            {
+                snprintf(Name, sizeof(Name), "debug/codeview");
+            }
+            else
+            {
+                snprintf(Name, sizeof(Name), "debug/type%u", Count);
+            }
+            Result |= AddProfileItem(Profile, Name, ReadUint32(Directory + Offset + PE_DEBUG_SIZE_OF_DATA), 1);
+        }
+    }
+
+    /* Data appended past the last section, like the certificate table */
+    if(Image->Size > DataEnd)
+    {
+        Result |= AddProfileItem(Profile, "overlay", Image->Size - DataEnd, 1);
+    }
+
+    /* Return result */
+    return Result;
+}
+
+/* Reads a 16-bit little-endian value */
+static uint16_t ReadUint16(const uint8_t *Buffer)
+{
+    return (uint16_t)(Buffer[0] | (Buffer[1] << 8));
+}
+
+/* Reads a 32-bit little-endian value */
+static uint32_t ReadUint32(const uint8_t *Buffer)
+{
+    return ReadUint16(Buffer) | ((uint32_t)ReadUint16(Buffer + 2) << 16);
+}
+
+/* Reads a 64-bit little-endian value */
+static uint64_t ReadUint64(const uint8_t *Buffer)
+{
+    return ReadUint32(Buffer) | ((uint64_t)ReadUint32(Buffer + 4) << 32);
+}
+
+/* Rewrites the image so that raw section offsets equal their RVAs and it can be mapped without copying */
+static int RelayoutImage(PPE_IMAGE Image, int Apply, char *Message, size_t Size)
+{
+    PPE_SECTION Sections;
+    PPE_SECTION Moved;
+    uint8_t *Buffer;
+    uint32_t Alignment;
+    uint32_t Headers;
+    uint32_t Index;
+    uint64_t DataEnd;
+    uint64_t FileEnd;
+    uint64_t Limit;
+    uint64_t NewSize;
+    uint64_t OldSize;
+    uint64_t Overlay;
+    uint32_t Security = 0;
+    uint32_t SecuritySize = 0;
+    int Mapped;
+
+    /* Section alignment becomes the file alignment, headers are padded up to it */
+    Alignment = (uint32_t)GetField(Image, PE_FIELD_SECTION_ALIGNMENT);
+    Headers = (uint32_t)GetField(Image, PE_FIELD_SIZE_OF_HEADERS);
+    if(Alignment == 0 || (Alignment & (Alignment - 1)) || Headers > Image->Size)
+    {
+        snprintf(Message, Size, "Error: image has invalid SectionAlignment or SizeOfHeaders\n");
+        return -1;
+    }
+    Mapped = (GetField(Image, PE_FIELD_FILE_ALIGNMENT) == Alignment && Headers % Alignment == 0);
+    DataEnd = Headers;
+    FileEnd = ((uint64_t)Headers + Alignment - 1) & ~(uint64_t)(Alignment - 1);
+    Limit = FileEnd;
+
+    /* Read the section table, sections have to be aligned, ascending and non-overlapping */
+    Sections = (PPE_SECTION)calloc(Image->NumberOfSections + 1, sizeof(PE_SECTION));
+    if(Sections == NULL)
+    {
+        snprintf(Message, Size, "Error: out of memory\n");
+        return -1;
+    }
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        GetSection(Image, Index, &Sections[Index]);
+        if(Sections[Index].VirtualAddress % Alignment || Sections[Index].VirtualAddress < Limit)
+        {
+            snprintf(Message, Size, "Error: section %s is not aligned or overlaps the previous one\n",
+                     Sections[Index].Name);
+            free(Sections);
+            return -1;
+        }
+        if(Sections[Index].SizeOfRawData)
+        {
+            if((uint64_t)Sections[Index].PointerToRawData + Sections[Index].SizeOfRawData > Image->Size)
+            {
+                snprintf(Message, Size, "Error: raw data of section %s lies outside the file\n", Sections[Index].Name);
+                free(Sections);
+                return -1;
+            }
+            if((uint64_t)Sections[Index].PointerToRawData + Sections[Index].SizeOfRawData > DataEnd)
+            {
+                DataEnd = (uint64_t)Sections[Index].PointerToRawData + Sections[Index].SizeOfRawData;
+            }
+            Mapped &= (Sections[Index].PointerToRawData == Sections[Index].VirtualAddress);
+            FileEnd = ((uint64_t)Sections[Index].VirtualAddress + Sections[Index].SizeOfRawData + Alignment - 1) &
+                      ~(uint64_t)(Alignment - 1);
+        }
+        Limit = (uint64_t)Sections[Index].VirtualAddress +
+                (Sections[Index].VirtualSize > Sections[Index].SizeOfRawData ? Sections[Index].VirtualSize :
+                                                                               Sections[Index].SizeOfRawData);
+        Limit = (Limit + Alignment - 1) & ~(uint64_t)(Alignment - 1);
+    }
+
+    /* Data past the last section, like the certificate table, is moved along with the end of the file */
+    Overlay = Image->Size - DataEnd;
+    if(GetDirectory(Image, PE_DIRECTORY_SECURITY, &Security, &SecuritySize) &&
+       (Security < DataEnd || (uint64_t)Security + SecuritySize > Image->Size))
+    {
+        snprintf(Message, Size, "Error: certificate table does not follow the section data\n");
+        free(Sections);
+        return -1;
+    }
+
+    /* Check if there is anything to do */
+    OldSize = Image->Size;
+    NewSize = FileEnd + Overlay;
+    if(Mapped || !Apply)
+    {
+        if(Mapped && Apply)
+        {
+            snprintf(Message, Size, "PE image already laid out at section alignment\n");
+        }
+        free(Sections);
+        return 0;
+    }
+
+    /* Build the new layout, padding between sections stays zeroed */
+    Buffer = (uint8_t *)calloc(1, (size_t)NewSize);
+    if(Buffer == NULL)
+    {
+        snprintf(Message, Size, "Error: out of memory\n");
+        free(Sections);
+        return -1;
+    }
+    memcpy(Buffer, Image->Data, Headers);
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        if(Sections[Index].SizeOfRawData)
+        {
+            memcpy(Buffer + Sections[Index].VirtualAddress, Image->Data + Sections[Index].PointerToRawData,
+                   Sections[Index].SizeOfRawData);
+        }
+    }
+    memcpy(Buffer + FileEnd, Image->Data + DataEnd, (size_t)Overlay);
+
+    /* Debug data is referenced by its file offset, translate it to the new layout */
+    Moved = (PPE_SECTION)calloc(Image->NumberOfSections + 1, sizeof(PE_SECTION));
+    if(Moved == NULL)
+    {
+        snprintf(Message, Size, "Error: out of memory\n");
+        free(Buffer);
+        free(Sections);
+        return -1;
+    }
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        Moved[Index] = Sections[Index];
+        Moved[Index].PointerToRawData = Sections[Index].VirtualAddress;
+    }
+    MoveDebugData(Image, Buffer, Sections, Moved, DataEnd, FileEnd);
+    free(Moved);
+
+    /* Grow the file and write the new layout */
+    if(ResizeImage(Image, NewSize) != 0)
+    {
+        snprintf(Message, Size, "Error: unable to resize image\n");
+        free(Buffer);
+        free(Sections);
+        return -1;
+    }
+    memcpy(Image->Data, Buffer, (size_t)NewSize);
+    free(Buffer);
+
+    /* Point the section headers to the new raw data */
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        if(Sections[Index].SizeOfRawData)
+        {
+            WriteUint32(Image->Data + Sections[Index].HeaderOffset + PE_SECTION_RAW_POINTER,
+                        Sections[Index].VirtualAddress);
+            WriteUint32(Image->Data + Sections[Index].HeaderOffset + PE_SECTION_RAW_SIZE,
+                        (Sections[Index].SizeOfRawData + Alignment - 1) & ~(Alignment - 1));
+        }
+    }
+    free(Sections);
+
+    /* Update the alignment, headers size and the certificate table location */
+    SetField(Image, PE_FIELD_FILE_ALIGNMENT, Alignment);
+    SetField(Image, PE_FIELD_SIZE_OF_HEADERS, (Headers + Alignment - 1) & ~(Alignment - 1));
+    if(SecuritySize)
+    {
+        SetDirectory(Image, PE_DIRECTORY_SECURITY, (uint32_t)(FileEnd + Security - DataEnd), SecuritySize);
+    }
+
+    /* Report the padding cost */
+    snprintf(Message, Size, "PE image laid out at 0x%X alignment: %" PRIu64 " to %" PRIu64 " bytes, "
+             "%" PRIu64 " bytes of padding added\n", Alignment, OldSize, NewSize, NewSize - OldSize);
+    return 0;
+}
+
+
+/* Walks all base relocation blocks, checking them or applying the delta to every relocated address */
+static int RelocateImage(PPE_IMAGE Image, uint64_t Delta, int Apply, uint32_t *Count)
+{
+    uint32_t VirtualAddress;
+    uint32_t DirectorySize;
+    uint32_t BlockAddress;
+    uint32_t BlockSize;
+    uint32_t Offset;
+    uint32_t Index;
+    uint32_t Value;
+    uint16_t Entry;
+    uint8_t *Directory;
+    uint8_t *Target;
+
+    /* Check if the image has relocations */
+    *Count = 0;
+    if(!GetDirectory(Image, PE_DIRECTORY_BASERELOC, &VirtualAddress, &DirectorySize) ||
+       (GetField(Image, PE_FIELD_CHARACTERISTICS) & PE_FILE_RELOCS_STRIPPED))
+    {
+        /* Image can be loaded at its ImageBase only */
+        return (Delta == 0) ? 0 : -1;
+    }
+    Directory = RvaToPointer(Image, VirtualAddress, DirectorySize);
+    if(Directory == NULL)
+    {
+        return -1;
+    }
+
+    /* Walk all blocks, each one covers a single 4KB page */
+    for(Offset = 0; Offset + 8 <= DirectorySize; Offset += BlockSize)
+    {
+        BlockAddress = ReadUint32(Directory + Offset);
+        BlockSize = ReadUint32(Directory + Offset + 4);
+        if(BlockSize < 8 || BlockSize > DirectorySize - Offset || (BlockSize & 1))
+        {
+            /* Malformed block */
+            return -1;
+        }
+
+        /* Process all entries in the block */
+        for(Index = 8; Index + 2 <= BlockSize; Index += 2)
+        {
+            Entry = ReadUint16(Directory + Offset + Index);
+            switch(Entry >> 12)
+            {
+                case PE_RELOCATION_ABSOLUTE:
+                    /* Padding entry */
+                    continue;
+                case PE_RELOCATION_HIGH:
+                    /* High 16 bits of the address */
+                    Target = RvaToPointer(Image, BlockAddress + (Entry & 0xFFF), 2);
+                    if(Target && Apply)
+                    {
+                        WriteUint16(Target, (uint16_t)(ReadUint16(Target) + (uint16_t)(Delta >> 16)));
+                    }
+                    break;
+                case PE_RELOCATION_LOW:
+                    /* Low 16 bits of the address */
+                    Target = RvaToPointer(Image, BlockAddress + (Entry & 0xFFF), 2);
+                    if(Target && Apply)
+                    {
+                        WriteUint16(Target, (uint16_t)(ReadUint16(Target) + (uint16_t)Delta));
+                    }
+                    break;
+                case PE_RELOCATION_HIGHLOW:
+                    /* 32-bit address */
+                    Target = RvaToPointer(Image, BlockAddress + (Entry & 0xFFF), 4);
+                    if(Target && Apply)
+                    {
+                        WriteUint32(Target, ReadUint32(Target) + (uint32_t)Delta);
+                    }
+                    break;
+                case PE_RELOCATION_HIGHADJ:
+                    /* High half of the address, adjusted with the low half stored in the next entry */
+                    Target = RvaToPointer(Image, BlockAddress + (Entry & 0xFFF), 2);
+                    Index += 2;
+                    if(Index + 2 > BlockSize)
+                    {
+                        return -1;
+                    }
+                    if(Target && Apply)
+                    {
+                        Value = ((uint32_t)ReadUint16(Target) << 16) + (int16_t)ReadUint16(Directory + Offset + Index);
+                        WriteUint16(Target, (uint16_t)((Value + (uint32_t)Delta + 0x8000) >> 16));
+                    }
+                    break;
+                case PE_RELOCATION_DIR64:
+                    /* 64-bit address */
+                    Target = RvaToPointer(Image, BlockAddress + (Entry & 0xFFF), 8);
+                    if(Target && Apply)
+                    {
+                        WriteUint64(Target, ReadUint64(Target) + Delta);
+                    }
+                    break;
+                default:
+                    /* Unsupported relocation type */
+                    return -1;
+            }
+
+            /* Relocated address has to be backed by the file */
+            if(Target == NULL)
+            {
+                return -1;
+            }
+            (*Count)++;
+        }
+    }
+
+    /* Mark the image as modified */
+    if(Apply && *Count)
+    {
+        Image->Modified = 1;
+    }
+    return 0;
+}
+
+/* Resizes the file and maps it again */
+static int ResizeImage(PPE_IMAGE Image, uint64_t Size)
+{
+#ifdef _WIN32
+    LARGE_INTEGER FileSize;
+#endif
+    uint64_t Resized = Size;
+    uint8_t *Copy;
+
+    /* Private copy is resized in memory, the file is resized once the copy is written back */
+    if(Image->View)
+    {
+        Copy = (uint8_t *)realloc(Image->Data, (size_t)Size);
+        if(Copy == NULL)
+        {
+            return -1;
+        }
+        if(Size > Image->Size)
+        {
+            memset(Copy + Image->Size, 0, (size_t)(Size - Image->Size));
+        }
+        Image->Data = Copy;
+        Image->Size = Size;
+        Image->Modified = 1;
+        return 0;
+    }
+
+#ifdef _WIN32
+
+    /* Unmap the view, so that the file can be resized */
+    FlushViewOfFile(Image->Data, 0);
+    UnmapViewOfFile(Image->Data);
+    CloseHandle(Image->MappingHandle);
+    Image->Data = NULL;
+
+    /* Resize the file and map it again */
+    FileSize.QuadPart = (LONGLONG)Size;
+    if(!SetFilePointerEx(Image->FileHandle, FileSize, NULL, FILE_BEGIN) || !SetEndOfFile(Image->FileHandle))
+    {
+        Resized = Image->MappedSize;
+    }
+    Image->MappingHandle = CreateFileMappingA(Image->FileHandle, NULL, PAGE_READWRITE, 0, 0, NULL);
+    Image->Data = Image->MappingHandle ? (uint8_t *)MapViewOfFile(Image->MappingHandle, FILE_MAP_WRITE, 0, 0, 0) : NULL;
+    if(Image->Data == NULL)
+    {
+        /* Image cannot be accessed anymore */
+        return -1;
+    }
+#else
+    /* Unmap the file, resize it and map it again */
+    munmap(Image->Data, (size_t)Image->MappedSize);
+    if(ftruncate(Image->Descriptor, (off_t)Size) != 0)
+    {
+        Resized = Image->MappedSize;
+    }
+    Image->Data = (uint8_t *)mmap(NULL, (size_t)Resized, PROT_READ | PROT_WRITE, MAP_SHARED, Image->Descriptor, 0);
+    if(Image->Data == MAP_FAILED)
+    {
+        /* Image cannot be accessed anymore */
+        Image->Data = NULL;
+        return -1;
+    }
+#endif
+
+    /* Check if the file has been resized */
+    Image->Modified = 1;
+    if(Resized != Size)
+    {
+        return -1;
+    }
+    Image->Size = Size;
+    Image->MappedSize = Size;
+    return 0;
+}
+
+/* Resolves the imported symbol to its address, following forwarders to other modules */
+static int ResolveImport(PPE_BIND_CONTEXT Context, PPE_IMAGE Module, const char *Name, uint16_t Hint,
+                         uint32_t Ordinal, uint64_t *Address, int Depth)
+{
+    PE_IMAGE Target;
+    const char *Forwarder;
+    const char *Separator;
+    char ModuleName[PE_MAX_MODULE_NAME];
+    uint32_t Function;
+    uint32_t TimeDateStamp;
+    int Index;
+    int Result;
+
+    /* Find the export */
+    if(GetExport(Module, Name, Hint, Ordinal, &Function, &Forwarder) != 0)
+    {
+        return -1;
+    }
+    if(Forwarder == NULL)
+    {
+        /* Regular export, DLL is already rebased so its ImageBase is final */
+        *Address = GetField(Module, PE_FIELD_IMAGE_BASE) + Function;
+        return 0;
+    }
+
+    /* Forwarder has the form of MODULE.Symbol or MODULE.#Ordinal */
+    Separator = strrchr(Forwarder, '.');
+    if(Separator == NULL || Depth >= PE_MAX_FORWARDERS)
+    {
+        return -1;
+    }
+    snprintf(ModuleName, sizeof(ModuleName), "%.*s.dll", (int)(Separator - Forwarder), Forwarder);
+    if(OpenModule(Context, &Target, ModuleName) != PE_STATUS_SUCCESS)
+    {
+        return -1;
+    }
+
+    /* Record the forwarder module once per imported module, so that the loader validates its timestamp too */
+    TimeDateStamp = (uint32_t)GetField(&Target, PE_FIELD_TIME_DATE_STAMP);
+    for(Index = Context->Current + 1; Index < Context->EntryCount; Index++)
+    {
+        if(strcasecmp(Context->Entries[Index].Name, ModuleName) == 0)
+        {
+            break;
+        }
+    }
+    if(Index == Context->EntryCount)
+    {
+        if(AddBoundEntry(Context, ModuleName, TimeDateStamp) == NULL)
+        {
+            CloseImage(&Target);
+            return -1;
+        }
+        Context->Entries[Context->Current].References++;
+    }
+
+    /* Resolve the symbol in the target module */
+    Result = ResolveImport(Context, &Target, (Separator[1] == '#') ? NULL : Separator + 1, 0,
+                           (uint32_t)atoi(Separator + 2), Address, Depth + 1);
+    Context->Forwarded += (Result == 0 && Depth == 0);
+    CloseImage(&Target);
+    return Result;
+}
+
+/* Translates the RVA range into pointer to the file data, or NULL if it is not backed by the file */
+static uint8_t *RvaToPointer(PPE_IMAGE Image, uint32_t VirtualAddress, uint32_t Length)
+{
+    PE_SECTION Section;
+    uint32_t Index;
+
+    /* Check if the range lies within the headers */
+    if((uint64_t)VirtualAddress + Length <= GetField(Image, PE_FIELD_SIZE_OF_HEADERS))
+    {
+        return GetPointer(Image, VirtualAddress, Length);
+    }
+
+    /* Find the section holding the range */
+    for(Index = 0; Index < Image->NumberOfSections; Index++)
+    {
+        GetSection(Image, Index, &Section);
+        if(VirtualAddress >= Section.VirtualAddress &&
+           (uint64_t)VirtualAddress - Section.VirtualAddress + Length <= Section.SizeOfRawData)
+        {
+            return GetPointer(Image, (uint64_t)Section.PointerToRawData + VirtualAddress - Section.VirtualAddress,
+                              Length);
+        }
+    }
+
+    /* Range is not backed by the file */
+    return NULL;
+}
+
+/* Gets pointer to the NUL-terminated string at the RVA, or NULL if it is not entirely backed by the file */
+static const char *RvaToString(PPE_IMAGE Image, uint32_t VirtualAddress)
+{
+    const uint8_t *String;
+    uint64_t Length;
+
+    /* Find the start of the string */
+    String = RvaToPointer(Image, VirtualAddress, 1);
+    if(String == NULL)
+    {
+        return NULL;
+    }
+
+    /* Make sure the string ends within the file */
+    Length = Image->Size - (uint64_t)(String - Image->Data);
+    return memchr(String, '\0', (size_t)Length) ? (const char *)String : NULL;
+}
+
+/* Selects the fastest checksum kernel supported by the CPU */
+static PPE_SUM_KERNEL SelectSumKernel(void)
+{
+    int Index;
+
+    /* Walk the kernels list starting from the fastest one */
+    for(Index = sizeof(SumKernels) / sizeof(PE_SUM_KERNEL) - 1; Index > 0; Index--)
+    {
+        if(!SumKernels[Index].IsSupported || SumKernels[Index].IsSupported())
+        {
+            /* Kernel supported */
+            return &SumKernels[Index];
+        }
+    }
+
+    /* Fall back to the scalar kernel */
+    return &SumKernels[0];
+}
+
+/* Moves the image to a private copy, so that edits which can still fail leave the file intact */
+static int StageImage(PPE_IMAGE Image)
+{
+    uint8_t *Copy;
+
+    /* Copy the mapped file */
+    Copy = (uint8_t *)malloc((size_t)Image->Size);
+    if(Copy == NULL)
+    {
+        return -1;
+    }
+    memcpy(Copy, Image->Data, (size_t)Image->Size);
+
+    /* Edit the copy, the mapping is kept for writing it back */
+    Image->View = Image->Data;
+    Image->Data = Copy;
+    return 0;
+}
+
+/* Removes the relocation directory, along with the .reloc section if it is the last one in the image */
+static void StripRelocations(PPE_IMAGE Image, char *Message, size_t Size)
+{
+    PE_SECTION Previous;
+    PE_SECTION Section;
+    uint32_t VirtualAddress;
+    uint32_t DirectorySize;
+    uint32_t Alignment;
+    uint32_t Security;
+    uint32_t Index;
+    uint64_t Removed = 0;
+
+    /* Mark the image as not relocatable */
+    SetField(Image, PE_FIELD_CHARACTERISTICS, GetField(Image, PE_FIELD_CHARACTERISTICS) | PE_FILE_RELOCS_STRIPPED);
+    SetField(Image, PE_FIELD_DLL_CHARACTERISTICS,
+             GetField(Image, PE_FIELD_DLL_CHARACTERISTICS) & ~(PE_DLL_DYNAMIC_BASE | PE_DLL_HIGH_ENTROPY_VA));
+
+    /* Check if the image has relocations */
+    if(!GetDirectory(Image, PE_DIRECTORY_BASERELOC, &VirtualAddress, &DirectorySize))
+    {
+        snprintf(Message, Size, "PE relocations stripped: image has no relocation directory\n");
+        return;
+    }
+    SetDirectory(Image, PE_DIRECTORY_BASERELOC, 0, 0);
+
+    /* Check if the last section holds nothing but relocations and its data ends the file */
+    Index = Image->NumberOfSections - 1;
+    if(Image->NumberOfSections > 1 && GetSection(Image, Index, &Section) == 0 &&
+       VirtualAddress == Section.VirtualAddress && DirectorySize <= Section.VirtualSize &&
+       (Section.SizeOfRawData == 0 || (uint64_t)Section.PointerToRawData + Section.SizeOfRawData == Image->Size) &&
+       !GetDirectory(Image, PE_DIRECTORY_SECURITY, &Security, &Security))
+    {
+        /* Remove the section header and shrink the image */
+        GetSection(Image, Index - 1, &Previous);
+        Alignment = (uint32_t)GetField(Image, PE_FIELD_SECTION_ALIGNMENT);
+        memset(Image->Data + Section.HeaderOffset, 0, PE_SECTION_HEADER_SIZE);
+        WriteUint16(Image->Data + Image->FileHeader + PE_FILE_NUMBER_OF_SECTIONS, (uint16_t)Index);
+        Image->NumberOfSections = Index;
+        SetField(Image, PE_FIELD_SIZE_OF_IMAGE,
+                 ((uint64_t)Previous.VirtualAddress + Previous.VirtualSize + Alignment - 1) & ~(uint64_t)(Alignment - 1));
+        if(Section.SizeOfRawData)
+        {
+            Removed = Image->Size - Section.PointerToRawData;
+            Image->Size = Section.PointerToRawData;
+        }
+        snprintf(Message, Size, "PE relocations stripped: section %s removed, file shrunk by %" PRIu64 " bytes\n",
+                 Section.Name, Removed);
+        return;
+    }
+
+    /* Relocations are not in a separate section */
+    snprintf(Message, Size, "PE relocations stripped: relocation directory cleared\n");
+}
+
+/* Updates the location and size of the data directory */
+static int SetDirectory(PPE_IMAGE Image, int Index, uint32_t VirtualAddress, uint32_t Size)
+{
+    uint8_t *Entry;
+
+    /* Check if the directory is present */
+    if((uint32_t)Index >= Image->NumberOfDirectories)
+    {
+        return -1;
+    }
+
+    /* Write the directory entry */
+    Entry = Image->Data + Image->OptionalHeader + (Image->Pe32Plus ? 112 : 96) + Index * 8;
+    WriteUint32(Entry, VirtualAddress);
+    WriteUint32(Entry + 4, Size);
+    Image->Modified = 1;
+    return 0;
+}
+
+/* Writes the header field */
+static void SetField(PPE_IMAGE Image, int Field, uint64_t Value)
+{
+    uint8_t *Pointer;
+    uint8_t Size;
+
+    /* Locate the field */
+    Pointer = Image->Data + (Fields[Field].Header == PE_HEADER_FILE ? Image->FileHeader : Image->OptionalHeader) +
+              (Image->Pe32Plus ? Fields[Field].Offset64 : Fields[Field].Offset32);
+    Size = Image->Pe32Plus ? Fields[Field].Size64 : Fields[Field].Size32;
+
+    /* Write the value */
+    switch(Size)
+    {
+        case 2:
+            WriteUint16(Pointer, (uint16_t)Value);
+            break;
+        case 4:
+            WriteUint32(Pointer, (uint32_t)Value);
+            break;
+        default:
+            WriteUint64(Pointer, Value);
+            break;
+    }
+    Image->Modified = 1;
+}
+
+/* Writes the image signature */
+static void SetSignature(PPE_IMAGE Image, uint32_t Signature)
+{
+    WriteUint32(Image->Data + Image->HeaderOffset, Signature);
+    Image->Modified = 1;
+}
+
+#ifdef EXETOOL_X86_KERNELS
+/* Sums little-endian 16-bit words using AVX2 instructions, 32 bytes at a time */
+__attribute__((target("avx2")))
+static uint64_t SumWordsAvx2(const uint8_t *Data, size_t Length)
+{
+    const __m256i LowMask = _mm256_set1_epi16(0x00FF);
+    const __m256i Zero = _mm256_setzero_si256();
+    __m256i High = _mm256_setzero_si256();
+    __m256i Low = _mm256_setzero_si256();
+    __m256i Words;
+    uint64_t Lanes[4];
+
+    /* Sum low and high bytes of all words separately, SAD yields 64-bit lanes that never overflow */
+    while(Length >= 32)
+    {
+        Words = _mm256_loadu_si256((const __m256i *)Data);
+        Low = _mm256_add_epi64(Low, _mm256_sad_epu8(_mm256_and_si256(Words, LowMask), Zero));
+        High = _mm256_add_epi64(High, _mm256_sad_epu8(_mm256_srli_epi16(Words, 8), Zero));
+        Data += 32;
+        Length -= 32;
+    }
+
+    /* Combine all lanes */
+    _mm256_storeu_si256((__m256i *)Lanes, _mm256_add_epi64(Low, _mm256_slli_epi64(High, 8)));
+
+    /* Sum the remaining words */
+    return Lanes[0] + Lanes[1] + Lanes[2] + Lanes[3] + SumWordsSse2(Data, Length);
+}
+#endif
+
+#ifdef EXETOOL_NEON_KERNEL
+/* Sums little-endian 16-bit words using NEON instructions, 16 bytes at a time */
+static uint64_t SumWordsNeon(const uint8_t *Data, size_t Length)
+{
+    uint64x2_t Sum = vdupq_n_u64(0);
+    uint32x4_t Partial;
+    size_t Count;
+
+    /* Accumulate words pairwise into 32-bit lanes, widening them before they could overflow */
+    while(Length >= 16)
+    {
+        Partial = vdupq_n_u32(0);
+        for(Count = 0; Count < 16384 && Length >= 16; Count++)
+        {
+            Partial = vpadalq_u16(Partial, vreinterpretq_u16_u8(vld1q_u8(Data)));
+            Data += 16;
+            Length -= 16;
+        }
+        Sum = vpadalq_u32(Sum, Partial);
+    }
+
+    /* Sum the remaining words */
+    return vgetq_lane_u64(Sum, 0) + vgetq_lane_u64(Sum, 1) + SumWordsScalar(Data, Length);
+}
+#endif
+
+/* Sums little-endian 16-bit words */
+static uint64_t SumWordsScalar(const uint8_t *Data, size_t Length)
+{
+    uint64_t Sum = 0;
+    size_t Index;
+
+    /* Add all words */
+    for(Index = 0; Index + 1 < Length; Index += 2)
+    {
+        Sum += ReadUint16(Data + Index);
+    }
+
+    /* Return the sum */
+    return Sum;
+}
+
+#ifdef EXETOOL_X86_KERNELS
+/* Sums little-endian 16-bit words using SSE2 instructions, 16 bytes at a time */
+__attribute__((target("sse2")))
+static uint64_t SumWordsSse2(const uint8_t *Data, size_t Length)
+{
+    const __m128i LowMask = _mm_set1_epi16(0x00FF);
+    const __m128i Zero = _mm_setzero_si128();
+    __m128i High = _mm_setzero_si128();
+    __m128i Low = _mm_setzero_si128();
+    __m128i Words;
+    uint64_t Lanes[2];
+
+    /* Sum low and high bytes of all words separately, SAD yields 64-bit lanes that never overflow */
+    while(Length >= 16)
+    {
+        Words = _mm_loadu_si128((const __m128i *)Data);
+        Low = _mm_add_epi64(Low, _mm_sad_epu8(_mm_and_si128(Words, LowMask), Zero));
+        High = _mm_add_epi64(High, _mm_sad_epu8(_mm_srli_epi16(Words, 8), Zero));
+        Data += 16;
+        Length -= 16;
+    }
+
+    /* Combine both lanes */
+    _mm_storeu_si128((__m128i *)Lanes, _mm_add_epi64(Low, _mm_slli_epi64(High, 8)));
+
+    /* Sum the remaining words */
+    return Lanes[0] + Lanes[1] + SumWordsScalar(Data, Length);
+}
+#endif
+
+/* Recalculates the image checksum and stores it only if it has changed */
+static uint32_t UpdateChecksum(PPE_IMAGE Image, uint32_t *OldChecksum)
+{
+    uint32_t Checksum;
+
+    /* Calculate the checksum */
+    *OldChecksum = (uint32_t)GetField(Image, PE_FIELD_CHECKSUM);
+    Checksum = ComputeChecksum(Image);
+
+    /* Avoid dirtying the mapping if nothing has changed */
+    if(Checksum != *OldChecksum)
+    {
+        SetField(Image, PE_FIELD_CHECKSUM, Checksum);
+    }
+
+    /* Return the new checksum */
+    return Checksum;
+}
+
+/* Checks whether all edits can be applied to the image */
+static int ValidateEdit(PPE_IMAGE Image, PPE_EDIT Edit)
+{
+    PE_PACKAGE Package;
+    uint32_t Relocations;
+    uint64_t SubSystem;
+    uint64_t Limit;
+    uint8_t Size;
+    int Field;
+
+    /* Make sure all values fit in their fields, sizes differ between PE32 and PE32+ */
+    for(Field = 0; Field < PE_FIELD_COUNT; Field++)
+    {
+        Size = Image->Pe32Plus ? Fields[Field].Size64 : Fields[Field].Size32;
+        Limit = (Size == 8) ? UINT64_MAX : ((1ULL << (Size * 8)) - 1);
+        if((Edit->FieldMask & (1U << Field)) && Edit->Values[Field] > Limit)
+        {
+            snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: value 0x%" PRIX64 " does not fit in %s field\n",
+                     Edit->Values[Field], Fields[Field].Name);
+            return -1;
+        }
+    }
+
+    /* Image base has to be aligned on 64KB boundary */
+    if(GetEditValue(Image, Edit, PE_FIELD_IMAGE_BASE) % PE_IMAGE_BASE_ALIGNMENT)
+    {
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: ImageBase has to be aligned on 0x%X boundary\n",
+                 PE_IMAGE_BASE_ALIGNMENT);
+        return -1;
+    }
+
+    /* Rebased image has to fit in the address space and its relocations have to be valid */
+    if(Edit->Rebase)
+    {
+        if(!Image->Pe32Plus && Edit->Values[PE_FIELD_IMAGE_BASE] + GetField(Image, PE_FIELD_SIZE_OF_IMAGE) > 0x100000000ULL)
+        {
+            snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: image does not fit in 32-bit address space\n");
+            return -1;
+        }
+        if(RelocateImage(Image, Edit->Values[PE_FIELD_IMAGE_BASE] - GetField(Image, PE_FIELD_IMAGE_BASE), 0,
+                         &Relocations) != 0)
+        {
+            snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: image cannot be rebased, its relocations are stripped, "
+                     "malformed or use unsupported types\n");
+            return -1;
+        }
+    }
+
+    /* Debug directory has to be well-formed before build identifiers are replaced */
+    if(Edit->Normalize != PE_NORMALIZE_NONE &&
+       NormalizeImage(Image, Edit->Normalize, 0, Edit->Message, PE_MESSAGE_SIZE) != 0)
+    {
+        return -1;
+    }
+
+    /* Section table has to be consistent before the sections are moved */
+    if(Edit->Relayout && RelayoutImage(Image, 0, Edit->Message, PE_MESSAGE_SIZE) != 0)
+    {
+        return -1;
+    }
+
+    /* Image has to have sections that can be packed and room for the pack section */
+    if(Edit->Pack)
+    {
+        /* ARM32 stub maintains caches through CP15, which is only accessible at PL1, so user mode images fault */
+        SubSystem = (Edit->SubSystem && !(Edit->FieldMask & (1U << PE_FIELD_SUBSYSTEM))) ?
+                    (uint64_t)Edit->SubSystem->Identifier : GetEditValue(Image, Edit, PE_FIELD_SUBSYSTEM);
+        if(GetField(Image, PE_FIELD_MACHINE) == PE_MACHINE_ARMNT && SubSystem != 0x01 &&
+           (SubSystem < 0x0A || SubSystem > 0x0D) && SubSystem != 0x10 && SubSystem != 0x14 && SubSystem != 0x16)
+        {
+            snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: ARM32 images can only be packed with a native, EFI or "
+                     "boot subsystem\n");
+            return -1;
+        }
+        if(BuildPackage(Image, &Package, 0, Edit->Message, PE_MESSAGE_SIZE) != 0)
+        {
+            FreePackage(&Package);
+            return -1;
+        }
+        FreePackage(&Package);
+    }
+
+    /* Committed stack and heap cannot exceed the reserved size */
+    if(GetEditValue(Image, Edit, PE_FIELD_SIZE_OF_STACK_COMMIT) >
+       GetEditValue(Image, Edit, PE_FIELD_SIZE_OF_STACK_RESERVE))
+    {
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: SizeOfStackCommit exceeds SizeOfStackReserve\n");
+        return -1;
+    }
+    if(GetEditValue(Image, Edit, PE_FIELD_SIZE_OF_HEAP_COMMIT) >
+       GetEditValue(Image, Edit, PE_FIELD_SIZE_OF_HEAP_RESERVE))
+    {
+        snprintf(Edit->Message, PE_MESSAGE_SIZE, "Error: SizeOfHeapCommit exceeds SizeOfHeapReserve\n");
+        return -1;
+    }
+
+    /* All edits are valid */
+    return 0;
+}
+
+/* Prints usage information */
+static void Usage(const char *ExecName)
+{
+    int Field;
+
+    printf("Usage: %s <filename> <edit> [<edit> ...]\n"
+           "       %s [<options> ...] --checksum|--normalize|--pack|--relayout <filename> ...\n"
+           "       %s [<options> ...] --layout=<base>[:<limit>] <filename> ...\n"
+           "       %s [<options> ...] --batch=<manifest file>\n"
+           "       %s [<options> ...] --glob=<pattern> <edit> [<edit> ...]\n"
+           "       %s [<options> ...] --profile[=<file>] [--diff=<baseline>] <filename|directory> ...\n"
+           "       %s --benchmark[=<KB/s>] <filename> ...\n\n"
+           "Possible edits:\n"
+           "  <SubSystem>             set the new SubSystem and matching PE/PEXT signature\n"
+           "  <Field>=<value>         set the header field, all edits are applied at once\n"
+           "  checksum                report the checksum, it is recalculated after every edit anyway\n"
+           "  bind                    bind imports against DLLs found in the bind paths or next to the image\n"
+           "  rebase=<address>        apply base relocations and set the new ImageBase\n"
+           "  pack                    compress sections not needed by the loader, a stub in the new .xtpack\n"
+           "                          section restores them before jumping to the original entry point,\n"
+           "                          ARM32 images need a native, EFI or boot subsystem as the stub runs\n"
+           "                          privileged cache maintenance\n"
+           "  relayout                place raw section data at their RVAs, so the image can be mapped\n"
+           "                          without copying, FileAlignment becomes SectionAlignment\n"
+           "  striprelocs             remove base relocations, the image can be loaded at its ImageBase only\n"
+           "  normalize[=hash|zero]   derive timestamps and debug identifiers from the image contents,\n"
+           "                          or zero them, so identical builds produce identical images\n\n"
+           "Possible options:\n"
+           "  --batch=<file>          apply edits listed in the manifest file, every line holds\n"
+           "                          <filename> followed by its edits, lines starting with # are ignored\n"
+           "  --benchmark[=<KB/s>]    compare reading raw images with reading packed images and decompressing\n"
+           "                          them at the simulated media bandwidth, defaults to 2048 KB/s,\n"
+           "                          decompression is timed with the host decoder, not the boot stub\n"
+           "  --bind=<directory>      bind imports of every image, looking for DLLs in the directory,\n"
+           "                          can be given multiple times\n"
+           "  --checksum              only recalculate the checksum, same as the 'checksum' edit\n"
+           "  --diff=<baseline>       compare the size profile with the baseline image, or with images\n"
+           "                          at the same relative path in the baseline directory\n"
+           "  --normalize[=<mode>]    normalize every image, same as the 'normalize' edit\n"
+           "  --pack                  pack every image, same as the 'pack' edit\n"
+           "  --priority=<file>       place images listed in the file first, one name per line\n"
+           "  --profile[=<file>]      write size breakdown of every image, or every PE image found in\n"
+           "                          the directory trees, as JSON to the file or standard output\n"
+           "  --relayout              lay out every image at section alignment, same as the 'relayout' edit\n"
+           "  --glob=<pattern>        apply edits to all files matching the pattern\n"
+           "  --layout=<base>[:<limit>]\n"
+           "                          rebase all images to non-overlapping addresses within the range,\n"
+           "                          images are placed after the modules they import\n"
+           "  --map=<file>            write assigned image bases to the map file\n"
+           "  --threads=<count>       number of images processed in parallel, defaults to processor count\n\n"
+           "The image checksum is recalculated after every edit.\n",
+           ExecName, ExecName, ExecName, ExecName, ExecName, ExecName, ExecName);
+
+    /* Print editable fields */
+    printf("\nEditable fields:\n  Subsystem");
+    for(Field = 0; Field < PE_FIELD_COUNT; Field++)
+    {
+        if(Fields[Field].Editable)
+        {
+            printf(", %s", Fields[Field].Name);
+        }
+    }
+    printf("\n");
+}
+
+/* Places the module after all its dependencies */
+static void VisitModule(PPE_MODULE Modules, int Count, int Index, int *Order, int *Position)
+{
+    int Dependency;
+    int Import;
+
+    /* Visit every module once, which also breaks import cycles */
+    if(Modules[Index].Visited)
+    {
+        return;
+    }
+    Modules[Index].Visited = 1;
+
+    /* Visit all imported modules from the set first */
+    for(Import = 0; Import < Modules[Index].ImportCount; Import++)
+    {
+        Dependency = FindModule(Modules, Count, Modules[Index].Imports[Import]);
+        if(Dependency >= 0)
+        {
+            VisitModule(Modules, Count, Dependency, Order, Position);
+        }
+    }
+    Order[(*Position)++] = Index;
+}
+
+/* Writes the map of assigned image bases */
+static int WriteLayoutMap(PPE_EDIT_LIST List, PPE_MODULE Modules, int *Order, const char *FileName)
+{
+    FILE *File;
+    PPE_EDIT Edit;
+    uint64_t Size;
+    int Index;
+
+    /* Open the map file */
+    File = fopen(FileName, "w");
+    if(File == NULL)
+    {
+        printf("Error: unable to open file %s\n", FileName);
+        return -1;
+    }
+
+    /* Write all images in the address order */
+    fprintf(File, "# ImageBase          End                  SizeOfImage  Status  Image\n");
+    for(Index = 0; Index < List->Count; Index++)
+    {
+        Edit = &List->Items[Order[Index]];
+        Size = Modules[Order[Index]].SizeOfImage;
+        fprintf(File, "0x%016" PRIX64 "  0x%016" PRIX64 "  0x%08" PRIX64 "   %-6s  %s\n",
+                Edit->Values[PE_FIELD_IMAGE_BASE], Edit->Values[PE_FIELD_IMAGE_BASE] + Size, Size,
+                (Edit->Status == PE_STATUS_SUCCESS) ? "ok" : "failed", Edit->FileName);
+    }
+
+    /* Close the map file */
+    fclose(File);
+    return 0;
+}
+
+/* Writes the string as a quoted JSON string */
+static void WriteJsonString(FILE *File, const char *String)
+{
+    /* Escape quotes, backslashes and control characters */
+    fputc('"', File);
+    for(; *String; String++)
+    {
+        if(*String == '"' || *String == '\\')
+        {
+            fprintf(File, "\\%c", *String);
+        }
+        else if((unsigned char)*String < 0x20)
+        {
+            fprintf(File, "\\u%04x", (unsigned char)*String);
+        }
+        else
+        {
+            fputc(*String, File);
+        }
+    }
+    fputc('"', File);
+}
+
+/* Writes profiles of all images as JSON, along with the changes against the baseline build */
+static int WriteProfile(PPE_EDIT_LIST List, const char *FileName, int Diff)
+{
+    PPE_PROFILE_CHANGE Growth = NULL;
+    PPE_PROFILE_CHANGE Changes;
+    PPE_PROFILE_CHANGE Items;
+    PE_PROFILE Empty = {0};
+    uint64_t BaselineSize = 0;
+    uint64_t Size = 0;
+    PPE_EDIT Edit;
+    FILE *File;
+    int GrowthCount = 0;
+    int Failed = 0;
+    int Images = 0;
+    int Count;
+    int Index;
+    int Item;
+
+    /* Open the output file */
+    File = FileName ? fopen(FileName, "w") : stdout;
+    if(File == NULL)
+    {
+        printf("Error: unable to open file %s\n", FileName);
+        return -1;
+    }
+
+    /* Write all images, scanned files that are not PE images are skipped */
+    fprintf(File, "{\n  \"images\": [");
+    for(Index = 0; Index < List->Count; Index++)
+    {
+        Edit = &List->Items[Index];
+        if(Edit->Status != PE_STATUS_SUCCESS && Edit->Analyze == PE_ANALYZE_SCANNED)
+        {
+            continue;
+        }
+        fprintf(File, "%s\n    {\"file\": ", Images++ ? "," : "");
+        WriteJsonString(File, Edit->FileName);
+        if(Edit->Status != PE_STATUS_SUCCESS)
+        {
+            fprintf(File, ", \"error\": ");
+            WriteJsonString(File, Edit->Message);
+            fprintf(File, "}");
+            Failed++;
+            continue;
+        }
+
+        /* Write the breakdown */
+        Size += Edit->Profile.FileSize;
+        fprintf(File, ", \"size\": %" PRIu64 ", \"items\": [", Edit->Profile.FileSize);
+        for(Item = 0; Item < Edit->Profile.Count; Item++)
+        {
+            fprintf(File, "%s\n      {\"name\": ", Item ? "," : "");
+            WriteJsonString(File, Edit->Profile.Items[Item].Name);
+            fprintf(File, ", \"size\": %" PRIu64 ", \"count\": %" PRIu64 "}", Edit->Profile.Items[Item].Size,
+                    Edit->Profile.Items[Item].Count);
+        }
+        fprintf(File, "\n    ]");
+
+        /* Write changes against the baseline, images missing in the baseline are compared to an empty one */
+        if(Diff)
+        {
+            if(Edit->HasBaseline)
+            {
+                BaselineSize += Edit->Baseline.FileSize;
+                fprintf(File, ", \"baseline\": ");
+                WriteJsonString(File, Edit->BaselineName);
+                fprintf(File, ", \"baselineSize\": %" PRIu64, Edit->Baseline.FileSize);
+            }
+            fprintf(File, ", \"delta\": %" PRId64 ", \"changes\": [",
+                    (int64_t)(Edit->Profile.FileSize - Edit->Baseline.FileSize));
+            if(DiffProfiles(&Edit->Profile, Edit->HasBaseline ? &Edit->Baseline : &Empty, &Changes, &Count) != 0)
+            {
+                printf("Error: unable to allocate memory for the profile\n");
+                Count = 0;
+                Changes = NULL;
+            }
+            for(Item = 0; Item < Count; Item++)
+            {
+                fprintf(File, "%s\n      {\"name\": ", Item ? "," : "");
+                WriteJsonString(File, Changes[Item].Name);
+                fprintf(File, ", \"old\": %" PRIu64 ", \"new\": %" PRIu64 ", \"delta\": %" PRId64 "}",
+                        Changes[Item].Old, Changes[Item].New, Changes[Item].Delta);
+            }
+            fprintf(File, "%s]", Count ? "\n    " : "");
+
+            /* Collect growth across all images */
+            Items = (PPE_PROFILE_CHANGE)realloc(Growth, (GrowthCount + Count + 1) * sizeof(PE_PROFILE_CHANGE));
+            for(Item = 0; Items && Item < Count && Changes[Item].Delta > 0; Item++)
+            {
+                Items[GrowthCount] = Changes[Item];
+                Items[GrowthCount++].Image = Index;
+            }
+            Growth = Items ? Items : Growth;
+            free(Changes);
+        }
+        fprintf(File, "}");
+    }
+    fprintf(File, "\n  ],\n");
+
+    /* Write the largest growth across all images */
+    if(Diff)
+    {
+        qsort(Growth, GrowthCount, sizeof(PE_PROFILE_CHANGE), CompareChanges);
+        fprintf(File, "  \"growth\": [");
+        for(Item = 0; Item < GrowthCount && Item < PE_PROFILE_TOP; Item++)
+        {
+            fprintf(File, "%s\n    {\"file\": ", Item ? "," : "");
+            WriteJsonString(File, List->Items[Growth[Item].Image].FileName);
+            fprintf(File, ", \"name\": ");
+            WriteJsonString(File, Growth[Item].Name);
+            fprintf(File, ", \"delta\": %" PRId64 "}", Growth[Item].Delta);
+        }
+        fprintf(File, "%s],\n", GrowthCount ? "\n  " : "");
+        free(Growth);
+    }
+
+    /* Write the summary */
+    fprintf(File, "  \"summary\": {\"images\": %d, \"failed\": %d, \"size\": %" PRIu64, Images, Failed, Size);
+    if(Diff)
+    {
+        fprintf(File, ", \"baselineSize\": %" PRIu64 ", \"delta\": %" PRId64, BaselineSize,
+                (int64_t)(Size - BaselineSize));
+    }
+    fprintf(File, "}\n}\n");
+
+    /* Close the output file */
+    if(File != stdout)
+    {
+        fclose(File);
+    }
+    return Failed ? -1 : 0;
+}
+
+/* Stores a 16-bit little-endian value */
+static void WriteUint16(uint8_t *Buffer, uint16_t Value)
+{
+    Buffer[0] = (uint8_t)Value;
+    Buffer[1] = (uint8_t)(Value >> 8);
+}
+
+/* Stores a 32-bit little-endian value */
+static void WriteUint32(uint8_t *Buffer, uint32_t Value)
+{
+    WriteUint16(Buffer, (uint16_t)Value);
+    WriteUint16(Buffer + 2, (uint16_t)(Value >> 16));
+}
+
+/* Stores a 64-bit little-endian value */
+static void WriteUint64(uint8_t *Buffer, uint64_t Value)
+{
+    WriteUint32(Buffer, (uint32_t)Value);
+    WriteUint32(Buffer + 4, (uint32_t)(Value >> 32));
+}
+
+int main(int argc, char *argv[])
+{
+    PE_EDIT_LIST Edits = {0};
+    PE_LAYOUT Layout = {0};
+    PE_EDIT Options = {0};
+    PPE_MODULE Modules = NULL;
+    PPE_EDIT Edit;
+    struct stat Stat;
+    char *Separator;
+    char Path[2048];
+    int *Order = NULL;
+    const char *BaselineName = NULL;
+    const char *GlobPattern = NULL;
+    const char *ManifestName = NULL;
+    const char *ProfileName = NULL;
+    uint64_t Bandwidth;
+    double PackedTime = 0;
+    double RawTime = 0;
+    double Start;
+    int Failed = 0;
+    int Planned = 0;
+    int Profiled = 0;
+    int Index;
+    int Standalone;
+    int Status = PE_STATUS_SUCCESS;
+    int Threads = 0;
+
+    /* Parse options */
+    for(Index = 1; Index < argc && strncmp(argv[Index], "--", 2) == 0; Index++)
+    {
+        if(strncmp(argv[Index], "--batch=", 8) == 0)
+        {
+            /* Manifest file */
+            ManifestName = argv[Index] + 8;
+        }
+        else if(strcmp(argv[Index], "--benchmark") == 0 || strncmp(argv[Index], "--benchmark=", 12) == 0)
+        {
+            /* Simulated media bandwidth in KB/s */
+            Bandwidth = PE_PACK_BANDWIDTH;
+            if(argv[Index][11] && (ParseNumber(argv[Index] + 12, &Bandwidth) != 0 || Bandwidth == 0 ||
+                                   Bandwidth > UINT32_MAX))
+            {
+                printf("Error: %s is not a valid bandwidth\n", argv[Index] + 12);
+                return 1;
+            }
+            Options.Bandwidth = (uint32_t)Bandwidth;
+        }
+        else if(strncmp(argv[Index], "--bind=", 7) == 0)
+        {
+            /* Bind path */
+            if(BindPathCount == PE_MAX_BIND_PATHS)
+            {
+                printf("Error: too many bind paths\n");
+                return 1;
+            }
+            BindPaths[BindPathCount++] = argv[Index] + 7;
+            Options.Bind = 1;
+        }
+        else if(strcmp(argv[Index], "--checksum") == 0)
+        {
+            /* Checksum only */
+            Options.Checksum = 1;
+        }
+        else if(strncmp(argv[Index], "--diff=", 7) == 0)
+        {
+            /* Baseline build to compare the profile with */
+            BaselineName = argv[Index] + 7;
+            Profiled = 1;
+        }
+        else if(strncmp(argv[Index], "--layout=", 9) == 0)
+        {
+            /* Address range for the layout */
+            Separator = strchr(argv[Index] + 9, ':');
+            if(Separator)
+            {
+                *Separator = '\0';
+            }
+            Layout.Limit = UINT64_MAX;
+            if(ParseNumber(argv[Index] + 9, &Layout.Base) != 0 ||
+               (Separator && (ParseNumber(Separator + 1, &Layout.Limit) != 0 || Layout.Limit <= Layout.Base)))
+            {
+                printf("Error: invalid address range for layout\n");
+                return 1;
+            }
+            Planned = 1;
+        }
+        else if(strncmp(argv[Index], "--map=", 6) == 0)
+        {
+            /* Layout map file */
+            Layout.MapName = argv[Index] + 6;
+        }
+        else if(strcmp(argv[Index], "--normalize") == 0 || strncmp(argv[Index], "--normalize=", 12) == 0)
+        {
+            /* Normalize all images */
+            if(ParseNormalize(&Options, argv[Index][11] ? argv[Index] + 12 : "hash") != 0)
+            {
+                return 1;
+            }
+        }
+        else if(strncmp(argv[Index], "--glob=", 7) == 0)
+        {
+            /* File name pattern */
+            GlobPattern = argv[Index] + 7;
+        }
+        else if(strcmp(argv[Index], "--profile") == 0 || strncmp(argv[Index], "--profile=", 10) == 0)
+        {
+            /* Size profile, written to the standard output by default */
+            ProfileName = argv[Index][9] ? argv[Index] + 10 : NULL;
+            Profiled = 1;
+        }
+        else if(strncmp(argv[Index], "--priority=", 11) == 0)
+        {
+            /* Layout priority list */
+            Layout.PriorityName = argv[Index] + 11;
+        }
+        else if(strcmp(argv[Index], "--pack") == 0)
+        {
+            /* Pack all images */
+            Options.Pack = 1;
+        }
+        else if(strcmp(argv[Index], "--relayout") == 0)
+        {
+            /* Lay out all images at section alignment */
+            Options.Relayout = 1;
+        }
+        else if(strncmp(argv[Index], "--threads=", 10) == 0)
+        {
+            /* Number of worker threads */
+            Threads = atoi(argv[Index] + 10);
+            if(Threads <= 0)
+            {
+                printf("Error: %s is not a valid number of threads\n", argv[Index] + 10);
+                return 1;
+            }
+        }
+        else
+        {
+            /* Unknown option */
+            printf("Error: unknown option %s\n", argv[Index]);
+            return 1;
+        }
+    }
+
+    /* Check for proper number of arguments, edits are optional when applying the same edit to all images */
+    Standalone = Options.Bind || Options.Checksum || Options.Normalize || Options.Relayout || Options.Pack || Planned ||
+                 Profiled || Options.Bandwidth;
+    if((ManifestName && (GlobPattern || Index != argc)) || (GlobPattern && !Standalone && Index == argc) ||
+       (!ManifestName && !GlobPattern && (Standalone ? Index == argc : argc - Index < 2)))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    /* Select the checksum kernel before any worker starts */
+    SumKernel = SelectSumKernel();
+
+    /* Profile images and whole directory trees without modifying them */
+    if(Profiled)
+    {
+        /* Profiling cannot be combined with edits */
+        if(ManifestName || GlobPattern || Index == argc)
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+        for(; Index < argc; Index++)
+        {
+            if(stat(argv[Index], &Stat) == 0 && S_ISDIR(Stat.st_mode))
+            {
+                /* Directory is compared with the baseline directory tree */
+                if(AddDirectory(&Edits, argv[Index], BaselineName) != 0)
+                {
+                    return 1;
+                }
+                continue;
+            }
+
+            /* Single image is compared with the baseline image, or the image of the same name in the directory */
+            Edit = AddEdit(&Edits, argv[Index]);
+            if(Edit == NULL)
+            {
+                return 1;
+            }
+            Edit->Analyze = PE_ANALYZE_FILE;
+            if(BaselineName)
+            {
+                Separator = _tcsrchrs(argv[Index], '/', '\\');
+                if(stat(BaselineName, &Stat) == 0 && S_ISDIR(Stat.st_mode))
+                {
+                    snprintf(Path, sizeof(Path), "%s%c%s", BaselineName, PATH_SEP,
+                             Separator ? Separator + 1 : argv[Index]);
+                }
+                else
+                {
+                    snprintf(Path, sizeof(Path), "%s", BaselineName);
+                }
+                Edit->BaselineName = strdup(Path);
+                if(Edit->BaselineName == NULL)
+                {
+                    printf("Error: unable to allocate memory for edit list\n");
+                    return 1;
+                }
+            }
+        }
+
+        /* Analyze all images in parallel and write the report */
+        ProcessEdits(&Edits, Threads ? Threads : GetProcessorCount());
+        return WriteProfile(&Edits, ProfileName, BaselineName != NULL) ? PE_STATUS_INVALID_IMAGE : PE_STATUS_SUCCESS;
+    }
+
+    /* Compare loading packed and raw images without modifying them, timing is done on a single thread */
+    if(Options.Bandwidth)
+    {
+        /* Benchmark cannot be combined with edits */
+        if(ManifestName || GlobPattern || Index == argc)
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+        for(; Index < argc; Index++)
+        {
+            Edit = AddEdit(&Edits, argv[Index]);
+            if(Edit == NULL)
+            {
+                return 1;
+            }
+            Edit->Bandwidth = Options.Bandwidth;
+        }
+        ProcessEdits(&Edits, 1);
+
+        /* Report results and the total load time */
+        for(Index = 0; Index < Edits.Count; Index++)
+        {
+            printf("%s: %s", Edits.Items[Index].FileName, Edits.Items[Index].Message);
+            if(Edits.Items[Index].Status != PE_STATUS_SUCCESS)
+            {
+                Status = (Edits.Items[Index].Status > Status) ? Edits.Items[Index].Status : Status;
+                continue;
+            }
+            RawTime += Edits.Items[Index].RawTime;
+            PackedTime += Edits.Items[Index].PackedTime;
+        }
+        if(PackedTime > 0)
+        {
+            printf("Total load time at %u KB/s: raw %.2f ms, packed %.2f ms, %.2fx\n", Options.Bandwidth,
+                   RawTime * 1000, PackedTime * 1000, RawTime / PackedTime);
+        }
+        return Status;
+    }
+
+    /* Single image edited in place */
+    if(!ManifestName && !GlobPattern && !Standalone)
+    {
+        /* Parse all edits from the command line arguments */
+        Edit = AddEdit(&Edits, argv[Index]);
+        if(Edit == NULL)
+        {
+            return 1;
+        }
+        for(Index++; Index < argc; Index++)
+        {
+            if(ParseEdit(Edit, argv[Index]) != 0)
+            {
+                return 1;
+            }
+        }
+
+        /* Apply the edit */
+        Status = ApplyEdit(Edit);
+        printf("%s", Edit->Message);
+        return Status;
+    }
+
+    /* Collect all images and their edits */
+    if(!ManifestName && !GlobPattern)
+    {
+        /* Images listed on the command line */
+        for(; Index < argc; Index++)
+        {
+            if(AddEdit(&Edits, argv[Index]) == NULL)
+            {
+                return 1;
+            }
+        }
+    }
+    else if(ManifestName ? LoadManifest(&Edits, ManifestName) :
+                           AddGlob(&Edits, GlobPattern, argv + Index, argc - Index))
+    {
+        return 1;
+    }
+
+    /* Apply edits given by options to every image */
+    for(Index = 0; Index < Edits.Count; Index++)
+    {
+        Edits.Items[Index].Bind |= Options.Bind;
+        Edits.Items[Index].Checksum |= Options.Checksum;
+        Edits.Items[Index].Relayout |= Options.Relayout;
+        Edits.Items[Index].Pack |= Options.Pack;
+        Edits.Items[Index].Normalize = Options.Normalize ? Options.Normalize : Edits.Items[Index].Normalize;
+    }
+
+    /* Plan the address space layout, every image gets rebased to its new address */
+    if(Planned && PlanLayout(&Edits, &Layout, &Modules, &Order) != 0)
+    {
+        return 1;
+    }
+
+    /* Process all images in parallel */
+    Start = get_timestamp();
+    ProcessEdits(&Edits, Threads ? Threads : GetProcessorCount());
+
+    /* Report results in the original order */
+    for(Index = 0; Index < Edits.Count; Index++)
+    {
+        printf("%s: %s", Edits.Items[Index].FileName, Edits.Items[Index].Message);
+        if(Edits.Items[Index].Status != PE_STATUS_SUCCESS)
+        {
+            Status = (Edits.Items[Index].Status > Status) ? Edits.Items[Index].Status : Status;
+            Failed++;
+        }
+    }
+    printf("Processed %d images in %.3f seconds, %d succeeded, %d failed\n",
+           Edits.Count, get_timestamp() - Start, Edits.Count - Failed, Failed);
+
+    /* Write the layout map */
+    if(Planned && Layout.MapName && WriteLayoutMap(&Edits, Modules, Order, Layout.MapName) != 0)
+    {
+        return 1;
+    }
+    return Status;
 }
@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -42,6 +43,52 @@ typedef struct _RESERVED_SECTOR_INFO
     const char* Description;
 } RESERVED_SECTOR_INFO, *PRESERVED_SECTOR_INFO;
 
+typedef struct _FAT_VOLUME
+{
+    FILE *File;
+    long Offset;                // Partition offset in bytes
+    int FatType;                // 16 or 32
+    uint32_t HiddenSectors;     // Sectors preceding the partition
+    uint32_t TotalSectors;      // Partition size in sectors
+    uint16_t ReservedSectors;   // Sectors before the first FAT
+    uint8_t SectorsPerCluster;  // Cluster size in sectors
+    uint8_t NumberOfFats;       // FAT copies
+    uint32_t SectorsPerFat;     // Size of a single FAT
+    uint16_t RootEntries;       // Root directory entries (FAT16)
+    uint32_t RootSectors;       // Root directory size in sectors (FAT16)
+    uint32_t RootCluster;       // Root directory cluster (FAT32)
+    uint32_t FirstDataSector;   // First sector of cluster 2
+    uint32_t ClusterCount;      // Data clusters
+    uint32_t *Fat;              // In-memory copy of the FAT
+    uint32_t NextFree;          // Next cluster to allocate
+    uint32_t FreeClusters;      // Free clusters left
+} FAT_VOLUME, *PFAT_VOLUME;
+
+typedef struct _FAT_DIRECTORY
+{
+    uint8_t *Entries;           // Directory contents, written out once complete
+    uint32_t Count;             // Used entries
+    uint32_t Capacity;          // Allocated entries
+    uint32_t Limit;             // Maximum entries, 0 if the directory can grow
+} FAT_DIRECTORY, *PFAT_DIRECTORY;
+
+typedef struct _FAT_NODE
+{
+    char *Path;                 // Source path
+    const char *Name;           // Name in the image, points into Path
+    uint8_t Attributes;         // Directory or archive
+    uint32_t Size;              // File size
+    time_t Time;                // Modification time
+    uint32_t Cluster;           // First cluster of the run
+    uint32_t Clusters;          // Run length
+    uint32_t EntryIndex;        // Short name entry in the parent directory
+    uint32_t BootOrder;         // Position in the boot trace, 0 if not listed
+    FAT_DIRECTORY Directory;    // Directory entries
+    struct _FAT_NODE *Parent;   // Parent directory, NULL for the root directory
+    struct _FAT_NODE *Child;    // First child, sorted by name
+    struct _FAT_NODE *Next;     // Next sibling
+} FAT_NODE, *PFAT_NODE;
+
 static
 inline
 char *
@@ -70,6 +117,26 @@ _tcsrchrs(const char *str,
     return ptr1;
 }
 
+static
+inline
+double
+get_timestamp(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
+
 static
 inline
 void